@@ -95,11 +95,14 @@ static void on_accept(int fd, short ev, nt_sockserv_runloop_t *rs) {
   nt_sockconn_t *conn;
   conn = nt_sockconn_new();
   
-  // Set read and write timeouts, in seconds
-  nt_sockconn_settimeout(conn, 5, 5);
-  
-  if (nt_sockconn_accept(conn, rs, fd, &on_conn_read, NULL, &on_conn_error))
+  if (nt_sockconn_accept(conn, rs, fd, &on_conn_read, NULL, &on_conn_error)) {
+    // Close the connection after 5 seconds without reads or writes
+    nt_sockconn_setidletimeout(conn, 5);
+    // Stop reading from a client which does not read what we echo, once
+    // 256 kB is waiting to be sent, until it is down to 64 kB
+    nt_sockconn_setwatermarks(conn, 256 * 1024, 64 * 1024, NULL, NULL);
     on_connected(conn);
+  }
   else
     nt_release(conn);
 }
@@ -179,10 +182,13 @@ int main(int argc, char * const *argv) {
     possible (epoll, kqueue, etc).
     
     In a multi-threaded environment you have one runloop per thread, and
-    add the server to each runloop.
+    add the server to each runloop. nt_runloop_group_t (runloop_group.h)
+    does this for you.
   */
   
   runloop = nt_runloop_new();
+  // Pause the clients holding the most output once 64 MB is buffered in total
+  runloop->outlimit = 64 * 1024 * 1024;
   
   // Add our server
   if (!nt_runloop_addsockserv(runloop, server))
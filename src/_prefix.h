@@ -1,6 +1,11 @@
 #ifndef _NT_DEFINES_H_
 #define _NT_DEFINES_H_
 
+/* Expose Linux extensions (mremap, accept4, etc) */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE 1
+#endif
+
 #include <sys/types.h>
 #include <sys/time.h>
 #include <stdio.h>
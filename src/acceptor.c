@@ -0,0 +1,205 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "acceptor.h"
+#include "sockutil.h"
+#include "mpool.h"
+
+/* An accepted socket on its way to a worker */
+typedef struct _handoff_t {
+  nt_acceptor_t *acceptor;      /* retained */
+  nt_acceptor_worker_t *worker;
+  int fd;
+  nt_sockaddr_t addr;
+} _handoff_t;
+
+
+static void _dealloc(nt_acceptor_t *self) {
+  size_t i;
+  nt_acceptor_stop(self);
+  for (i = 0; i < self->nworkers; i++)
+    nt_release(self->workers[i].rs.runloop);
+  nt_free(self->workers, sizeof(nt_acceptor_worker_t) * self->nworkers);
+  nt_release(self->server);
+  nt_free(self, sizeof(nt_acceptor_t));
+}
+
+
+nt_acceptor_t *nt_acceptor_new(nt_sockserv_t *server, nt_runloop_group_t *workers,
+                               int policy, nt_acceptor_handler_t handler)
+{
+  size_t i;
+  NT_OBJ_ALLOC_INIT_self(nt_acceptor_t, &_dealloc);
+  NT_OBJ_CLEAR(self, nt_acceptor_t);
+  
+  assert(workers->nstarted == workers->nthreads);
+  assert(handler != NULL);
+  
+  self->nworkers = workers->nthreads;
+  self->workers = (nt_acceptor_worker_t *)nt_calloc(self->nworkers, sizeof(nt_acceptor_worker_t));
+  if (self->workers == NULL) {
+    nt_free(self, sizeof(nt_acceptor_t));
+    return NULL;
+  }
+  for (i = 0; i < self->nworkers; i++) {
+    self->workers[i].rs.server = server;
+    self->workers[i].rs.runloop = nt_runloop_group_runloop(workers, i);
+    nt_retain(self->workers[i].rs.runloop);
+  }
+  nt_retain(server);
+  self->server = server;
+  self->policy = policy;
+  self->handler = handler;
+  self->batch = server->accept_batch ? server->accept_batch : NT_SOCKSERV_ACCEPTV_MAX;
+  self->rand = 2463534242U;
+  return self;
+}
+
+
+/* xorshift32 */
+NT_STATIC_INLINE uint32_t _rand(nt_acceptor_t *self) {
+  uint32_t x = self->rand;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return (self->rand = x);
+}
+
+
+static size_t _pick(nt_acceptor_t *self) {
+  size_t i, n = self->nworkers, best, other;
+  int32_t load, bestload;
+  
+  if (n == 1)
+    return 0;
+  
+  switch (self->policy) {
+    case NT_ACCEPTOR_LEASTCONN:
+      /* start at a different worker each time so ties are spread out */
+      best = self->next;
+      bestload = nt_acceptor_load(self, best);
+      for (i = 1; i < n && bestload > 0; i++) {
+        other = (self->next + i) % n;
+        if ((load = nt_acceptor_load(self, other)) < bestload) {
+          best = other;
+          bestload = load;
+        }
+      }
+      self->next = (self->next + 1) % n;
+      return best;
+    
+    case NT_ACCEPTOR_P2C:
+      best = _rand(self) % n;
+      other = _rand(self) % (n - 1);
+      if (other >= best)
+        other++;
+      return (nt_acceptor_load(self, other) < nt_acceptor_load(self, best)) ? other : best;
+    
+    default:
+      best = self->next;
+      self->next = (best + 1) % n;
+      return best;
+  }
+}
+
+
+/* Runs on the worker, or with @runloop NULL if the worker has stopped */
+static void _handoffcb(nt_runloop_t *runloop, _handoff_t *h) {
+  nt_acceptor_t *self = h->acceptor;
+  /* the handler adds the connection before we stop counting it as pending */
+  if (runloop)
+    self->handler(h->fd, &h->addr, &h->worker->rs);
+  else
+    close(h->fd);
+  nt_atomic_sub32(&h->worker->pending, 1);
+  nt_free(h, sizeof(_handoff_t));
+  nt_release(self);
+}
+
+
+static void _acceptcb(int fd, short ev, nt_acceptor_t *self) {
+  nt_acceptor_worker_t *w;
+  _handoff_t *h = NULL;
+  size_t n = 0;
+  
+  /* drain the backlog, up to the server's batch limit */
+  while (n < self->batch) {
+    if (h == NULL && (h = (_handoff_t *)nt_malloc(sizeof(_handoff_t))) == NULL)
+      return; /* try again on the next event */
+    
+    if ((h->fd = nt_sockutil_acceptnb(fd, &h->addr)) == -1) {
+      /* interrupted, or the connection was reset while in the backlog --
+         the rest of the backlog is still there */
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        nt_warn("accept");
+      break;
+    }
+    nt_sockopts_setconn(&self->server->opts, h->fd);
+    n++;
+    
+    w = &self->workers[_pick(self)];
+    h->acceptor = self;
+    h->worker = w;
+    nt_retain(self);
+    nt_atomic_add32(&w->pending, 1);
+    w->handoffs++;
+    
+    if (!nt_runloop_post(w->rs.runloop, (nt_runloop_postcb_t)&_handoffcb, (void *)h)) {
+      nt_atomic_sub32(&w->pending, 1);
+      close(h->fd);
+      nt_free(h, sizeof(_handoff_t));
+      nt_release(self);
+    }
+    h = NULL;
+  }
+  if (h)
+    nt_free(h, sizeof(_handoff_t));
+}
+
+
+void nt_acceptor_start(nt_acceptor_t *self, nt_runloop_t *runloop) {
+  assert(self->runloop == NULL);
+  assert(self->server->fd4 != -1 || self->server->fd6 != -1);
+  self->runloop = runloop;
+  if (self->server->fd4 != -1) {
+    event_set(&self->ev4, self->server->fd4, EV_READ|EV_PERSIST,
+      (void (*)(int, short, void *))&_acceptcb, (void *)self);
+    nt_runloop_addev(runloop, &self->ev4, NULL);
+  }
+  if (self->server->fd6 != -1) {
+    event_set(&self->ev6, self->server->fd6, EV_READ|EV_PERSIST,
+      (void (*)(int, short, void *))&_acceptcb, (void *)self);
+    nt_runloop_addev(runloop, &self->ev6, NULL);
+  }
+}
+
+
+void nt_acceptor_stop(nt_acceptor_t *self) {
+  if (self->runloop == NULL)
+    return;
+  if (self->server->fd4 != -1)
+    event_del(&self->ev4);
+  if (self->server->fd6 != -1)
+    event_del(&self->ev6);
+  self->runloop = NULL;
+}
@@ -0,0 +1,128 @@
+/**
+  Accepts connections on one runloop and hands them to worker runloops.
+  
+  An alternative to SO_REUSEPORT sharding (see runloop_group.h) where the
+  kernel picks the thread: here the acceptor picks the worker, based on how
+  many connections each worker has. Accepted sockets are passed to the
+  worker with nt_runloop_post (a lock-free queue plus an eventfd wakeup),
+  where the handler sets up the connection:
+  
+    static void on_handoff(int fd, const nt_sockaddr_t *addr, nt_sockserv_runloop_t *rs) {
+      nt_sockconn_t *conn = nt_sockconn_new();
+      nt_sockconn_open(conn, rs, fd, addr, &on_read, NULL, &on_error);
+    }
+    
+    workers = nt_runloop_group_new(0, NT_RUNLOOP_GROUP_F_AFFINITY);
+    nt_runloop_group_start(workers, NULL, NULL);
+    acceptor = nt_acceptor_new(server, workers, NT_ACCEPTOR_P2C, &on_handoff);
+    nt_acceptor_start(acceptor, nt_runloop_default());
+  
+  Balancing policies:
+  
+  - NT_ACCEPTOR_ROUNDROBIN  each worker in turn.
+  - NT_ACCEPTOR_LEASTCONN   the worker with the fewest connections. Looks at
+                            every worker for every connection.
+  - NT_ACCEPTOR_P2C         the less loaded of two random workers ("power
+                            of two choices"). Nearly as even as LEASTCONN
+                            at constant cost.
+  
+  A worker's load is its nt_runloop_t nconns (connections added with
+  nt_runloop_addsockconn) plus handoffs it has not yet processed.
+  
+  The acceptor must outlive the connections it hands off, since their
+  nt_sockserv_runloop_t lives in the acceptor.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_ACCEPTOR_H_
+#define _NT_ACCEPTOR_H_
+
+#include "obj.h"
+#include "runloop.h"
+#include "runloop_group.h"
+#include "sockserv.h"
+
+#define NT_ACCEPTOR_ROUNDROBIN  0
+#define NT_ACCEPTOR_LEASTCONN   1
+#define NT_ACCEPTOR_P2C         2
+
+/**
+  Called on the worker's thread with an accepted, non-blocking socket. The
+  handler owns @fd.
+  
+  @param rs the server and the worker's runloop, e.g. for nt_sockconn_open
+**/
+typedef void (*nt_acceptor_handler_t)(int fd, const nt_sockaddr_t *addr,
+                                      nt_sockserv_runloop_t *rs);
+
+typedef struct nt_acceptor_worker_t {
+  nt_sockserv_runloop_t rs;     /* server and worker runloop (retained) */
+  volatile int32_t pending;     /* posted handoffs not yet processed */
+  uint64_t handoffs;            /* total number of handoffs */
+} nt_acceptor_worker_t;
+
+typedef struct nt_acceptor_t {
+  NT_OBJ_HEAD
+  nt_sockserv_t *server;        /* retained */
+  nt_runloop_t *runloop;        /* runloop accepting, while started */
+  struct event ev4;
+  struct event ev6;
+  nt_acceptor_worker_t *workers;
+  size_t nworkers;
+  int policy;
+  size_t next;                  /* next worker for NT_ACCEPTOR_ROUNDROBIN */
+  uint32_t rand;                /* random state for NT_ACCEPTOR_P2C */
+  size_t batch;                 /* max connections accepted per event */
+  nt_acceptor_handler_t handler;
+} nt_acceptor_t;
+
+/**
+  Create a new acceptor.
+  
+  @param server  bound and listening server. Up to server->accept_batch
+                 connections (see nt_sockserv_setacceptv) are accepted per
+                 readiness event.
+  @param workers started group whose runloops receive the connections
+  @param policy  NT_ACCEPTOR_ROUNDROBIN, NT_ACCEPTOR_LEASTCONN or
+                 NT_ACCEPTOR_P2C
+  @param handler called on a worker for each accepted connection
+**/
+nt_acceptor_t *nt_acceptor_new(nt_sockserv_t *server, nt_runloop_group_t *workers,
+                               int policy, nt_acceptor_handler_t handler);
+
+/**
+  Start accepting connections on @runloop.
+**/
+void nt_acceptor_start(nt_acceptor_t *self, nt_runloop_t *runloop);
+
+/**
+  Stop accepting connections. Handoffs already posted are still delivered.
+**/
+void nt_acceptor_stop(nt_acceptor_t *self);
+
+/**
+  Load of worker @index: its connections plus pending handoffs.
+**/
+#define nt_acceptor_load(self, index) \
+  (nt_atomic_load32(&(self)->workers[(index)].rs.runloop->nconns) + \
+   nt_atomic_load32(&(self)->workers[(index)].pending))
+
+#endif
@@ -1,6 +1,8 @@
 /**
   Generic array modeled on top of buffer.h.
   
+  Stores pointers only. Use NT_VEC(T) from vec.h to store values.
+  
   Copyright (c) 2009 Notion <http://notion.se/>
 
   Permission is hereby granted, free of charge, to any person obtaining a copy
@@ -26,7 +26,7 @@
 
 #include <stdint.h>
 
-#if (__GNUC__ >= 4) && (__GNUC_MINOR__ >= 1)
+#if (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 1))
   #include "atomic_gcc.h"
 #elif (__APPLE__)
   #include "atomic_osx.h"
@@ -37,7 +37,7 @@
 // if the current value of *ptr is oldval, then write newval into *ptr.
 // returns true if the comparison is successful and newval was written.
 #define nt_atomic_bool_compare_and_swapptr(ptr, oldval, newval) \
-  __sync_bool_compare_and_swap((intptr_t)ptr, (intptr_t)oldval, (intptr_t *)newval)
+  __sync_bool_compare_and_swap(ptr, oldval, newval)
 
 // read pointer
 #define nt_atomic_readptr(ptr) __sync_fetch_and_add(ptr, 0)
@@ -46,6 +46,22 @@
 #define nt_atomic_setptr(ptr, newval) \
   while(!nt_atomic_bool_compare_and_swapptr(ptr, nt_atomic_readptr(ptr), newval))
 
+// full memory barrier
+#define nt_atomic_barrier() __sync_synchronize()
+
+// read pointer with acquire semantics, without writing to its cache line
+// set pointer with release semantics
+#ifdef __ATOMIC_ACQUIRE
+  #define nt_atomic_loadptr(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+  #define nt_atomic_storeptr(ptr, newval) __atomic_store_n(ptr, newval, __ATOMIC_RELEASE)
+#else
+  #define nt_atomic_loadptr(ptr) \
+    ({ __typeof__(*(ptr)) _v = *(volatile __typeof__(*(ptr)) *)(ptr); \
+       __sync_synchronize(); _v; })
+  #define nt_atomic_storeptr(ptr, newval) \
+    do { __sync_synchronize(); *(volatile __typeof__(*(ptr)) *)(ptr) = (newval); } while (0)
+#endif
+
 /* ---- 32 ---- */
 
 // compare and swap.
@@ -67,6 +83,16 @@
 #define nt_atomic_set32(ptr, newval) \
   while(!__sync_bool_compare_and_swap(ptr, nt_atomic_read32(ptr), newval))
 
+// read value with acquire semantics, without writing to its cache line
+// set value with release semantics
+#ifdef __ATOMIC_ACQUIRE
+  #define nt_atomic_load32(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+  #define nt_atomic_store32(ptr, newval) __atomic_store_n(ptr, newval, __ATOMIC_RELEASE)
+#else
+  #define nt_atomic_load32(ptr) nt_atomic_loadptr(ptr)
+  #define nt_atomic_store32(ptr, newval) nt_atomic_storeptr(ptr, newval)
+#endif
+
 // add value
 #define nt_atomic_add32(ptr, n) __sync_add_and_fetch(ptr, n)
 
@@ -49,6 +49,19 @@
   while(!nt_atomic_bool_compare_and_swapptr(ptr, nt_atomic_readptr(ptr), newval))
 
 
+#define nt_atomic_barrier() OSMemoryBarrier()
+
+/* plain loads and stores are ordered by a barrier on the trailing/leading side */
+NT_STATIC_INLINE void *nt_atomic_loadptr_(void * volatile *ptr) {
+  void *v = *ptr;
+  OSMemoryBarrier();
+  return v;
+}
+#define nt_atomic_loadptr(ptr) nt_atomic_loadptr_((void * volatile *)(ptr))
+
+#define nt_atomic_storeptr(ptr, newval) \
+  do { OSMemoryBarrier(); *(ptr) = (newval); } while (0)
+
 /* ---- 32 ---- */
 
 #define nt_atomic_compare_and_swap32(ptr, oldval, newval) \
@@ -62,6 +75,15 @@
 #define nt_atomic_set32(ptr, newval) \
   while(!nt_atomic_bool_compare_and_swap32(ptr, nt_atomic_read32(ptr), newval))
 
+NT_STATIC_INLINE int32_t nt_atomic_load32(volatile int32_t *ptr) {
+  int32_t v = *ptr;
+  OSMemoryBarrier();
+  return v;
+}
+
+#define nt_atomic_store32(ptr, newval) \
+  do { OSMemoryBarrier(); *(ptr) = (newval); } while (0)
+
 #define nt_atomic_add32(ptr, n) OSAtomicAdd32Barrier(n, ptr)
 
 #define nt_atomic_sub32(ptr, n) OSAtomicAdd32Barrier(-(n), ptr)
@@ -56,7 +56,7 @@ typedef volatile struct {
 	volatile void *opaque1;
 	volatile long opaque2;
 #if defined(__x86_64__)
-} nt_atomic_queue NT_ATTR(aligned (16));
+} nt_atomic_queue NT_ATTR((aligned (16)));
 #else
 } nt_atomic_queue;
 #endif
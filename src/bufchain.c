@@ -0,0 +1,295 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "bufchain.h"
+#include "mpool.h"
+#include <limits.h>
+
+#ifndef IOV_MAX
+  #define IOV_MAX 1024
+#endif
+
+/* Number of iovecs nt_bufchain_writev puts on the stack */
+#define WRITEV_IOVMAX ((IOV_MAX < 256) ? IOV_MAX : 256)
+
+
+/* ------------------------------------------------------------------------- */
+/* Segments */
+
+static void _seg_dealloc(nt_bufseg_t *self) {
+  if (self->freefn) {
+    self->freefn((void *)self->start, self->freearg);
+    nt_free(self, sizeof(nt_bufseg_t));
+  }
+  else {
+    nt_free(self, sizeof(nt_bufseg_t) + nt_bufseg_size(self));
+  }
+}
+
+
+nt_bufseg_t *nt_bufseg_new(size_t size) {
+  nt_bufseg_t *self;
+  size = NT_ALIGN_M(size);
+  if ((self = (nt_bufseg_t *)nt_malloc(sizeof(nt_bufseg_t) + size)) == NULL)
+    return NULL;
+  NT_OBJ_INIT(self, &_seg_dealloc);
+  self->start = self->ptr = (byte_t *)(self + 1);
+  self->end = self->start + size;
+  self->freefn = NULL;
+  self->freearg = NULL;
+  return self;
+}
+
+
+static void _seg_nofree(void *data, void *arg) {}
+
+
+nt_bufseg_t *nt_bufseg_wrap(byte_t *data, size_t size, nt_bufseg_freefn_t freefn, void *arg) {
+  NT_OBJ_ALLOC_INIT_self(nt_bufseg_t, &_seg_dealloc);
+  self->start = data;
+  self->ptr = self->end = data + size;
+  self->freefn = freefn ? freefn : &_seg_nofree;
+  self->freearg = arg;
+  return self;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Links */
+
+static bool _pushlink(nt_bufchain_t *self, nt_bufseg_t *seg, byte_t *start, byte_t *end) {
+  nt_bufchain_link_t *link;
+  if ((link = (nt_bufchain_link_t *)nt_malloc(sizeof(nt_bufchain_link_t))) == NULL)
+    return false;
+  nt_retain(seg);
+  link->next = NULL;
+  link->seg = seg;
+  link->start = start;
+  link->end = end;
+  if (self->tail)
+    self->tail->next = link;
+  else
+    self->head = link;
+  self->tail = link;
+  self->length += end - start;
+  self->nlinks++;
+  return true;
+}
+
+
+static void _freelink(nt_bufchain_link_t *link) {
+  nt_release(link->seg);
+  nt_free(link, sizeof(nt_bufchain_link_t));
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Chains */
+
+static void _dealloc(nt_bufchain_t *self) {
+  nt_bufchain_link_t *link, *next;
+  for (link = self->head; link; link = next) {
+    next = link->next;
+    _freelink(link);
+  }
+  nt_free(self, sizeof(nt_bufchain_t));
+}
+
+
+nt_bufchain_t *nt_bufchain_new(size_t segsize) {
+  NT_OBJ_ALLOC_INIT_self(nt_bufchain_t, &_dealloc);
+  self->head = self->tail = NULL;
+  self->length = 0;
+  self->nlinks = 0;
+  self->segsize = segsize ? segsize : NT_BUFCHAIN_SEGSIZE;
+  return self;
+}
+
+
+bool nt_bufchain_append(nt_bufchain_t *self, const byte_t *what, size_t length) {
+  nt_bufchain_link_t *tail = self->tail;
+  nt_bufseg_t *seg;
+  size_t n;
+
+  /* fill the tail segment if we wrote its last byte and no one else holds it */
+  if (tail && tail->end == tail->seg->ptr && tail->seg->freefn == NULL &&
+      nt_obj_get_refcount((nt_obj_t *)tail->seg) == 1)
+  {
+    n = nt_bufseg_available(tail->seg);
+    if (n > length)
+      n = length;
+    memcpy(tail->seg->ptr, what, n);
+    tail->seg->ptr += n;
+    tail->end += n;
+    self->length += n;
+    what += n;
+    length -= n;
+  }
+
+  if (length == 0)
+    return true;
+
+  if ((seg = nt_bufseg_new(length > self->segsize ? length : self->segsize)) == NULL)
+    return false;
+  memcpy(seg->ptr, what, length);
+  seg->ptr += length;
+  if (!_pushlink(self, seg, seg->start, seg->ptr)) {
+    nt_release(seg);
+    return false;
+  }
+  nt_release(seg); /* the link holds a reference */
+  return true;
+}
+
+
+bool nt_bufchain_appendseg(nt_bufchain_t *self, nt_bufseg_t *seg, size_t offset, size_t length) {
+  assert(offset + length <= nt_bufseg_length(seg));
+  if (length == 0)
+    return true;
+  return _pushlink(self, seg, seg->start + offset, seg->start + offset + length);
+}
+
+
+bool nt_bufchain_appendchain(nt_bufchain_t *self, const nt_bufchain_t *other) {
+  const nt_bufchain_link_t *link;
+  nt_bufchain_link_t *last = self->tail;
+
+  assert(self != other);
+  for (link = other->head; link; link = link->next) {
+    if (!_pushlink(self, link->seg, link->start, link->end)) {
+      /* roll back */
+      nt_bufchain_link_t *l, *next;
+      for (l = last ? last->next : self->head; l; l = next) {
+        next = l->next;
+        self->length -= l->end - l->start;
+        self->nlinks--;
+        _freelink(l);
+      }
+      if (last)
+        last->next = NULL;
+      else
+        self->head = NULL;
+      self->tail = last;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+nt_bufchain_t *nt_bufchain_slice(const nt_bufchain_t *self, size_t offset, size_t length) {
+  const nt_bufchain_link_t *link;
+  nt_bufchain_t *slice;
+
+  if (offset + length < offset || offset + length > self->length)
+    return NULL;
+  if ((slice = nt_bufchain_new(self->segsize)) == NULL)
+    return NULL;
+
+  for (link = self->head; link && length; link = link->next) {
+    size_t linklen = link->end - link->start;
+    size_t n;
+    if (offset >= linklen) {
+      offset -= linklen;
+      continue;
+    }
+    n = linklen - offset;
+    if (n > length)
+      n = length;
+    if (!_pushlink(slice, link->seg, link->start + offset, link->start + offset + n)) {
+      nt_release(slice);
+      return NULL;
+    }
+    length -= n;
+    offset = 0;
+  }
+
+  return slice;
+}
+
+
+void nt_bufchain_consume(nt_bufchain_t *self, size_t n) {
+  nt_bufchain_link_t *link;
+
+  assert(n <= self->length);
+  while (n && (link = self->head)) {
+    size_t linklen = link->end - link->start;
+    if (n < linklen) {
+      link->start += n;
+      self->length -= n;
+      return;
+    }
+    n -= linklen;
+    self->length -= linklen;
+    self->nlinks--;
+    if ((self->head = link->next) == NULL)
+      self->tail = NULL;
+    _freelink(link);
+  }
+}
+
+
+size_t nt_bufchain_copyout(const nt_bufchain_t *self, size_t offset, byte_t *dst, size_t length) {
+  const nt_bufchain_link_t *link;
+  size_t copied = 0;
+
+  for (link = self->head; link && length; link = link->next) {
+    size_t linklen = link->end - link->start;
+    size_t n;
+    if (offset >= linklen) {
+      offset -= linklen;
+      continue;
+    }
+    n = linklen - offset;
+    if (n > length)
+      n = length;
+    memcpy(dst + copied, link->start + offset, n);
+    copied += n;
+    length -= n;
+    offset = 0;
+  }
+
+  return copied;
+}
+
+
+int nt_bufchain_iov(const nt_bufchain_t *self, struct iovec *iov, int iovmax) {
+  const nt_bufchain_link_t *link;
+  int i = 0;
+  for (link = self->head; link && i < iovmax; link = link->next, i++) {
+    iov[i].iov_base = (void *)link->start;
+    iov[i].iov_len = link->end - link->start;
+  }
+  return i;
+}
+
+
+ssize_t nt_bufchain_writev(nt_bufchain_t *self, int fd) {
+  struct iovec iov[WRITEV_IOVMAX];
+  ssize_t n;
+  int iovcnt;
+
+  if ((iovcnt = nt_bufchain_iov(self, iov, WRITEV_IOVMAX)) == 0)
+    return 0;
+  if ((n = writev(fd, iov, iovcnt)) > 0)
+    nt_bufchain_consume(self, (size_t)n);
+  return n;
+}
@@ -0,0 +1,176 @@
+/**
+  Chained buffer made of reference-counted segments.
+
+  A nt_bufchain_t is a list of byte ranges ("links"), each pointing into a
+  nt_bufseg_t. Segments are shared between chains by reference counting, so
+  appending an existing segment or another chain, and slicing out a range of
+  a chain, never copy payload bytes. The content can be written to a socket
+  in one writev() call using nt_bufchain_iov() or nt_bufchain_writev().
+
+  Example:
+
+    nt_bufchain_t *msg = nt_bufchain_new(0);
+    nt_bufchain_appends(msg, "HTTP/1.1 200 OK\r\n\r\n");
+    nt_bufchain_appendchain(msg, cached_body);   // no copy
+    nt_bufchain_writev(msg, fd);
+
+  Chains are not thread-safe, but segments may be shared between chains
+  owned by different threads since the bytes referenced by a link never
+  change.
+
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_BUFCHAIN_H_
+#define _NT_BUFCHAIN_H_
+
+#include "obj.h"
+#include <sys/uio.h>
+
+/* Default size of segments allocated for copied data */
+#define NT_BUFCHAIN_SEGSIZE 0x1000
+
+/**
+  Called when a segment wrapping external memory is deallocated.
+**/
+typedef void (*nt_bufseg_freefn_t)(void *data, void *arg);
+
+/**
+  A reference-counted block of memory.
+**/
+typedef struct nt_bufseg_t {
+  NT_OBJ_HEAD
+  byte_t *start;              /* start address */
+  byte_t *ptr;                /* next free byte */
+  byte_t *end;                /* end address */
+  nt_bufseg_freefn_t freefn;  /* NULL if memory follows this struct */
+  void *freearg;
+} nt_bufseg_t;
+
+/**
+  A range of bytes in a segment.
+**/
+typedef struct nt_bufchain_link_t {
+  struct nt_bufchain_link_t *next;
+  nt_bufseg_t *seg;           /* retained */
+  byte_t *start;
+  byte_t *end;
+} nt_bufchain_link_t;
+
+typedef struct nt_bufchain_t {
+  NT_OBJ_HEAD
+  nt_bufchain_link_t *head;
+  nt_bufchain_link_t *tail;
+  size_t length;              /* total number of bytes */
+  size_t nlinks;              /* number of links */
+  size_t segsize;             /* size of segments allocated by append */
+} nt_bufchain_t;
+
+/**
+  Create a new segment with room for @size bytes.
+
+  The memory is allocated together with the segment (one nt_malloc).
+**/
+nt_bufseg_t *nt_bufseg_new(size_t size);
+
+/**
+  Create a segment referencing existing memory, without copying it.
+
+  @param data   memory to reference. It must not change while referenced.
+  @param size   number of bytes (all considered used).
+  @param freefn called with @data and @arg when the last reference goes away.
+                May be NULL for memory which outlives the segment.
+**/
+nt_bufseg_t *nt_bufseg_wrap(byte_t *data, size_t size, nt_bufseg_freefn_t freefn, void *arg);
+
+#define nt_bufseg_size(self)      ((size_t)((self)->end - (self)->start))
+#define nt_bufseg_length(self)    ((size_t)((self)->ptr - (self)->start))
+#define nt_bufseg_available(self) ((size_t)((self)->end - (self)->ptr))
+
+/**
+  Create a new, empty chain.
+
+  @param segsize size of segments allocated for copied data, or 0 for
+                 NT_BUFCHAIN_SEGSIZE.
+**/
+nt_bufchain_t *nt_bufchain_new(size_t segsize);
+
+#define nt_bufchain_length(self) ((self)->length)
+
+/**
+  Copy @length bytes to the end of the chain.
+
+  Fills free space in the last segment when this chain is the one which
+  wrote the segment's last byte and the only one referencing it, otherwise
+  allocates a new segment.
+**/
+bool nt_bufchain_append(nt_bufchain_t *self, const byte_t *what, size_t length);
+#define nt_bufchain_appends(self, what) \
+  nt_bufchain_append((self), (const byte_t *)(what), strlen(what))
+
+/**
+  Append @length bytes of @seg starting at @offset, without copying.
+
+  The segment is retained by the chain.
+**/
+bool nt_bufchain_appendseg(nt_bufchain_t *self, nt_bufseg_t *seg, size_t offset, size_t length);
+
+/**
+  Append all content of @other, without copying.
+**/
+bool nt_bufchain_appendchain(nt_bufchain_t *self, const nt_bufchain_t *other);
+
+/**
+  Create a new chain referencing @length bytes of @self starting at @offset,
+  without copying.
+
+  @returns NULL if the range is out of bounds or memory is exhausted.
+**/
+nt_bufchain_t *nt_bufchain_slice(const nt_bufchain_t *self, size_t offset, size_t length);
+
+/**
+  Discard @n bytes from the front.
+**/
+void nt_bufchain_consume(nt_bufchain_t *self, size_t n);
+
+/**
+  Copy @length bytes starting at @offset into @dst.
+
+  @returns number of bytes copied.
+**/
+size_t nt_bufchain_copyout(const nt_bufchain_t *self, size_t offset, byte_t *dst, size_t length);
+
+/**
+  Describe the content as iovecs, suitable for writev() or sendmsg().
+
+  @param iov    array of at least @iovmax iovecs.
+  @param iovmax maximum number of iovecs to set.
+  @returns number of iovecs set.
+**/
+int nt_bufchain_iov(const nt_bufchain_t *self, struct iovec *iov, int iovmax);
+
+/**
+  Write content to @fd with a single writev() and consume what was written.
+
+  @returns see writev()
+**/
+ssize_t nt_bufchain_writev(nt_bufchain_t *self, int fd);
+
+#endif
@@ -22,6 +22,14 @@
 #include "buffer.h"
 #include "mpool.h"
 #include <stdarg.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+  #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define DEFAULT_GROWFACTOR 200
 
 
 #define ADDROF(a, i, size) ((void **)((a)->start + ((size) * (i))))
@@ -40,44 +48,136 @@ NT_OBJ(nt_buffer_t, nt_buffer_new(size_t size, size_t growextra),
 	self->end = self->start + size;
 	self->ptr = self->start;
   self->growextra = growextra;
+  self->growmax = NT_BUFFER_GROW_MAX;
+  self->growfactor = DEFAULT_GROWFACTOR;
+  self->growth = NT_BUFFER_GROW_LINEAR;
+  self->flags = 0;
 },
 {/* destructor: */
   if (self->start && nt_buffer_size(self)) {
-    nt_free(self->start, nt_buffer_size(self));
+    if (self->flags & NT_BUFFER_F_MMAPPED)
+      munmap(self->start, nt_buffer_size(self));
+    else
+      nt_free(self->start, nt_buffer_size(self));
   }
 })
 
 
-bool nt_buffer_grow(nt_buffer_t *self, size_t length) {
+static size_t _pagesize(void) {
+  static size_t pagesize = 0;
+  if (pagesize == 0)
+    pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  return pagesize;
+}
+
+
+void nt_buffer_setgrowth(nt_buffer_t *self, nt_buffer_growth_t growth, unsigned int factor) {
+  if (factor == 0)
+    factor = DEFAULT_GROWFACTOR;
+  assert(factor > 100 && factor <= UINT16_MAX);
+  self->growth = (uint8_t)growth;
+  self->growfactor = (uint16_t)factor;
+}
+
+
+/*
+  Move storage to a buffer of new_size bytes. Content up to
+  min(occupied, new_size) is preserved.
+*/
+static bool _resize(nt_buffer_t *self, size_t new_size) {
 	byte_t *new_start;
-	size_t new_size;
+	size_t size = nt_buffer_size(self);
+	size_t occupied = nt_buffer_occupied(self);
+	
+	if (occupied > new_size)
+	  occupied = new_size;
+	
+	if (self->flags & NT_BUFFER_F_MMAPPED) {
+	  new_size = NT_ALIGN(new_size, _pagesize());
+	  #if defined(__linux__)
+	  new_start = (byte_t *)mremap(self->start, size, new_size, MREMAP_MAYMOVE);
+	  if (new_start == (byte_t *)MAP_FAILED)
+	    return false;
+	  #else
+	  new_start = (byte_t *)mmap(NULL, new_size, PROT_READ|PROT_WRITE,
+	                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	  if (new_start == (byte_t *)MAP_FAILED)
+	    return false;
+	  memcpy(new_start, self->start, occupied);
+	  munmap(self->start, size);
+	  #endif
+	}
+	else if (self->growth == NT_BUFFER_GROW_MMAP && new_size >= NT_BUFFER_MMAP_THRESHOLD) {
+	  new_size = NT_ALIGN(new_size, _pagesize());
+	  new_start = (byte_t *)mmap(NULL, new_size, PROT_READ|PROT_WRITE,
+	                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	  if (new_start == (byte_t *)MAP_FAILED)
+	    return false;
+	  memcpy(new_start, self->start, occupied);
+	  nt_free(self->start, size);
+	  self->flags |= NT_BUFFER_F_MMAPPED;
+	}
+	else if ((new_start = nt_realloc(self->start, size, new_size)) == NULL) {
+	  return false;
+	}
+	
+	self->ptr = new_start + occupied;
+	self->start = new_start;
+	self->end = new_start + new_size;
+	
+	return true;
+}
+
+
+bool nt_buffer_grow(nt_buffer_t *self, size_t length) {
+	size_t needed, new_size;
 
 	if (length <= nt_buffer_available(self))
 	  return true;
 	
-  if (
-    #ifdef NT_BUFFER_GROW_MAX
-  	  length > NT_BUFFER_GROW_MAX || 
-  	#endif
-	  self->start == NULL) {
+	if (self->start == NULL)
 	  return false;
-  }
-  
-	new_size = NT_ALIGN_M(nt_buffer_occupied(self) + length + self->growextra);
 	
-	#ifdef NT_BUFFER_GROW_MAX
-	if (new_size > NT_BUFFER_GROW_MAX)
+	needed = nt_buffer_occupied(self) + length;
+	if (needed < length || (self->growmax && needed > self->growmax))
 	  return false;
-	#endif
 	
-	if ((new_start = nt_realloc(self->start, nt_buffer_size(self), new_size)) == NULL)
-    err(1, NULL);
-  
-	self->ptr = new_start + nt_buffer_occupied(self);
-	self->start = new_start;
-	self->end = new_start + new_size;
+	new_size = needed + self->growextra;
 	
-	return true;
+	switch (self->growth) {
+	  case NT_BUFFER_GROW_GEOMETRIC:
+	  case NT_BUFFER_GROW_MMAP: {
+	    size_t size = nt_buffer_size(self);
+	    size_t geometric = (size / 100) * self->growfactor +
+	                       ((size % 100) * self->growfactor) / 100;
+	    if (geometric > new_size)
+	      new_size = geometric;
+	    if (self->growth == NT_BUFFER_GROW_MMAP)
+	      new_size = NT_ALIGN(new_size, _pagesize());
+	    break;
+	  }
+	  case NT_BUFFER_GROW_PAGE:
+	    new_size = NT_ALIGN(new_size, _pagesize());
+	    break;
+	}
+	
+	new_size = NT_ALIGN_M(new_size);
+	
+	/* clamp to growmax (we know needed fits) */
+	if (self->growmax && new_size > self->growmax)
+	  new_size = self->growmax;
+	
+	return _resize(self, new_size);
+}
+
+
+bool nt_buffer_shrink(nt_buffer_t *self) {
+  size_t new_size = NT_ALIGN_M(nt_buffer_occupied(self));
+  if (new_size == 0)
+    new_size = NT_ALIGN_M(1);
+  if (self->start == NULL || new_size >= nt_buffer_size(self))
+    return true;
+  return _resize(self, new_size);
 }
 
 
@@ -98,69 +198,358 @@ bool nt_buffer_appendb(nt_buffer_t *self, byte_t what) {
 }
 
 
+bool nt_buffer_appendvf(nt_buffer_t *self, const char *fmt, va_list args) {
+  va_list args2;
+  size_t size = nt_buffer_available(self);
+  int n;
+  
+  va_copy(args2, args);
+  n = vsnprintf((char *)self->ptr, size, fmt, args2);
+  va_end(args2);
+  if (n < 0)
+    return false;
+  
+  if ((size_t)n >= size) {
+    /* vsnprintf told us exactly how much it needs */
+    if (!nt_buffer_grow(self, (size_t)n + 1))
+      return false;
+    n = vsnprintf((char *)self->ptr, nt_buffer_available(self), fmt, args);
+    if (n < 0)
+      return false;
+  }
+  
+  self->ptr += n;
+  return true;
+}
+
+
 bool nt_buffer_appendf(nt_buffer_t *self, const char *fmt, ...) {
-	va_list args;
-	size_t length, size;
-	int n;
+  va_list args;
+  bool r;
+  va_start(args, fmt);
+  r = nt_buffer_appendvf(self, fmt, args);
+  va_end(args);
+  return r;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Number formatting */
+
+static const uint64_t _pow10[20] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static const char _digits2[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static const char _hexdigits[16] = "0123456789abcdef";
+
+
+/* Number of decimal digits in @v, without branches or loops */
+NT_STATIC_INLINE unsigned int _ndigits10(uint64_t v) {
+  /* log10(x) ~= log2(x) * 1233/4096 */
+  unsigned int t = ((64 - __builtin_clzll(v | 1)) * 1233) >> 12;
+  return t + 1 - ((v | 1) < _pow10[t]);
+}
+
+
+/* Write the decimal digits of @v so that the last one ends up at @end-1 */
+NT_STATIC_INLINE void _putdigits10(byte_t *end, uint64_t v) {
+  while (v >= 100) {
+    const char *d = &_digits2[(v % 100) * 2];
+    v /= 100;
+    *--end = d[1];
+    *--end = d[0];
+  }
+  if (v >= 10) {
+    *--end = _digits2[v * 2 + 1];
+    *--end = _digits2[v * 2];
+  }
+  else {
+    *--end = (byte_t)('0' + v);
+  }
+}
+
+
+size_t nt_fmt_u64(byte_t *dst, uint64_t v) {
+  unsigned int n = _ndigits10(v);
+  _putdigits10(dst + n, v);
+  return n;
+}
+
+
+size_t nt_fmt_i64(byte_t *dst, int64_t v) {
+  if (v < 0) {
+    *dst = '-';
+    return nt_fmt_u64(dst + 1, 0 - (uint64_t)v) + 1;
+  }
+  return nt_fmt_u64(dst, (uint64_t)v);
+}
+
+
+size_t nt_fmt_x64(byte_t *dst, uint64_t v) {
+  unsigned int n = (64 - __builtin_clzll(v | 1) + 3) >> 2;
+  byte_t *p = dst + n;
+  do {
+    *--p = _hexdigits[v & 0xf];
+    v >>= 4;
+  } while (p != dst);
+  return n;
+}
+
+
+size_t nt_fmt_double(byte_t *dst, double v, unsigned int precision) {
+  byte_t *p = dst;
+  uint64_t scale, total, frac;
+  double a;
   
-	length = 1;
-	size = nt_buffer_available(self);
-	
-	do {
-		if (length > size) {
-			if (nt_buffer_grow(self, length))
-			  return false;
-			size = nt_buffer_available(self);
-		}
-    
-		va_start(args, fmt);
-		n = vsnprintf((char *)self->ptr, size, fmt, args);
-		va_end(args);
-    
-		if (n >= 0) {
-			if (n < size) {
-				self->ptr += n;
-				return true;
-			}
-			length = n + 1;
-		}
-		else {
-			length = size << 1;
-		}
-	}
-	while (length > size);
+  if (v != v) {
+    memcpy(dst, "nan", 3);
+    return 3;
+  }
+  if (precision > 9)
+    precision = 9;
+  scale = _pow10[precision];
   
-	return false;
+  a = v < 0 ? -v : v;
+  if (a >= 1e18 / (double)scale) {
+    /* also catches inf */
+    int n = snprintf((char *)dst, NT_FMT_DOUBLE_MAX, "%.17g", v);
+    return n < 0 ? 0 : (size_t)n;
+  }
+  
+  if (signbit(v))
+    *p++ = '-';
+  total = (uint64_t)(a * (double)scale + 0.5);
+  p += nt_fmt_u64(p, total / scale);
+  if (precision) {
+    frac = total % scale;
+    *p++ = '.';
+    _putdigits10(p + precision, frac);
+    /* zero-pad fraction on the left */
+    memset(p, '0', precision - _ndigits10(frac));
+    p += precision;
+  }
+  
+  return p - dst;
+}
+
+
+bool nt_buffer_appendu(nt_buffer_t *self, uint64_t v) {
+  if (nt_buffer_reserve(self, NT_FMT_U64_MAX) == NULL)
+    return false;
+  self->ptr += nt_fmt_u64(self->ptr, v);
+  return true;
 }
 
 
-ssize_t nt_buffer_indexof(nt_buffer_t *self, const byte_t *what, size_t n) {
-  ssize_t i;
+bool nt_buffer_appendi(nt_buffer_t *self, int64_t v) {
+  if (nt_buffer_reserve(self, NT_FMT_I64_MAX) == NULL)
+    return false;
+  self->ptr += nt_fmt_i64(self->ptr, v);
+  return true;
+}
+
+
+bool nt_buffer_appendx(nt_buffer_t *self, uint64_t v) {
+  if (nt_buffer_reserve(self, NT_FMT_X64_MAX) == NULL)
+    return false;
+  self->ptr += nt_fmt_x64(self->ptr, v);
+  return true;
+}
+
+
+bool nt_buffer_appendd(nt_buffer_t *self, double v, unsigned int precision) {
+  if (nt_buffer_reserve(self, NT_FMT_DOUBLE_MAX) == NULL)
+    return false;
+  self->ptr += nt_fmt_double(self->ptr, v, precision);
+  return true;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Substring search */
+
+/* Needles longer than this are handed to memmem (two-way) where available */
+#define MEMFIND_LONG_NEEDLE 64
+
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+  #define HAVE_MEMMEM 1
+#endif
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define HAVE_SSE2 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+  #include <immintrin.h>
+  #define HAVE_AVX2 1
+#endif
+
+typedef const byte_t *(*_memfind_func)(const byte_t *h, size_t hlen,
+                                       const byte_t *n, size_t nlen);
+
+
+static const byte_t *_memfind_generic(const byte_t *h, size_t hlen,
+                                      const byte_t *n, size_t nlen)
+{
+  const byte_t *p, *end;
+  
+  if (nlen > hlen)
+    return NULL;
+  
+  #if HAVE_MEMMEM
+  if (nlen > MEMFIND_LONG_NEEDLE)
+    return (const byte_t *)memmem(h, hlen, n, nlen);
+  #endif
+  
+  /* memchr for the first byte, then compare the rest */
+  end = h + (hlen - nlen) + 1;
+  for (p = h; p < end; p++) {
+    if ((p = (const byte_t *)memchr(p, n[0], end - p)) == NULL)
+      break;
+    if (memcmp(p + 1, n + 1, nlen - 1) == 0)
+      return p;
+  }
+  return NULL;
+}
+
+
+#if HAVE_SSE2
+/*
+  Compare the first and last byte of the needle at 16 positions at once and
+  only memcmp positions where both matched.
+*/
+static const byte_t *_memfind_sse2(const byte_t *h, size_t hlen,
+                                   const byte_t *n, size_t nlen)
+{
+  const __m128i first = _mm_set1_epi8((char)n[0]);
+  const __m128i last = _mm_set1_epi8((char)n[nlen-1]);
+  size_t i;
+  
+  for (i = 0; i + nlen + 15 <= hlen; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(h + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(h + i + nlen - 1));
+    unsigned int mask = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+    while (mask) {
+      unsigned int bit = __builtin_ctz(mask);
+      if (memcmp(h + i + bit + 1, n + 1, nlen - 2) == 0)
+        return h + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  
+  return _memfind_generic(h + i, hlen - i, n, nlen);
+}
+#endif
+
+
+#if HAVE_AVX2
+__attribute__((target("avx2")))
+static const byte_t *_memfind_avx2(const byte_t *h, size_t hlen,
+                                   const byte_t *n, size_t nlen)
+{
+  const __m256i first = _mm256_set1_epi8((char)n[0]);
+  const __m256i last = _mm256_set1_epi8((char)n[nlen-1]);
+  size_t i;
+  
+  for (i = 0; i + nlen + 31 <= hlen; i += 32) {
+    __m256i bf = _mm256_loadu_si256((const __m256i *)(h + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i *)(h + i + nlen - 1));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+    while (mask) {
+      unsigned int bit = __builtin_ctz(mask);
+      if (memcmp(h + i + bit + 1, n + 1, nlen - 2) == 0)
+        return h + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  
+  return _memfind_generic(h + i, hlen - i, n, nlen);
+}
+#endif
+
+
+static const byte_t *_memfind_resolve(const byte_t *h, size_t hlen,
+                                      const byte_t *n, size_t nlen);
+
+/* Points to the best implementation after the first call */
+static _memfind_func _memfind = &_memfind_resolve;
+
+static const byte_t *_memfind_resolve(const byte_t *h, size_t hlen,
+                                      const byte_t *n, size_t nlen)
+{
+  _memfind_func f = &_memfind_generic;
+  #if HAVE_SSE2
+  f = &_memfind_sse2;
+  #endif
+  #if HAVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    f = &_memfind_avx2;
+  #endif
+  _memfind = f;
+  return f(h, hlen, n, nlen);
+}
+
+
+const byte_t *nt_memfind(const byte_t *haystack, size_t hlen,
+                         const byte_t *needle, size_t nlen)
+{
+  if (nlen == 0)
+    return haystack;
+  if (nlen > hlen)
+    return NULL;
+  if (nlen == 1)
+    return (const byte_t *)memchr(haystack, needle[0], hlen);
+  if (nlen > MEMFIND_LONG_NEEDLE)
+    return _memfind_generic(haystack, hlen, needle, nlen);
+  return _memfind(haystack, hlen, needle, nlen);
+}
+
+
+ssize_t nt_buffer_indexfrom(nt_buffer_t *self, size_t start, const byte_t *what, size_t n) {
+  const byte_t *p;
   size_t len = nt_buffer_length(self);
-  // what happens if len > SSIZETMAX?
-  for (i = 0; i < len; i++)
-    if (memcmp((const char *)(self->start + i), (const char *)what, n) == 0)
-      return i;
-  return -1;
+  if (start > len)
+    return -1;
+  if ((p = nt_memfind(self->start + start, len - start, what, n)) == NULL)
+    return -1;
+  return (ssize_t)(p - self->start);
 }
 
 
 void nt_buffer_del(nt_buffer_t *self, size_t index, size_t count, size_t size) {
-  size_t length, i, cpycount;
-  void *srcp, *dstp;
+  size_t length;
+  byte_t *dstp, *srcp;
   
   length = nt_buffer_length(self) / size;
-  cpycount = count;
   assert(index < length);
+  if (index + count > length)
+    count = length - index;
   
-  for (i = index; i < length; i += cpycount) {
-    if (i + cpycount > length)
-      cpycount = length - i;
-    srcp = ADDROF(self, i + cpycount, size);
-    dstp = ADDROF(self, i, size);
-    AN(memcpy((void *)dstp, (const void *)srcp, size * cpycount));
-  }
+  dstp = (byte_t *)ADDROF(self, index, size);
+  srcp = (byte_t *)ADDROF(self, index + count, size);
+  memmove((void *)dstp, (const void *)srcp, size * (length - index - count));
   
   self->ptr = (byte_t *)ADDROF(self, length - count, size);
-  memset((void *)dstp, 0, size * count);
+  memset((void *)self->ptr, 0, size * count);
 }
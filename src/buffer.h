@@ -25,33 +25,224 @@
 #define _NT_BUFFER_H_
 
 #include "obj.h"
+#include <stdarg.h>
 
 #define NT_BUFFER_GROWSIZE 0x8000
-#define NT_BUFFER_GROW_MAX 0x1000000
+
+/* Default value of nt_buffer_t.growmax. Define as 0 for no limit. */
+#ifndef NT_BUFFER_GROW_MAX
+  #define NT_BUFFER_GROW_MAX 0x1000000
+#endif
+
+/* NT_BUFFER_GROW_MMAP buffers move to their own mapping at this size */
+#ifndef NT_BUFFER_MMAP_THRESHOLD
+  #define NT_BUFFER_MMAP_THRESHOLD 0x100000
+#endif
+
+/**
+  Growth strategies.
+**/
+typedef enum {
+  /* realloc(occupied + length + growextra) -- the default */
+  NT_BUFFER_GROW_LINEAR = 0,
+  /* multiply size by growfactor percent, but at least what LINEAR gives */
+  NT_BUFFER_GROW_GEOMETRIC,
+  /* like LINEAR but rounded up to whole pages */
+  NT_BUFFER_GROW_PAGE,
+  /* page-aligned GEOMETRIC. Above NT_BUFFER_MMAP_THRESHOLD the storage lives
+     in its own anonymous mapping which is grown with mremap() (no copy) */
+  NT_BUFFER_GROW_MMAP,
+} nt_buffer_growth_t;
+
+/* nt_buffer_t.flags */
+#define NT_BUFFER_F_MMAPPED 0x1 /* storage is an mmap()ed region */
 
 typedef struct nt_buffer_t {
   NT_OBJ_HEAD
-  byte_t *start;    /* start address */
-  byte_t *ptr;      /* next free byte */
-  byte_t *end;      /* end address */
-  size_t growextra; /* grow: realloc(sizeneeded + growextra) */
+  byte_t *start;       /* start address */
+  byte_t *ptr;         /* next free byte */
+  byte_t *end;         /* end address */
+  size_t growextra;    /* grow: realloc(sizeneeded + growextra) */
+  size_t growmax;      /* never grow beyond this size. 0 means no limit */
+  uint16_t growfactor; /* percent. used by GEOMETRIC and MMAP growth */
+  uint8_t growth;      /* nt_buffer_growth_t */
+  uint8_t flags;       /* NT_BUFFER_F_* */
 } nt_buffer_t;
 
 nt_buffer_t *nt_buffer_new(size_t size, size_t growextra);
 
+/**
+  Set growth strategy.
+  
+  @param growth strategy
+  @param factor growth factor in percent (e.g. 150 grows by 1.5x). Only used
+                by NT_BUFFER_GROW_GEOMETRIC and NT_BUFFER_GROW_MMAP. 0 means
+                the default (200).
+**/
+void nt_buffer_setgrowth(nt_buffer_t *self, nt_buffer_growth_t growth, unsigned int factor);
+
+/**
+  Set the maximum size the buffer may grow to, or 0 for no limit.
+**/
+#define nt_buffer_setgrowmax(self, max) ((self)->growmax = (max))
+
 #define nt_buffer_size(self)      ((self)->end - (self)->start)
 #define nt_buffer_occupied(self)  ((self)->ptr - (self)->start)
 #define nt_buffer_available(self) ((self)->end - (self)->ptr)
 #define nt_buffer_length(self)    nt_buffer_occupied(self)
 
+/**
+  Make room for at least @length more bytes.
+  
+  @returns false if growing would exceed growmax or memory is exhausted.
+**/
 bool nt_buffer_grow(nt_buffer_t *self, size_t length);
 
+/**
+  Release unused capacity so that size equals length (machine aligned).
+  
+  @returns false if memory could not be reallocated.
+**/
+bool nt_buffer_shrink(nt_buffer_t *self);
+
 bool nt_buffer_append(nt_buffer_t *self, const byte_t *what, size_t length);
 bool nt_buffer_appendb(nt_buffer_t *self, byte_t b);
 #define nt_buffer_appendc(self, c) nt_buffer_appendb(self, (byte_t)c)
-bool nt_buffer_appendf(nt_buffer_t *self, const char *fmt, ...) NT_ATTR((format(printf, 2, 3)));
 #define nt_buffer_appends(buf, what) nt_buffer_append((buf), (const byte_t *)(what), strlen(what))
-ssize_t nt_buffer_indexof(nt_buffer_t *self, const byte_t *what, size_t n);
+
+/**
+  Append printf-formatted text.
+  
+  Formats directly into free space and, if the result did not fit, grows by
+  exactly what is needed and formats a second time. Prefer the specialized
+  nt_buffer_append{u,i,x,d} functions below in hot paths.
+**/
+bool nt_buffer_appendf(nt_buffer_t *self, const char *fmt, ...) NT_ATTR((format(printf, 2, 3)));
+bool nt_buffer_appendvf(nt_buffer_t *self, const char *fmt, va_list args) NT_ATTR((format(printf, 2, 0)));
+
+/**
+  Number formatting.
+  
+  Each nt_fmt_* function writes to @dst without a terminating NUL and returns
+  the number of bytes written, which is never more than the corresponding
+  NT_FMT_*_MAX.
+**/
+#define NT_FMT_U64_MAX    20
+#define NT_FMT_I64_MAX    20
+#define NT_FMT_X64_MAX    16
+#define NT_FMT_DOUBLE_MAX 32
+
+/* Unsigned decimal */
+size_t nt_fmt_u64(byte_t *dst, uint64_t v);
+
+/* Signed decimal */
+size_t nt_fmt_i64(byte_t *dst, int64_t v);
+
+/* Lower-case hexadecimal, no prefix */
+size_t nt_fmt_x64(byte_t *dst, uint64_t v);
+
+/**
+  Fixed-point decimal with @precision (at most 9) fractional digits, rounded
+  half away from zero. Values of 1e18/10^precision or larger are written as
+  "%.17g".
+**/
+size_t nt_fmt_double(byte_t *dst, double v, unsigned int precision);
+
+/**
+  Make room for @length more bytes and return a pointer to the free space.
+  
+  Write into the returned memory and then call nt_buffer_commit().
+  
+  @returns NULL if the buffer could not grow.
+**/
+NT_STATIC_INLINE byte_t *nt_buffer_reserve(nt_buffer_t *self, size_t length) {
+  if (length > (size_t)nt_buffer_available(self) && !nt_buffer_grow(self, length))
+    return NULL;
+  return self->ptr;
+}
+
+/**
+  Mark @n bytes written to memory returned by nt_buffer_reserve() as used.
+**/
+NT_STATIC_INLINE void nt_buffer_commit(nt_buffer_t *self, size_t n) {
+  assert(n <= (size_t)nt_buffer_available(self));
+  self->ptr += n;
+}
+
+/**
+  Unchecked appends for batches of small fields.
+  
+  These do not grow the buffer. Reserve room for the whole batch first by
+  summing the upper bounds:
+  
+    if (!nt_buffer_reserve(buf, 2*NT_FMT_U64_MAX + 2))
+      return false;
+    nt_buffer_putu(buf, status);
+    nt_buffer_putc(buf, ' ');
+    nt_buffer_putu(buf, length);
+    nt_buffer_putc(buf, '\n');
+**/
+NT_STATIC_INLINE void nt_buffer_put(nt_buffer_t *self, const byte_t *what, size_t length) {
+  assert(length <= (size_t)nt_buffer_available(self));
+  memcpy(self->ptr, what, length);
+  self->ptr += length;
+}
+#define nt_buffer_puts(self, what) nt_buffer_put((self), (const byte_t *)(what), strlen(what))
+#define nt_buffer_putc(self, c) (assert((self)->ptr < (self)->end), *((self)->ptr++) = (byte_t)(c))
+#define nt_buffer_putu(self, v) ((self)->ptr += nt_fmt_u64((self)->ptr, (v)))
+#define nt_buffer_puti(self, v) ((self)->ptr += nt_fmt_i64((self)->ptr, (v)))
+#define nt_buffer_putx(self, v) ((self)->ptr += nt_fmt_x64((self)->ptr, (v)))
+#define nt_buffer_putd(self, v, precision) \
+  ((self)->ptr += nt_fmt_double((self)->ptr, (v), (precision)))
+
+/**
+  Append a formatted number. Each reserves the upper bound once and formats
+  straight into the buffer.
+**/
+bool nt_buffer_appendu(nt_buffer_t *self, uint64_t v);
+bool nt_buffer_appendi(nt_buffer_t *self, int64_t v);
+bool nt_buffer_appendx(nt_buffer_t *self, uint64_t v);
+bool nt_buffer_appendd(nt_buffer_t *self, double v, unsigned int precision);
+
+/**
+  Find the first occurance of @what in the buffer, starting at byte @start.
+  
+  Incremental parsers should pass the offset they have already scanned up to
+  (minus n-1) as @start to avoid searching the same bytes again.
+  
+  @param start  byte offset at which to start searching.
+  @param what   bytes to search for.
+  @param n      number of bytes in @what.
+  @returns index of the first byte of the match, or -1 if not found.
+**/
+ssize_t nt_buffer_indexfrom(nt_buffer_t *self, size_t start, const byte_t *what, size_t n);
+
+/**
+  Find the first occurance of @what in the buffer.
+  
+  @returns index of the first byte of the match, or -1 if not found.
+**/
+NT_STATIC_INLINE
+ssize_t nt_buffer_indexof(nt_buffer_t *self, const byte_t *what, size_t n) {
+  return nt_buffer_indexfrom(self, 0, what, n);
+}
+
+/**
+  Find @needle (of @nlen bytes) in @haystack (of @hlen bytes).
+  
+  Uses SSE2 or AVX2 (selected at runtime) when available.
+  
+  @returns pointer to the first match or NULL if not found.
+**/
+const byte_t *nt_memfind(const byte_t *haystack, size_t hlen,
+                         const byte_t *needle, size_t nlen);
+
+/**
+  Remove @count elements of @size bytes starting at element @index.
+  
+  Shifts the remainder of the buffer down, which makes this O(n). Use
+  nt_ringbuf_t when consuming from the front of a stream.
+**/
 void nt_buffer_del(nt_buffer_t *buf, size_t index, size_t count, size_t size);
 
 
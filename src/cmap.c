@@ -0,0 +1,288 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "cmap.h"
+#include "mpool.h"
+
+#define MIN_SIZE 16
+
+#define TABLE_SIZEOF(size) \
+  (sizeof(nt_cmap_table_t) + (size) * sizeof(nt_cmap_node_t *))
+
+/* Epochs wrap around. @a is older than @b */
+#define EPOCH_BEFORE(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+
+
+static nt_cmap_table_t *_table_new(size_t size) {
+  nt_cmap_table_t *t;
+  if ((t = (nt_cmap_table_t *)nt_calloc(1, TABLE_SIZEOF(size))) == NULL)
+    return NULL;
+  t->size = size;
+  return t;
+}
+
+
+static void _node_free(nt_cmap_t *self, nt_cmap_node_t *n, bool release_value) {
+  if (release_value && (self->flags & NT_CMAP_F_RETAIN))
+    nt_release(n->value);
+  nt_free(n, sizeof(nt_cmap_node_t));
+}
+
+
+/* Free a table and its nodes. Values now belong to the next table's nodes */
+static void _table_free(nt_cmap_t *self, nt_cmap_table_t *t, bool release_values) {
+  size_t i;
+  nt_cmap_node_t *n, *next;
+  for (i = 0; i < t->size; i++) {
+    for (n = t->buckets[i]; n; n = next) {
+      next = n->next;
+      _node_free(self, n, release_values);
+    }
+  }
+  nt_free(t, TABLE_SIZEOF(t->size));
+}
+
+
+static void _dealloc(nt_cmap_t *self) {
+  nt_cmap_node_t *n, *nnext;
+  nt_cmap_table_t *t, *tnext;
+  
+  for (n = self->limbo; n; n = nnext) {
+    nnext = n->limbo;
+    _node_free(self, n, true);
+  }
+  for (t = self->tlimbo; t; t = tnext) {
+    tnext = t->limbo;
+    _table_free(self, t, false);
+  }
+  _table_free(self, self->tab, true);
+  pthread_mutex_destroy(&self->wlock);
+  nt_free(self, sizeof(nt_cmap_t));
+}
+
+
+nt_cmap_t *nt_cmap_new(const nt_hashmap_keyops_t *keyops, uint32_t flags) {
+  NT_OBJ_ALLOC_INIT_self(nt_cmap_t, &_dealloc);
+  memset((byte_t *)self + sizeof(nt_obj_t), 0, sizeof(nt_cmap_t) - sizeof(nt_obj_t));
+  if ((self->tab = _table_new(MIN_SIZE)) == NULL) {
+    nt_free(self, sizeof(nt_cmap_t));
+    return NULL;
+  }
+  self->keyops = keyops;
+  self->flags = flags;
+  self->epoch = 1;
+  self->readers = (nt_cmap_reader_t *)NT_ALIGN((uintptr_t)self->readerbuf, NT_CACHELINE_SIZE);
+  AZ(pthread_mutex_init(&self->wlock, NULL));
+  return self;
+}
+
+
+nt_cmap_reader_t *nt_cmap_addreader(nt_cmap_t *self) {
+  int32_t i, n;
+  for (i = 0; i < NT_CMAP_READERS_MAX; i++) {
+    if (nt_atomic_load32(&self->readers[i].used) == 0 &&
+        nt_atomic_bool_compare_and_swap32(&self->readers[i].used, 0, 1))
+    {
+      /* writers look at slots below nreaders */
+      while ((n = nt_atomic_load32(&self->nreaders)) <= i &&
+             !nt_atomic_bool_compare_and_swap32(&self->nreaders, n, i + 1))
+        ;
+      return &self->readers[i];
+    }
+  }
+  return NULL;
+}
+
+
+void nt_cmap_removereader(nt_cmap_t *self, nt_cmap_reader_t *r) {
+  assert(r->used && r->epoch == 0);
+  nt_atomic_store32(&r->used, 0);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Reclamation. Called with wlock held */
+
+static void _retire(nt_cmap_t *self, nt_cmap_node_t *n) {
+  n->epoch = self->epoch;
+  n->limbo = self->limbo;
+  self->limbo = n;
+}
+
+
+/*
+  Start a new epoch and free everything unlinked before the oldest epoch a
+  reader is still in.
+*/
+static void _advance(nt_cmap_t *self) {
+  int32_t i, nreaders, e, oldest;
+  nt_cmap_node_t **np, *n, *next;
+  nt_cmap_table_t **tp, *t, *tnext;
+  
+  oldest = self->epoch + 1;
+  if (oldest == 0)
+    oldest = 1;
+  nt_atomic_store32(&self->epoch, oldest);
+  /* unlinks and the new epoch must be visible before we look at readers */
+  nt_atomic_barrier();
+  
+  nreaders = nt_atomic_load32(&self->nreaders);
+  for (i = 0; i < nreaders; i++) {
+    e = nt_atomic_load32(&self->readers[i].epoch);
+    if (e != 0 && EPOCH_BEFORE(e, oldest))
+      oldest = e;
+  }
+  
+  /* lists are newest first -- cut at the first reclaimable entry */
+  for (np = &self->limbo; *np && !EPOCH_BEFORE((*np)->epoch, oldest); np = &(*np)->limbo)
+    ;
+  for (n = *np, *np = NULL; n; n = next) {
+    next = n->limbo;
+    _node_free(self, n, true);
+  }
+  for (tp = &self->tlimbo; *tp && !EPOCH_BEFORE((*tp)->epoch, oldest); tp = &(*tp)->limbo)
+    ;
+  for (t = *tp, *tp = NULL; t; t = tnext) {
+    tnext = t->limbo;
+    _table_free(self, t, false);
+  }
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Writers */
+
+static nt_cmap_node_t *_node_new(const void *key, void *value, uint32_t hash,
+                                 nt_cmap_node_t *next)
+{
+  nt_cmap_node_t *n;
+  if ((n = (nt_cmap_node_t *)nt_malloc(sizeof(nt_cmap_node_t))) == NULL)
+    return NULL;
+  n->next = next;
+  n->key = key;
+  n->value = value;
+  n->hash = hash;
+  n->epoch = 0;
+  n->limbo = NULL;
+  return n;
+}
+
+
+/*
+  Copy all nodes into a table twice the size and publish it. Readers still
+  walking the old table keep seeing a consistent (old) view.
+*/
+static bool _grow(nt_cmap_t *self) {
+  nt_cmap_table_t *old = self->tab, *t;
+  nt_cmap_node_t *n, *copy;
+  size_t i, mask;
+  
+  if ((t = _table_new(old->size * 2)) == NULL)
+    return false;
+  mask = t->size - 1;
+  
+  for (i = 0; i < old->size; i++) {
+    for (n = old->buckets[i]; n; n = n->next) {
+      if ((copy = _node_new(n->key, n->value, n->hash, t->buckets[n->hash & mask])) == NULL) {
+        _table_free(self, t, false);
+        return false;
+      }
+      t->buckets[n->hash & mask] = copy;
+    }
+  }
+  
+  nt_atomic_storeptr(&self->tab, t);
+  old->epoch = self->epoch;
+  old->limbo = self->tlimbo;
+  self->tlimbo = old;
+  return true;
+}
+
+
+bool nt_cmap_put(nt_cmap_t *self, const void *key, void *value) {
+  uint32_t hash = self->keyops->hash(key);
+  nt_cmap_node_t * volatile *np;
+  nt_cmap_node_t *n, *old;
+  bool ok = true;
+  
+  AZ(pthread_mutex_lock(&self->wlock));
+  
+  for (np = &self->tab->buckets[hash & (self->tab->size - 1)]; (old = *np); np = &old->next) {
+    if (old->hash == hash && (old->key == key || self->keyops->equal(old->key, key)))
+      break;
+  }
+  
+  if ((n = _node_new(key, value, hash, old ? old->next : *np)) == NULL) {
+    ok = false;
+    goto out;
+  }
+  if (self->flags & NT_CMAP_F_RETAIN)
+    nt_retain(value);
+  
+  /* the node is complete before it becomes reachable */
+  nt_atomic_storeptr(np, n);
+  
+  if (old) {
+    _retire(self, old);
+  }
+  else if (++self->count > self->tab->size) {
+    /* failing to grow only makes chains longer */
+    _grow(self);
+  }
+  
+  _advance(self);
+out:
+  AZ(pthread_mutex_unlock(&self->wlock));
+  return ok;
+}
+
+
+bool nt_cmap_remove(nt_cmap_t *self, const void *key) {
+  uint32_t hash = self->keyops->hash(key);
+  nt_cmap_node_t * volatile *np;
+  nt_cmap_node_t *n;
+  
+  AZ(pthread_mutex_lock(&self->wlock));
+  
+  for (np = &self->tab->buckets[hash & (self->tab->size - 1)]; (n = *np); np = &n->next) {
+    if (n->hash == hash && (n->key == key || self->keyops->equal(n->key, key)))
+      break;
+  }
+  
+  if (n) {
+    /* readers on n can still follow n->next */
+    nt_atomic_storeptr(np, n->next);
+    _retire(self, n);
+    self->count--;
+    _advance(self);
+  }
+  
+  AZ(pthread_mutex_unlock(&self->wlock));
+  return n != NULL;
+}
+
+
+void nt_cmap_reclaim(nt_cmap_t *self) {
+  AZ(pthread_mutex_lock(&self->wlock));
+  if (self->limbo || self->tlimbo)
+    _advance(self);
+  AZ(pthread_mutex_unlock(&self->wlock));
+}
@@ -0,0 +1,196 @@
+/**
+  Concurrent read-mostly hash map.
+  
+  Any number of threads may look up keys concurrently without taking locks
+  or writing to memory shared with other threads. Writers are serialized by
+  a mutex and never modify a node a reader might be looking at: puts and
+  removes link in new nodes and unlink old ones, and growing the table
+  copies it. Unlinked memory is reclaimed once every reader which could
+  still see it has left its read-side section (epoch-based reclamation).
+  
+  Each reading thread registers once to get a reader slot, which lives on
+  its own cache line:
+  
+    nt_cmap_reader_t *r = nt_cmap_addreader(sessions);
+    ...
+    nt_cmap_rlock(sessions, r);
+    session = nt_cmap_get(sessions, key);
+    if (session) nt_retain(session);  // to keep it past runlock
+    nt_cmap_runlock(sessions, r);
+    ...
+    nt_cmap_removereader(sessions, r);  // when the thread is done reading
+  
+  With NT_CMAP_F_RETAIN, values are nt_obj_t-based objects which the map
+  retains while they are stored, releasing them only after all readers which
+  could have seen them are done.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_CMAP_H_
+#define _NT_CMAP_H_
+
+#include "obj.h"
+#include "atomic.h"
+#include "hashmap.h"
+#include <pthread.h>
+
+/* Maximum number of reader threads per map */
+#ifndef NT_CMAP_READERS_MAX
+  #define NT_CMAP_READERS_MAX 64
+#endif
+
+#ifndef NT_CACHELINE_SIZE
+  #define NT_CACHELINE_SIZE 64
+#endif
+
+/* nt_cmap_new flags */
+#define NT_CMAP_F_RETAIN 0x1 /* values are nt_obj_t and retained by the map */
+
+typedef struct nt_cmap_node_t {
+  struct nt_cmap_node_t * volatile next;
+  const void *key;
+  void *value;
+  uint32_t hash;
+  int32_t epoch;                  /* when unlinked */
+  struct nt_cmap_node_t *limbo;   /* next unlinked node */
+} nt_cmap_node_t;
+
+typedef struct nt_cmap_table_t {
+  size_t size;                    /* number of buckets, a power of two */
+  int32_t epoch;                  /* when replaced */
+  struct nt_cmap_table_t *limbo;  /* next replaced table */
+  nt_cmap_node_t * volatile buckets[];
+} nt_cmap_table_t;
+
+/* A reader's announcement of the epoch it entered at. 0 when outside */
+typedef struct nt_cmap_reader_t {
+  volatile int32_t epoch;
+  volatile int32_t used;          /* taken by nt_cmap_addreader */
+  byte_t pad[NT_CACHELINE_SIZE - 2 * sizeof(int32_t)];
+} nt_cmap_reader_t;
+
+typedef struct nt_cmap_t {
+  NT_OBJ_HEAD
+  nt_cmap_table_t * volatile tab;
+  const nt_hashmap_keyops_t *keyops;
+  uint32_t flags;
+  volatile int32_t nreaders;      /* slots ever taken (the rest are unused) */
+  nt_cmap_reader_t *readers;      /* NT_CMAP_READERS_MAX slots in readerbuf,
+                                     each starting a cache line */
+  
+  /* written by writers only. Kept off the readers' cache lines */
+  byte_t pad0[NT_CACHELINE_SIZE];
+  pthread_mutex_t wlock;
+  volatile int32_t epoch;
+  size_t count;
+  nt_cmap_node_t *limbo;          /* unlinked nodes, newest first */
+  nt_cmap_table_t *tlimbo;        /* replaced tables, newest first */
+  byte_t pad1[NT_CACHELINE_SIZE];
+  
+  byte_t readerbuf[(NT_CMAP_READERS_MAX + 1) * NT_CACHELINE_SIZE];
+} nt_cmap_t;
+
+/**
+  Create a new concurrent map.
+  
+  @param keyops key operations, e.g. &nt_hashmap_intkeys.
+  @param flags  NT_CMAP_F_* flags.
+**/
+nt_cmap_t *nt_cmap_new(const nt_hashmap_keyops_t *keyops, uint32_t flags);
+
+/**
+  Register the calling thread as a reader.
+  
+  The returned slot must only be used by one thread at a time, and should
+  be handed back with nt_cmap_removereader when the thread stops reading
+  (e.g. before it exits).
+  
+  @returns NULL if NT_CMAP_READERS_MAX readers are already registered.
+**/
+nt_cmap_reader_t *nt_cmap_addreader(nt_cmap_t *self);
+
+/**
+  Unregister a reader, outside of a read-side section. The slot may then be
+  taken by another thread.
+**/
+void nt_cmap_removereader(nt_cmap_t *self, nt_cmap_reader_t *r);
+
+/**
+  Enter a read-side section. Nodes and values seen inside it stay valid
+  until nt_cmap_runlock().
+**/
+NT_STATIC_INLINE void nt_cmap_rlock(nt_cmap_t *self, nt_cmap_reader_t *r) {
+  nt_atomic_store32(&r->epoch, nt_atomic_load32(&self->epoch));
+  /* announce before looking at any node */
+  nt_atomic_barrier();
+}
+
+/**
+  Leave a read-side section.
+**/
+NT_STATIC_INLINE void nt_cmap_runlock(nt_cmap_t *self, nt_cmap_reader_t *r) {
+  nt_atomic_store32(&r->epoch, 0);
+}
+
+/**
+  Look up @key. Must be called inside a read-side section.
+  
+  @returns the value or NULL if not found.
+**/
+NT_STATIC_INLINE void *nt_cmap_get(nt_cmap_t *self, const void *key) {
+  nt_cmap_table_t *t = (nt_cmap_table_t *)nt_atomic_loadptr(&self->tab);
+  uint32_t hash = self->keyops->hash(key);
+  nt_cmap_node_t *n = (nt_cmap_node_t *)nt_atomic_loadptr(&t->buckets[hash & (t->size - 1)]);
+  for (; n; n = (nt_cmap_node_t *)nt_atomic_loadptr(&n->next)) {
+    if (n->hash == hash && (n->key == key || self->keyops->equal(n->key, key)))
+      return n->value;
+  }
+  return NULL;
+}
+
+/**
+  Associate @value with @key, replacing any current value.
+  
+  @returns false if memory is exhausted.
+**/
+bool nt_cmap_put(nt_cmap_t *self, const void *key, void *value);
+
+/**
+  Remove @key.
+  
+  @returns false if @key was not found.
+**/
+bool nt_cmap_remove(nt_cmap_t *self, const void *key);
+
+/**
+  Free memory unlinked by earlier writes which no reader can see anymore.
+  
+  Every put and remove does this, so this is only needed to release memory
+  (and values) sooner when writes stop.
+**/
+void nt_cmap_reclaim(nt_cmap_t *self);
+
+/**
+  Number of entries. Exact only when read by a writer.
+**/
+#define nt_cmap_count(self) ((self)->count)
+
+#endif
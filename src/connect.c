@@ -0,0 +1,174 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "connect.h"
+#include "sockutil.h"
+#include "mpool.h"
+
+
+/* Copy @addrs, alternating between the first address family and the rest */
+static size_t _interleave(nt_sockaddr_t *dst, const nt_sockaddr_t *addrs, size_t naddrs) {
+  sa_family_t first = addrs[0].ss_family;
+  size_t i, j, n = 0;
+  
+  for (i = 0, j = 0; n < naddrs && n < NT_CONNECT_MAXADDRS; ) {
+    while (i < naddrs && addrs[i].ss_family != first)
+      i++;
+    while (j < naddrs && addrs[j].ss_family == first)
+      j++;
+    if (i == naddrs && j == naddrs)
+      break;
+    if (i < naddrs)
+      memcpy((void *)&dst[n++], (const void *)&addrs[i++], sizeof(nt_sockaddr_t));
+    if (j < naddrs && n < NT_CONNECT_MAXADDRS)
+      memcpy((void *)&dst[n++], (const void *)&addrs[j++], sizeof(nt_sockaddr_t));
+  }
+  return n;
+}
+
+
+static void _free(nt_connect_t *self) {
+  size_t i;
+  for (i = 0; i < self->next; i++) {
+    if (self->attempts[i].fd != -1) {
+      event_del(&self->attempts[i].ev);
+      close(self->attempts[i].fd);
+    }
+  }
+  event_del(&self->delayev);
+  nt_runloop_rmtimer(self->runloop, &self->timer);
+  nt_free(self, sizeof(nt_connect_t));
+}
+
+
+/* Free @self and report @fd (or @error) */
+static void _finish(nt_connect_t *self, int fd, size_t index, int error) {
+  nt_connect_cb_t cb = self->cb;
+  void *arg = self->arg;
+  nt_sockaddr_t addr;
+  
+  if (fd != -1) {
+    memcpy((void *)&addr, (const void *)&self->addrs[index], sizeof(addr));
+    self->attempts[index].fd = -1;
+  }
+  _free(self);
+  cb(fd, (fd != -1) ? &addr : NULL, error, arg);
+}
+
+
+static void _attemptcb(int fd, short ev, nt_connect_attempt_t *attempt);
+
+/* Start the next attempt. Returns false if there are no addresses left. */
+static bool _startnext(nt_connect_t *self) {
+  struct timeval tv;
+  nt_connect_attempt_t *attempt;
+  
+  while (self->next < self->naddrs) {
+    attempt = &self->attempts[self->next];
+    if ((attempt->fd = nt_sockutil_connectnb(&self->addrs[self->next++])) == -1) {
+      self->error = errno;
+      continue;
+    }
+    attempt->connect = self;
+    event_set(&attempt->ev, attempt->fd, EV_WRITE,
+      (void (*)(int, short, void *))&_attemptcb, (void *)attempt);
+    nt_runloop_addev(self->runloop, &attempt->ev, NULL);
+    self->nactive++;
+    if (self->next < self->naddrs) {
+      tv.tv_sec = NT_CONNECT_DELAY_MSEC / 1000;
+      tv.tv_usec = (NT_CONNECT_DELAY_MSEC % 1000) * 1000;
+      AZ(event_add(&self->delayev, &tv));
+    }
+    return true;
+  }
+  return false;
+}
+
+
+static void _attemptcb(int fd, short ev, nt_connect_attempt_t *attempt) {
+  nt_connect_t *self = attempt->connect;
+  int error = nt_sockutil_getiopt(fd, SOL_SOCKET, SO_ERROR);
+  
+  if (error == 0) {
+    _finish(self, fd, attempt - self->attempts, 0);
+    return;
+  }
+  close(fd);
+  attempt->fd = -1;
+  self->nactive--;
+  self->error = error;
+  /* no need to wait for the delay */
+  event_del(&self->delayev);
+  if (!_startnext(self) && self->nactive == 0)
+    _finish(self, -1, 0, self->error);
+}
+
+
+static void _delaycb(int fd, short ev, nt_connect_t *self) {
+  _startnext(self);
+}
+
+
+static void _timeoutcb(nt_timer_t *timer, nt_connect_t *self) {
+  _finish(self, -1, 0, ETIMEDOUT);
+}
+
+
+nt_connect_t *nt_connect_start(nt_runloop_t *runloop, const nt_sockaddr_t *addrs,
+                               size_t naddrs, unsigned int timeout_msec,
+                               nt_connect_cb_t cb, void *arg)
+{
+  nt_connect_t *self;
+  size_t i;
+  int error;
+  
+  assert(naddrs > 0);
+  assert(cb != NULL);
+  if ((self = (nt_connect_t *)nt_malloc(sizeof(nt_connect_t))) == NULL)
+    return NULL;
+  self->runloop = runloop;
+  self->naddrs = _interleave(self->addrs, addrs, naddrs);
+  self->next = 0;
+  self->nactive = 0;
+  for (i = 0; i < NT_CONNECT_MAXADDRS; i++)
+    self->attempts[i].fd = -1;
+  self->error = 0;
+  self->cb = cb;
+  self->arg = arg;
+  evtimer_set(&self->delayev, (void (*)(int, short, void *))&_delaycb, (void *)self);
+  AZ(event_base_set(runloop->ev_base, &self->delayev));
+  nt_timer_init(&self->timer, (nt_timer_cb_t)&_timeoutcb, self);
+  
+  if (!_startnext(self)) {
+    error = self->error;
+    _free(self);
+    errno = error;
+    return NULL;
+  }
+  if (timeout_msec)
+    nt_runloop_addtimer(runloop, &self->timer, timeout_msec);
+  return self;
+}
+
+
+void nt_connect_cancel(nt_connect_t *self) {
+  _free(self);
+}
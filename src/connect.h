@@ -0,0 +1,103 @@
+/**
+  Non-blocking TCP connect with "happy eyeballs" (RFC 8305).
+  
+  Given the addresses of a host, e.g. from nt_sockutil_getaddrs, attempts
+  are started one at a time with a NT_CONNECT_DELAY_MSEC head start each,
+  alternating between IPv6 and IPv4, and the first connection to be
+  established wins. A failed attempt starts the next one right away. An
+  unreachable address therefore costs one delay rather than a full TCP
+  timeout, and a broken address family costs nothing once the other one
+  answers:
+  
+    static void on_connect(int fd, const nt_sockaddr_t *addr, int error, void *arg) {
+      if (error) ...
+      nt_sockconn_open(conn, rs, fd, addr, &on_read, NULL, &on_error);
+    }
+    
+    naddrs = nt_sockutil_getaddrs("example.com", 80, AF_UNSPEC, addrs, 8);
+    nt_connect_start(runloop, addrs, naddrs, 5000, &on_connect, NULL);
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_CONNECT_H_
+#define _NT_CONNECT_H_
+
+#include "runloop.h"
+
+/* Max number of addresses tried per connect */
+#define NT_CONNECT_MAXADDRS 8
+
+/* Head start of each attempt ("Connection Attempt Delay") */
+#ifndef NT_CONNECT_DELAY_MSEC
+  #define NT_CONNECT_DELAY_MSEC 250
+#endif
+
+/**
+  Called once, when a connection has been established or all attempts
+  failed.
+  
+  @param fd    connected non-blocking socket, owned by the callback, or -1
+  @param addr  address @fd is connected to, or NULL
+  @param error 0, the error of the last failed attempt or ETIMEDOUT
+**/
+typedef void (*nt_connect_cb_t)(int fd, const nt_sockaddr_t *addr, int error, void *arg);
+
+typedef struct nt_connect_attempt_t {
+  int fd;                       /* -1 when not in progress */
+  struct event ev;              /* waits for the socket to become writable */
+  struct nt_connect_t *connect;
+} nt_connect_attempt_t;
+
+typedef struct nt_connect_t {
+  nt_runloop_t *runloop;
+  nt_sockaddr_t addrs[NT_CONNECT_MAXADDRS];  /* in the order they are tried */
+  size_t naddrs;
+  size_t next;                  /* next address to try */
+  size_t nactive;               /* attempts in progress */
+  nt_connect_attempt_t attempts[NT_CONNECT_MAXADDRS];
+  struct event delayev;         /* starts the next attempt */
+  nt_timer_t timer;             /* gives up */
+  int error;                    /* error of the last failed attempt */
+  nt_connect_cb_t cb;
+  void *arg;
+} nt_connect_t;
+
+/**
+  Start connecting to the first of @addrs to answer.
+  
+  Addresses are reordered so that families alternate, keeping the order
+  within each family, and only the first NT_CONNECT_MAXADDRS are used.
+  
+  @param timeout_msec give up (with ETIMEDOUT) after this long, or 0 to
+                      wait for the attempts to time out on their own
+  @returns the pending connect, which is freed before @cb is called, or
+           NULL with errno set if no attempt could be started
+**/
+nt_connect_t *nt_connect_start(nt_runloop_t *runloop, const nt_sockaddr_t *addrs,
+                               size_t naddrs, unsigned int timeout_msec,
+                               nt_connect_cb_t cb, void *arg);
+
+/**
+  Abort a pending connect. The callback is not called.
+**/
+void nt_connect_cancel(nt_connect_t *self);
+
+#endif
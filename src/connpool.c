@@ -0,0 +1,284 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "connpool.h"
+#include "connect.h"
+#include "mpool.h"
+
+/* An idle socket */
+typedef struct nt_connpool_idle_t {
+  struct nt_connpool_idle_t *next;
+  struct nt_connpool_idle_t **pprev;
+  int fd;
+  nt_connpool_t *pool;
+  nt_connpool_backend_t *backend;
+  struct event ev;              /* the backend sent something or closed */
+  nt_timer_t timer;             /* idletimeout */
+} nt_connpool_idle_t;
+
+/* A request waiting for a socket, or connecting */
+typedef struct nt_connpool_req_t {
+  struct nt_connpool_req_t *next;
+  nt_connpool_t *pool;          /* retained while connecting */
+  nt_connpool_backend_t *backend;
+  nt_connpool_cb_t cb;
+  void *arg;
+} nt_connpool_req_t;
+
+
+/* Remove an idle socket from its backend. Returns the socket. */
+static int _unidle(nt_connpool_idle_t *idle) {
+  int fd = idle->fd;
+  if ((*idle->pprev = idle->next))
+    idle->next->pprev = idle->pprev;
+  idle->backend->nidle--;
+  event_del(&idle->ev);
+  nt_runloop_rmtimer(idle->pool->runloop, &idle->timer);
+  nt_free(idle, sizeof(nt_connpool_idle_t));
+  return fd;
+}
+
+
+static void _dealloc(nt_connpool_t *self) {
+  size_t iter = 0;
+  nt_hashmap_entry_t *e;
+  nt_connpool_backend_t *b;
+  nt_connpool_req_t *req;
+  
+  while ((e = nt_hashmap_next(self->backends, &iter))) {
+    b = (nt_connpool_backend_t *)e->value;
+    while (b->idle)
+      close(_unidle(b->idle));
+    while ((req = b->waithead)) {
+      b->waithead = req->next;
+      req->cb(self, -1, ECANCELED, req->arg);
+      nt_free(req, sizeof(nt_connpool_req_t));
+    }
+    nt_free(b, sizeof(nt_connpool_backend_t));
+  }
+  nt_release(self->backends);
+  nt_release(self->runloop);
+  nt_free(self, sizeof(nt_connpool_t));
+}
+
+
+nt_connpool_t *nt_connpool_new(nt_runloop_t *runloop, size_t maxconns, size_t maxidle) {
+  NT_OBJ_ALLOC_INIT_self(nt_connpool_t, &_dealloc);
+  NT_OBJ_CLEAR(self, nt_connpool_t);
+  if ((self->backends = nt_hashmap_new(&nt_hashmap_sockaddrkeys, 0)) == NULL) {
+    nt_free(self, sizeof(nt_connpool_t));
+    return NULL;
+  }
+  nt_retain(runloop);
+  self->runloop = runloop;
+  self->rs.runloop = runloop;
+  self->maxconns = maxconns;
+  self->maxidle = maxidle;
+  self->idletimeout = 60000;
+  self->connecttimeout = 5000;
+  return self;
+}
+
+
+static nt_connpool_backend_t *_backend(nt_connpool_t *self, const nt_sockaddr_t *addr) {
+  nt_connpool_backend_t *b = (nt_connpool_backend_t *)nt_hashmap_get(self->backends, addr);
+  if (b)
+    return b;
+  if ((b = (nt_connpool_backend_t *)nt_calloc(1, sizeof(nt_connpool_backend_t))) == NULL)
+    return NULL;
+  memcpy((void *)&b->addr, (const void *)addr, nt_sockaddr_len(addr));
+  if (!nt_hashmap_put(self->backends, &b->addr, b)) {
+    nt_free(b, sizeof(nt_connpool_backend_t));
+    return NULL;
+  }
+  return b;
+}
+
+
+static void _connectedcb(int fd, const nt_sockaddr_t *addr, int error, nt_connpool_req_t *req);
+
+/* Connect for @req, which is freed on failure */
+static bool _connect(nt_connpool_t *self, nt_connpool_req_t *req) {
+  int error;
+  req->backend->nconns++;
+  req->pool = self;
+  nt_retain(self);
+  if (nt_connect_start(self->runloop, &req->backend->addr, 1, self->connecttimeout,
+                       (nt_connect_cb_t)&_connectedcb, req) == NULL) {
+    error = errno;
+    req->backend->nconns--;
+    nt_free(req, sizeof(nt_connpool_req_t));
+    nt_release(self);
+    errno = error;
+    return false;
+  }
+  return true;
+}
+
+
+/* A socket of @b was closed: let a waiting request connect */
+static void _slotfreed(nt_connpool_t *self, nt_connpool_backend_t *b) {
+  nt_connpool_req_t *req;
+  while ((req = b->waithead) && (self->maxconns == 0 || b->nconns < self->maxconns)) {
+    nt_connpool_cb_t cb = req->cb;
+    void *arg = req->arg;
+    if ((b->waithead = req->next) == NULL)
+      b->waittail = NULL;
+    if (_connect(self, req))
+      break;
+    cb(self, -1, errno, arg);
+  }
+}
+
+
+static void _connectedcb(int fd, const nt_sockaddr_t *addr, int error, nt_connpool_req_t *req) {
+  nt_connpool_t *self = req->pool;
+  nt_connpool_backend_t *b = req->backend;
+  nt_connpool_cb_t cb = req->cb;
+  void *arg = req->arg;
+  
+  nt_free(req, sizeof(nt_connpool_req_t));
+  if (fd == -1) {
+    b->nconns--;
+    cb(self, -1, error, arg);
+    _slotfreed(self, b);
+  }
+  else {
+    self->nconnects++;
+    cb(self, fd, 0, arg);
+  }
+  nt_release(self);
+}
+
+
+/* An idle socket is reusable if there is nothing to read and no EOF */
+static bool _alive(int fd) {
+  char c;
+  return recv(fd, &c, 1, MSG_PEEK|MSG_DONTWAIT) == -1 &&
+         (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+
+bool nt_connpool_get(nt_connpool_t *self, const nt_sockaddr_t *addr,
+                     nt_connpool_cb_t cb, void *arg)
+{
+  nt_connpool_backend_t *b;
+  nt_connpool_req_t *req;
+  int fd;
+  
+  if ((b = _backend(self, addr)) == NULL)
+    return false;
+  while (b->idle) {
+    fd = _unidle(b->idle);
+    if (_alive(fd)) {
+      self->nreused++;
+      cb(self, fd, 0, arg);
+      return true;
+    }
+    close(fd);
+    b->nconns--;
+  }
+  
+  if ((req = (nt_connpool_req_t *)nt_malloc(sizeof(nt_connpool_req_t))) == NULL)
+    return false;
+  req->next = NULL;
+  req->backend = b;
+  req->cb = cb;
+  req->arg = arg;
+  if (self->maxconns && b->nconns >= self->maxconns) {
+    if (b->waittail)
+      b->waittail->next = req;
+    else
+      b->waithead = req;
+    b->waittail = req;
+    return true;
+  }
+  return _connect(self, req);
+}
+
+
+static void _closeidle(nt_connpool_idle_t *idle) {
+  nt_connpool_t *self = idle->pool;
+  nt_connpool_backend_t *b = idle->backend;
+  close(_unidle(idle));
+  b->nconns--;
+  _slotfreed(self, b);
+}
+
+
+static void _idlereadcb(int fd, short ev, nt_connpool_idle_t *idle) {
+  /* EOF, a reset, or data nobody asked for */
+  _closeidle(idle);
+}
+
+
+static void _idletimeoutcb(nt_timer_t *timer, nt_connpool_idle_t *idle) {
+  _closeidle(idle);
+}
+
+
+void nt_connpool_put(nt_connpool_t *self, const nt_sockaddr_t *addr, int fd) {
+  nt_connpool_backend_t *b = (nt_connpool_backend_t *)nt_hashmap_get(self->backends, addr);
+  nt_connpool_req_t *req;
+  nt_connpool_idle_t *idle;
+  
+  assert(b != NULL && b->nconns > 0);
+  if ((req = b->waithead)) {
+    /* straight to the next request */
+    nt_connpool_cb_t cb = req->cb;
+    void *arg = req->arg;
+    if ((b->waithead = req->next) == NULL)
+      b->waittail = NULL;
+    nt_free(req, sizeof(nt_connpool_req_t));
+    self->nreused++;
+    cb(self, fd, 0, arg);
+    return;
+  }
+  
+  if (b->nidle >= self->maxidle ||
+      (idle = (nt_connpool_idle_t *)nt_malloc(sizeof(nt_connpool_idle_t))) == NULL) {
+    close(fd);
+    b->nconns--;
+    return;
+  }
+  idle->fd = fd;
+  idle->pool = self;
+  idle->backend = b;
+  event_set(&idle->ev, fd, EV_READ, (void (*)(int, short, void *))&_idlereadcb, (void *)idle);
+  nt_runloop_addev(self->runloop, &idle->ev, NULL);
+  nt_timer_init(&idle->timer, (nt_timer_cb_t)&_idletimeoutcb, idle);
+  if (self->idletimeout)
+    nt_runloop_addtimer(self->runloop, &idle->timer, self->idletimeout);
+  if ((idle->next = b->idle))
+    b->idle->pprev = &idle->next;
+  idle->pprev = &b->idle;
+  b->idle = idle;
+  b->nidle++;
+}
+
+
+void nt_connpool_discard(nt_connpool_t *self, const nt_sockaddr_t *addr, int fd) {
+  nt_connpool_backend_t *b = (nt_connpool_backend_t *)nt_hashmap_get(self->backends, addr);
+  assert(b != NULL && b->nconns > 0);
+  close(fd);
+  b->nconns--;
+  _slotfreed(self, b);
+}
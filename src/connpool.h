@@ -0,0 +1,117 @@
+/**
+  Per-runloop pool of outbound TCP connections, keyed by address.
+  
+  Sockets returned to the pool after a request are kept open (up to
+  maxidle per backend, for idletimeout milliseconds) and handed out again
+  instead of connecting anew. The number of sockets per backend -- in use,
+  idle or connecting -- is capped at maxconns; requests beyond that wait
+  until a socket is returned or discarded, so a slow backend sees a steady
+  number of connections instead of a reconnect storm:
+  
+    static void on_conn(nt_connpool_t *pool, int fd, int error, void *arg) {
+      nt_sockconn_open(conn, &pool->rs, fd, backend, &on_read, NULL, &on_error);
+      ...
+    }
+    
+    pool = nt_connpool_new(runloop, 32, 8);
+    nt_connpool_get(pool, backend, &on_conn, req);
+    ...
+    nt_connpool_put(pool, backend, nt_sockconn_detach(conn));
+  
+  Idle sockets are watched for the backend closing them, and are checked
+  once more when handed out. A pool must only be used from its runloop's
+  thread.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_CONNPOOL_H_
+#define _NT_CONNPOOL_H_
+
+#include "obj.h"
+#include "runloop.h"
+#include "hashmap.h"
+
+struct nt_connpool_t;
+struct nt_connpool_idle_t;
+struct nt_connpool_req_t;
+
+/**
+  Called with a connected socket for the backend, or -1 and an error.
+  The socket is the caller's until it is passed to nt_connpool_put or
+  nt_connpool_discard.
+**/
+typedef void (*nt_connpool_cb_t)(struct nt_connpool_t *pool, int fd, int error, void *arg);
+
+typedef struct nt_connpool_backend_t {
+  nt_sockaddr_t addr;
+  size_t nconns;                      /* in use, idle or connecting */
+  struct nt_connpool_idle_t *idle;    /* most recently returned first */
+  size_t nidle;
+  struct nt_connpool_req_t *waithead; /* requests waiting for maxconns */
+  struct nt_connpool_req_t *waittail;
+} nt_connpool_backend_t;
+
+typedef struct nt_connpool_t {
+  NT_OBJ_HEAD
+  nt_runloop_t *runloop;        /* retained */
+  nt_sockserv_runloop_t rs;     /* for nt_sockconn_open on pooled sockets */
+  nt_hashmap_t *backends;       /* nt_sockaddr_t * -> nt_connpool_backend_t * */
+  size_t maxconns;              /* per backend, 0 for no limit */
+  size_t maxidle;               /* idle sockets kept per backend */
+  unsigned int idletimeout;     /* msec an idle socket is kept, 0 for no limit */
+  unsigned int connecttimeout;  /* msec, 0 for the system's TCP timeout */
+  uint64_t nreused;             /* requests served with an idle socket */
+  uint64_t nconnects;           /* connections established */
+} nt_connpool_t;
+
+/**
+  Create a new pool.
+  
+  @param maxconns max sockets per backend, or 0 for no limit
+  @param maxidle  max idle sockets kept per backend
+**/
+nt_connpool_t *nt_connpool_new(nt_runloop_t *runloop, size_t maxconns, size_t maxidle);
+
+/**
+  Get a socket connected to @addr.
+  
+  If an idle socket is available, @cb is called before this function
+  returns. Otherwise a connection is started, or, if the backend has
+  maxconns sockets, the request waits for one to be returned.
+  
+  @returns false with errno set if no connection could be started
+**/
+bool nt_connpool_get(nt_connpool_t *self, const nt_sockaddr_t *addr,
+                     nt_connpool_cb_t cb, void *arg);
+
+/**
+  Return a socket for reuse. It must be idle: no request in progress and
+  nothing left to read.
+**/
+void nt_connpool_put(nt_connpool_t *self, const nt_sockaddr_t *addr, int fd);
+
+/**
+  Close a socket which must not be reused (e.g. after an error), making
+  room for another connection to the backend.
+**/
+void nt_connpool_discard(nt_connpool_t *self, const nt_sockaddr_t *addr, int fd);
+
+#endif
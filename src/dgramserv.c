@@ -0,0 +1,434 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "dgramserv.h"
+#include "sockutil.h"
+#include "mpool.h"
+#include <netdb.h>
+
+#ifdef __linux__
+  #include <netinet/udp.h>
+  #define HAVE_MMSG 1
+  #ifdef UDP_SEGMENT
+    #define HAVE_GSO 1
+  #endif
+  #ifdef UDP_GRO
+    #define HAVE_GRO 1
+  #endif
+#endif
+
+/* Max number of segments in one UDP_SEGMENT send (UDP_MAX_SEGMENTS) */
+#define GSO_MAXSEGS 64
+
+#if HAVE_MMSG
+typedef struct mmsghdr _msg_t;
+#else
+typedef struct _msg_t {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+} _msg_t;
+#endif
+
+/* Room for one UDP_GRO or UDP_SEGMENT control message */
+typedef union _control_t {
+  struct cmsghdr hdr;
+  char buf[CMSG_SPACE(sizeof(int))];
+} _control_t;
+
+/* Slots for one direction, allocated as a single block */
+typedef struct nt_dgramserv_batch_t {
+  size_t size;                  /* allocation size */
+  _msg_t *msgs;
+  struct iovec *iovs;
+  _control_t *controls;
+  nt_sockaddr_t *addrs;
+  nt_dgram_t *dgrams;
+} nt_dgramserv_batch_t;
+
+#define _ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+
+static nt_dgramserv_batch_t *_newbatch(size_t nslots, size_t slotsize) {
+  nt_dgramserv_batch_t *b;
+  byte_t *p;
+  size_t i, size;
+  
+  size = _ALIGN(sizeof(nt_dgramserv_batch_t))
+       + _ALIGN(nslots * sizeof(_msg_t))
+       + _ALIGN(nslots * sizeof(struct iovec))
+       + _ALIGN(nslots * sizeof(_control_t))
+       + _ALIGN(nslots * sizeof(nt_sockaddr_t))
+       + _ALIGN(nslots * sizeof(nt_dgram_t))
+       + nslots * slotsize;
+  if ((p = (byte_t *)nt_malloc(size)) == NULL)
+    return NULL;
+  b = (nt_dgramserv_batch_t *)p;
+  b->size = size;
+  p += _ALIGN(sizeof(nt_dgramserv_batch_t));
+  b->msgs = (_msg_t *)p;
+  p += _ALIGN(nslots * sizeof(_msg_t));
+  b->iovs = (struct iovec *)p;
+  p += _ALIGN(nslots * sizeof(struct iovec));
+  b->controls = (_control_t *)p;
+  p += _ALIGN(nslots * sizeof(_control_t));
+  b->addrs = (nt_sockaddr_t *)p;
+  p += _ALIGN(nslots * sizeof(nt_sockaddr_t));
+  b->dgrams = (nt_dgram_t *)p;
+  p += _ALIGN(nslots * sizeof(nt_dgram_t));
+  
+  memset((void *)b->msgs, 0, nslots * sizeof(_msg_t));
+  for (i = 0; i < nslots; i++) {
+    struct msghdr *hdr = &b->msgs[i].msg_hdr;
+    b->iovs[i].iov_base = (void *)(p + i * slotsize);
+    b->iovs[i].iov_len = slotsize;
+    hdr->msg_name = (void *)&b->addrs[i];
+    hdr->msg_namelen = sizeof(nt_sockaddr_t);
+    hdr->msg_iov = &b->iovs[i];
+    hdr->msg_iovlen = 1;
+    hdr->msg_control = (void *)&b->controls[i];
+    hdr->msg_controllen = sizeof(_control_t);
+    b->dgrams[i].data = (byte_t *)b->iovs[i].iov_base;
+    b->dgrams[i].addr = &b->addrs[i];
+  }
+  return b;
+}
+
+
+static void _dealloc(nt_dgramserv_t *self) {
+  nt_dgramserv_stop(self);
+  nt_fd_close(&self->fd);
+  if (self->in)
+    nt_free(self->in, self->in->size);
+  if (self->out)
+    nt_free(self->out, self->out->size);
+  nt_free(self, sizeof(nt_dgramserv_t));
+}
+
+
+nt_dgramserv_t *nt_dgramserv_new(nt_dgramserv_on_recv_t on_recv, size_t nslots,
+                                 size_t slotsize)
+{
+  NT_OBJ_ALLOC_INIT_self(nt_dgramserv_t, &_dealloc);
+  NT_OBJ_CLEAR(self, nt_dgramserv_t);
+  assert(on_recv != NULL);
+  self->fd = -1;
+  self->on_recv = on_recv;
+  self->nslots = nslots ? nslots : NT_DGRAMSERV_SLOTS;
+  self->slotsize = slotsize ? slotsize : NT_DGRAMSERV_SLOTSIZE;
+  if ((self->in = _newbatch(self->nslots, self->slotsize)) == NULL ||
+      (self->out = _newbatch(self->nslots, self->slotsize)) == NULL) {
+    nt_release(self);
+    return NULL;
+  }
+  return self;
+}
+
+
+bool nt_dgramserv_bindtoaddr(nt_dgramserv_t *self, const nt_sockaddr_t *sa, int flags) {
+  socklen_t salen = sizeof(self->addr);
+  
+  assert(self->fd == -1);
+  if ((flags & NT_DGRAMSERV_GRO) && self->slotsize < 0x10000) {
+    errno = EINVAL;
+    return false;
+  }
+  if ((self->fd = nt_sockutil_socket(SOCK_DGRAM, sa->ss_family)) == -1)
+    return false;
+  if (nt_sockutil_bind(self->fd, sa) != 0) {
+    nt_fd_close(&self->fd);
+    return false;
+  }
+  
+  #if HAVE_GRO
+  /* not an error if the kernel is too old -- datagrams just come one by one */
+  if (flags & NT_DGRAMSERV_GRO) {
+    int one = 1;
+    setsockopt(self->fd, IPPROTO_UDP, UDP_GRO, (const void *)&one, sizeof(one));
+  }
+  #endif
+  
+  // Save the address, with the port picked by the kernel if @sa had none
+  if (getsockname(self->fd, (struct sockaddr *)&self->addr, &salen) == -1)
+    memcpy((void *)&self->addr, (const void *)sa, nt_sockaddr_len(sa));
+  return true;
+}
+
+
+bool nt_dgramserv_bind(nt_dgramserv_t *self, const char *addr, int port, int family,
+                       int flags)
+{
+  struct addrinfo hints, *servinfo;
+  char strport[12];
+  bool ok;
+  int rv;
+  
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags = AI_PASSIVE;
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf(strport, sizeof(strport), "%d", port);
+  if ((rv = getaddrinfo((addr && *addr) ? addr : NULL, strport, &hints, &servinfo)) != 0) {
+    nt_warn("getaddrinfo: %s", gai_strerror(rv));
+    return false;
+  }
+  ok = nt_dgramserv_bindtoaddr(self, (const nt_sockaddr_t *)servinfo->ai_addr, flags);
+  freeaddrinfo(servinfo);
+  return ok;
+}
+
+
+/* Size of the datagrams coalesced by UDP_GRO, or 0 */
+static size_t _grosize(struct msghdr *hdr, size_t length) {
+  #if HAVE_GRO
+  struct cmsghdr *cmsg;
+  int segsize;
+  for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+    if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+      memcpy((void *)&segsize, (const void *)CMSG_DATA(cmsg), sizeof(segsize));
+      return ((size_t)segsize < length) ? (size_t)segsize : 0;
+    }
+  }
+  #endif
+  return 0;
+}
+
+
+/* Receive up to nslots datagrams. Returns the count or -1. */
+static int _recvbatch(nt_dgramserv_t *self, nt_dgramserv_batch_t *b) {
+  #if HAVE_MMSG
+  return recvmmsg(self->fd, b->msgs, (unsigned int)self->nslots, MSG_DONTWAIT, NULL);
+  #else
+  ssize_t n;
+  int i;
+  for (i = 0; i < (int)self->nslots; i++) {
+    if ((n = recvmsg(self->fd, &b->msgs[i].msg_hdr, MSG_DONTWAIT)) == -1)
+      return i ? i : -1;
+    b->msgs[i].msg_len = (unsigned int)n;
+  }
+  return i;
+  #endif
+}
+
+
+static void _readcb(int fd, short ev, nt_dgramserv_t *self) {
+  nt_dgramserv_batch_t *b = self->in;
+  int i, n, nbatches = 0;
+  
+  do {
+    if ((n = _recvbatch(self, b)) == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        nt_warn("recvmmsg");
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      struct msghdr *hdr = &b->msgs[i].msg_hdr;
+      nt_dgram_t *dgram = &b->dgrams[i];
+      dgram->length = b->msgs[i].msg_len;
+      dgram->truncated = (hdr->msg_flags & MSG_TRUNC) != 0;
+      dgram->segsize = _grosize(hdr, dgram->length);
+      /* the kernel updated these */
+      hdr->msg_namelen = sizeof(nt_sockaddr_t);
+      hdr->msg_controllen = sizeof(_control_t);
+    }
+    self->nrecv += (uint64_t)n;
+    self->on_recv(self, b->dgrams, (size_t)n);
+    /* a partial batch means the socket is drained */
+  } while (n == (int)self->nslots && ++nbatches < NT_DGRAMSERV_MAXBATCHES && self->runloop);
+}
+
+
+static void _flushcb(int fd, short ev, nt_dgramserv_t *self) {
+  self->flushev_pending = false;
+  nt_dgramserv_flush(self);
+}
+
+
+void nt_dgramserv_start(nt_dgramserv_t *self, nt_runloop_t *runloop) {
+  assert(self->runloop == NULL);
+  assert(self->fd != -1);
+  self->runloop = runloop;
+  event_set(&self->ev, self->fd, EV_READ|EV_PERSIST,
+    (void (*)(int, short, void *))&_readcb, (void *)self);
+  nt_runloop_addev(runloop, &self->ev, NULL);
+  event_set(&self->flushev, -1, 0, (void (*)(int, short, void *))&_flushcb, (void *)self);
+  AZ(event_base_set(runloop->ev_base, &self->flushev));
+  if (self->nout) {
+    self->flushev_pending = true;
+    event_active(&self->flushev, EV_WRITE, 1);
+  }
+}
+
+
+void nt_dgramserv_stop(nt_dgramserv_t *self) {
+  if (self->runloop == NULL)
+    return;
+  event_del(&self->ev);
+  event_del(&self->flushev);
+  self->flushev_pending = false;
+  self->runloop = NULL;
+  nt_dgramserv_flush(self);
+}
+
+
+/* Take the next send slot, flushing if all are used */
+static size_t _nextslot(nt_dgramserv_t *self, const nt_sockaddr_t *to) {
+  nt_dgramserv_batch_t *b = self->out;
+  struct msghdr *hdr;
+  size_t i;
+  
+  if (self->nout == self->nslots)
+    nt_dgramserv_flush(self);
+  i = self->nout++;
+  hdr = &b->msgs[i].msg_hdr;
+  hdr->msg_namelen = nt_sockaddr_len(to);
+  memcpy((void *)&b->addrs[i], (const void *)to, hdr->msg_namelen);
+  hdr->msg_control = NULL;
+  hdr->msg_controllen = 0;
+  b->dgrams[i].segsize = 0;
+  
+  /* send at the end of this runloop iteration */
+  if (self->runloop && !self->flushev_pending) {
+    self->flushev_pending = true;
+    event_active(&self->flushev, EV_WRITE, 1);
+  }
+  return i;
+}
+
+
+bool nt_dgramserv_send(nt_dgramserv_t *self, const nt_sockaddr_t *to,
+                       const void *data, size_t length)
+{
+  size_t i;
+  if (length > self->slotsize) {
+    errno = EMSGSIZE;
+    return false;
+  }
+  i = _nextslot(self, to);
+  memcpy(self->out->iovs[i].iov_base, data, length);
+  self->out->iovs[i].iov_len = length;
+  return true;
+}
+
+
+bool nt_dgramserv_sendsegments(nt_dgramserv_t *self, const nt_sockaddr_t *to,
+                               const void *data, size_t length, size_t segsize)
+{
+  #if HAVE_GSO
+  struct cmsghdr *cmsg;
+  struct msghdr *hdr;
+  uint16_t gsosize;
+  size_t i;
+  #else
+  size_t off, n;
+  #endif
+  
+  assert(segsize > 0);
+  if (length <= segsize)
+    return nt_dgramserv_send(self, to, data, length);
+  if (length > self->slotsize || segsize > 0xffff || (length + segsize - 1) / segsize > GSO_MAXSEGS) {
+    errno = EMSGSIZE;
+    return false;
+  }
+  
+  #if HAVE_GSO
+  i = _nextslot(self, to);
+  hdr = &self->out->msgs[i].msg_hdr;
+  memcpy(self->out->iovs[i].iov_base, data, length);
+  self->out->iovs[i].iov_len = length;
+  self->out->dgrams[i].segsize = segsize;
+  hdr->msg_control = (void *)&self->out->controls[i];
+  hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+  cmsg = CMSG_FIRSTHDR(hdr);
+  cmsg->cmsg_level = IPPROTO_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  gsosize = (uint16_t)segsize;
+  memcpy((void *)CMSG_DATA(cmsg), (const void *)&gsosize, sizeof(gsosize));
+  #else
+  for (off = 0; off < length; off += n) {
+    n = (length - off < segsize) ? length - off : segsize;
+    nt_dgramserv_send(self, to, (const byte_t *)data + off, n);
+  }
+  #endif
+  return true;
+}
+
+
+/* Send queued datagrams from @start. Returns the number sent, or -1. */
+static int _sendbatch(nt_dgramserv_t *self, nt_dgramserv_batch_t *b, size_t start) {
+  #if HAVE_MMSG
+  return sendmmsg(self->fd, b->msgs + start, (unsigned int)(self->nout - start), MSG_DONTWAIT);
+  #else
+  size_t i;
+  for (i = start; i < self->nout; i++) {
+    if (sendmsg(self->fd, &b->msgs[i].msg_hdr, MSG_DONTWAIT) == -1)
+      return (i > start) ? (int)(i - start) : -1;
+  }
+  return (int)(i - start);
+  #endif
+}
+
+
+/* Send a segmented datagram one segment at a time */
+static void _sendsplit(nt_dgramserv_t *self, nt_dgramserv_batch_t *b, size_t i) {
+  struct msghdr *hdr = &b->msgs[i].msg_hdr;
+  const byte_t *data = (const byte_t *)b->iovs[i].iov_base;
+  size_t off, n, length = b->iovs[i].iov_len, segsize = b->dgrams[i].segsize;
+  
+  for (off = 0; off < length; off += n) {
+    n = (length - off < segsize) ? length - off : segsize;
+    if (sendto(self->fd, data + off, n, MSG_DONTWAIT, (const struct sockaddr *)hdr->msg_name,
+               hdr->msg_namelen) == -1)
+      self->ndropped++;
+    else
+      self->nsent++;
+  }
+}
+
+
+void nt_dgramserv_flush(nt_dgramserv_t *self) {
+  nt_dgramserv_batch_t *b = self->out;
+  size_t i = 0;
+  int n;
+  
+  while (i < self->nout) {
+    if ((n = _sendbatch(self, b, i)) > 0) {
+      self->nsent += (uint64_t)n;
+      i += (size_t)n;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      /* socket buffer full */
+      self->ndropped += (uint64_t)(self->nout - i);
+      break;
+    }
+    /* the datagram at @i failed on its own, e.g. EMSGSIZE, or EIO when the
+       device can not do UDP_SEGMENT */
+    if (b->dgrams[i].segsize)
+      _sendsplit(self, b, i);
+    else
+      self->ndropped++;
+    i++;
+  }
+  self->nout = 0;
+}
@@ -0,0 +1,189 @@
+/**
+  Datagram (UDP) server.
+
+  Datagrams are received in batches into a fixed set of slots, allocated
+  once with nt_malloc, and handed to the receive callback together. Replies
+  are copied into send slots and go out in one sendmmsg call at the end of
+  the runloop iteration (or as soon as all send slots are used):
+
+    static void on_recv(nt_dgramserv_t *server, nt_dgram_t *dgrams, size_t count) {
+      size_t i;
+      for (i = 0; i < count; i++)
+        nt_dgramserv_send(server, dgrams[i].addr, dgrams[i].data, dgrams[i].length);
+    }
+
+    server = nt_dgramserv_new(&on_recv, 0, 0);
+    nt_dgramserv_bind(server, "", 5300, AF_INET, 0);
+    nt_dgramserv_start(server, runloop);
+
+  On Linux, a readiness event is handled with recvmmsg calls receiving up
+  to nslots datagrams each, and UDP generic segmentation offload can be
+  used in both directions: nt_dgramserv_sendsegments hands the kernel one
+  large buffer which is split into datagrams (UDP_SEGMENT), and with
+  NT_DGRAMSERV_GRO the kernel may deliver several datagrams from the same
+  sender in one slot (UDP_GRO). Elsewhere the same is done with one
+  recvmsg/sendmsg call per datagram.
+
+  Sockets are bound with SO_REUSEPORT, so a server can be sharded over the
+  threads of a nt_runloop_group_t by creating one server per runloop, all
+  bound to the same address, in the group's init callback. The kernel then
+  spreads datagrams over the sockets by source address and port.
+
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_DGRAMSERV_H_
+#define _NT_DGRAMSERV_H_
+
+#include "obj.h"
+#include "sockaddr.h"
+#include "runloop.h"
+#include <event.h>
+
+/* Default number of slots in each direction */
+#define NT_DGRAMSERV_SLOTS 64
+
+/* Default slot size. Larger datagrams are truncated. */
+#define NT_DGRAMSERV_SLOTSIZE 2048
+
+/* Max number of batches received per readiness event */
+#define NT_DGRAMSERV_MAXBATCHES 8
+
+/* Flags for nt_dgramserv_bind */
+#define NT_DGRAMSERV_GRO 1  /* receive coalesced datagrams (slots must be 64 kB) */
+
+/**
+  A received datagram.
+**/
+typedef struct nt_dgram_t {
+  byte_t *data;         /* valid until the receive callback returns */
+  size_t length;
+  nt_sockaddr_t *addr;  /* sender */
+  size_t segsize;       /* with NT_DGRAMSERV_GRO: if not 0, @data holds
+                           several datagrams of @segsize bytes each (the
+                           last one may be shorter) */
+  bool truncated;       /* the datagram did not fit in the slot */
+} nt_dgram_t;
+
+struct nt_dgramserv_t;
+struct nt_dgramserv_batch_t;
+
+/**
+  Called with datagrams received in one batch.
+**/
+typedef void (*nt_dgramserv_on_recv_t)(struct nt_dgramserv_t *server,
+                                       nt_dgram_t *dgrams, size_t count);
+
+typedef struct nt_dgramserv_t {
+  NT_OBJ_HEAD
+  int fd;
+  nt_sockaddr_t addr;           /* bound address */
+  nt_dgramserv_on_recv_t on_recv;
+  void *arg;                    /* user data */
+  size_t nslots;                /* slots in each direction */
+  size_t slotsize;
+  struct nt_dgramserv_batch_t *in;
+  struct nt_dgramserv_batch_t *out;
+  size_t nout;                  /* queued datagrams in @out */
+  nt_runloop_t *runloop;        /* while started */
+  struct event ev;              /* socket readable */
+  struct event flushev;         /* sends queued datagrams */
+  bool flushev_pending;
+
+  /* Statistics */
+  uint64_t nrecv;               /* datagrams (or GRO buffers) received */
+  uint64_t nsent;               /* datagrams (or GSO buffers) sent */
+  uint64_t ndropped;            /* datagrams which could not be sent */
+} nt_dgramserv_t;
+
+/**
+  Create a new datagram server.
+
+  @param on_recv  receive callback
+  @param nslots   number of slots in each direction, or 0 for
+                  NT_DGRAMSERV_SLOTS
+  @param slotsize size of each slot, or 0 for NT_DGRAMSERV_SLOTSIZE
+  @returns NULL if memory is exhausted
+**/
+nt_dgramserv_t *nt_dgramserv_new(nt_dgramserv_on_recv_t on_recv, size_t nslots,
+                                 size_t slotsize);
+
+/**
+  Bind server to a specific address.
+
+  @param flags 0 or NT_DGRAMSERV_GRO
+  @returns boolean success. Fails with EINVAL if NT_DGRAMSERV_GRO is asked
+           for with slots smaller than 64 kB.
+**/
+bool nt_dgramserv_bindtoaddr(nt_dgramserv_t *self, const nt_sockaddr_t *sa, int flags);
+
+/**
+  Bind server to address/hostname and port.
+
+  @param family AF_INET or AF_INET6. Binds to the first address found.
+  @param flags  0 or NT_DGRAMSERV_GRO
+  @returns boolean success
+**/
+bool nt_dgramserv_bind(nt_dgramserv_t *self, const char *addr, int port, int family,
+                       int flags);
+
+/**
+  Start receiving on @runloop. The server must be bound.
+**/
+void nt_dgramserv_start(nt_dgramserv_t *self, nt_runloop_t *runloop);
+
+/**
+  Stop receiving. Queued datagrams are sent first.
+**/
+void nt_dgramserv_stop(nt_dgramserv_t *self);
+
+/**
+  Queue a datagram.
+
+  The data is copied into a send slot. Queued datagrams are sent at the end
+  of the runloop iteration, or when all slots are used. Datagrams which can
+  not be sent because the socket buffer is full are dropped and counted in
+  self->ndropped, much like datagrams lost on the network.
+
+  @returns false with EMSGSIZE if @length is larger than the slot size
+**/
+bool nt_dgramserv_send(nt_dgramserv_t *self, const nt_sockaddr_t *to,
+                       const void *data, size_t length);
+
+/**
+  Queue @length bytes to be sent as datagrams of @segsize bytes each (the
+  last one may be shorter).
+
+  With UDP_SEGMENT, the kernel (or the network card) does the splitting and
+  the buffer is sent as one message. Otherwise, or if the kernel refuses,
+  the datagrams are sent one by one.
+
+  @returns false with EMSGSIZE if @length is larger than the slot size or
+           would make more than 64 datagrams
+**/
+bool nt_dgramserv_sendsegments(nt_dgramserv_t *self, const nt_sockaddr_t *to,
+                               const void *data, size_t length, size_t segsize);
+
+/**
+  Send queued datagrams now.
+**/
+void nt_dgramserv_flush(nt_dgramserv_t *self);
+
+#endif
@@ -0,0 +1,386 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "hashmap.h"
+#include "mpool.h"
+#include "buffer.h"
+#include "sockaddr.h"
+
+#define MIN_SIZE 16
+
+/* Grow when count exceeds 4/5 of the slots */
+#define OVERLOADED(t, count) ((count) * 5 > (t)->size * 4)
+
+/* Number of old slots migrated per modifying operation */
+#define MIGRATE_STEP 32
+
+
+/* ------------------------------------------------------------------------- */
+/* Hash functions */
+
+uint32_t nt_hash_u64(uint64_t v) {
+  /* MurmurHash3 finalizer */
+  v ^= v >> 33;
+  v *= 0xff51afd7ed558ccdULL;
+  v ^= v >> 33;
+  v *= 0xc4ceb9fe1a85ec53ULL;
+  v ^= v >> 33;
+  return (uint32_t)v;
+}
+
+
+uint32_t nt_hash_bytes(const void *data, size_t length) {
+  const byte_t *p = (const byte_t *)data;
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ length;
+  uint64_t w;
+  
+  while (length >= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ (w * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+    h ^= h >> 31;
+    p += 8;
+    length -= 8;
+  }
+  if (length) {
+    w = 0;
+    memcpy(&w, p, length);
+    h = (h ^ (w * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+  }
+  return nt_hash_u64(h);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Key operations */
+
+static uint32_t _int_hash(const void *key) {
+  return nt_hash_u64((uint64_t)(uintptr_t)key);
+}
+
+static bool _int_equal(const void *a, const void *b) {
+  return a == b;
+}
+
+const nt_hashmap_keyops_t nt_hashmap_intkeys = {&_int_hash, &_int_equal};
+
+
+static uint32_t _sockaddr_hash(const void *key) {
+  const nt_sockaddr_t *sa = (const nt_sockaddr_t *)key;
+  if (sa->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)sa;
+    return nt_hash_bytes(&in6->sin6_addr, sizeof(in6->sin6_addr)) ^
+           nt_hash_u64(in6->sin6_port);
+  }
+  else {
+    const struct sockaddr_in *in4 = (const struct sockaddr_in *)sa;
+    return nt_hash_u64(((uint64_t)in4->sin_addr.s_addr << 16) | in4->sin_port);
+  }
+}
+
+static bool _sockaddr_equal(const void *a, const void *b) {
+  const nt_sockaddr_t *x = (const nt_sockaddr_t *)a;
+  const nt_sockaddr_t *y = (const nt_sockaddr_t *)b;
+  if (x->ss_family != y->ss_family)
+    return false;
+  if (x->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *x6 = (const struct sockaddr_in6 *)x;
+    const struct sockaddr_in6 *y6 = (const struct sockaddr_in6 *)y;
+    return x6->sin6_port == y6->sin6_port &&
+           memcmp(&x6->sin6_addr, &y6->sin6_addr, sizeof(x6->sin6_addr)) == 0;
+  }
+  else {
+    const struct sockaddr_in *x4 = (const struct sockaddr_in *)x;
+    const struct sockaddr_in *y4 = (const struct sockaddr_in *)y;
+    return x4->sin_port == y4->sin_port &&
+           x4->sin_addr.s_addr == y4->sin_addr.s_addr;
+  }
+}
+
+const nt_hashmap_keyops_t nt_hashmap_sockaddrkeys = {&_sockaddr_hash, &_sockaddr_equal};
+
+
+static uint32_t _buffer_hash(const void *key) {
+  const nt_buffer_t *buf = (const nt_buffer_t *)key;
+  return nt_hash_bytes(buf->start, nt_buffer_length(buf));
+}
+
+static bool _buffer_equal(const void *a, const void *b) {
+  const nt_buffer_t *x = (const nt_buffer_t *)a;
+  const nt_buffer_t *y = (const nt_buffer_t *)b;
+  return nt_buffer_length(x) == nt_buffer_length(y) &&
+         memcmp(x->start, y->start, nt_buffer_length(x)) == 0;
+}
+
+const nt_hashmap_keyops_t nt_hashmap_bufferkeys = {&_buffer_hash, &_buffer_equal};
+
+
+static uint32_t _cstr_hash(const void *key) {
+  return nt_hash_bytes(key, strlen((const char *)key));
+}
+
+static bool _cstr_equal(const void *a, const void *b) {
+  return strcmp((const char *)a, (const char *)b) == 0;
+}
+
+const nt_hashmap_keyops_t nt_hashmap_cstrkeys = {&_cstr_hash, &_cstr_equal};
+
+
+/* ------------------------------------------------------------------------- */
+/* Tables */
+
+static bool _table_init(nt_hashmap_table_t *t, size_t size) {
+  if ((t->entries = (nt_hashmap_entry_t *)nt_calloc(size, sizeof(nt_hashmap_entry_t))) == NULL)
+    return false;
+  t->size = size;
+  t->count = 0;
+  return true;
+}
+
+
+static void _table_free(nt_hashmap_table_t *t) {
+  if (t->entries)
+    nt_free(t->entries, t->size * sizeof(nt_hashmap_entry_t));
+  t->entries = NULL;
+  t->size = t->count = 0;
+}
+
+
+static ssize_t _table_find(nt_hashmap_t *self, nt_hashmap_table_t *t,
+                           const void *key, uint32_t hash)
+{
+  size_t mask, i;
+  uint32_t dist;
+  
+  if (t->count == 0)
+    return -1;
+  
+  mask = t->size - 1;
+  i = hash & mask;
+  for (dist = 1; ; dist++) {
+    nt_hashmap_entry_t *e = &t->entries[i];
+    /* an empty slot or a richer entry means the key is not here */
+    if (e->dist < dist)
+      return -1;
+    if (e->hash == hash && (e->key == key || self->keyops->equal(e->key, key)))
+      return (ssize_t)i;
+    i = (i + 1) & mask;
+  }
+}
+
+
+/* Insert a key which is known not to be in @t */
+static void _table_insert(nt_hashmap_table_t *t, const void *key, void *value, uint32_t hash) {
+  size_t mask = t->size - 1;
+  size_t i = hash & mask;
+  nt_hashmap_entry_t e, tmp;
+  
+  e.key = key;
+  e.value = value;
+  e.hash = hash;
+  e.dist = 1;
+  
+  while (t->entries[i].dist != 0) {
+    if (t->entries[i].dist < e.dist) {
+      /* take from the rich */
+      tmp = t->entries[i];
+      t->entries[i] = e;
+      e = tmp;
+    }
+    i = (i + 1) & mask;
+    e.dist++;
+  }
+  
+  t->entries[i] = e;
+  t->count++;
+}
+
+
+/* Remove the entry at @i, shifting the following cluster back one step */
+static void _table_removeat(nt_hashmap_table_t *t, size_t i) {
+  size_t mask = t->size - 1;
+  size_t j = (i + 1) & mask;
+  
+  while (t->entries[j].dist > 1) {
+    t->entries[i] = t->entries[j];
+    t->entries[i].dist--;
+    i = j;
+    j = (j + 1) & mask;
+  }
+  
+  t->entries[i].dist = 0;
+  t->count--;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Incremental resize */
+
+/*
+  Move up to @n slots from the old table into the current one. Slots before
+  migratepos are always empty: backward shifts only move entries to lower
+  indices, and only from within a cluster.
+*/
+static void _migrate(nt_hashmap_t *self, size_t n) {
+  nt_hashmap_table_t *old = &self->old;
+  
+  while (old->count && n--) {
+    nt_hashmap_entry_t *e = &old->entries[self->migratepos];
+    if (e->dist == 0) {
+      self->migratepos++;
+      assert(self->migratepos < old->size);
+      continue;
+    }
+    _table_insert(&self->tab, e->key, e->value, e->hash);
+    _table_removeat(old, self->migratepos);
+  }
+  
+  if (old->count == 0 && old->entries)
+    _table_free(old);
+}
+
+
+static bool _grow(nt_hashmap_t *self) {
+  /* a previous resize must complete before the next one starts */
+  if (self->old.count)
+    _migrate(self, SIZE_MAX);
+  
+  self->old = self->tab;
+  self->migratepos = 0;
+  if (!_table_init(&self->tab, self->old.size * 2)) {
+    self->tab = self->old;
+    self->old.entries = NULL;
+    self->old.size = self->old.count = 0;
+    return false;
+  }
+  return true;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* Map */
+
+static void _dealloc(nt_hashmap_t *self) {
+  _table_free(&self->tab);
+  _table_free(&self->old);
+  nt_free(self, sizeof(nt_hashmap_t));
+}
+
+
+nt_hashmap_t *nt_hashmap_new(const nt_hashmap_keyops_t *keyops, size_t capacity) {
+  size_t size = MIN_SIZE;
+  NT_OBJ_ALLOC_INIT_self(nt_hashmap_t, &_dealloc);
+  
+  while (size * 4 < capacity * 5)
+    size <<= 1;
+  
+  self->keyops = keyops;
+  self->old.entries = NULL;
+  self->old.size = self->old.count = 0;
+  self->migratepos = 0;
+  if (!_table_init(&self->tab, size)) {
+    nt_free(self, sizeof(nt_hashmap_t));
+    return NULL;
+  }
+  
+  return self;
+}
+
+
+nt_hashmap_entry_t *nt_hashmap_find(nt_hashmap_t *self, const void *key) {
+  uint32_t hash = self->keyops->hash(key);
+  ssize_t i;
+  
+  if ((i = _table_find(self, &self->tab, key, hash)) != -1)
+    return &self->tab.entries[i];
+  if ((i = _table_find(self, &self->old, key, hash)) != -1)
+    return &self->old.entries[i];
+  return NULL;
+}
+
+
+bool nt_hashmap_put(nt_hashmap_t *self, const void *key, void *value) {
+  uint32_t hash = self->keyops->hash(key);
+  ssize_t i;
+  
+  if (self->old.count)
+    _migrate(self, MIGRATE_STEP);
+  
+  if ((i = _table_find(self, &self->tab, key, hash)) != -1) {
+    self->tab.entries[i].value = value;
+    return true;
+  }
+  if ((i = _table_find(self, &self->old, key, hash)) != -1) {
+    self->old.entries[i].value = value;
+    return true;
+  }
+  
+  if (OVERLOADED(&self->tab, self->tab.count + 1) && !_grow(self))
+    return false;
+  
+  _table_insert(&self->tab, key, value, hash);
+  return true;
+}
+
+
+bool nt_hashmap_remove(nt_hashmap_t *self, const void *key, void **value) {
+  uint32_t hash = self->keyops->hash(key);
+  nt_hashmap_table_t *t = &self->tab;
+  ssize_t i;
+  
+  if ((i = _table_find(self, t, key, hash)) == -1) {
+    t = &self->old;
+    if ((i = _table_find(self, t, key, hash)) == -1)
+      return false;
+  }
+  
+  if (value)
+    *value = t->entries[i].value;
+  _table_removeat(t, (size_t)i);
+  
+  if (self->old.count)
+    _migrate(self, MIGRATE_STEP);
+  else if (self->old.entries)
+    _table_free(&self->old);
+  
+  return true;
+}
+
+
+nt_hashmap_entry_t *nt_hashmap_next(nt_hashmap_t *self, size_t *iter) {
+  size_t i = *iter;
+  
+  for (; i < self->tab.size; i++) {
+    if (self->tab.entries[i].dist) {
+      *iter = i + 1;
+      return &self->tab.entries[i];
+    }
+  }
+  for (; i < self->tab.size + self->old.size; i++) {
+    nt_hashmap_entry_t *e = &self->old.entries[i - self->tab.size];
+    if (e->dist) {
+      *iter = i + 1;
+      return e;
+    }
+  }
+  
+  *iter = i;
+  return NULL;
+}
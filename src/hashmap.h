@@ -0,0 +1,147 @@
+/**
+  Open-addressing hash map.
+  
+  Robin Hood hashing with backward-shift deletion, in one flat array of
+  entries allocated with nt_malloc. The hash of each key is kept in its
+  entry so probing rarely calls the key comparison function and resizing
+  never rehashes keys.
+  
+  Resizing is incremental: when the table grows, a new table twice the size
+  is allocated and every following operation moves a few entries from the
+  old table to the new one. No single call pays for a full rehash.
+  
+  Keys and values are pointers which are stored as-is -- the map does not
+  copy or retain what they point to. Integer keys are stored directly in the
+  pointer (see NT_HASHMAP_INTKEY).
+  
+  Example:
+  
+    nt_hashmap_t *conns = nt_hashmap_new(&nt_hashmap_intkeys, 0);
+    nt_hashmap_put(conns, NT_HASHMAP_INTKEY(fd), conn);
+    conn = nt_hashmap_get(conns, NT_HASHMAP_INTKEY(fd));
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_HASHMAP_H_
+#define _NT_HASHMAP_H_
+
+#include "obj.h"
+
+/**
+  Key type operations.
+**/
+typedef struct nt_hashmap_keyops_t {
+  uint32_t (*hash)(const void *key);
+  bool (*equal)(const void *a, const void *b);
+} nt_hashmap_keyops_t;
+
+/* Integer keys stored in the key pointer. Use NT_HASHMAP_INTKEY */
+extern const nt_hashmap_keyops_t nt_hashmap_intkeys;
+/* Keys are const nt_sockaddr_t * (AF_INET and AF_INET6) */
+extern const nt_hashmap_keyops_t nt_hashmap_sockaddrkeys;
+/* Keys are const nt_buffer_t *. Compared by content */
+extern const nt_hashmap_keyops_t nt_hashmap_bufferkeys;
+/* Keys are NUL-terminated C strings */
+extern const nt_hashmap_keyops_t nt_hashmap_cstrkeys;
+
+#define NT_HASHMAP_INTKEY(i)  ((const void *)(uintptr_t)(i))
+
+typedef struct nt_hashmap_entry_t {
+  const void *key;
+  void *value;
+  uint32_t hash;
+  uint32_t dist;  /* probe distance + 1. 0 means the slot is empty */
+} nt_hashmap_entry_t;
+
+typedef struct nt_hashmap_table_t {
+  nt_hashmap_entry_t *entries;
+  size_t size;    /* number of slots, a power of two */
+  size_t count;   /* number of occupied slots */
+} nt_hashmap_table_t;
+
+typedef struct nt_hashmap_t {
+  NT_OBJ_HEAD
+  const nt_hashmap_keyops_t *keyops;
+  nt_hashmap_table_t tab;     /* current table */
+  nt_hashmap_table_t old;     /* table being migrated from, or empty */
+  size_t migratepos;          /* next slot in old to migrate */
+} nt_hashmap_t;
+
+/**
+  Create a new hash map.
+  
+  @param keyops   key operations, e.g. &nt_hashmap_intkeys.
+  @param capacity number of entries to make room for, or 0 for a default.
+**/
+nt_hashmap_t *nt_hashmap_new(const nt_hashmap_keyops_t *keyops, size_t capacity);
+
+#define nt_hashmap_count(self) ((self)->tab.count + (self)->old.count)
+
+/**
+  Find the entry for @key.
+  
+  @returns the entry or NULL if not found. The entry is valid until the map
+           is modified.
+**/
+nt_hashmap_entry_t *nt_hashmap_find(nt_hashmap_t *self, const void *key);
+
+/**
+  @returns the value for @key or NULL if not found.
+**/
+NT_STATIC_INLINE void *nt_hashmap_get(nt_hashmap_t *self, const void *key) {
+  nt_hashmap_entry_t *e = nt_hashmap_find(self, key);
+  return e ? e->value : NULL;
+}
+
+/**
+  Associate @value with @key, replacing any current value.
+  
+  @returns false if memory is exhausted.
+**/
+bool nt_hashmap_put(nt_hashmap_t *self, const void *key, void *value);
+
+/**
+  Remove @key.
+  
+  @param value if not NULL, set to the removed value.
+  @returns false if @key was not found.
+**/
+bool nt_hashmap_remove(nt_hashmap_t *self, const void *key, void **value);
+
+/**
+  Iterate over all entries.
+  
+    size_t iter = 0;
+    nt_hashmap_entry_t *e;
+    while ((e = nt_hashmap_next(map, &iter)))
+      ...
+  
+  The map must not be modified during iteration.
+**/
+nt_hashmap_entry_t *nt_hashmap_next(nt_hashmap_t *self, size_t *iter);
+
+/**
+  Hash functions, for use by custom key operations.
+**/
+uint32_t nt_hash_u64(uint64_t v);
+uint32_t nt_hash_bytes(const void *data, size_t length);
+
+#endif
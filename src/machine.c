@@ -20,11 +20,14 @@
   THE SOFTWARE.
 */
 #include "machine.h"
-#include <sys/sysctl.h>
 #include <err.h>
 
+#include <time.h>
+
 #ifdef __APPLE__
+#include <sys/sysctl.h>
 #include <mach/machine.h>
+#include <mach/mach_time.h>
 #endif
 
 int nt_machine_ncpu(int *fake64) {
@@ -44,6 +47,9 @@ int nt_machine_ncpu(int *fake64) {
       return -1;
     }
     *fake64 = (cputype == CPU_TYPE_POWERPC) && (cpusubtype == CPU_SUBTYPE_POWERPC_970) ? 1 : 0;
+  #elif defined(_SC_NPROCESSORS_ONLN)
+    if ((ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+      return -1;
   #else
     /* todo: other systems */
     #warning Unsupported system -- defaulting to 32-bit mp
@@ -51,4 +57,20 @@ int nt_machine_ncpu(int *fake64) {
   #endif
   
   return ncpu;
-}
\ No newline at end of file
+}
+
+
+uint64_t nt_machine_msec(void) {
+  #if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+  #elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+      AZ(mach_timebase_info(&timebase));
+    return mach_absolute_time() * timebase.numer / timebase.denom / 1000000;
+  #else
+    #error No monotonic clock
+  #endif
+}
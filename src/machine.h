@@ -31,4 +31,10 @@
 */
 int nt_machine_ncpu(int *fake64);
 
+/**
+  Milliseconds on a monotonic clock, which is not affected by changes to
+  the wall clock. Only differences between values are meaningful.
+*/
+uint64_t nt_machine_msec(void);
+
 #endif
@@ -1615,6 +1615,171 @@ void  *nt_mpool_resize(nt_mpool_t *mp_p, void *old_addr,
   return new_addr;
 }
 
+/*
+ * void *nt_mpool_alloc_mirrored
+ *
+ * DESCRIPTION:
+ *
+ * Allocate a region of pages which is mapped twice, back to back.
+ *
+ * RETURNS:
+ *
+ * Success - Pointer to the first of the two views.
+ *
+ * Failure - NULL
+ *
+ * ARGUMENTS:
+ *
+ * mp_p <-> Pointer to the memory pool.  If NULL then the system
+ * page-size is used and nothing is accounted.
+ *
+ * size_p <-> Pointer to the number of bytes wanted.  Will be rounded
+ * up to a multiple of the page-size.
+ *
+ * error_p <- Pointer to integer which, if not NULL, will be set with
+ * a mpool error code.
+ */
+void  *nt_mpool_alloc_mirrored(nt_mpool_t *mp_p, size_t *size_p,
+         int *error_p)
+{
+  static volatile int32_t  seq = 0;
+  unsigned int  page_size, page_n = 0;
+  size_t  size;
+  char    *mem;
+  int    fd;
+  
+  if (size_p == NULL || *size_p == 0) {
+    SET_POINTER(error_p, NT_MPOOL_ERROR_ARG_INVALID);
+    return NULL;
+  }
+  
+  if (mp_p == NULL) {
+    page_size = (unsigned int)getpagesize();
+  }
+  else {
+    if (mp_p->mp_magic != NT_MPOOL_MAGIC) {
+      SET_POINTER(error_p, NT_MPOOL_ERROR_PNT);
+      return NULL;
+    }
+    if (mp_p->mp_magic2 != NT_MPOOL_MAGIC) {
+      SET_POINTER(error_p, NT_MPOOL_ERROR_POOL_OVER);
+      return NULL;
+    }
+    page_size = mp_p->mp_page_size;
+  }
+  
+  size = ((*size_p + page_size - 1) / page_size) * page_size;
+  
+  if (mp_p != NULL) {
+    page_n = (unsigned int)((size / page_size) * 2);
+    LOCK_POOL(mp_p);
+    if (mp_p->mp_max_pages > 0 && mp_p->mp_page_c + page_n > mp_p->mp_max_pages) {
+      UNLOCK_POOL(mp_p);
+      SET_POINTER(error_p, NT_MPOOL_ERROR_NO_PAGES);
+      return NULL;
+    }
+    mp_p->mp_page_c += page_n;
+    UNLOCK_POOL(mp_p);
+  }
+  
+  /* shared memory object backing both views */
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  (void)seq;
+  fd = memfd_create("nt_mpool_mirrored", MFD_CLOEXEC);
+#else
+  {
+    char  name[48];
+    snprintf(name, sizeof(name), "/nt_mpool_mirrored.%d.%d", (int)getpid(),
+             (int)nt_atomic_fetch_and_add32(&seq, 1));
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) != -1) {
+      (void)shm_unlink(name);
+    }
+  }
+#endif
+  if (fd == -1) {
+    SET_POINTER(error_p, NT_MPOOL_ERROR_MMAP);
+    goto fail;
+  }
+  if (ftruncate(fd, (off_t)size) != 0) {
+    SET_POINTER(error_p, NT_MPOOL_ERROR_NO_MEM);
+    goto fail_close;
+  }
+  
+  /* reserve address space for both views, then map the object twice */
+  mem = (char *)mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == (char *)MAP_FAILED) {
+    SET_POINTER(error_p, NT_MPOOL_ERROR_NO_MEM);
+    goto fail_close;
+  }
+  if (mmap(mem, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+        == MAP_FAILED
+      || mmap(mem + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+        == MAP_FAILED)
+  {
+    (void)munmap(mem, size * 2);
+    SET_POINTER(error_p, NT_MPOOL_ERROR_MMAP);
+    goto fail_close;
+  }
+  
+  (void)close(fd);
+  *size_p = size;
+  SET_POINTER(error_p, NT_MPOOL_ERROR_NONE);
+  return mem;
+  
+ fail_close:
+  (void)close(fd);
+ fail:
+  if (mp_p != NULL) {
+    LOCK_POOL(mp_p);
+    mp_p->mp_page_c -= page_n;
+    UNLOCK_POOL(mp_p);
+  }
+  return NULL;
+}
+
+/*
+ * int nt_mpool_free_mirrored
+ *
+ * DESCRIPTION:
+ *
+ * Free pages allocated with nt_mpool_alloc_mirrored.
+ *
+ * RETURNS:
+ *
+ * Success - NT_MPOOL_ERROR_NONE
+ *
+ * Failure - Mpool error code
+ *
+ * ARGUMENTS:
+ *
+ * mp_p <-> Pointer to the memory pool.
+ *
+ * addr <-> Address returned by nt_mpool_alloc_mirrored.
+ *
+ * size -> Size (as set in size_p) of the allocation.
+ */
+int  nt_mpool_free_mirrored(nt_mpool_t *mp_p, void *addr, size_t size)
+{
+  if (addr == NULL) {
+    return NT_MPOOL_ERROR_ARG_NULL;
+  }
+  if (mp_p != NULL) {
+    if (mp_p->mp_magic != NT_MPOOL_MAGIC) {
+      return NT_MPOOL_ERROR_PNT;
+    }
+    if (mp_p->mp_magic2 != NT_MPOOL_MAGIC) {
+      return NT_MPOOL_ERROR_POOL_OVER;
+    }
+    LOCK_POOL(mp_p);
+    mp_p->mp_page_c -= (unsigned int)((size / mp_p->mp_page_size) * 2);
+    UNLOCK_POOL(mp_p);
+  }
+  if (munmap((caddr_t)addr, size * 2) != 0) {
+    return NT_MPOOL_ERROR_MMAP;
+  }
+  return NT_MPOOL_ERROR_NONE;
+}
+
 /*
  * int nt_mpool_stats
  *
@@ -334,6 +334,62 @@ void  *nt_mpool_resize(nt_mpool_t *mp_p, void *old_addr,
           size_t new_byte_size,
           int *error_p);
 
+/*
+ * void *nt_mpool_alloc_mirrored
+ *
+ * DESCRIPTION:
+ *
+ * Allocate a region of pages which is mapped twice, back to back, so
+ * that addr[i] and addr[i + size] refer to the same byte.  Used for
+ * ring buffers which never need to handle wrap-around.  The pages are
+ * accounted for (and limited by nt_mpool_set_max_pages) like other
+ * pages in the pool but are not used for regular allocations.
+ *
+ * RETURNS:
+ *
+ * Success - Pointer to the first of the two views.
+ *
+ * Failure - NULL
+ *
+ * ARGUMENTS:
+ *
+ * mp_p <-> Pointer to the memory pool.  If NULL then the system
+ * page-size is used and nothing is accounted.
+ *
+ * size_p <-> Pointer to the number of bytes wanted.  Will be rounded
+ * up to a multiple of the page-size.
+ *
+ * error_p <- Pointer to integer which, if not NULL, will be set with
+ * a mpool error code.
+ */
+extern
+void  *nt_mpool_alloc_mirrored(nt_mpool_t *mp_p, size_t *size_p,
+          int *error_p);
+
+/*
+ * int nt_mpool_free_mirrored
+ *
+ * DESCRIPTION:
+ *
+ * Free pages allocated with nt_mpool_alloc_mirrored.
+ *
+ * RETURNS:
+ *
+ * Success - NT_MPOOL_ERROR_NONE
+ *
+ * Failure - Mpool error code
+ *
+ * ARGUMENTS:
+ *
+ * mp_p <-> Pointer to the memory pool.
+ *
+ * addr <-> Address returned by nt_mpool_alloc_mirrored.
+ *
+ * size -> Size (as set in size_p) of the allocation.
+ */
+extern
+int  nt_mpool_free_mirrored(nt_mpool_t *mp_p, void *addr, size_t size);
+
 /*
  * int nt_mpool_stats
  *
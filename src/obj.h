@@ -40,7 +40,7 @@ typedef struct nt_obj_t {
   /* deallocator - pointer to the function that will clean up the object when
    *              the last reference to the object is released. Required.
    */
-  volatile nt_obj_deallocator *deallocator;
+  nt_obj_deallocator * volatile deallocator;
 } nt_obj_t;
 
 /* Convenience macros with type casting */
@@ -117,7 +117,7 @@ NT_STATIC_INLINE void nt_obj_init(nt_obj_t *obj, nt_obj_deallocator *deallocator
 #define NT_OBJ_INIT(obj, _deallocator) \
   do { \
     ((nt_obj_t *)(obj))->refcount = 1; \
-    ((nt_obj_t *)(obj))->deallocator = (volatile nt_obj_deallocator *)_deallocator; \
+    ((nt_obj_t *)(obj))->deallocator = (nt_obj_deallocator *)_deallocator; \
   } while(0)
 
 /**
@@ -185,7 +185,7 @@ NT_STATIC_INLINE void nt_obj_init(nt_obj_t *obj, nt_obj_deallocator *deallocator
   Clear an object without clearing the NT_OBJ_HEAD
 **/
 #define NT_OBJ_CLEAR(objptr, objtype) \
-  memset((objptr)+sizeof(nt_obj_t), 0, sizeof(objtype)-sizeof(nt_obj_t));
+  memset(((char *)(objptr))+sizeof(nt_obj_t), 0, sizeof(objtype)-sizeof(nt_obj_t));
 
 
 /**
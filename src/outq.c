@@ -0,0 +1,493 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "outq.h"
+#include "mpool.h"
+#include <fcntl.h>
+
+#ifdef __linux__
+  #include <sys/sendfile.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <linux/errqueue.h>
+  #define HAVE_SENDFILE 1
+  #define HAVE_SPLICE 1
+  #if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    #define HAVE_ZEROCOPY 1
+  #endif
+#elif defined(__APPLE__)
+  #include <sys/socket.h>
+  #define HAVE_SENDFILE 1
+#endif
+
+/* Max number of bytes moved by one sendfile or splice call */
+#define XFER_MAX 0x100000
+
+/* Buffer used for files where sendfile is not available */
+#define PREAD_BUFSIZE 0x4000
+
+
+static nt_outq_chunk_t *_push(nt_outq_t *self, int type) {
+  nt_outq_chunk_t *chunk;
+  if ((chunk = (nt_outq_chunk_t *)nt_malloc(sizeof(nt_outq_chunk_t))) == NULL)
+    return NULL;
+  chunk->next = NULL;
+  chunk->type = type;
+  chunk->data = NULL;
+  chunk->fd = -1;
+  chunk->offset = 0;
+  chunk->length = 0;
+  chunk->inpipe = 0;
+  chunk->cb = NULL;
+  chunk->arg = NULL;
+  if (self->tail)
+    self->tail->next = chunk;
+  else
+    self->head = chunk;
+  self->tail = chunk;
+  return chunk;
+}
+
+
+/* Remove the head chunk, then call its callback */
+static void _finish(nt_outq_t *self, int error) {
+  nt_outq_chunk_t *chunk = self->head;
+  if ((self->head = chunk->next) == NULL)
+    self->tail = NULL;
+  if (chunk->data)
+    nt_release(chunk->data);
+  if (chunk->cb)
+    chunk->cb(chunk->fd, error, chunk->arg);
+  nt_free(chunk, sizeof(nt_outq_chunk_t));
+}
+
+
+static void _closepipe(nt_outq_t *self) {
+  if (self->pipefd[0] != -1) {
+    close(self->pipefd[0]);
+    close(self->pipefd[1]);
+    self->pipefd[0] = self->pipefd[1] = -1;
+  }
+}
+
+
+static void _freezcref(nt_outq_zcref_t *ref) {
+  size_t i;
+  for (i = 0; i < ref->nsegs; i++)
+    nt_release(ref->segs[i]);
+  nt_free(ref, sizeof(nt_outq_zcref_t) + ref->size * sizeof(nt_bufseg_t *));
+}
+
+
+void nt_outq_init(nt_outq_t *self) {
+  self->head = self->tail = NULL;
+  self->pipefd[0] = self->pipefd[1] = -1;
+  self->zcthreshold = 0;
+  self->zcnext = 0;
+  self->zchead = self->zctail = NULL;
+  self->zccopied = 0;
+}
+
+
+void nt_outq_clear(nt_outq_t *self) {
+  nt_outq_zcref_t *ref;
+  while (self->head)
+    _finish(self, ECANCELED);
+  _closepipe(self);
+  while ((ref = self->zchead)) {
+    self->zchead = ref->next;
+    _freezcref(ref);
+  }
+  self->zctail = NULL;
+}
+
+
+size_t nt_outq_length(const nt_outq_t *self) {
+  const nt_outq_chunk_t *chunk;
+  size_t length = 0;
+  for (chunk = self->head; chunk; chunk = chunk->next) {
+    if (chunk->type == NT_OUTQ_DATA)
+      length += nt_bufchain_length(chunk->data);
+  }
+  return length;
+}
+
+
+/* The data chunk at the tail, or a new one */
+static nt_bufchain_t *_taildata(nt_outq_t *self) {
+  nt_outq_chunk_t *chunk = self->tail;
+  nt_bufchain_t *chain;
+  if (chunk && chunk->type == NT_OUTQ_DATA)
+    return chunk->data;
+  if ((chain = nt_bufchain_new(0)) == NULL)
+    return NULL;
+  if ((chunk = _push(self, NT_OUTQ_DATA)) == NULL) {
+    nt_release(chain);
+    return NULL;
+  }
+  /* an empty data chunk is simply skipped by nt_outq_flush */
+  return chunk->data = chain;
+}
+
+
+bool nt_outq_write(nt_outq_t *self, const void *data, size_t length) {
+  nt_bufchain_t *chain;
+  if ((chain = _taildata(self)) == NULL)
+    return false;
+  return nt_bufchain_append(chain, (const byte_t *)data, length);
+}
+
+
+bool nt_outq_appendchain(nt_outq_t *self, const nt_bufchain_t *chain) {
+  nt_bufchain_t *tail;
+  if ((tail = _taildata(self)) == NULL)
+    return false;
+  return nt_bufchain_appendchain(tail, chain);
+}
+
+
+bool nt_outq_appendseg(nt_outq_t *self, nt_bufseg_t *seg, size_t offset, size_t length) {
+  nt_bufchain_t *tail;
+  if ((tail = _taildata(self)) == NULL)
+    return false;
+  return nt_bufchain_appendseg(tail, seg, offset, length);
+}
+
+
+bool nt_outq_sendfile(nt_outq_t *self, int fd, off_t offset, size_t length,
+                      nt_outq_donecb_t cb, void *arg)
+{
+  nt_outq_chunk_t *chunk;
+  if ((chunk = _push(self, NT_OUTQ_FILE)) == NULL)
+    return false;
+  chunk->fd = fd;
+  chunk->offset = offset;
+  chunk->length = length;
+  chunk->cb = cb;
+  chunk->arg = arg;
+  return true;
+}
+
+
+bool nt_outq_splice(nt_outq_t *self, int fd, size_t length,
+                    nt_outq_donecb_t cb, void *arg)
+{
+#if HAVE_SPLICE
+  nt_outq_chunk_t *chunk;
+  if (self->pipefd[0] == -1 && pipe2(self->pipefd, O_NONBLOCK|O_CLOEXEC) == -1) {
+    self->pipefd[0] = self->pipefd[1] = -1;
+    return false;
+  }
+  if ((chunk = _push(self, NT_OUTQ_SPLICE)) == NULL)
+    return false;
+  chunk->fd = fd;
+  chunk->length = length;
+  chunk->cb = cb;
+  chunk->arg = arg;
+  return true;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+
+/* Send part of a file. Returns bytes sent, 0 at end of file or -1 */
+static ssize_t _sendfile(nt_outq_chunk_t *chunk, int fd) {
+  size_t want = (chunk->length < XFER_MAX) ? chunk->length : XFER_MAX;
+#if HAVE_SENDFILE && defined(__linux__)
+  return sendfile(fd, chunk->fd, &chunk->offset, want);
+#elif HAVE_SENDFILE
+  off_t len = (off_t)want;
+  if (sendfile(chunk->fd, fd, chunk->offset, &len, NULL, 0) == -1 && len == 0)
+    return -1;
+  chunk->offset += len;
+  return (ssize_t)len;
+#else
+  byte_t buf[PREAD_BUFSIZE];
+  ssize_t n;
+  if (want > sizeof(buf))
+    want = sizeof(buf);
+  if ((n = pread(chunk->fd, buf, want, chunk->offset)) <= 0)
+    return n;
+  /* a partial write simply re-reads the rest next time */
+  if ((n = write(fd, buf, (size_t)n)) > 0)
+    chunk->offset += n;
+  return n;
+#endif
+}
+
+
+#if HAVE_ZEROCOPY
+
+/* Max number of iovecs per zerocopy send */
+#define ZC_IOVMAX 64
+
+
+bool nt_outq_setzerocopy(nt_outq_t *self, int fd, size_t threshold) {
+  int one = 1;
+  if (threshold && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1)
+    return false;
+  self->zcthreshold = threshold;
+  return true;
+}
+
+
+/* Like nt_bufchain_writev, but retains the segments sent until completion */
+static ssize_t _sendzc(nt_outq_t *self, nt_bufchain_t *chain, int fd) {
+  struct iovec iov[ZC_IOVMAX];
+  struct msghdr msg;
+  nt_outq_zcref_t *ref;
+  nt_bufchain_link_t *link;
+  size_t left;
+  ssize_t n;
+  int iovcnt = nt_bufchain_iov(chain, iov, ZC_IOVMAX);
+  
+  ref = (nt_outq_zcref_t *)nt_malloc(sizeof(nt_outq_zcref_t) + iovcnt * sizeof(nt_bufseg_t *));
+  if (ref == NULL)
+    return nt_bufchain_writev(chain, fd);
+  memset((void *)&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  if ((n = sendmsg(fd, &msg, MSG_ZEROCOPY|MSG_NOSIGNAL)) <= 0) {
+    nt_free(ref, sizeof(nt_outq_zcref_t) + iovcnt * sizeof(nt_bufseg_t *));
+    /* ENOBUFS: out of memory for pinning pages -- copy this time */
+    return (n == -1 && errno == ENOBUFS) ? nt_bufchain_writev(chain, fd) : n;
+  }
+  
+  ref->next = NULL;
+  ref->seq = self->zcnext++;
+  ref->size = (size_t)iovcnt;
+  ref->nsegs = 0;
+  for (link = chain->head, left = (size_t)n; link && left; link = link->next) {
+    size_t linklen = link->end - link->start;
+    nt_retain(link->seg);
+    ref->segs[ref->nsegs++] = link->seg;
+    left -= (linklen < left) ? linklen : left;
+  }
+  if (self->zctail)
+    self->zctail->next = ref;
+  else
+    self->zchead = ref;
+  self->zctail = ref;
+  
+  nt_bufchain_consume(chain, (size_t)n);
+  return n;
+}
+
+
+/* Release sends with sequence numbers in [lo, hi] */
+static int _zcdone(nt_outq_t *self, uint32_t lo, uint32_t hi) {
+  nt_outq_zcref_t *ref, *prev = NULL, *next;
+  int count = 0;
+  for (ref = self->zchead; ref; ref = next) {
+    next = ref->next;
+    if (ref->seq - lo > hi - lo) {
+      prev = ref;
+      continue;
+    }
+    if (prev)
+      prev->next = next;
+    else
+      self->zchead = next;
+    if (self->zctail == ref)
+      self->zctail = prev;
+    _freezcref(ref);
+    count++;
+  }
+  return count;
+}
+
+
+int nt_outq_reapzerocopy(nt_outq_t *self, int fd) {
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  struct sock_extended_err *serr;
+  char control[128];
+  int count = 0;
+  
+  for (;;) {
+    memset((void *)&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+      if (errno == EINTR)
+        continue;
+      break; /* EAGAIN: drained */
+    }
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      serr = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        self->zccopied++;
+      count += _zcdone(self, serr->ee_info, serr->ee_data);
+    }
+  }
+  
+  return count;
+}
+
+#else
+
+bool nt_outq_setzerocopy(nt_outq_t *self, int fd, size_t threshold) {
+  if (threshold == 0)
+    return true;
+  errno = ENOSYS;
+  return false;
+}
+
+int nt_outq_reapzerocopy(nt_outq_t *self, int fd) {
+  return 0;
+}
+
+#endif /* HAVE_ZEROCOPY */
+
+
+#if HAVE_SPLICE
+
+/* Move a splice chunk forward. Returns an nt_outq_flush result or -1 */
+static int _splice(nt_outq_t *self, nt_outq_chunk_t *chunk, int fd, int *error) {
+  ssize_t n;
+  
+  /* the pipe is closed after a failed splice, since it might not be empty */
+  if (self->pipefd[0] == -1 && pipe2(self->pipefd, O_NONBLOCK|O_CLOEXEC) == -1) {
+    self->pipefd[0] = self->pipefd[1] = -1;
+    *error = errno;
+    return -1;
+  }
+  
+  for (;;) {
+    if (chunk->inpipe) {
+      n = splice(self->pipefd[0], NULL, fd, NULL, chunk->inpipe,
+                 SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        chunk->inpipe -= (size_t)n;
+        continue;
+      }
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return NT_OUTQ_WAITWRITE;
+      *error = (n == 0) ? EPIPE : errno;
+      return -1;
+    }
+    if (chunk->length == 0) {
+      *error = 0;
+      return NT_OUTQ_EMPTY;
+    }
+    /* the pipe is empty, so EAGAIN means the source is */
+    n = splice(chunk->fd, NULL, self->pipefd[1], NULL,
+               (chunk->length < XFER_MAX) ? chunk->length : XFER_MAX,
+               SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      chunk->inpipe = (size_t)n;
+      if (chunk->length != NT_OUTQ_UNTIL_EOF)
+        chunk->length -= (size_t)n;
+      continue;
+    }
+    if (n == 0) {
+      *error = (chunk->length == NT_OUTQ_UNTIL_EOF) ? 0 : EIO;
+      return *error ? -1 : NT_OUTQ_EMPTY;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return NT_OUTQ_WAITSOURCE;
+    *error = errno;
+    return -1;
+  }
+}
+
+#endif /* HAVE_SPLICE */
+
+
+static ssize_t _writedata(nt_outq_t *self, nt_bufchain_t *chain, int fd) {
+  #if HAVE_ZEROCOPY
+  if (self->zcthreshold && nt_bufchain_length(chain) >= self->zcthreshold)
+    return _sendzc(self, chain, fd);
+  #endif
+  return nt_bufchain_writev(chain, fd);
+}
+
+
+int nt_outq_flush(nt_outq_t *self, int fd) {
+  nt_outq_chunk_t *chunk;
+  ssize_t n;
+  int error;
+  
+  while ((chunk = self->head)) {
+    error = 0;
+    switch (chunk->type) {
+      
+      case NT_OUTQ_DATA:
+        while (nt_bufchain_length(chunk->data)) {
+          if ((n = _writedata(self, chunk->data, fd)) >= 0 || errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return NT_OUTQ_WAITWRITE;
+          return -1;
+        }
+        break;
+      
+      case NT_OUTQ_FILE:
+        while (chunk->length) {
+          if ((n = _sendfile(chunk, fd)) > 0) {
+            chunk->length -= (size_t)n;
+            continue;
+          }
+          if (n == 0) {
+            error = EIO; /* the file is shorter than promised */
+            break;
+          }
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return NT_OUTQ_WAITWRITE;
+          error = errno;
+          break;
+        }
+        break;
+      
+      #if HAVE_SPLICE
+      case NT_OUTQ_SPLICE: {
+        int r = _splice(self, chunk, fd, &error);
+        if (r > 0)
+          return r;
+        if (r == -1 && chunk->inpipe)
+          _closepipe(self);
+        break;
+      }
+      #endif
+    }
+    
+    _finish(self, error);
+    if (error) {
+      errno = error;
+      return -1;
+    }
+  }
+  
+  return NT_OUTQ_EMPTY;
+}
@@ -0,0 +1,195 @@
+/**
+  Ordered output queue of memory, file and socket-to-socket transfers.
+  
+  Chunks are written to a socket in the order they were queued:
+  
+  - data: bytes copied in with nt_outq_write or referenced with
+    nt_outq_appendchain and nt_outq_appendseg. Consecutive data is kept in
+    one nt_bufchain_t, where small copies share segments, and written with
+    one writev() for up to 256 pieces.
+  - file: a range of a file, sent with sendfile() without passing through
+    userspace.
+  - splice: bytes read from another socket, moved through a pipe with
+    splice() (Linux only).
+  
+  The queue does no event handling; nt_outq_flush writes until the socket
+  or a splice source would block and says which one to wait for.
+  nt_sockconn_sendfile and nt_sockconn_splice use it to order transfers
+  after buffered writes.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_OUTQ_H_
+#define _NT_OUTQ_H_
+
+#include "bufchain.h"
+#include <sys/types.h>
+
+/* Chunk types */
+#define NT_OUTQ_DATA    0
+#define NT_OUTQ_FILE    1
+#define NT_OUTQ_SPLICE  2
+
+/* Length of a splice which continues until the source reaches end of stream */
+#define NT_OUTQ_UNTIL_EOF ((size_t)-1)
+
+/* Results of nt_outq_flush */
+#define NT_OUTQ_EMPTY       0   /* everything was written */
+#define NT_OUTQ_WAITWRITE   1   /* wait for the socket to become writable */
+#define NT_OUTQ_WAITSOURCE  2   /* wait for nt_outq_sourcefd() to become readable */
+
+/**
+  Called when a file or splice chunk has been written, or failed.
+  
+  @param fd    the file or source socket of the chunk, now unused by the queue
+  @param error 0 on success, EIO if the source ended before the requested
+               length, ECANCELED if the queue was cleared, or an errno of
+               the failing read or write.
+**/
+typedef void (*nt_outq_donecb_t)(int fd, int error, void *arg);
+
+typedef struct nt_outq_chunk_t {
+  struct nt_outq_chunk_t *next;
+  int type;
+  nt_bufchain_t *data;        /* NT_OUTQ_DATA */
+  int fd;                     /* file or source socket */
+  off_t offset;               /* NT_OUTQ_FILE: next byte to send */
+  size_t length;              /* bytes left, or NT_OUTQ_UNTIL_EOF */
+  size_t inpipe;              /* NT_OUTQ_SPLICE: bytes in the pipe */
+  nt_outq_donecb_t cb;
+  void *arg;
+} nt_outq_chunk_t;
+
+/* Segments referenced by a MSG_ZEROCOPY send until the kernel is done with them */
+typedef struct nt_outq_zcref_t {
+  struct nt_outq_zcref_t *next;
+  uint32_t seq;               /* the send's zerocopy sequence number */
+  size_t size;                /* number of entries in segs */
+  size_t nsegs;               /* number of entries used */
+  nt_bufseg_t *segs[];        /* retained */
+} nt_outq_zcref_t;
+
+typedef struct nt_outq_t {
+  nt_outq_chunk_t *head;
+  nt_outq_chunk_t *tail;
+  int pipefd[2];              /* for splice, created on demand */
+  size_t zcthreshold;         /* see nt_outq_setzerocopy, 0 when disabled */
+  uint32_t zcnext;            /* sequence number of the next zerocopy send */
+  nt_outq_zcref_t *zchead;    /* sends not yet completed, oldest first */
+  nt_outq_zcref_t *zctail;
+  size_t zccopied;            /* completions where the kernel copied anyway */
+} nt_outq_t;
+
+/**
+  Initialize an empty queue.
+**/
+void nt_outq_init(nt_outq_t *self);
+
+/**
+  Drop all chunks, calling the callbacks of unfinished file and splice
+  chunks with ECANCELED, close the pipe and release segments waiting for
+  zerocopy completions.
+**/
+void nt_outq_clear(nt_outq_t *self);
+
+#define nt_outq_empty(self) ((self)->head == NULL)
+
+/**
+  Number of bytes held in data chunks -- the memory the queue keeps alive.
+  File and splice chunks are not counted. O(number of chunks).
+**/
+size_t nt_outq_length(const nt_outq_t *self);
+
+/* The splice source to wait for after NT_OUTQ_WAITSOURCE */
+#define nt_outq_sourcefd(self) ((self)->head->fd)
+
+/**
+  Queue a copy of @length bytes.
+**/
+bool nt_outq_write(nt_outq_t *self, const void *data, size_t length);
+
+/**
+  Queue the content of @chain without copying it. The chain is left as-is.
+**/
+bool nt_outq_appendchain(nt_outq_t *self, const nt_bufchain_t *chain);
+
+/**
+  Queue @length bytes of file @fd starting at @offset. The file must stay
+  open until @cb has been called.
+**/
+bool nt_outq_sendfile(nt_outq_t *self, int fd, off_t offset, size_t length,
+                      nt_outq_donecb_t cb, void *arg);
+
+/**
+  Queue @length bytes of @seg starting at @offset without copying them. The
+  segment is retained until the bytes have been written.
+**/
+bool nt_outq_appendseg(nt_outq_t *self, nt_bufseg_t *seg, size_t offset, size_t length);
+
+/**
+  Queue @length bytes (or NT_OUTQ_UNTIL_EOF) read from non-blocking socket
+  @fd. The socket must stay open until @cb has been called.
+  
+  @returns false with errno ENOSYS where splice() is not available
+**/
+bool nt_outq_splice(nt_outq_t *self, int fd, size_t length,
+                    nt_outq_donecb_t cb, void *arg);
+
+/**
+  Send queued data of at least @threshold bytes with MSG_ZEROCOPY, so that
+  the kernel transmits straight from the queued segments instead of copying
+  them into the socket buffer. The segments are retained until the kernel
+  reports completion on @fd's error queue, which must be drained with
+  nt_outq_reapzerocopy when @fd signals an error (POLLERR).
+  
+  Only worth it for large payloads -- completion handling costs more than
+  copying a few kilobytes. On loopback the kernel always copies (counted in
+  zccopied).
+  
+  @param fd        the TCP or UDP socket nt_outq_flush is going to write to
+  @param threshold minimum queued length, or 0 to disable
+  @returns false with errno set if the socket does not support SO_ZEROCOPY
+**/
+bool nt_outq_setzerocopy(nt_outq_t *self, int fd, size_t threshold);
+
+/* True while zerocopy sends wait for completion */
+#define nt_outq_zcpending(self) ((self)->zchead != NULL)
+
+/**
+  Handle zerocopy completions on @fd's error queue, releasing the segments
+  of completed sends.
+  
+  @returns number of completed sends
+**/
+int nt_outq_reapzerocopy(nt_outq_t *self, int fd);
+
+/**
+  Write queued chunks to non-blocking socket @fd until the queue is empty
+  or something would block.
+  
+  @returns NT_OUTQ_EMPTY, NT_OUTQ_WAITWRITE, NT_OUTQ_WAITSOURCE, or -1 with
+           errno set when writing to @fd failed or a chunk could not be
+           completed (after its callback was called). The stream is then
+           incomplete and the connection should be closed.
+**/
+int nt_outq_flush(nt_outq_t *self, int fd);
+
+#endif
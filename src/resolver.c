@@ -0,0 +1,710 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "resolver.h"
+#include "mpool.h"
+#include "machine.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <strings.h>
+#include <stdio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <ctype.h>
+
+#define DNS_PORT      53
+#define DNS_MAXNAME   255
+#define DNS_MAXPACKET 512   /* UDP, without EDNS */
+#define DNS_HEADER    12
+#define DNS_CLASS_IN  1
+#define DNS_TYPE_A    1
+#define DNS_TYPE_AAAA 28
+#define DNS_RCODE_NXDOMAIN 3
+
+/* Answers are not cached for longer than this many seconds */
+#define MAXTTL 86400
+
+/* Cached names looked at for eviction when the cache is full */
+#define EVICTSCAN 8
+
+/* A lookup in progress, delivered with nt_runloop_post */
+typedef struct nt_resolver_waiter_t {
+  struct nt_resolver_waiter_t *next;
+  nt_runloop_t *runloop;
+  nt_resolver_cb_t cb;
+  void *arg;
+  int port;
+  int family;
+  int error;
+  size_t naddrs;
+  nt_sockaddr_t addrs[NT_RESOLVER_MAXADDRS];
+} nt_resolver_waiter_t;
+
+/* A cached name, which is queued while it is being looked up */
+typedef struct nt_resolver_entry_t {
+  char name[DNS_MAXNAME + 1];   /* key, lower case */
+  struct nt_resolver_entry_t *nextjob;
+  struct nt_resolver_entry_t *lruprev;
+  struct nt_resolver_entry_t *lrunext;
+  nt_resolver_waiter_t *waiters;
+  bool pending;
+  int error;
+  size_t naddrs;
+  nt_sockaddr_t addrs[NT_RESOLVER_MAXADDRS];  /* without port */
+  uint64_t expires;             /* msec */
+} nt_resolver_entry_t;
+
+/* Result of a lookup on a resolver thread */
+typedef struct _result_t {
+  int error;
+  size_t naddrs;
+  nt_sockaddr_t addrs[NT_RESOLVER_MAXADDRS];
+  uint32_t ttl;
+} _result_t;
+
+
+/* Current time in milliseconds, from a monotonic clock */
+#define _msec() nt_machine_msec()
+
+
+/* Parse a numeric IPv4 or IPv6 address into @sa (port 0) */
+static bool _parseaddr(const char *s, nt_sockaddr_t *sa) {
+  struct sockaddr_in *in = (struct sockaddr_in *)sa;
+  struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)sa;
+  memset((void *)sa, 0, sizeof(nt_sockaddr_t));
+  if (inet_pton(AF_INET, s, &in->sin_addr) == 1) {
+    in->sin_family = AF_INET;
+    return true;
+  }
+  if (inet_pton(AF_INET6, s, &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    return true;
+  }
+  return false;
+}
+
+
+static void _setport(nt_sockaddr_t *sa, int port) {
+  if (sa->ss_family == AF_INET6)
+    ((struct sockaddr_in6 *)sa)->sin6_port = htons((uint16_t)port);
+  else
+    ((struct sockaddr_in *)sa)->sin_port = htons((uint16_t)port);
+}
+
+
+/* Add @sa to @r unless it is full or already there */
+static void _addaddr(_result_t *r, const nt_sockaddr_t *sa) {
+  size_t i;
+  if (r->naddrs == NT_RESOLVER_MAXADDRS)
+    return;
+  for (i = 0; i < r->naddrs; i++) {
+    if (memcmp((const void *)&r->addrs[i], (const void *)sa, sizeof(nt_sockaddr_t)) == 0)
+      return;
+  }
+  memcpy((void *)&r->addrs[r->naddrs++], (const void *)sa, sizeof(nt_sockaddr_t));
+}
+
+
+/* ----- hosts file ----- */
+
+static void _hostslookup(const char *path, const char *name, _result_t *r) {
+  char line[512], *p, *addr, *tok;
+  nt_sockaddr_t sa;
+  FILE *f;
+  
+  if (path[0] == '\0' || (f = fopen(path, "r")) == NULL)
+    return;
+  while (fgets(line, sizeof(line), f)) {
+    if ((p = strchr(line, '#')))
+      *p = '\0';
+    if ((addr = strtok_r(line, " \t\r\n", &p)) == NULL)
+      continue;
+    while ((tok = strtok_r(NULL, " \t\r\n", &p))) {
+      if (strcasecmp(tok, name) == 0) {
+        if (_parseaddr(addr, &sa))
+          _addaddr(r, &sa);
+        break;
+      }
+    }
+  }
+  fclose(f);
+}
+
+
+/* ----- DNS ----- */
+
+/* Write a query for @name to @buf. Returns its length, or 0 if @name is invalid. */
+static size_t _mkquery(byte_t *buf, uint16_t id, const char *name, uint16_t type) {
+  byte_t *p = buf + DNS_HEADER;
+  const char *label = name, *dot;
+  size_t len;
+  
+  memset((void *)buf, 0, DNS_HEADER);
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+  buf[2] = 0x01;                /* recursion desired */
+  buf[5] = 1;                   /* one question */
+  while (*label) {
+    dot = strchr(label, '.');
+    len = dot ? (size_t)(dot - label) : strlen(label);
+    if (len == 0 || len > 63)
+      return 0;
+    *p++ = (byte_t)len;
+    memcpy((void *)p, (const void *)label, len);
+    p += len;
+    label += len + (dot ? 1 : 0);
+  }
+  *p++ = 0;
+  *p++ = type >> 8;
+  *p++ = type & 0xff;
+  *p++ = 0;
+  *p++ = DNS_CLASS_IN;
+  return p - buf;
+}
+
+
+/* Offset after the (possibly compressed) name at @off, or 0 if malformed */
+static size_t _skipname(const byte_t *p, size_t len, size_t off) {
+  while (off < len) {
+    if ((p[off] & 0xc0) == 0xc0)
+      return (off + 2 <= len) ? off + 2 : 0;
+    if (p[off] == 0)
+      return off + 1;
+    off += 1 + p[off];
+  }
+  return 0;
+}
+
+
+/**
+  Parse an answer to @query (of @qlen bytes) into @r.
+  
+  @returns the response code, -1 if the packet is not an answer to @query
+           and -2 if the answer is malformed
+**/
+static int _parse(const byte_t *p, size_t len, const byte_t *query, size_t qlen, _result_t *r) {
+  size_t off, i, ancount, rdlen;
+  uint16_t type, class;
+  uint32_t ttl;
+  nt_sockaddr_t sa;
+  
+  /* same id and question (names compared case-insensitively) */
+  if (len < qlen || p[0] != query[0] || p[1] != query[1] || !(p[2] & 0x80))
+    return -1;
+  if (p[4] != 0 || p[5] != 1)
+    return -1;
+  for (i = DNS_HEADER; i < qlen; i++) {
+    if (tolower(p[i]) != tolower(query[i]))
+      return -1;
+  }
+  
+  ancount = ((size_t)p[6] << 8) | p[7];
+  for (off = qlen; ancount--; off += 10 + rdlen) {
+    if ((off = _skipname(p, len, off)) == 0 || off + 10 > len)
+      return -2;
+    type = (p[off] << 8) | p[off + 1];
+    class = (p[off + 2] << 8) | p[off + 3];
+    ttl = ((uint32_t)p[off + 4] << 24) | ((uint32_t)p[off + 5] << 16) |
+          ((uint32_t)p[off + 6] << 8) | p[off + 7];
+    rdlen = ((size_t)p[off + 8] << 8) | p[off + 9];
+    if (off + 10 + rdlen > len)
+      return -2;
+    if (class != DNS_CLASS_IN)
+      continue;
+    /* records of other types, e.g. the CNAMEs leading here, are skipped */
+    memset((void *)&sa, 0, sizeof(sa));
+    if (type == DNS_TYPE_A && rdlen == 4) {
+      sa.ss_family = AF_INET;
+      memcpy((void *)&((struct sockaddr_in *)&sa)->sin_addr, (const void *)(p + off + 10), 4);
+    }
+    else if (type == DNS_TYPE_AAAA && rdlen == 16) {
+      sa.ss_family = AF_INET6;
+      memcpy((void *)&((struct sockaddr_in6 *)&sa)->sin6_addr, (const void *)(p + off + 10), 16);
+    }
+    else {
+      continue;
+    }
+    _addaddr(r, &sa);
+    if (ttl < r->ttl)
+      r->ttl = ttl;
+  }
+  return p[3] & 0x0f;
+}
+
+
+/**
+  Send A and AAAA queries for @name to @ns and wait up to @timeout msec for
+  the answers.
+  
+  @returns true if the server answered (r->error is 0 or ENOENT), false to
+           try another server (r->error is ETIMEDOUT or EIO)
+**/
+static bool _query(const nt_sockaddr_t *ns, const char *name, unsigned int timeout,
+                   unsigned int *seed, _result_t *r)
+{
+  byte_t query[2][DNS_HEADER + DNS_MAXNAME + 6], buf[DNS_MAXPACKET];
+  size_t qlen[2];
+  int i, fd, rcode[2] = {-1, -1};
+  uint64_t deadline = _msec() + timeout, now;
+  struct pollfd pfd;
+  ssize_t n;
+  
+  qlen[0] = _mkquery(query[0], (uint16_t)rand_r(seed), name, DNS_TYPE_A);
+  qlen[1] = _mkquery(query[1], (uint16_t)rand_r(seed), name, DNS_TYPE_AAAA);
+  if (qlen[0] == 0) {
+    r->error = ENOENT;
+    return true;
+  }
+  
+  r->error = EIO;
+  if ((fd = socket(ns->ss_family, SOCK_DGRAM, 0)) == -1)
+    return false;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  /* connected, so that only the server's answers are received */
+  if (connect(fd, (const struct sockaddr *)ns, nt_sockaddr_len(ns)) == -1 ||
+      send(fd, query[0], qlen[0], 0) == -1 || send(fd, query[1], qlen[1], 0) == -1) {
+    close(fd);
+    return false;
+  }
+  
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while ((rcode[0] == -1 || rcode[1] == -1) && (now = _msec()) < deadline) {
+    if (poll(&pfd, 1, (int)(deadline - now)) <= 0)
+      continue;
+    if ((n = recv(fd, buf, sizeof(buf), 0)) == -1 && errno != EINTR)
+      break;  /* e.g. ECONNREFUSED: nothing listens on the port */
+    if (n <= 0)
+      continue;
+    for (i = 0; i < 2; i++) {
+      if (rcode[i] == -1 && (rcode[i] = _parse(buf, (size_t)n, query[i], qlen[i], r)) != -1)
+        break;
+    }
+  }
+  close(fd);
+  
+  if (r->naddrs) {
+    /* a missing AAAA answer only costs the IPv6 addresses */
+    r->error = 0;
+    return true;
+  }
+  if (rcode[0] == DNS_RCODE_NXDOMAIN || rcode[1] == DNS_RCODE_NXDOMAIN ||
+      (rcode[0] == 0 && rcode[1] == 0)) {
+    r->error = ENOENT;
+    return true;
+  }
+  r->error = (rcode[0] == -1 && rcode[1] == -1) ? ETIMEDOUT : EIO;
+  return false;
+}
+
+
+/**
+  Look up @name in the hosts file, then with the name servers.
+  
+  @returns true if the name servers were asked
+**/
+static bool _lookup(nt_resolver_t *self, const char *name, unsigned int *seed, _result_t *r) {
+  nt_sockaddr_t ns[NT_RESOLVER_MAXNS];
+  size_t i, nns;
+  unsigned int timeout, attempts, attempt;
+  char hostspath[sizeof(self->hostspath)];
+  
+  AZ(pthread_mutex_lock(&self->lock));
+  memcpy((void *)ns, (const void *)self->ns, sizeof(ns));
+  nns = self->nns;
+  timeout = self->timeout;
+  attempts = self->attempts;
+  memcpy((void *)hostspath, (const void *)self->hostspath, sizeof(hostspath));
+  AZ(pthread_mutex_unlock(&self->lock));
+  
+  r->naddrs = 0;
+  _hostslookup(hostspath, name, r);
+  if (r->naddrs) {
+    r->error = 0;
+    r->ttl = NT_RESOLVER_HOSTSTTL;
+    return false;
+  }
+  
+  r->ttl = MAXTTL;
+  r->error = ETIMEDOUT;
+  for (attempt = 0; attempt < attempts; attempt++) {
+    for (i = 0; i < nns; i++) {
+      if (_query(&ns[i], name, timeout, seed, r))
+        goto done;
+    }
+  }
+done:
+  if (r->error)
+    r->ttl = NT_RESOLVER_NEGTTL;
+  return true;
+}
+
+
+/* ----- cache ----- */
+
+/* The part of @e's answer matching @w's family, with @w's port */
+static void _answer(const nt_resolver_entry_t *e, nt_resolver_waiter_t *w) {
+  size_t i;
+  w->naddrs = 0;
+  w->error = e->error;
+  for (i = 0; i < e->naddrs; i++) {
+    if (w->family != AF_UNSPEC && e->addrs[i].ss_family != w->family)
+      continue;
+    memcpy((void *)&w->addrs[w->naddrs], (const void *)&e->addrs[i], sizeof(nt_sockaddr_t));
+    _setport(&w->addrs[w->naddrs++], w->port);
+  }
+  if (w->error == 0 && w->naddrs == 0)
+    w->error = ENOENT;
+}
+
+
+static void _freeentry(nt_resolver_entry_t *e) {
+  nt_resolver_waiter_t *w;
+  while ((w = e->waiters)) {
+    e->waiters = w->next;
+    nt_free(w, sizeof(nt_resolver_waiter_t));
+  }
+  nt_free(e, sizeof(nt_resolver_entry_t));
+}
+
+
+/* Cached names are kept most recently used first. Called with the lock held. */
+static void _lrupush(nt_resolver_t *self, nt_resolver_entry_t *e) {
+  e->lruprev = NULL;
+  if ((e->lrunext = self->lruhead))
+    e->lrunext->lruprev = e;
+  else
+    self->lrutail = e;
+  self->lruhead = e;
+}
+
+
+static void _lruunlink(nt_resolver_t *self, nt_resolver_entry_t *e) {
+  if (e->lruprev)
+    e->lruprev->lrunext = e->lrunext;
+  else
+    self->lruhead = e->lrunext;
+  if (e->lrunext)
+    e->lrunext->lruprev = e->lruprev;
+  else
+    self->lrutail = e->lruprev;
+  e->lruprev = e->lrunext = NULL;
+}
+
+
+static void _drop(nt_resolver_t *self, nt_resolver_entry_t *e) {
+  AN(nt_hashmap_remove(self->cache, e->name, NULL));
+  _lruunlink(self, e);
+  _freeentry(e);
+}
+
+
+/**
+  Make room for one more name by dropping the least recently used ones.
+  Names being looked up are kept, and at most EVICTSCAN names are looked
+  at, so a cache full of pending lookups may grow past maxentries.
+  Called with the lock held.
+**/
+static void _evict(nt_resolver_t *self) {
+  nt_resolver_entry_t *e, *prev;
+  size_t n;
+  for (e = self->lrutail, n = 0;
+       e && n < EVICTSCAN && nt_hashmap_count(self->cache) >= self->maxentries;
+       e = prev, n++)
+  {
+    prev = e->lruprev;
+    if (!e->pending)
+      _drop(self, e);
+  }
+}
+
+
+/* Drop all cached names except those being looked up. Called with the lock held. */
+static void _purge(nt_resolver_t *self) {
+  nt_resolver_entry_t *e, *next;
+  for (e = self->lruhead; e; e = next) {
+    next = e->lrunext;
+    if (!e->pending)
+      _drop(self, e);
+  }
+}
+
+
+/* ----- threads ----- */
+
+static void _deliver(nt_runloop_t *runloop, nt_resolver_waiter_t *w) {
+  /* dropped if the runloop went away first */
+  if (runloop)
+    w->cb(w->addrs, w->naddrs, w->error, w->arg);
+  nt_free(w, sizeof(nt_resolver_waiter_t));
+}
+
+
+static void *_threadmain(nt_resolver_t *self) {
+  nt_resolver_entry_t *e;
+  nt_resolver_waiter_t *w, *next;
+  unsigned int seed = (unsigned int)_msec() ^ (unsigned int)(uintptr_t)&seed;
+  _result_t r;
+  bool asked;
+  
+  AZ(pthread_mutex_lock(&self->lock));
+  while (1) {
+    while (!self->stopping && self->queuehead == NULL)
+      AZ(pthread_cond_wait(&self->cond, &self->lock));
+    if (self->stopping)
+      break;
+    e = self->queuehead;
+    if ((self->queuehead = e->nextjob) == NULL)
+      self->queuetail = NULL;
+    AZ(pthread_mutex_unlock(&self->lock));
+    
+    asked = _lookup(self, e->name, &seed, &r);
+    
+    AZ(pthread_mutex_lock(&self->lock));
+    if (self->stopping)
+      break;  /* the answer is dropped along with the waiters */
+    if (asked)
+      self->nqueries++;
+    e->error = r.error;
+    e->naddrs = r.naddrs;
+    memcpy((void *)e->addrs, (const void *)r.addrs, r.naddrs * sizeof(nt_sockaddr_t));
+    e->expires = _msec() + (uint64_t)(r.ttl < MAXTTL ? r.ttl : MAXTTL) * 1000;
+    e->pending = false;
+    for (w = e->waiters; w; w = w->next)
+      _answer(e, w);
+    /* waiters were added last first */
+    for (w = NULL; e->waiters; e->waiters = next) {
+      next = e->waiters->next;
+      e->waiters->next = w;
+      w = e->waiters;
+    }
+    AZ(pthread_mutex_unlock(&self->lock));
+    for (; w; w = next) {
+      next = w->next;
+      AN(nt_runloop_post(w->runloop, (nt_runloop_postcb_t)&_deliver, w));
+    }
+    AZ(pthread_mutex_lock(&self->lock));
+  }
+  AZ(pthread_mutex_unlock(&self->lock));
+  return NULL;
+}
+
+
+/* Read name servers from /etc/resolv.conf */
+static void _readresolvconf(nt_resolver_t *self) {
+  char line[256], *p, *tok;
+  FILE *f;
+  
+  self->nns = 0;
+  if ((f = fopen("/etc/resolv.conf", "r"))) {
+    while (self->nns < NT_RESOLVER_MAXNS && fgets(line, sizeof(line), f)) {
+      if ((tok = strtok_r(line, " \t\r\n", &p)) == NULL || strcmp(tok, "nameserver") != 0)
+        continue;
+      if ((tok = strtok_r(NULL, " \t\r\n", &p)) && _parseaddr(tok, &self->ns[self->nns]))
+        _setport(&self->ns[self->nns++], DNS_PORT);
+    }
+    fclose(f);
+  }
+  if (self->nns == 0) {
+    _parseaddr("127.0.0.1", &self->ns[0]);
+    _setport(&self->ns[self->nns++], DNS_PORT);
+  }
+}
+
+
+static void _stop(nt_resolver_t *self) {
+  size_t i;
+  AZ(pthread_mutex_lock(&self->lock));
+  self->stopping = true;
+  AZ(pthread_cond_broadcast(&self->cond));
+  AZ(pthread_mutex_unlock(&self->lock));
+  for (i = 0; i < self->nthreads; i++)
+    AZ(pthread_join(self->threads[i], NULL));
+}
+
+
+static void _dealloc(nt_resolver_t *self) {
+  size_t n = self->nthreads;
+  _stop(self);
+  /* lookups still queued are dropped */
+  if (self->cache) {
+    nt_hashmap_entry_t *he;
+    size_t iter = 0;
+    while ((he = nt_hashmap_next(self->cache, &iter)))
+      _freeentry((nt_resolver_entry_t *)he->value);
+    nt_release(self->cache);
+  }
+  nt_free(self->threads, n * sizeof(pthread_t));
+  AZ(pthread_mutex_destroy(&self->lock));
+  AZ(pthread_cond_destroy(&self->cond));
+  nt_free(self, sizeof(nt_resolver_t));
+}
+
+
+nt_resolver_t *nt_resolver_new(size_t nthreads) {
+  size_t i;
+  NT_OBJ_ALLOC_INIT_self(nt_resolver_t, &_dealloc);
+  NT_OBJ_CLEAR(self, nt_resolver_t);
+  AZ(pthread_mutex_init(&self->lock, NULL));
+  AZ(pthread_cond_init(&self->cond, NULL));
+  self->timeout = 2000;
+  self->attempts = 2;
+  self->maxentries = NT_RESOLVER_MAXENTRIES;
+  strcpy(self->hostspath, "/etc/hosts");
+  _readresolvconf(self);
+  
+  nthreads = nthreads ? nthreads : 1;
+  if ((self->cache = nt_hashmap_new(&nt_hashmap_cstrkeys, 0)) == NULL ||
+      (self->threads = (pthread_t *)nt_malloc(nthreads * sizeof(pthread_t))) == NULL) {
+    nt_release(self);
+    return NULL;
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&self->threads[i], NULL, (void *(*)(void *))&_threadmain, (void *)self) != 0) {
+      self->nthreads = i;
+      nt_release(self);
+      return NULL;
+    }
+    self->nthreads = i + 1;
+  }
+  return self;
+}
+
+
+void nt_resolver_setnameservers(nt_resolver_t *self, const nt_sockaddr_t *addrs, size_t naddrs) {
+  size_t i;
+  AZ(pthread_mutex_lock(&self->lock));
+  self->nns = 0;
+  for (i = 0; i < naddrs && self->nns < NT_RESOLVER_MAXNS; i++) {
+    memcpy((void *)&self->ns[self->nns], (const void *)&addrs[i], sizeof(nt_sockaddr_t));
+    if (nt_sockaddr_port(&addrs[i]) == 0)
+      _setport(&self->ns[self->nns], DNS_PORT);
+    self->nns++;
+  }
+  AZ(pthread_mutex_unlock(&self->lock));
+}
+
+
+void nt_resolver_sethosts(nt_resolver_t *self, const char *path) {
+  AZ(pthread_mutex_lock(&self->lock));
+  if (path)
+    snprintf(self->hostspath, sizeof(self->hostspath), "%s", path);
+  else
+    self->hostspath[0] = '\0';
+  AZ(pthread_mutex_unlock(&self->lock));
+}
+
+
+bool nt_resolver_resolve(nt_resolver_t *self, nt_runloop_t *runloop, const char *host,
+                         int port, int family, nt_resolver_cb_t cb, void *arg)
+{
+  char name[DNS_MAXNAME + 1];
+  nt_resolver_entry_t *e;
+  nt_resolver_waiter_t *w, answer;
+  size_t i, len = strlen(host);
+  
+  answer.port = port;
+  answer.family = family;
+  
+  /* a numeric address */
+  if (_parseaddr(host, &answer.addrs[0])) {
+    answer.naddrs = (family == AF_UNSPEC || answer.addrs[0].ss_family == family) ? 1 : 0;
+    _setport(&answer.addrs[0], port);
+    cb(answer.addrs, answer.naddrs, answer.naddrs ? 0 : ENOENT, arg);
+    return true;
+  }
+  
+  /* names are case-insensitive and may end with a dot */
+  if (len && host[len - 1] == '.')
+    len--;
+  if (len == 0 || len > DNS_MAXNAME) {
+    cb(NULL, 0, ENOENT, arg);
+    return true;
+  }
+  for (i = 0; i < len; i++)
+    name[i] = tolower((unsigned char)host[i]);
+  name[len] = '\0';
+  
+  AZ(pthread_mutex_lock(&self->lock));
+  e = (nt_resolver_entry_t *)nt_hashmap_get(self->cache, name);
+  if (e && e != self->lruhead) {
+    _lruunlink(self, e);
+    _lrupush(self, e);
+  }
+  if (e && !e->pending && e->expires > _msec()) {
+    self->nhits++;
+    _answer(e, &answer);
+    AZ(pthread_mutex_unlock(&self->lock));
+    cb(answer.addrs, answer.naddrs, answer.error, arg);
+    return true;
+  }
+  
+  if ((w = (nt_resolver_waiter_t *)nt_malloc(sizeof(nt_resolver_waiter_t))) == NULL)
+    goto nomem;
+  w->runloop = runloop;
+  w->cb = cb;
+  w->arg = arg;
+  w->port = port;
+  w->family = family;
+  
+  if (e == NULL) {
+    if (nt_hashmap_count(self->cache) >= self->maxentries)
+      _evict(self);
+    if ((e = (nt_resolver_entry_t *)nt_malloc(sizeof(nt_resolver_entry_t))) == NULL) {
+      nt_free(w, sizeof(nt_resolver_waiter_t));
+      goto nomem;
+    }
+    memset((void *)e, 0, sizeof(nt_resolver_entry_t));
+    memcpy((void *)e->name, (const void *)name, len + 1);
+    if (!nt_hashmap_put(self->cache, e->name, e)) {
+      nt_free(e, sizeof(nt_resolver_entry_t));
+      nt_free(w, sizeof(nt_resolver_waiter_t));
+      goto nomem;
+    }
+    _lrupush(self, e);
+  }
+  w->next = e->waiters;
+  e->waiters = w;
+  if (!e->pending) {
+    e->pending = true;
+    e->nextjob = NULL;
+    if (self->queuetail)
+      self->queuetail->nextjob = e;
+    else
+      self->queuehead = e;
+    self->queuetail = e;
+    AZ(pthread_cond_signal(&self->cond));
+  }
+  AZ(pthread_mutex_unlock(&self->lock));
+  return true;
+
+nomem:
+  AZ(pthread_mutex_unlock(&self->lock));
+  return false;
+}
+
+
+void nt_resolver_flush(nt_resolver_t *self) {
+  AZ(pthread_mutex_lock(&self->lock));
+  _purge(self);
+  AZ(pthread_mutex_unlock(&self->lock));
+}
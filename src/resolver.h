@@ -0,0 +1,148 @@
+/**
+  Asynchronous host name resolution with a TTL-aware cache.
+  
+  Lookups run on a small pool of resolver threads and results are
+  delivered on the runloop which asked, through nt_runloop_post, so a slow
+  name server never stalls a runloop:
+  
+    static void on_resolved(const nt_sockaddr_t *addrs, size_t naddrs, int error, void *arg) {
+      if (error == 0)
+        nt_sockconn_connect(conn, runloop, addrs, naddrs, 5000, &on_connect, NULL);
+    }
+    
+    resolver = nt_resolver_new(2);
+    nt_runloop_enablepost(runloop);
+    nt_resolver_resolve(resolver, runloop, "example.com", 80, AF_UNSPEC, &on_resolved, NULL);
+  
+  Names are looked up in the hosts file first, then with A and AAAA
+  queries to the name servers in /etc/resolv.conf (sent together, over
+  UDP). Answers are cached for their TTL, failures for NT_RESOLVER_NEGTTL
+  seconds and hosts file entries for NT_RESOLVER_HOSTSTTL seconds. The
+  cache is shared by all runloops using the resolver, and concurrent
+  lookups of the same name share one query.
+  
+  This is a stub resolver for the common case -- it does not follow search
+  domains, retry truncated answers over TCP, or validate DNSSEC. Use
+  getaddrinfo (e.g. nt_sockutil_getaddrs) off the runloop for that.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_RESOLVER_H_
+#define _NT_RESOLVER_H_
+
+#include "obj.h"
+#include "runloop.h"
+#include "hashmap.h"
+#include "sockaddr.h"
+#include <pthread.h>
+
+/* Max number of addresses kept per name */
+#define NT_RESOLVER_MAXADDRS 16
+
+/* Max number of name servers */
+#define NT_RESOLVER_MAXNS 3
+
+/* Seconds failed lookups and hosts file entries are cached */
+#define NT_RESOLVER_NEGTTL   5
+#define NT_RESOLVER_HOSTSTTL 60
+
+/* Default max number of cached names. The least recently used are dropped first. */
+#define NT_RESOLVER_MAXENTRIES 10000
+
+/**
+  Called on the runloop which asked, or before nt_resolver_resolve returns
+  when the answer is cached. Not called if the runloop is stopped or
+  released before the answer gets to it.
+  
+  @param addrs  addresses with the port asked for. Valid during the call.
+  @param error  0, ENOENT if the name does not exist or has no addresses
+                of the family asked for, ETIMEDOUT if no name server
+                answered, or EIO for a server failure or bad answer
+**/
+typedef void (*nt_resolver_cb_t)(const nt_sockaddr_t *addrs, size_t naddrs, int error,
+                                 void *arg);
+
+struct nt_resolver_entry_t;
+
+typedef struct nt_resolver_t {
+  NT_OBJ_HEAD
+  pthread_t *threads;
+  size_t nthreads;
+  pthread_mutex_t lock;         /* protects everything below */
+  pthread_cond_t cond;          /* signals queued lookups */
+  bool stopping;
+  struct nt_resolver_entry_t *queuehead;  /* names to look up */
+  struct nt_resolver_entry_t *queuetail;
+  nt_hashmap_t *cache;          /* name -> nt_resolver_entry_t * */
+  struct nt_resolver_entry_t *lruhead;    /* cached names, most recently used first */
+  struct nt_resolver_entry_t *lrutail;
+  size_t maxentries;            /* cached names (NT_RESOLVER_MAXENTRIES) */
+  nt_sockaddr_t ns[NT_RESOLVER_MAXNS];    /* name servers */
+  size_t nns;
+  char hostspath[256];
+  unsigned int timeout;         /* msec to wait for an answer */
+  unsigned int attempts;        /* queries per name server */
+  uint64_t nhits;               /* lookups answered from the cache */
+  uint64_t nqueries;            /* lookups sent to name servers */
+} nt_resolver_t;
+
+/**
+  Create a resolver with @nthreads threads (1 if 0).
+  
+  Name servers are read from /etc/resolv.conf (127.0.0.1 if there are
+  none) and host names from /etc/hosts.
+  
+  @returns NULL if memory is exhausted or a thread could not be started
+**/
+nt_resolver_t *nt_resolver_new(size_t nthreads);
+
+/**
+  Use @addrs (port 0 means 53) instead of the name servers in
+  /etc/resolv.conf.
+**/
+void nt_resolver_setnameservers(nt_resolver_t *self, const nt_sockaddr_t *addrs, size_t naddrs);
+
+/**
+  Read host names from @path instead of /etc/hosts, or from nothing if
+  @path is NULL.
+**/
+void nt_resolver_sethosts(nt_resolver_t *self, const char *path);
+
+/**
+  Look up the addresses of @host.
+  
+  Numeric addresses and cached names are answered right away, before this
+  function returns. Otherwise @runloop must have been enabled with
+  nt_runloop_enablepost and must outlive the lookup. Lookups still going
+  on when the resolver is deallocated are dropped without a call.
+  
+  @param family AF_INET, AF_INET6 or AF_UNSPEC for both
+  @returns false if memory is exhausted
+**/
+bool nt_resolver_resolve(nt_resolver_t *self, nt_runloop_t *runloop, const char *host,
+                         int port, int family, nt_resolver_cb_t cb, void *arg);
+
+/**
+  Forget all cached names.
+**/
+void nt_resolver_flush(nt_resolver_t *self);
+
+#endif
@@ -0,0 +1,293 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "ringbuf.h"
+#include "mpool.h"
+
+#define MASK(self) (nt_ringbuf_size(self) - 1)
+
+/* Number of contiguous bytes following storage offset @off */
+#define CONTIG(self, off) \
+  (((self)->flags & NT_RINGBUF_F_MIRRORED) ? \
+    nt_ringbuf_size(self) : nt_ringbuf_size(self) - (off))
+
+
+static size_t _pow2(size_t v) {
+  size_t n = NT_ALIGN_M(1);
+  while (n < v)
+    n <<= 1;
+  return n;
+}
+
+
+NT_OBJ(nt_ringbuf_t, nt_ringbuf_new(size_t size),
+{/* constructor: */
+  size = _pow2(size);
+  if ( (self->start = (byte_t *)nt_malloc(size)) == NULL ) {
+    return NULL; // ENOMEM
+  }
+  self->end = self->start + size;
+  self->rpos = self->wpos = 0;
+  self->growmax = NT_BUFFER_GROW_MAX;
+  self->flags = 0;
+},
+{/* destructor: */
+  if (self->start) {
+    if (self->flags & NT_RINGBUF_F_MIRRORED)
+      nt_mpool_free_mirrored(nt_mpool_shared, self->start, nt_ringbuf_size(self));
+    else
+      nt_free(self->start, nt_ringbuf_size(self));
+  }
+})
+
+
+static byte_t *_allocmirrored(size_t *size) {
+  size_t want = *size;
+  byte_t *p = (byte_t *)nt_mpool_alloc_mirrored(nt_mpool_shared, size,
+                                                &nt_mpool_shared_errno);
+  if (p && *size != _pow2(*size)) {
+    /* pool page size is not a power of two -- cursors would not wrap */
+    nt_mpool_free_mirrored(nt_mpool_shared, p, *size);
+    *size = want;
+    return NULL;
+  }
+  return p;
+}
+
+
+nt_ringbuf_t *nt_ringbuf_newmirrored(size_t size) {
+  NT_OBJ_ALLOC_INIT_self(nt_ringbuf_t, &_dealloc_nt_ringbuf_t);
+  size = _pow2(size);
+  if ((self->start = _allocmirrored(&size)) == NULL) {
+    nt_free(self, sizeof(nt_ringbuf_t));
+    return NULL;
+  }
+  self->end = self->start + size;
+  self->rpos = self->wpos = 0;
+  self->growmax = NT_BUFFER_GROW_MAX;
+  self->flags = NT_RINGBUF_F_MIRRORED;
+  return self;
+}
+
+
+/* Copy content into @dst (of at least length bytes), unwrapped */
+static void _copyout(nt_ringbuf_t *self, byte_t *dst, size_t length) {
+  size_t off = self->rpos & MASK(self);
+  size_t first = CONTIG(self, off);
+  if (first >= length) {
+    memcpy(dst, self->start + off, length);
+  }
+  else {
+    memcpy(dst, self->start + off, first);
+    memcpy(dst + first, self->start, length - first);
+  }
+}
+
+
+bool nt_ringbuf_grow(nt_ringbuf_t *self, size_t length) {
+  byte_t *new_start;
+  size_t needed, new_size, occupied = nt_ringbuf_length(self);
+
+  if (length <= nt_ringbuf_available(self))
+    return true;
+
+  needed = occupied + length;
+  if (needed < length || (self->growmax && needed > self->growmax))
+    return false;
+
+  new_size = _pow2(needed);
+  if (self->flags & NT_RINGBUF_F_MIRRORED) {
+    if ((new_start = _allocmirrored(&new_size)) == NULL)
+      return false;
+    _copyout(self, new_start, occupied);
+    nt_mpool_free_mirrored(nt_mpool_shared, self->start, nt_ringbuf_size(self));
+  }
+  else {
+    if ((new_start = (byte_t *)nt_malloc(new_size)) == NULL)
+      return false;
+    _copyout(self, new_start, occupied);
+    nt_free(self->start, nt_ringbuf_size(self));
+  }
+
+  self->start = new_start;
+  self->end = new_start + new_size;
+  self->rpos = 0;
+  self->wpos = occupied;
+
+  return true;
+}
+
+
+bool nt_ringbuf_write(nt_ringbuf_t *self, const byte_t *what, size_t length) {
+  size_t off, first;
+
+  if (length > nt_ringbuf_available(self) && !nt_ringbuf_grow(self, length))
+    return false;
+
+  off = self->wpos & MASK(self);
+  first = CONTIG(self, off);
+  if (first >= length) {
+    memcpy(self->start + off, what, length);
+  }
+  else {
+    memcpy(self->start + off, what, first);
+    memcpy(self->start, what + first, length - first);
+  }
+  self->wpos += length;
+
+  return true;
+}
+
+
+size_t nt_ringbuf_read(nt_ringbuf_t *self, byte_t *dst, size_t length) {
+  if (length > nt_ringbuf_length(self))
+    length = nt_ringbuf_length(self);
+  _copyout(self, dst, length);
+  nt_ringbuf_consume(self, length);
+  return length;
+}
+
+
+const byte_t *nt_ringbuf_peek(nt_ringbuf_t *self, size_t *length) {
+  size_t off = self->rpos & MASK(self);
+  size_t first = CONTIG(self, off);
+  size_t occupied = nt_ringbuf_length(self);
+
+  *length = (occupied < first) ? occupied : first;
+  return *length ? self->start + off : NULL;
+}
+
+
+byte_t *nt_ringbuf_reserve(nt_ringbuf_t *self, size_t *length) {
+  size_t off = self->wpos & MASK(self);
+  size_t first = CONTIG(self, off);
+  size_t available = nt_ringbuf_available(self);
+
+  *length = (available < first) ? available : first;
+  return *length ? self->start + off : NULL;
+}
+
+
+const byte_t *nt_ringbuf_linearize(nt_ringbuf_t *self) {
+  size_t off, occupied;
+
+  /* the mirror mapping already shows wrapped content as contiguous */
+  if (self->flags & NT_RINGBUF_F_MIRRORED)
+    return nt_ringbuf_rptr(self);
+  off = self->rpos & MASK(self);
+  occupied = nt_ringbuf_length(self);
+  if (off + occupied > CONTIG(self, 0)) {
+    /* content wraps -- rotate it to the start of storage */
+    byte_t *tmp;
+    if ((tmp = (byte_t *)nt_malloc(occupied)) == NULL)
+      err(1, NULL);
+    _copyout(self, tmp, occupied);
+    memcpy(self->start, tmp, occupied);
+    nt_free(tmp, occupied);
+    self->rpos = 0;
+    self->wpos = occupied;
+  }
+
+  return nt_ringbuf_rptr(self);
+}
+
+
+void nt_ringbuf_view(nt_ringbuf_t *self, nt_buffer_t *view) {
+  assert(self->flags & NT_RINGBUF_F_MIRRORED);
+  NT_OBJ_INIT(view, NULL);
+  view->start = nt_ringbuf_rptr(self);
+  view->ptr = view->start + nt_ringbuf_length(self);
+  view->end = view->start + nt_ringbuf_size(self);
+  view->growextra = 0;
+  view->growmax = nt_ringbuf_size(self);
+  view->growfactor = 0;
+  view->growth = NT_BUFFER_GROW_LINEAR;
+  view->flags = 0;
+}
+
+
+int nt_ringbuf_readiov(nt_ringbuf_t *self, struct iovec iov[2]) {
+  size_t off = self->rpos & MASK(self);
+  size_t first = CONTIG(self, off);
+  size_t occupied = nt_ringbuf_length(self);
+
+  if (occupied == 0)
+    return 0;
+  iov[0].iov_base = (void *)(self->start + off);
+  if (occupied <= first) {
+    iov[0].iov_len = occupied;
+    return 1;
+  }
+  iov[0].iov_len = first;
+  iov[1].iov_base = (void *)self->start;
+  iov[1].iov_len = occupied - first;
+  return 2;
+}
+
+
+int nt_ringbuf_writeiov(nt_ringbuf_t *self, struct iovec iov[2]) {
+  size_t off = self->wpos & MASK(self);
+  size_t first = CONTIG(self, off);
+  size_t available = nt_ringbuf_available(self);
+
+  if (available == 0)
+    return 0;
+  iov[0].iov_base = (void *)(self->start + off);
+  if (available <= first) {
+    iov[0].iov_len = available;
+    return 1;
+  }
+  iov[0].iov_len = first;
+  iov[1].iov_base = (void *)self->start;
+  iov[1].iov_len = available - first;
+  return 2;
+}
+
+
+ssize_t nt_ringbuf_readfd(nt_ringbuf_t *self, int fd, size_t max) {
+  struct iovec iov[2];
+  ssize_t n;
+  int iovcnt;
+
+  if (max && !nt_ringbuf_grow(self, max))
+    return -1;
+  if ((iovcnt = nt_ringbuf_writeiov(self, iov)) == 0) {
+    /* not 0, which would read as end of file */
+    errno = ENOBUFS;
+    return -1;
+  }
+  if ((n = readv(fd, iov, iovcnt)) > 0)
+    self->wpos += (size_t)n;
+  return n;
+}
+
+
+ssize_t nt_ringbuf_writefd(nt_ringbuf_t *self, int fd) {
+  struct iovec iov[2];
+  ssize_t n;
+  int iovcnt;
+
+  if ((iovcnt = nt_ringbuf_readiov(self, iov)) == 0)
+    return 0;
+  if ((n = writev(fd, iov, iovcnt)) > 0)
+    nt_ringbuf_consume(self, (size_t)n);
+  return n;
+}
@@ -0,0 +1,207 @@
+/**
+  Ring buffer with O(1) consume from the front.
+
+  Bytes are appended at the write cursor and consumed from the read cursor.
+  Both cursors are free-running and the storage size is always a power of
+  two, so wrapping is a mask operation.
+
+  A mirrored ring buffer (nt_ringbuf_newmirrored) maps its storage twice,
+  back to back, so any window of up to nt_ringbuf_size() bytes starting at
+  either cursor is contiguous in memory. Peeks, reserves and iovec exports
+  then always cover everything, and the buffer can be handed to parsers and
+  recv()/send() as a single pointer (see nt_ringbuf_view).
+
+  Example (stream parsing):
+
+    nt_ringbuf_t *rb = nt_ringbuf_new(0x4000);
+    nt_ringbuf_readfd(rb, fd, 0);
+    while ((p = nt_ringbuf_peek(rb, &len)) && (n = parse(p, len)) > 0)
+      nt_ringbuf_consume(rb, n);
+
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_RINGBUF_H_
+#define _NT_RINGBUF_H_
+
+#include "obj.h"
+#include "buffer.h"
+#include <sys/uio.h>
+
+typedef struct nt_ringbuf_t {
+  NT_OBJ_HEAD
+  byte_t *start;  /* start address of storage */
+  byte_t *end;    /* end address of storage */
+  size_t rpos;    /* read cursor (free-running) */
+  size_t wpos;    /* write cursor (free-running) */
+  size_t growmax; /* never grow beyond this size. 0 means no limit */
+  uint8_t flags;  /* NT_RINGBUF_F_* */
+} nt_ringbuf_t;
+
+/* nt_ringbuf_t.flags */
+#define NT_RINGBUF_F_MIRRORED 0x1 /* storage is mapped twice in a row */
+
+/**
+  Create a new ring buffer.
+
+  @param size initial size, rounded up to the nearest power of two.
+**/
+nt_ringbuf_t *nt_ringbuf_new(size_t size);
+
+/**
+  Create a new mirrored ring buffer.
+
+  Storage is allocated with nt_mpool_alloc_mirrored from the shared pool.
+
+  @param size initial size, rounded up to the nearest power of two and at
+              least one page.
+  @returns NULL if the platform does not support the mapping.
+**/
+nt_ringbuf_t *nt_ringbuf_newmirrored(size_t size);
+
+#define nt_ringbuf_size(self)       ((size_t)((self)->end - (self)->start))
+#define nt_ringbuf_length(self)     ((self)->wpos - (self)->rpos)
+#define nt_ringbuf_available(self)  (nt_ringbuf_size(self) - nt_ringbuf_length(self))
+#define nt_ringbuf_rptr(self)       ((self)->start + ((self)->rpos & (nt_ringbuf_size(self)-1)))
+#define nt_ringbuf_wptr(self)       ((self)->start + ((self)->wpos & (nt_ringbuf_size(self)-1)))
+
+/**
+  Make room for at least @length more bytes.
+
+  Growing reallocates and unwraps the content.
+
+  @returns false if growing would exceed growmax or memory is exhausted.
+**/
+bool nt_ringbuf_grow(nt_ringbuf_t *self, size_t length);
+
+/**
+  Append @length bytes at the write cursor, growing if needed.
+**/
+bool nt_ringbuf_write(nt_ringbuf_t *self, const byte_t *what, size_t length);
+
+/**
+  Copy up to @length bytes from the read cursor into @dst and consume them.
+
+  @returns number of bytes copied.
+**/
+size_t nt_ringbuf_read(nt_ringbuf_t *self, byte_t *dst, size_t length);
+
+/**
+  Discard @n bytes from the front. O(1).
+**/
+NT_STATIC_INLINE void nt_ringbuf_consume(nt_ringbuf_t *self, size_t n) {
+  assert(n <= nt_ringbuf_length(self));
+  self->rpos += n;
+  /* rewind when empty so the next write is contiguous */
+  if (self->rpos == self->wpos)
+    self->rpos = self->wpos = 0;
+}
+
+/**
+  Contiguous view of the bytes at the front.
+
+  This might be less than nt_ringbuf_length() when the content wraps. Use
+  nt_ringbuf_linearize() to make everything contiguous.
+
+  @param length set to the number of bytes in the view.
+  @returns pointer to the first byte or NULL if the buffer is empty.
+**/
+const byte_t *nt_ringbuf_peek(nt_ringbuf_t *self, size_t *length);
+
+/**
+  Contiguous view of free space at the write cursor.
+
+  Write into the returned memory and then call nt_ringbuf_commit().
+
+  @param length set to the number of bytes available in the view.
+  @returns pointer to free space or NULL if the buffer is full.
+**/
+byte_t *nt_ringbuf_reserve(nt_ringbuf_t *self, size_t *length);
+
+/**
+  Mark @n bytes written to memory returned by nt_ringbuf_reserve() as used.
+**/
+NT_STATIC_INLINE void nt_ringbuf_commit(nt_ringbuf_t *self, size_t n) {
+  assert(n <= nt_ringbuf_available(self));
+  self->wpos += n;
+}
+
+/**
+  Present a mirrored ring buffer as a nt_buffer_t.
+
+  The view's start is the read cursor, ptr the write cursor and end is
+  start + nt_ringbuf_size(), so nt_buffer_indexof(), nt_buffer_append() and
+  friends work directly on the ring memory. The view never grows -- appends
+  which do not fit fail. Call nt_ringbuf_commitview() to apply bytes
+  appended through the view.
+
+  The view is not reference counted and must not be retained or released.
+  It is invalidated by any other operation on the ring buffer.
+**/
+void nt_ringbuf_view(nt_ringbuf_t *self, nt_buffer_t *view);
+
+/**
+  Commit bytes appended through a view created by nt_ringbuf_view().
+**/
+NT_STATIC_INLINE void nt_ringbuf_commitview(nt_ringbuf_t *self, const nt_buffer_t *view) {
+  assert(self->flags & NT_RINGBUF_F_MIRRORED);
+  assert(view->start == nt_ringbuf_rptr(self));
+  self->wpos = self->rpos + (size_t)(view->ptr - view->start);
+}
+
+/**
+  Move content so that all of it is contiguous.
+
+  @returns pointer to the first byte.
+**/
+const byte_t *nt_ringbuf_linearize(nt_ringbuf_t *self);
+
+/**
+  Describe the content as up to two iovecs, suitable for writev().
+
+  @returns number of iovecs set (0, 1 or 2).
+**/
+int nt_ringbuf_readiov(nt_ringbuf_t *self, struct iovec iov[2]);
+
+/**
+  Describe the free space as up to two iovecs, suitable for readv().
+
+  @returns number of iovecs set (0, 1 or 2).
+**/
+int nt_ringbuf_writeiov(nt_ringbuf_t *self, struct iovec iov[2]);
+
+/**
+  Read from @fd into free space with a single readv().
+
+  @param max grow to make room for this many bytes first. 0 to only use
+             space already available.
+  @returns see readv(). -1 with errno ENOBUFS if there is no free space
+           (the buffer is full and @max is 0).
+**/
+ssize_t nt_ringbuf_readfd(nt_ringbuf_t *self, int fd, size_t max);
+
+/**
+  Write content to @fd with a single writev() and consume what was written.
+
+  @returns see writev()
+**/
+ssize_t nt_ringbuf_writefd(nt_ringbuf_t *self, int fd);
+
+#endif
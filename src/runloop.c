@@ -25,6 +25,27 @@
 #include "atomic.h"
 #include "mpool.h"
 #include "sockserv.h"
+#include "machine.h"
+#include <pthread.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+  #include <sys/eventfd.h>
+  #include <sys/epoll.h>
+  #include <sched.h>
+  #define HAVE_EVENTFD 1
+  #define HAVE_EPOLL 1
+#elif defined(__APPLE__)
+  #include <mach/mach.h>
+  #include <mach/thread_policy.h>
+#endif
+
+/* A call posted with nt_runloop_post */
+typedef struct _call_t {
+  struct _call_t *next;
+  nt_runloop_postcb_t cb;
+  void *arg;
+} _call_t;
 
 static void _rmsockserv(nt_runloop_t *self, nt_sockserv_t *server) {
   if (server->ev4) {
@@ -40,17 +61,94 @@ static void _rmsockserv(nt_runloop_t *self, nt_sockserv_t *server) {
 }
 
 
+/* Current time in milliseconds, on a monotonic clock so that steps of the
+   wall clock do not fire or hold up timers */
+#define _msec() nt_machine_msec()
+
+#define _ticks() (_msec() / NT_RUNLOOP_TICK_MSEC)
+
+
+static void _timertick(int fd, short ev, nt_runloop_t *self);
+
+/* Schedule the next tick, if there are timers and it is not already scheduled */
+static void _armtimers(nt_runloop_t *self) {
+  struct timeval tv;
+  if (self->timerev_pending || self->timers.count == 0)
+    return;
+  /* wake up at the start of the next tick */
+  tv.tv_sec = 0;
+  tv.tv_usec = (NT_RUNLOOP_TICK_MSEC - _msec() % NT_RUNLOOP_TICK_MSEC) * 1000;
+  event_set(&self->timerev, -1, 0, (void (*)(int, short, void *))&_timertick, self);
+  AZ(event_base_set(self->ev_base, &self->timerev));
+  AZ(event_add(&self->timerev, &tv));
+  self->timerev_pending = true;
+}
+
+
+static void _timertick(int fd, short ev, nt_runloop_t *self) {
+  self->timerev_pending = false;
+  nt_timerwheel_advance(&self->timers, _ticks());
+  _armtimers(self);
+}
+
+
+void nt_runloop_addtimer(nt_runloop_t *self, nt_timer_t *timer, unsigned int msec) {
+  /* the wheel does not keep time while it is empty */
+  if (self->timers.count == 0)
+    nt_timerwheel_advance(&self->timers, _ticks());
+  nt_timerwheel_add(&self->timers, timer,
+                    (msec + NT_RUNLOOP_TICK_MSEC - 1) / NT_RUNLOOP_TICK_MSEC);
+  _armtimers(self);
+}
+
+
+static void _closewake(nt_runloop_t *self) {
+  if (self->wakeev) {
+    event_del(self->wakeev);
+    nt_free(self->wakeev, sizeof(struct event));
+    self->wakeev = NULL;
+  }
+  close(self->wakefd[0]);
+  if (self->wakefd[1] != self->wakefd[0])
+    close(self->wakefd[1]);
+  /* calls which never got to run */
+  nt_runloop_cancelposted(self);
+}
+
+
+static void _freeuring(nt_runloop_t *self) {
+  event_del(&self->uringev);
+  event_del(&self->flushev);
+  nt_uring_destroy(self->uring);
+  nt_free(self->uring, sizeof(nt_uring_t));
+  self->uring = NULL;
+}
+
+
 static void _dealloc(nt_runloop_t *self) {
   int i;
   
   assert(self->ev_base != NULL);
+  if (self->timerev_pending)
+    event_del(&self->timerev);
+  if (self->wakeev)
+    _closewake(self);
+  if (self->nio)
+    event_del(&self->epollev);
+  if (self->epfd != -1)
+    close(self->epfd);
+  if (self->uring)
+    _freeuring(self);
   event_base_free(self->ev_base);
+  nt_slabpool_destroy(&self->rxpool);
   
   // remove any sockservs
   for (i = 0; i < nt_array_length(self->srlist); i++) {
     nt_sockserv_runloop_t *sr = (nt_sockserv_runloop_t *)nt_array_get(self->srlist, i);
-    if (sr)
+    if (sr) {
       _rmsockserv(self, sr->server);
+      nt_free(sr, sizeof(nt_sockserv_runloop_t));
+    }
   }
   nt_release(self->srlist);
   
@@ -68,11 +166,60 @@ nt_runloop_t *nt_runloop_new() {
   NT_OBJ_CLEAR(self, nt_runloop_t);
   self->ev_base = event_base_new();
   self->srlist = nt_array_new(1, 0);
+  nt_timerwheel_init(&self->timers, _ticks());
+  self->epfd = -1;
+  self->cpu = -1;
+  nt_slabpool_init(&self->rxpool, NT_RUNLOOP_RXSLAB_SIZE, NT_RUNLOOP_RXSLAB_MAXFREE);
   return self;
 }
 
 
-// todo: make the current runloop thread-local
+static pthread_key_t _current_key;
+static pthread_once_t _current_once = PTHREAD_ONCE_INIT;
+
+static void _current_init(void) {
+  AZ(pthread_key_create(&_current_key, NULL));
+}
+
+
+nt_runloop_t *nt_runloop_current() {
+  nt_runloop_t *runloop;
+  AZ(pthread_once(&_current_once, &_current_init));
+  if ((runloop = (nt_runloop_t *)pthread_getspecific(_current_key)) == NULL)
+    runloop = nt_runloop_default();
+  return runloop;
+}
+
+
+void nt_runloop_setcurrent(nt_runloop_t *runloop) {
+  AZ(pthread_once(&_current_once, &_current_init));
+  AZ(pthread_setspecific(_current_key, runloop));
+}
+
+
+bool nt_runloop_setcpu(nt_runloop_t *self, int cpu) {
+  #if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    return false;
+  #elif defined(__APPLE__)
+  /* Darwin only takes a hint: threads with different tags on different CPUs */
+  thread_affinity_policy_data_t policy = { (integer_t)cpu + 1 };
+  if (thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                        (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT) != KERN_SUCCESS)
+    return false;
+  #else
+  errno = ENOTSUP;
+  return false;
+  #endif
+  self->cpu = cpu;
+  return true;
+}
+
+
+// used by threads which have not called nt_runloop_setcurrent
 extern struct event_base *current_base; /* defined in libevent/event.c */
 nt_runloop_t *nt_shared_runloop = NULL;
 nt_runloop_t *nt_runloop_default() {
@@ -98,12 +245,268 @@ void nt_runloop_addev(nt_runloop_t *self, struct event *ev, const struct timeval
 }
 
 
+/* Take all posted calls at once, then run them oldest first */
+static void _runposted(nt_runloop_t *self, nt_runloop_t *runloop) {
+  _call_t *call, *next, *calls = NULL;
+  void *head;
+  
+  do {
+    head = nt_atomic_loadptr(&self->posted);
+  } while (!nt_atomic_bool_compare_and_swapptr(&self->posted, head, NULL));
+  for (call = (_call_t *)head; call; call = next) {
+    next = call->next;
+    call->next = calls;
+    calls = call;
+  }
+  for (call = calls; call; call = next) {
+    next = call->next;
+    call->cb(runloop, call->arg);
+    nt_free(call, sizeof(_call_t));
+  }
+}
+
+
+static void _wakecb(int fd, short ev, nt_runloop_t *self) {
+  byte_t buf[64];
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+  _runposted(self, self);
+}
+
+
+void nt_runloop_cancelposted(nt_runloop_t *self) {
+  _runposted(self, NULL);
+}
+
+
+bool nt_runloop_enablepost(nt_runloop_t *self) {
+  if (self->wakeev)
+    return true;
+  
+  #if HAVE_EVENTFD
+  if ((self->wakefd[0] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+    return false;
+  self->wakefd[1] = self->wakefd[0];
+  #else
+  if (pipe(self->wakefd) == -1)
+    return false;
+  AZ(fcntl(self->wakefd[0], F_SETFL, O_NONBLOCK));
+  AZ(fcntl(self->wakefd[1], F_SETFL, O_NONBLOCK));
+  AZ(fcntl(self->wakefd[0], F_SETFD, FD_CLOEXEC));
+  AZ(fcntl(self->wakefd[1], F_SETFD, FD_CLOEXEC));
+  #endif
+  
+  if ((self->wakeev = (struct event *)nt_malloc(sizeof(struct event))) == NULL) {
+    _closewake(self);
+    return false;
+  }
+  event_set(self->wakeev, self->wakefd[0], EV_READ|EV_PERSIST,
+    (void (*)(int, short, void *))&_wakecb, (void *)self);
+  nt_runloop_addev(self, self->wakeev, NULL);
+  return true;
+}
+
+
+bool nt_runloop_post(nt_runloop_t *self, nt_runloop_postcb_t cb, void *arg) {
+  _call_t *call;
+  void *head;
+  
+  assert(self->wakeev != NULL);
+  if ((call = (_call_t *)nt_malloc(sizeof(_call_t))) == NULL)
+    return false;
+  call->cb = cb;
+  call->arg = arg;
+  do {
+    head = nt_atomic_loadptr(&self->posted);
+    call->next = (_call_t *)head;
+  } while (!nt_atomic_bool_compare_and_swapptr(&self->posted, head, (void *)call));
+  
+  /* only the first call on an empty stack needs to wake the runloop */
+  if (head == NULL) {
+    uint64_t one = 1;
+    /* EAGAIN means a wakeup is already pending */
+    if (write(self->wakefd[1], &one, sizeof(one)) == -1)
+      assert(errno == EAGAIN);
+  }
+  return true;
+}
+
+
+#if HAVE_EPOLL
+
+static void _epollcb(int fd, short ev, nt_runloop_t *self) {
+  struct epoll_event ready[NT_RUNLOOP_IO_BATCH];
+  int i, n;
+  
+  if ((n = epoll_wait(self->epfd, ready, NT_RUNLOOP_IO_BATCH, 0)) <= 0)
+    return;
+  
+  /* nt_runloop_rmio clears entries of watchers removed while dispatching */
+  self->ioready = (void *)ready;
+  self->nioready = n;
+  for (i = 0; i < n; i++) {
+    nt_runloop_io_t *io = (nt_runloop_io_t *)ready[i].data.ptr;
+    short events = 0;
+    if (io == NULL)
+      continue;
+    if (ready[i].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR))
+      events |= EV_READ;
+    if (ready[i].events & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+      events |= EV_WRITE;
+    if ((events &= io->events))
+      io->cb(io, events);
+  }
+  self->ioready = NULL;
+  self->nioready = 0;
+}
+
+
+bool nt_runloop_addio(nt_runloop_t *self, nt_runloop_io_t *io) {
+  struct epoll_event ev;
+  
+  assert(io->runloop == NULL);
+  
+  if (self->epfd == -1 && (self->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    return false;
+  
+  ev.events = 0;
+  ev.data.ptr = (void *)io;
+  if (io->events & EV_READ)
+    ev.events |= EPOLLIN|EPOLLRDHUP;
+  if (io->events & EV_WRITE)
+    ev.events |= EPOLLOUT;
+  if (io->flags & NT_RUNLOOP_IO_EDGE)
+    ev.events |= EPOLLET;
+  #ifdef EPOLLEXCLUSIVE
+  if (io->flags & NT_RUNLOOP_IO_EXCLUSIVE)
+    ev.events |= EPOLLEXCLUSIVE;
+  #endif
+  if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, io->fd, &ev) == -1)
+    return false;
+  
+  if (self->nio++ == 0) {
+    event_set(&self->epollev, self->epfd, EV_READ|EV_PERSIST,
+      (void (*)(int, short, void *))&_epollcb, (void *)self);
+    nt_runloop_addev(self, &self->epollev, NULL);
+  }
+  io->runloop = self;
+  return true;
+}
+
+
+void nt_runloop_rmio(nt_runloop_t *self, nt_runloop_io_t *io) {
+  struct epoll_event ev, *ready = (struct epoll_event *)self->ioready;
+  int i;
+  
+  if (io->runloop != self)
+    return;
+  /* the event argument is ignored, but must be non-NULL before Linux 2.6.9 */
+  epoll_ctl(self->epfd, EPOLL_CTL_DEL, io->fd, &ev);
+  for (i = 0; i < self->nioready; i++) {
+    if (ready[i].data.ptr == (void *)io)
+      ready[i].data.ptr = NULL;
+  }
+  io->runloop = NULL;
+  if (--self->nio == 0)
+    event_del(&self->epollev);
+}
+
+#else /* libevent fallback */
+
+static void _iocb(int fd, short ev, nt_runloop_io_t *io) {
+  io->cb(io, ev & (EV_READ|EV_WRITE));
+}
+
+
+bool nt_runloop_addio(nt_runloop_t *self, nt_runloop_io_t *io) {
+  assert(io->runloop == NULL);
+  event_set(&io->ev, io->fd, io->events|EV_PERSIST,
+    (void (*)(int, short, void *))&_iocb, (void *)io);
+  nt_runloop_addev(self, &io->ev, NULL);
+  io->runloop = self;
+  self->nio++;
+  return true;
+}
+
+
+void nt_runloop_rmio(nt_runloop_t *self, nt_runloop_io_t *io) {
+  if (io->runloop != self)
+    return;
+  event_del(&io->ev);
+  io->runloop = NULL;
+  self->nio--;
+}
+
+#endif /* HAVE_EPOLL */
+
+
+static void _flushcb(int fd, short ev, nt_runloop_t *self) {
+  int n;
+  /* EBUSY: the completion queue is full and must be reaped first */
+  while ((n = nt_uring_submit(self->uring)) == -1 && (errno == EINTR || errno == EBUSY))
+    nt_uring_reap(self->uring);
+  if (n == -1) {
+    /* retrying would spin -- give up on the ring, operations still queued
+       are never submitted */
+    nt_warn("io_uring_enter");
+    self->uringfailed = true;
+    return;
+  }
+  /* a short submit leaves operations queued, and queuedcb only fires when
+     the queue goes from empty to not -- try the rest next iteration */
+  if (self->uring->queued > 0) {
+    struct timeval tv = {0, 0};
+    AZ(event_add(&self->flushev, &tv));
+  }
+}
+
+
+static void _uringqueuedcb(nt_uring_t *uring, nt_runloop_t *self) {
+  /* runs after the callbacks already active in this iteration */
+  if (!self->uringfailed)
+    event_active(&self->flushev, EV_TIMEOUT, 1);
+}
+
+
+static void _uringcb(int fd, short ev, nt_runloop_t *self) {
+  nt_uring_reap(self->uring);
+}
+
+
+bool nt_runloop_enableuring(nt_runloop_t *self, unsigned int entries) {
+  if (self->uring)
+    return true;
+  if ((self->uring = (nt_uring_t *)nt_malloc(sizeof(nt_uring_t))) == NULL)
+    return false;
+  if (!nt_uring_init(self->uring, entries)) {
+    nt_free(self->uring, sizeof(nt_uring_t));
+    self->uring = NULL;
+    return false;
+  }
+  if (!nt_uring_probe(self->uring)) {
+    nt_uring_destroy(self->uring);
+    nt_free(self->uring, sizeof(nt_uring_t));
+    self->uring = NULL;
+    return false;
+  }
+  self->uring->queuedcb = (nt_uring_queuedcb_t)&_uringqueuedcb;
+  self->uring->queuedarg = (void *)self;
+  event_set(&self->flushev, -1, 0, (void (*)(int, short, void *))&_flushcb, (void *)self);
+  AZ(event_base_set(self->ev_base, &self->flushev));
+  event_set(&self->uringev, self->uring->fd, EV_READ|EV_PERSIST,
+    (void (*)(int, short, void *))&_uringcb, (void *)self);
+  nt_runloop_addev(self, &self->uringev, NULL);
+  return true;
+}
+
+
 NT_STATIC_INLINE struct event *_mkacceptev( nt_sockserv_runloop_t *sr, int fd) {
   struct event *ev;
   if ((ev = (struct event *)nt_malloc(sizeof(struct event))) == NULL)
     return NULL;
   event_set(ev, fd, EV_READ|EV_PERSIST, 
-    (void (*)(int, short, void *))(sr->server->on_accept),
+    (void (*)(int, short, void *))(sr->server->on_acceptv ?
+      &nt_sockserv_acceptv : sr->server->on_accept),
     (void *)sr);
   return ev;
 }
@@ -113,7 +516,7 @@ bool nt_runloop_addsockserv(nt_runloop_t *self, nt_sockserv_t *server) {
   nt_sockserv_runloop_t *sr;
   
   assert((server->fd4 != -1) || (server->fd6 != -1));
-  assert(server->on_accept != NULL);
+  assert(server->on_accept != NULL || server->on_acceptv != NULL);
   
   sr = (nt_sockserv_runloop_t *)nt_malloc(sizeof(nt_sockserv_runloop_t));
   sr->server = server;
@@ -166,6 +569,10 @@ void nt_runloop_rmsockserv(nt_runloop_t *self, nt_sockserv_t *server) {
 
 void nt_runloop_addsockconn(nt_runloop_t *self, nt_sockconn_t *conn) {
   short evflags = 0;
+  if (!conn->counted) {
+    conn->counted = true;
+    nt_atomic_add32(&self->nconns, 1);
+  }
   if (conn->bev.readcb)
     evflags |= EV_READ;
   if (conn->bev.writecb)
@@ -176,6 +583,10 @@ void nt_runloop_addsockconn(nt_runloop_t *self, nt_sockconn_t *conn) {
 
 void nt_runloop_rmsockconn(nt_runloop_t *self, nt_sockconn_t *conn) {
   short evflags = 0;
+  if (conn->counted) {
+    conn->counted = false;
+    nt_atomic_sub32(&self->nconns, 1);
+  }
   if (conn->bev.readcb)
     evflags |= EV_READ;
   if (conn->bev.writecb)
@@ -29,16 +29,99 @@
 #include "sockserv.h"
 #include "sockconn.h"
 #include "array.h"
+#include "timerwheel.h"
+#include "slabpool.h"
+#include "uring.h"
 #include <signal.h>
 #include <event.h>
 
+/* Length of a timer tick in milliseconds */
+#ifndef NT_RUNLOOP_TICK_MSEC
+  #define NT_RUNLOOP_TICK_MSEC 100
+#endif
+
+/* Size of the receive slabs in runloop->rxpool (see nt_sockconn_setrecv).
+   Also the largest partial message a connection can hold. */
+#ifndef NT_RUNLOOP_RXSLAB_SIZE
+  #define NT_RUNLOOP_RXSLAB_SIZE 16384
+#endif
+
+/* Returned receive slabs kept for reuse */
+#ifndef NT_RUNLOOP_RXSLAB_MAXFREE
+  #define NT_RUNLOOP_RXSLAB_MAXFREE 64
+#endif
+
+/* Flags for nt_runloop_io_t */
+#define NT_RUNLOOP_IO_EDGE      1  /* edge-triggered: read/write until EAGAIN */
+#define NT_RUNLOOP_IO_EXCLUSIVE 2  /* wake only one of the runloops watching @fd */
+
+/* Max number of ready nt_runloop_io_t handled per runloop iteration */
+#ifndef NT_RUNLOOP_IO_BATCH
+  #define NT_RUNLOOP_IO_BATCH 64
+#endif
+
+struct nt_runloop_t;
+struct nt_runloop_io_t;
+
+/**
+  Called when a watched file descriptor is ready.
+  
+  @param events EV_READ and/or EV_WRITE. Errors and hangups are reported as
+                readiness, so that the next read or write returns them.
+**/
+typedef void (*nt_runloop_iocb_t)(struct nt_runloop_io_t *io, short events);
+
+/**
+  A file descriptor watched with nt_runloop_addio.
+**/
+typedef struct nt_runloop_io_t {
+  int fd;
+  short events;                 /* EV_READ and/or EV_WRITE */
+  int flags;                    /* NT_RUNLOOP_IO_ flags */
+  nt_runloop_iocb_t cb;
+  void *arg;
+  struct nt_runloop_t *runloop; /* while added */
+  struct event ev;              /* used where epoll is not available */
+} nt_runloop_io_t;
+
 typedef struct nt_runloop_t {
   NT_OBJ_HEAD
   struct event_base *ev_base;
   nt_array_t *srlist; /* list of nt_sockserv_runloop_t */
   struct event *sigevv[NSIG];
+  nt_timerwheel_t timers; /* see nt_runloop_addtimer */
+  struct event timerev;   /* ticks the timer wheel */
+  bool timerev_pending;
+  struct event *wakeev;   /* see nt_runloop_enablepost */
+  int wakefd[2];          /* read and write end (the same fd for eventfd) */
+  void * volatile posted; /* lock-free stack of nt_runloop_post calls */
+  volatile int32_t nconns;  /* connections added with nt_runloop_addsockconn */
+  int epfd;               /* epoll instance for nt_runloop_io_t, or -1 */
+  struct event epollev;   /* fires when epfd has ready descriptors */
+  size_t nio;             /* number of nt_runloop_io_t added */
+  void *ioready;          /* batch being dispatched (struct epoll_event *) */
+  int nioready;
+  nt_uring_t *uring;      /* see nt_runloop_enableuring */
+  bool uringfailed;       /* submitting to uring failed, see nt_runloop_uring */
+  struct event uringev;   /* fires when the ring has completions */
+  struct event flushev;   /* submits queued operations */
+  int cpu;                /* see nt_runloop_setcpu, or -1 */
+  size_t outbytes;        /* output buffered by its connections */
+  size_t outlimit;        /* limit for outbytes (see nt_sockconn_setwatermarks),
+                             or 0 for none */
+  nt_slabpool_t rxpool;   /* receive slabs, see nt_sockconn_setrecv */
 } nt_runloop_t;
 
+/**
+  Function called on a runloop's thread by nt_runloop_post.
+  
+  A call which can no longer run, because the runloop has been stopped
+  (see nt_runloop_cancelposted) or released, is made with @runloop NULL
+  instead, on whichever thread cancels it, so that it can release what
+  @arg holds.
+**/
+typedef void (*nt_runloop_postcb_t)(nt_runloop_t *runloop, void *arg);
+
 /**
   Called when a observed signal was raised.
 **/
@@ -54,6 +137,30 @@ nt_runloop_t *nt_runloop_new();
 **/
 nt_runloop_t *nt_runloop_default();
 
+/**
+  The runloop of the calling thread.
+  
+  @returns the runloop set with nt_runloop_setcurrent for this thread, or
+           nt_runloop_default() if none was set.
+**/
+nt_runloop_t *nt_runloop_current();
+
+/**
+  Set the runloop of the calling thread. Not retained.
+  
+  @param runloop runloop or NULL to clear
+**/
+void nt_runloop_setcurrent(nt_runloop_t *runloop);
+
+/**
+  Pin the calling thread, which runs @self, to CPU @cpu (with
+  sched_setaffinity on Linux; Darwin only takes it as a hint) and record it
+  in self->cpu.
+  
+  @returns false if the thread could not be pinned
+**/
+bool nt_runloop_setcpu(nt_runloop_t *self, int cpu);
+
 /**
   Handle events.
   
@@ -119,6 +226,116 @@ void nt_runloop_rmev(struct event *ev) {
   AZ(event_del(ev));
 }
 
+/**
+  Add a coarse timer to the runloop.
+  
+  The timer fires on the first tick (of NT_RUNLOOP_TICK_MSEC) after @msec
+  milliseconds have passed. Unlike nt_runloop_addev with a timeout, adding,
+  re-arming and removing timers are O(1) and do not touch libevent, which
+  makes them suitable for per-connection timeouts. Adding a pending timer
+  re-arms it.
+  
+  @param timer timer initialized with nt_timer_init
+  @param msec  milliseconds from now
+**/
+void nt_runloop_addtimer(nt_runloop_t *self, nt_timer_t *timer, unsigned int msec);
+
+/**
+  Remove a timer from the runloop. Does nothing if the timer is not pending.
+**/
+NT_STATIC_INLINE
+void nt_runloop_rmtimer(nt_runloop_t *self, nt_timer_t *timer) {
+  nt_timerwheel_cancel(&self->timers, timer);
+}
+
+/**
+  Allow other threads to call nt_runloop_post on this runloop.
+  
+  Adds a persistent wakeup event (an eventfd, or a pipe where eventfd is not
+  available) to the runloop, which means nt_runloop_run will not return
+  for lack of events. Must be called from the thread running the runloop.
+  
+  @returns boolean success
+**/
+bool nt_runloop_enablepost(nt_runloop_t *self);
+
+/**
+  Call @cb with @arg on the thread running @self.
+  
+  Thread-safe and lock-free. Calls are run in the order they were posted,
+  during the next iteration of the runloop. nt_runloop_enablepost must have
+  been called for @self.
+  
+  @returns false if memory is exhausted
+**/
+bool nt_runloop_post(nt_runloop_t *self, nt_runloop_postcb_t cb, void *arg);
+
+/**
+  Cancel calls posted to @self which have not run yet, calling each with a
+  NULL runloop. For use once @self will not be run again, e.g. after its
+  thread has exited. Done implicitly when @self is released.
+**/
+void nt_runloop_cancelposted(nt_runloop_t *self);
+
+/**
+  Initialize a file descriptor watcher.
+  
+  @param events EV_READ and/or EV_WRITE
+  @param flags  0 or a combination of NT_RUNLOOP_IO_EDGE and
+                NT_RUNLOOP_IO_EXCLUSIVE
+**/
+NT_STATIC_INLINE void nt_runloop_io_init(nt_runloop_io_t *io, int fd, short events,
+                                         int flags, nt_runloop_iocb_t cb, void *arg) {
+  io->fd = fd;
+  io->events = events;
+  io->flags = flags;
+  io->cb = cb;
+  io->arg = arg;
+  io->runloop = NULL;
+}
+
+/**
+  Start watching a file descriptor.
+  
+  On Linux, watchers are kept in an epoll instance owned by the runloop:
+  NT_RUNLOOP_IO_EDGE registers with EPOLLET, NT_RUNLOOP_IO_EXCLUSIVE with
+  EPOLLEXCLUSIVE (for a listening socket watched by several runloops), and
+  ready descriptors are collected NT_RUNLOOP_IO_BATCH at a time with one
+  epoll_wait call per runloop iteration. Libevent only watches the epoll
+  descriptor itself, so per-descriptor libevent bookkeeping is avoided. This
+  costs one extra epoll_wait per wakeup, which pays off when many watchers
+  are ready at once but not for a single busy descriptor.
+  
+  Elsewhere the watcher is a persistent libevent event, which is level-
+  triggered; callbacks which read or write until EAGAIN work with both.
+  
+  @returns boolean success
+**/
+bool nt_runloop_addio(nt_runloop_t *self, nt_runloop_io_t *io);
+
+/**
+  Stop watching a file descriptor. May be called from any io callback, also
+  for other watchers ready in the same iteration.
+**/
+void nt_runloop_rmio(nt_runloop_t *self, nt_runloop_io_t *io);
+
+/**
+  Attach an io_uring instance with room for @entries queued operations.
+  
+  Operations queued on nt_runloop_uring(self) during a loop iteration are
+  submitted together with one io_uring_enter call at the end of the
+  iteration, and completion callbacks run from the runloop.
+  
+  @returns false if io_uring is not available (not Linux, a kernel older
+           than 6.0 -- see nt_uring_probe -- or a sandbox forbidding it), in
+           which case nt_runloop_addio should be used instead.
+**/
+bool nt_runloop_enableuring(nt_runloop_t *self, unsigned int entries);
+
+/* The ring attached by nt_runloop_enableuring, or NULL if there is none or
+   the kernel stopped taking submissions (use nt_runloop_addio then) */
+#define nt_runloop_uring(self) ((self)->uringfailed ? NULL : (self)->uring)
+
 /**
   Add a server to the runloop.
   
@@ -136,6 +353,9 @@ void nt_runloop_rmsockserv(nt_runloop_t *self, nt_sockserv_t *server);
 /**
   Add a socket connection to the runloop.
   
+  Connections are counted in self->nconns until removed, which may be read
+  from other threads with nt_atomic_load32.
+  
   @param conn socket connection
 **/
 void nt_runloop_addsockconn(nt_runloop_t *self, nt_sockconn_t *conn);
@@ -0,0 +1,225 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "runloop_group.h"
+#include "machine.h"
+#include "mpool.h"
+#include "fd.h"
+
+
+static void _releaseservers(nt_runloop_group_t *self) {
+  size_t i;
+  for (i = 0; i < self->nthreads; i++) {
+    nt_sockserv_t *server = self->threads[i].server;
+    if (server) {
+      nt_fd_close(&server->fd4);
+      nt_fd_close(&server->fd6);
+      nt_release(server);
+      self->threads[i].server = NULL;
+    }
+  }
+}
+
+
+static void _dealloc(nt_runloop_group_t *self) {
+  if (self->nstarted)
+    nt_runloop_group_stop(self);
+  _releaseservers(self);
+  AZ(pthread_mutex_destroy(&self->lock));
+  AZ(pthread_cond_destroy(&self->cond));
+  nt_free(self->threads, sizeof(nt_runloop_thread_t) * self->nthreads);
+  nt_free(self, sizeof(nt_runloop_group_t));
+}
+
+
+nt_runloop_group_t *nt_runloop_group_new(size_t nthreads, int flags) {
+  size_t i;
+  int fake64;
+  NT_OBJ_ALLOC_INIT_self(nt_runloop_group_t, &_dealloc);
+  
+  if (nthreads == 0) {
+    int ncpu = nt_machine_ncpu(&fake64);
+    nthreads = (ncpu > 0) ? (size_t)ncpu : 1;
+  }
+  if ((self->threads = (nt_runloop_thread_t *)nt_calloc(nthreads, sizeof(nt_runloop_thread_t))) == NULL) {
+    nt_free(self, sizeof(nt_runloop_group_t));
+    return NULL;
+  }
+  for (i = 0; i < nthreads; i++) {
+    self->threads[i].group = self;
+    self->threads[i].index = i;
+  }
+  self->nthreads = nthreads;
+  self->flags = flags;
+  memcpy((void *)&self->opts, (const void *)&nt_sockopts_default, sizeof(nt_sockopts_t));
+  self->initcb = NULL;
+  self->arg = NULL;
+  self->nstarted = 0;
+  self->nready = 0;
+  AZ(pthread_mutex_init(&self->lock, NULL));
+  AZ(pthread_cond_init(&self->cond, NULL));
+  return self;
+}
+
+
+/* CPU of thread @index with NT_RUNLOOP_GROUP_F_AFFINITY */
+static int _cpuof(size_t index) {
+  int fake64, ncpu = nt_machine_ncpu(&fake64);
+  return (ncpu > 0) ? (int)(index % ncpu) : 0;
+}
+
+
+/* Attach the CPU steering program to the listeners */
+static bool _steer(nt_runloop_group_t *self) {
+  int *cpus;
+  size_t i;
+  bool ok;
+  if ((cpus = (int *)nt_malloc(self->nthreads * sizeof(int))) == NULL)
+    return false;
+  for (i = 0; i < self->nthreads; i++)
+    cpus[i] = _cpuof(i);
+  if (!(ok = nt_sockserv_steerbycpu(self->threads[0].server, cpus, self->nthreads)))
+    nt_warn("nt_sockserv_steerbycpu");
+  nt_free(cpus, self->nthreads * sizeof(int));
+  return ok;
+}
+
+
+bool nt_runloop_group_listen(nt_runloop_group_t *self, const char *addr, int port,
+                             int family, nt_sockserv_on_accept_t on_accept)
+{
+  #ifdef SO_REUSEPORT
+  nt_sockopts_t opts = self->opts;
+  size_t i;
+  assert(self->nstarted == 0);
+  opts.flags |= NT_SOCKOPTS_REUSEPORT;
+  for (i = 0; i < self->nthreads; i++) {
+    nt_sockserv_t *server;
+    assert(self->threads[i].server == NULL);
+    if ((server = nt_sockserv_new(on_accept)) == NULL)
+      break;
+    self->threads[i].server = server;
+    if (self->flags & NT_RUNLOOP_GROUP_F_STEER)
+      opts.incomingcpu = _cpuof(i);
+    nt_sockserv_setopts(server, &opts);
+    if (!nt_sockserv_bind(server, addr, port, SOCK_STREAM, family) ||
+        !nt_sockserv_listen(server))
+      break;
+  }
+  if (i == self->nthreads && (!(self->flags & NT_RUNLOOP_GROUP_F_STEER) || _steer(self)))
+    return true;
+  _releaseservers(self);
+  #endif
+  return false;
+}
+
+
+static void *_threadmain(nt_runloop_thread_t *t) {
+  nt_runloop_group_t *group = t->group;
+  
+  if ((t->runloop = nt_runloop_new()) != NULL) {
+    if ((group->flags & (NT_RUNLOOP_GROUP_F_AFFINITY|NT_RUNLOOP_GROUP_F_STEER)) &&
+        !nt_runloop_setcpu(t->runloop, _cpuof(t->index)))
+      nt_warn("nt_runloop_setcpu");
+    nt_runloop_setcurrent(t->runloop);
+    t->ok = nt_runloop_enablepost(t->runloop)
+         && (!t->server || nt_runloop_addsockserv(t->runloop, t->server))
+         && (!group->initcb || group->initcb(group, t->runloop, t->index));
+  }
+  
+  AZ(pthread_mutex_lock(&group->lock));
+  group->nready++;
+  AZ(pthread_cond_broadcast(&group->cond));
+  AZ(pthread_mutex_unlock(&group->lock));
+  
+  if (t->ok)
+    nt_runloop_run(t->runloop, 0);
+  
+  nt_runloop_setcurrent(NULL);
+  return NULL;
+}
+
+
+bool nt_runloop_group_start(nt_runloop_group_t *self, nt_runloop_group_initcb_t initcb,
+                            void *arg)
+{
+  size_t i;
+  bool ok = true;
+  
+  assert(self->nstarted == 0);
+  self->initcb = initcb;
+  self->arg = arg;
+  self->nready = 0;
+  
+  for (i = 0; i < self->nthreads; i++) {
+    nt_runloop_thread_t *t = &self->threads[i];
+    t->ok = false;
+    if (pthread_create(&t->thread, NULL, (void *(*)(void *))&_threadmain, (void *)t) != 0) {
+      ok = false;
+      break;
+    }
+    self->nstarted++;
+  }
+  
+  /* wait for all threads to finish initializing */
+  AZ(pthread_mutex_lock(&self->lock));
+  while (self->nready < self->nstarted)
+    AZ(pthread_cond_wait(&self->cond, &self->lock));
+  AZ(pthread_mutex_unlock(&self->lock));
+  
+  for (i = 0; i < self->nstarted; i++)
+    ok = ok && self->threads[i].ok;
+  if (!ok)
+    nt_runloop_group_stop(self);
+  
+  return ok;
+}
+
+
+static void _breakcb(nt_runloop_t *runloop, void *arg) {
+  if (runloop)
+    nt_runloop_abort(runloop);
+}
+
+
+void nt_runloop_group_stop(nt_runloop_group_t *self) {
+  size_t i;
+  
+  for (i = 0; i < self->nstarted; i++) {
+    nt_runloop_thread_t *t = &self->threads[i];
+    if (t->ok)
+      AN(nt_runloop_post(t->runloop, &_breakcb, NULL));
+  }
+  
+  for (i = 0; i < self->nstarted; i++) {
+    nt_runloop_thread_t *t = &self->threads[i];
+    AZ(pthread_join(t->thread, NULL));
+    if (t->runloop) {
+      /* e.g. acceptor handoffs, which would otherwise wait forever */
+      nt_runloop_cancelposted(t->runloop);
+      nt_release(t->runloop);
+      t->runloop = NULL;
+    }
+    t->ok = false;
+  }
+  
+  self->nstarted = 0;
+}
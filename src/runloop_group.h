@@ -0,0 +1,141 @@
+/**
+  A group of threads, each running its own runloop.
+  
+  Every thread gets a nt_runloop_t which is also its current runloop (see
+  nt_runloop_current), optionally pinned to a CPU. A group can listen on an
+  address with one SO_REUSEPORT socket per thread, so that the kernel
+  spreads incoming connections over the threads without a shared accept
+  lock:
+  
+    static bool on_init(nt_runloop_group_t *group, nt_runloop_t *runloop, size_t i) {
+      nt_runloop_addsignal(runloop, SIGPIPE, on_signal, NULL);
+      return true;
+    }
+    
+    group = nt_runloop_group_new(0, NT_RUNLOOP_GROUP_F_AFFINITY);
+    nt_runloop_group_listen(group, "", 7000, AF_UNSPEC, &on_accept);
+    nt_runloop_group_start(group, &on_init, NULL);
+    ...
+    nt_runloop_group_stop(group);
+  
+  The accept callback runs on the thread owning the listening socket, so
+  nt_sockconn_accept adds the connection to that thread's runloop.
+  
+  Only Linux (3.9 and later) balances connections over SO_REUSEPORT sockets;
+  other systems deliver them all to one socket.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_RUNLOOP_GROUP_H_
+#define _NT_RUNLOOP_GROUP_H_
+
+#include "obj.h"
+#include "runloop.h"
+#include "sockserv.h"
+#include <pthread.h>
+
+/* Pin thread i to CPU (i % number of CPUs) */
+#define NT_RUNLOOP_GROUP_F_AFFINITY 1
+
+/* Pin threads like NT_RUNLOOP_GROUP_F_AFFINITY and have nt_runloop_group_listen
+   steer each connection to the thread on the CPU which received it (see
+   nt_sockserv_steerbycpu). Meant for one thread per CPU. */
+#define NT_RUNLOOP_GROUP_F_STEER 2
+
+struct nt_runloop_group_t;
+
+/**
+  Called on each new thread before its runloop starts running, e.g. to add
+  events. Returning false makes nt_runloop_group_start fail.
+**/
+typedef bool (*nt_runloop_group_initcb_t)(struct nt_runloop_group_t *group,
+                                          nt_runloop_t *runloop, size_t index);
+
+typedef struct nt_runloop_thread_t {
+  struct nt_runloop_group_t *group;
+  size_t index;
+  pthread_t thread;
+  nt_runloop_t *runloop;
+  nt_sockserv_t *server;        /* this thread's listener, or NULL */
+  bool ok;                      /* thread initialized successfully */
+} nt_runloop_thread_t;
+
+typedef struct nt_runloop_group_t {
+  NT_OBJ_HEAD
+  size_t nthreads;
+  nt_runloop_thread_t *threads;
+  int flags;
+  nt_runloop_group_initcb_t initcb;
+  void *arg;                    /* user data passed to nt_runloop_group_start */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t nstarted;              /* threads created */
+  size_t nready;                /* threads done initializing */
+  nt_sockopts_t opts;           /* for nt_runloop_group_listen. Starts out
+                                   as nt_sockopts_default */
+} nt_runloop_group_t;
+
+/**
+  Create a new group.
+  
+  @param nthreads number of threads, or 0 for one per CPU
+  @param flags    0, NT_RUNLOOP_GROUP_F_AFFINITY or NT_RUNLOOP_GROUP_F_STEER
+**/
+nt_runloop_group_t *nt_runloop_group_new(size_t nthreads, int flags);
+
+#define nt_runloop_group_count(self) ((self)->nthreads)
+
+/**
+  Bind and listen on one socket per thread (with SO_REUSEPORT).
+  
+  Must be called before nt_runloop_group_start. Parameters are those of
+  nt_sockserv_new and nt_sockserv_bind. The sockets get self->opts, with
+  NT_SOCKOPTS_REUSEPORT added. With NT_RUNLOOP_GROUP_F_STEER, each socket
+  also gets the CPU of its thread as SO_INCOMING_CPU.
+  
+  @returns false if binding failed, SO_REUSEPORT is not available or
+           steering was asked for and could not be set up
+**/
+bool nt_runloop_group_listen(nt_runloop_group_t *self, const char *addr, int port,
+                             int family, nt_sockserv_on_accept_t on_accept);
+
+/**
+  Start all threads and wait for them to initialize.
+  
+  @param initcb called on each thread before its runloop runs. May be NULL.
+  @param arg    stored as self->arg
+  @returns false if a thread could not be started or initialized, in which
+           case any started threads have been stopped.
+**/
+bool nt_runloop_group_start(nt_runloop_group_t *self, nt_runloop_group_initcb_t initcb,
+                            void *arg);
+
+/**
+  Make every runloop exit and wait for the threads to finish.
+**/
+void nt_runloop_group_stop(nt_runloop_group_t *self);
+
+/**
+  The runloop of thread @index.
+**/
+#define nt_runloop_group_runloop(self, index) ((self)->threads[(index)].runloop)
+
+#endif
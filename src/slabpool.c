@@ -0,0 +1,71 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "slabpool.h"
+#include "mpool.h"
+
+
+void nt_slabpool_init(nt_slabpool_t *self, size_t slabsize, size_t maxfree) {
+  assert(slabsize >= sizeof(void *));
+  self->slabsize = slabsize;
+  self->maxfree = maxfree;
+  self->free = NULL;
+  self->nfree = 0;
+  self->nused = 0;
+}
+
+
+byte_t *nt_slabpool_get(nt_slabpool_t *self) {
+  byte_t *slab = (byte_t *)self->free;
+  if (slab) {
+    self->free = *(void **)slab;
+    self->nfree--;
+  }
+  else if ((slab = (byte_t *)nt_malloc(self->slabsize)) == NULL) {
+    return NULL;
+  }
+  self->nused++;
+  return slab;
+}
+
+
+void nt_slabpool_put(nt_slabpool_t *self, byte_t *slab) {
+  assert(self->nused > 0);
+  self->nused--;
+  if (self->nfree < self->maxfree) {
+    *(void **)slab = self->free;
+    self->free = slab;
+    self->nfree++;
+  }
+  else {
+    nt_free(slab, self->slabsize);
+  }
+}
+
+
+void nt_slabpool_destroy(nt_slabpool_t *self) {
+  void *slab;
+  while ((slab = self->free) != NULL) {
+    self->free = *(void **)slab;
+    nt_free(slab, self->slabsize);
+  }
+  self->nfree = 0;
+}
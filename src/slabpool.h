@@ -0,0 +1,65 @@
+/**
+  Pool of fixed-size buffers ("slabs").
+  
+  Returned slabs are kept on a free list, up to a limit, and handed out
+  again before anything new is allocated. A pool is not thread safe; it is
+  meant to be owned by one runloop, like nt_runloop_t's receive pool (see
+  nt_sockconn_setrecv), so that buffers move between the connections of one
+  thread instead of each connection holding its own.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_SLABPOOL_H_
+#define _NT_SLABPOOL_H_
+
+typedef struct nt_slabpool_t {
+  size_t slabsize;
+  size_t maxfree;     /* slabs kept on the free list at most */
+  void *free;         /* free list, linked through the first word of each slab */
+  size_t nfree;
+  size_t nused;       /* slabs handed out and not yet returned */
+} nt_slabpool_t;
+
+/**
+  Initialize a pool of @slabsize byte slabs, keeping at most @maxfree
+  returned slabs for reuse.
+**/
+void nt_slabpool_init(nt_slabpool_t *self, size_t slabsize, size_t maxfree);
+
+/**
+  Take a slab.
+  
+  @returns NULL if memory is exhausted
+**/
+byte_t *nt_slabpool_get(nt_slabpool_t *self);
+
+/**
+  Return a slab taken with nt_slabpool_get.
+**/
+void nt_slabpool_put(nt_slabpool_t *self, byte_t *slab);
+
+/**
+  Free the slabs on the free list. Slabs still handed out must not be
+  returned afterwards.
+**/
+void nt_slabpool_destroy(nt_slabpool_t *self);
+
+#endif
@@ -56,4 +56,9 @@ NT_STATIC_INLINE sa_family_t nt_sockaddr_family(const nt_sockaddr_t *sa) {
   return sa->ss_family;
 }
 
+// Length of an IPv4 or IPv6 address, as passed to bind, sendto etc.
+NT_STATIC_INLINE socklen_t nt_sockaddr_len(const nt_sockaddr_t *sa) {
+  return (sa->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
 #endif
@@ -24,15 +24,32 @@
 #include "fd.h"
 #include "sockutil.h"
 #include "runloop.h"
+#include "connect.h"
 #include "mpool.h"
 
 
+static void _zctick(nt_timer_t *timer, nt_sockconn_t *self);
+
+/* Called by libevent whenever the length of the output buffer changes */
+static void _outputcb(struct evbuffer *buf, size_t oldlen, size_t newlen, nt_sockconn_t *self) {
+  /* additions are accounted by the writes themselves */
+  if (newlen < oldlen) {
+    nt_sockconn_touch(self);
+    nt_sockconn_checkout(self);
+  }
+}
+
 static void _dealloc(nt_sockconn_t *self) {
   nt_sockconn_close(self);
-  if (self->bev.input)
+  /* the structs are ours, their storage was allocated by libevent */
+  if (self->bev.input) {
+    free(self->bev.input->orig_buffer);
     nt_free(self->bev.input, sizeof(struct evbuffer));
-  if (self->bev.output)
+  }
+  if (self->bev.output) {
+    free(self->bev.output->orig_buffer);
     nt_free(self->bev.output, sizeof(struct evbuffer));
+  }
   nt_free(self, sizeof(nt_sockconn_t));
 }
 
@@ -42,11 +59,15 @@ nt_sockconn_t *nt_sockconn_new() {
   NT_OBJ_CLEAR(self, nt_sockconn_t);
   
   self->fd = -1;
+  nt_outq_init(&self->outq);
+  nt_timer_init(&self->zctimer, (nt_timer_cb_t)&_zctick, self);
   self->bev.input = nt_calloc(1, sizeof(struct evbuffer));
   if ( !self->bev.input || !(self->bev.output = nt_calloc(1, sizeof(struct evbuffer))) ) {
     nt_release(self);
     return NULL;
   }
+  evbuffer_setcb(self->bev.output,
+    (void (*)(struct evbuffer *, size_t, size_t, void *))&_outputcb, (void *)self);
   /*
 	 * Set to EV_WRITE so that using bufferevent_write is going to
 	 * trigger a callback.  Reading needs to be explicitly enabled
@@ -82,6 +103,85 @@ void _default_errorcb(struct bufferevent *bev, short what, nt_sockconn_t *client
 }
 
 
+static void _reapzc(nt_sockconn_t *self);
+
+/* Trampolines which record activity before calling the user callbacks */
+
+static void _readcb(struct bufferevent *bev, nt_sockconn_t *self) {
+  nt_sockconn_touch(self);
+  _reapzc(self);
+  self->readcb(bev, self);
+}
+
+
+static void _writecb(struct bufferevent *bev, nt_sockconn_t *self) {
+  nt_sockconn_touch(self);
+  /* the write buffer is not drained until outq is */
+  if (self->writecb && nt_outq_empty(&self->outq) && EVBUFFER_LENGTH(bev->output) == 0)
+    self->writecb(bev, self);
+}
+
+
+/*
+  Zerocopy completions are queued on the socket's error queue, which makes
+  the socket poll as ready (POLLERR) until they are reaped, waking its read
+  event over and over with nothing to read. So they are reaped before every
+  flush and read, and on every runloop tick while sends are outstanding.
+  Meanwhile the connection reads through zcev, which reaps before reading,
+  instead of through the bufferevent, which would not.
+*/
+
+static void _zcreadcb(int fd, short ev, nt_sockconn_t *self) {
+  int n;
+  _reapzc(self);
+  if ((n = evbuffer_read(self->bev.input, fd, -1)) > 0)
+    _readcb(&self->bev, self);
+  else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    self->errorcb(&self->bev, EVBUFFER_READ|(n == 0 ? EVBUFFER_EOF : EVBUFFER_ERROR), self);
+}
+
+
+static void _zcupdate(nt_sockconn_t *self) {
+  nt_runloop_t *runloop = self->rs->runloop;
+  bool pending = nt_outq_zcpending(&self->outq);
+  bool zcread = pending && self->readcb && !self->readpaused;
+  
+  if (!pending)
+    nt_runloop_rmtimer(runloop, &self->zctimer);
+  else if (!nt_timer_pending(&self->zctimer))
+    nt_runloop_addtimer(runloop, &self->zctimer, NT_RUNLOOP_TICK_MSEC);
+  
+  if (zcread && !self->zcev_pending) {
+    /* the bufferevent's read event must go first -- libevent 1.4 keeps
+       only one read event per descriptor */
+    bufferevent_disable(&self->bev, EV_READ);
+    event_set(&self->zcev, self->fd, EV_READ|EV_PERSIST,
+      (void (*)(int, short, void *))&_zcreadcb, (void *)self);
+    nt_runloop_addev(runloop, &self->zcev, NULL);
+    self->zcev_pending = true;
+  }
+  else if (!zcread && self->zcev_pending) {
+    event_del(&self->zcev);
+    self->zcev_pending = false;
+    if (self->readcb && !self->readpaused)
+      bufferevent_enable(&self->bev, EV_READ);
+  }
+}
+
+
+static void _reapzc(nt_sockconn_t *self) {
+  if (nt_outq_zcpending(&self->outq)) {
+    nt_outq_reapzerocopy(&self->outq, self->fd);
+    _zcupdate(self);
+  }
+}
+
+
+static void _zctick(nt_timer_t *timer, nt_sockconn_t *self) {
+  _reapzc(self);
+}
+
+
 void nt_sockconn_setcb( nt_sockconn_t *self,
                           nt_sockconn_readcb_t readcb,
                           nt_sockconn_writecb_t writecb,
@@ -89,12 +189,150 @@ void nt_sockconn_setcb( nt_sockconn_t *self,
 {
   if (errorcb == NULL)
     errorcb = &_default_errorcb;
+  self->readcb = readcb;
+  self->writecb = writecb;
+  self->errorcb = errorcb;
 	bufferevent_setcb(&self->bev,
-	  (evbuffercb)readcb, (evbuffercb)writecb, (everrorcb)errorcb,
+	  readcb ? (evbuffercb)&_readcb : NULL,
+	  writecb ? (evbuffercb)&_writecb : NULL,
+	  (everrorcb)errorcb,
 	  (void *)self);
 }
 
 
+static void _idlecb(nt_timer_t *timer, nt_sockconn_t *self) {
+  /* the wheel has moved past the tick being processed */
+  uint64_t idle = self->timers->now - self->lastactive;
+  if (idle < self->idleticks) {
+    /* there was activity since the timer was added -- wait for the rest */
+    nt_timerwheel_add(self->timers, timer, self->idleticks - idle);
+    return;
+  }
+  self->errorcb(&self->bev, EVBUFFER_TIMEOUT|EVBUFFER_READ, self);
+}
+
+
+void nt_sockconn_setidletimeout(nt_sockconn_t *self, unsigned int seconds) {
+  nt_runloop_t *runloop;
+  
+  assert(self->rs != NULL && self->rs->runloop != NULL);
+  runloop = self->rs->runloop;
+  
+  if (self->timers)
+    nt_runloop_rmtimer(runloop, &self->idletimer);
+  if (seconds == 0)
+    return;
+  
+  self->bev.timeout_read = 0;
+  self->bev.timeout_write = 0;
+  if (self->errorcb == NULL)
+    self->errorcb = &_default_errorcb;
+  self->timers = &runloop->timers;
+  self->idleticks = ((uint64_t)seconds * 1000 + NT_RUNLOOP_TICK_MSEC - 1) / NT_RUNLOOP_TICK_MSEC;
+  nt_timer_init(&self->idletimer, (nt_timer_cb_t)&_idlecb, self);
+  nt_runloop_addtimer(runloop, &self->idletimer, seconds * 1000);
+  nt_sockconn_touch(self);
+}
+
+
+/* Give the receive slab back to the pool */
+static void _rxrelease(nt_sockconn_t *self) {
+  if (self->rxslab) {
+    nt_slabpool_put(&self->rs->runloop->rxpool, self->rxslab);
+    self->rxslab = NULL;
+    self->rxlen = 0;
+  }
+}
+
+
+static void _rxcb(int fd, short ev, nt_sockconn_t *self) {
+  nt_slabpool_t *pool = &self->rs->runloop->rxpool;
+  ssize_t n;
+  size_t consumed;
+  
+  /* completions wake the read event too (see _reapzc) */
+  _reapzc(self);
+  if (self->rxslab == NULL && (self->rxslab = nt_slabpool_get(pool)) == NULL) {
+    self->errorcb(&self->bev, EVBUFFER_READ|EVBUFFER_ERROR, self);
+    return;
+  }
+  n = recv(fd, self->rxslab + self->rxlen, pool->slabsize - self->rxlen, 0);
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    if (self->rxlen == 0)
+      _rxrelease(self);
+    return;
+  }
+  if (n <= 0) {
+    _rxrelease(self);
+    self->errorcb(&self->bev, EVBUFFER_READ|(n == 0 ? EVBUFFER_EOF : EVBUFFER_ERROR), self);
+    return;
+  }
+  nt_sockconn_touch(self);
+  self->rxlen += (size_t)n;
+  
+  /* the callback may close and release the connection */
+  nt_retain(self);
+  consumed = self->recvcb(self, self->rxslab, self->rxlen);
+  if (self->rxslab == NULL) {
+    /* closed, which returned the slab */
+    nt_release(self);
+    return;
+  }
+  assert(consumed <= self->rxlen);
+  self->rxlen -= consumed;
+  if (self->rxlen == 0) {
+    _rxrelease(self);
+  }
+  else if (consumed) {
+    /* keep the partial message, at the start of the slab */
+    memmove(self->rxslab, self->rxslab + consumed, self->rxlen);
+  }
+  else if (self->rxlen == pool->slabsize) {
+    _rxrelease(self);
+    errno = EMSGSIZE;
+    self->errorcb(&self->bev, EVBUFFER_READ|EVBUFFER_ERROR, self);
+  }
+  nt_release(self);
+}
+
+
+/* Start or stop reading, with whichever receive path is in use */
+static void _setreading(nt_sockconn_t *self, bool enable) {
+  self->readpaused = !enable;
+  if (self->recvcb) {
+    if (enable && !self->rxev_pending)
+      nt_runloop_addev(self->rs->runloop, &self->rxev, NULL);
+    else if (!enable && self->rxev_pending)
+      event_del(&self->rxev);
+    self->rxev_pending = enable;
+  }
+  else if (!enable) {
+    bufferevent_disable(&self->bev, EV_READ);
+  }
+  else if (self->readcb && !nt_outq_zcpending(&self->outq)) {
+    bufferevent_enable(&self->bev, EV_READ);
+  }
+  _zcupdate(self);
+}
+
+
+void nt_sockconn_setrecv(nt_sockconn_t *self, nt_sockconn_recvcb_t cb) {
+  assert(self->rs != NULL && self->rs->runloop != NULL && self->fd != -1);
+  assert(cb != NULL && self->recvcb == NULL);
+  if (self->errorcb == NULL)
+    self->errorcb = &_default_errorcb;
+  /* the bufferevent is left to do the writing */
+  bufferevent_disable(&self->bev, EV_READ);
+  self->readcb = NULL;
+  bufferevent_setcb(&self->bev, NULL, self->writecb ? (evbuffercb)&_writecb : NULL,
+                    (everrorcb)self->errorcb, (void *)self);
+  self->recvcb = cb;
+  event_set(&self->rxev, self->fd, EV_READ|EV_PERSIST,
+    (void (*)(int, short, void *))&_rxcb, (void *)self);
+  _setreading(self, !self->outfull);
+}
+
+
 bool nt_sockconn_accept(nt_sockconn_t *self,
                         nt_sockserv_runloop_t *rs,
                         int fd,
@@ -102,21 +340,319 @@ bool nt_sockconn_accept(nt_sockconn_t *self,
                         nt_sockconn_writecb_t writecb,
                         nt_sockconn_errorcb_t errorcb)
 {
-  self->fd = nt_sockutil_accept(fd, &self->addr);
+  self->fd = nt_sockutil_acceptnb(fd, &self->addr);
   assert(self->fd != -1);
-  nt_sockconn_setfd(self, self->fd);
+  if (rs->server)
+    nt_sockopts_setconn(&rs->server->opts, self->fd);
+  return nt_sockconn_open(self, rs, self->fd, NULL, readcb, writecb, errorcb);
+}
+
+
+bool nt_sockconn_open(nt_sockconn_t *self,
+                      nt_sockserv_runloop_t *rs,
+                      int fd,
+                      const nt_sockaddr_t *addr,
+                      nt_sockconn_readcb_t readcb,
+                      nt_sockconn_writecb_t writecb,
+                      nt_sockconn_errorcb_t errorcb)
+{
+  if (addr)
+    memcpy((void * restrict)&self->addr, (const void * restrict)addr, sizeof(nt_sockaddr_t));
+  nt_sockconn_setfd(self, fd);
   nt_sockconn_setrs(self, rs);
   nt_sockconn_setcb(self, readcb, writecb, errorcb);
-  nt_sockutil_setblocking(self->fd, false);
   nt_runloop_addsockconn(rs->runloop, self);
   
   return true;
 }
 
 
+static void _connectedcb(int fd, const nt_sockaddr_t *addr, int error, nt_sockconn_t *self) {
+  self->connecting = NULL;
+  if (fd != -1)
+    nt_sockconn_open(self, &self->connrs, fd, addr, self->readcb, self->writecb, self->errorcb);
+  self->connectcb(self, error, self->connectarg);
+}
+
+
+bool nt_sockconn_connect(nt_sockconn_t *self, nt_runloop_t *runloop,
+                         const nt_sockaddr_t *addrs, size_t naddrs,
+                         unsigned int timeout_msec,
+                         nt_sockconn_connectcb_t cb, void *arg)
+{
+  assert(self->fd == -1 && self->connecting == NULL);
+  self->connrs.server = NULL;
+  self->connrs.runloop = runloop;
+  self->rs = &self->connrs;
+  self->connectcb = cb;
+  self->connectarg = arg;
+  self->connecting = nt_connect_start(runloop, addrs, naddrs, timeout_msec,
+                                      (nt_connect_cb_t)&_connectedcb, self);
+  return self->connecting != NULL;
+}
+
+
+static void _flushoutq(nt_sockconn_t *self);
+static void _closeoutq(nt_sockconn_t *self);
+
+static void _outcb(int fd, short ev, nt_sockconn_t *self) {
+  self->outev_pending = false;
+  _flushoutq(self);
+}
+
+
+static void _srccb(int fd, short ev, nt_sockconn_t *self) {
+  self->srcev_pending = false;
+  _flushoutq(self);
+}
+
+
+static void _flushoutq(nt_sockconn_t *self) {
+  nt_runloop_t *runloop = self->rs->runloop;
+  int status;
+  
+  _reapzc(self);
+  status = nt_outq_flush(&self->outq, self->fd);
+  _zcupdate(self);
+  
+  if (status >= 0)
+    nt_sockconn_checkout(self);
+  
+  switch (status) {
+    case NT_OUTQ_EMPTY:
+      nt_sockconn_touch(self);
+      _closeoutq(self);
+      if (self->writecb)
+        self->writecb(&self->bev, self);
+      break;
+    case NT_OUTQ_WAITWRITE:
+      nt_sockconn_touch(self);
+      event_set(&self->outev, self->fd, EV_WRITE,
+        (void (*)(int, short, void *))&_outcb, (void *)self);
+      nt_runloop_addev(runloop, &self->outev, NULL);
+      self->outev_pending = true;
+      break;
+    case NT_OUTQ_WAITSOURCE:
+      event_set(&self->srcev, nt_outq_sourcefd(&self->outq), EV_READ,
+        (void (*)(int, short, void *))&_srccb, (void *)self);
+      nt_runloop_addev(runloop, &self->srcev, NULL);
+      self->srcev_pending = true;
+      break;
+    default:
+      self->errorcb(&self->bev, EVBUFFER_WRITE|EVBUFFER_ERROR, self);
+      break;
+  }
+}
+
+
+static void _armoutq(nt_sockconn_t *self);
+
+/* Make outq the only way out, moving buffered output into it first */
+static bool _openoutq(nt_sockconn_t *self) {
+  struct evbuffer *output = self->bev.output;
+  if (!nt_outq_empty(&self->outq) || EVBUFFER_LENGTH(output) == 0)
+    return true;
+  if (!nt_outq_write(&self->outq, EVBUFFER_DATA(output), EVBUFFER_LENGTH(output)))
+    return false;
+  evbuffer_drain(output, EVBUFFER_LENGTH(output));
+  _armoutq(self);
+  return true;
+}
+
+
+/* outq has drained: hand output back to the bufferevent */
+static void _closeoutq(nt_sockconn_t *self) {
+  if (self->bev.enabled & EV_WRITE)
+    return;
+  if (EVBUFFER_LENGTH(self->bev.output))
+    bufferevent_enable(&self->bev, EV_WRITE);
+  else
+    self->bev.enabled |= EV_WRITE;  /* added by the next bufferevent_write */
+}
+
+
+/* Flush outq at the end of the current runloop iteration */
+static void _armoutq(nt_sockconn_t *self) {
+  /* the bufferevent's write event must go first -- libevent 1.4 keeps
+     only one write event per descriptor */
+  if (self->bev.enabled & EV_WRITE)
+    bufferevent_disable(&self->bev, EV_WRITE);
+  if (self->outev_pending || self->srcev_pending)
+    return;
+  event_set(&self->outev, self->fd, EV_WRITE,
+    (void (*)(int, short, void *))&_outcb, (void *)self);
+  AZ(event_base_set(self->rs->runloop->ev_base, &self->outev));
+  event_active(&self->outev, EV_WRITE, 1);
+  self->outev_pending = true;
+}
+
+
+bool nt_sockconn_queuewrite(nt_sockconn_t *self, const void *data, size_t size) {
+  if (!_openoutq(self) || !nt_outq_write(&self->outq, data, size))
+    return false;
+  _armoutq(self);
+  return true;
+}
+
+
+void nt_sockconn_writechain(nt_sockconn_t *self, const nt_bufchain_t *chain) {
+  nt_sockconn_touch(self);
+  AN(_openoutq(self));
+  AN(nt_outq_appendchain(&self->outq, chain));
+  _armoutq(self);
+  nt_sockconn_checkout(self);
+}
+
+
+bool nt_sockconn_writeref(nt_sockconn_t *self, const void *data, size_t size,
+                          nt_bufseg_freefn_t freefn, void *arg)
+{
+  nt_bufseg_t *seg;
+  bool ok;
+  nt_sockconn_touch(self);
+  if ((seg = nt_bufseg_wrap((byte_t *)data, size, freefn, arg)) == NULL)
+    return false;
+  ok = _openoutq(self) && nt_outq_appendseg(&self->outq, seg, 0, size);
+  nt_release(seg); /* outq holds a reference until the bytes are written */
+  if (ok) {
+    _armoutq(self);
+    nt_sockconn_checkout(self);
+  }
+  return ok;
+}
+
+
+void nt_sockconn_setwatermarks(nt_sockconn_t *self, size_t high, size_t low,
+                               nt_sockconn_flowcb_t cb, void *arg)
+{
+  assert(high == 0 || low < high);
+  self->outhigh = high;
+  self->outlow = low;
+  self->flowcb = cb;
+  self->flowarg = arg;
+}
+
+
+static void _setfull(nt_sockconn_t *self, bool full) {
+  self->outfull = full;
+  if (self->flowcb)
+    self->flowcb(self, full, self->flowarg);
+  else
+    _setreading(self, !full);
+}
+
+
+void nt_sockconn_checkout(nt_sockconn_t *self) {
+  nt_runloop_t *runloop;
+  size_t length;
+  
+  if (self->rs == NULL || (runloop = self->rs->runloop) == NULL)
+    return;
+  length = nt_sockconn_outlength(self);
+  runloop->outbytes = runloop->outbytes - self->outcounted + length;
+  self->outcounted = length;
+  
+  if (!self->outfull) {
+    if ((self->outhigh && length >= self->outhigh) ||
+        (runloop->outlimit && runloop->outbytes > runloop->outlimit && length > self->outlow))
+      _setfull(self, true);
+  }
+  else if (length <= self->outlow) {
+    _setfull(self, false);
+  }
+}
+
+
+void nt_sockconn_setcoalesce(nt_sockconn_t *self, bool enable) {
+  if (self->errorcb == NULL)
+    self->errorcb = &_default_errorcb;
+  self->coalesce = enable;
+}
+
+
+bool nt_sockconn_sendfile(nt_sockconn_t *self, int fd, off_t offset, size_t length,
+                          nt_outq_donecb_t cb, void *arg)
+{
+  assert(self->rs != NULL && self->rs->runloop != NULL);
+  if (self->errorcb == NULL)
+    self->errorcb = &_default_errorcb;
+  if (!_openoutq(self) || !nt_outq_sendfile(&self->outq, fd, offset, length, cb, arg))
+    return false;
+  nt_sockconn_touch(self);
+  _armoutq(self);
+  nt_sockconn_checkout(self);
+  return true;
+}
+
+
+bool nt_sockconn_splice(nt_sockconn_t *self, int fd, size_t length,
+                        nt_outq_donecb_t cb, void *arg)
+{
+  assert(self->rs != NULL && self->rs->runloop != NULL);
+  if (self->errorcb == NULL)
+    self->errorcb = &_default_errorcb;
+  if (!_openoutq(self) || !nt_outq_splice(&self->outq, fd, length, cb, arg))
+    return false;
+  nt_sockconn_touch(self);
+  _armoutq(self);
+  nt_sockconn_checkout(self);
+  return true;
+}
+
+
+/* Take the connection off its runloop, leaving the socket open */
+static void _detach(nt_sockconn_t *self) {
+  if (self->timers)
+    nt_timerwheel_cancel(self->timers, &self->idletimer);
+  if (self->outev_pending) {
+    event_del(&self->outev);
+    self->outev_pending = false;
+  }
+  if (self->srcev_pending) {
+    event_del(&self->srcev);
+    self->srcev_pending = false;
+  }
+  if (self->zcev_pending) {
+    event_del(&self->zcev);
+    self->zcev_pending = false;
+  }
+  nt_runloop_rmtimer(self->rs->runloop, &self->zctimer);
+  self->readpaused = false;
+  if (self->rxev_pending) {
+    event_del(&self->rxev);
+    self->rxev_pending = false;
+  }
+  _rxrelease(self);
+  self->recvcb = NULL;
+  nt_outq_clear(&self->outq);
+  self->bev.enabled |= EV_WRITE;
+  self->rs->runloop->outbytes -= self->outcounted;
+  self->outcounted = 0;
+  self->outfull = false;
+  nt_runloop_rmsockconn(self->rs->runloop, self);
+}
+
+
+int nt_sockconn_detach(nt_sockconn_t *self) {
+  int fd = self->fd;
+  assert(self->rs != NULL && self->connecting == NULL);
+  _detach(self);
+  evbuffer_drain(self->bev.input, EVBUFFER_LENGTH(self->bev.input));
+  evbuffer_drain(self->bev.output, EVBUFFER_LENGTH(self->bev.output));
+  self->fd = -1;
+  return fd;
+}
+
+
 void nt_sockconn_close(nt_sockconn_t *self) {
   assert(self->rs != NULL);
-  nt_runloop_rmsockconn(self->rs->runloop, self);
+  if (self->connecting) {
+    /* not open yet */
+    nt_connect_cancel(self->connecting);
+    self->connecting = NULL;
+    return;
+  }
+  _detach(self);
   nt_fd_close(&self->fd);
 }
 
@@ -27,33 +27,94 @@
 #include "obj.h"
 #include "sockaddr.h"
 #include "sockserv.h"
+#include "bufchain.h"
+#include "outq.h"
+#include "timerwheel.h"
 #include <event.h>
 
-
-typedef struct nt_sockconn_t {
-  NT_OBJ_HEAD
-  int fd;                       /* socket */
-  nt_sockaddr_t addr;           /* address */
-  nt_sockserv_runloop_t *rs;  /* runloop-server tuple */
-  struct bufferevent bev;       /* buffer event */
-} nt_sockconn_t;
-
+struct nt_sockconn_t;
+struct nt_connect_t;
 
 /**
   Called when there is data for the client to read.
 **/
-typedef void (*nt_sockconn_readcb_t)(struct bufferevent *bev, nt_sockconn_t *client);
+typedef void (*nt_sockconn_readcb_t)(struct bufferevent *bev, struct nt_sockconn_t *client);
 
 /**
   Called when the write buffer reaches 0.
 **/
-typedef void (*nt_sockconn_writecb_t)(struct bufferevent *bev, nt_sockconn_t *client);
+typedef void (*nt_sockconn_writecb_t)(struct bufferevent *bev, struct nt_sockconn_t *client);
 
 /**
   Called when an error occured.
   This callback is responsible for releasing the client.
 **/
-typedef void (*nt_sockconn_errorcb_t)(struct bufferevent *bev, short what, nt_sockconn_t *client);
+typedef void (*nt_sockconn_errorcb_t)(struct bufferevent *bev, short what, struct nt_sockconn_t *client);
+
+/**
+  Called when buffered output reaches the high watermark (@full is true) and
+  when it has drained to the low watermark again (see
+  nt_sockconn_setwatermarks).
+**/
+typedef void (*nt_sockconn_flowcb_t)(struct nt_sockconn_t *conn, bool full, void *arg);
+
+/**
+  Called with the bytes received and not yet consumed (see
+  nt_sockconn_setrecv). @data is valid until the callback returns.
+  
+  @returns the number of bytes consumed; the rest is kept and passed again,
+           followed by more, on the next call
+**/
+typedef size_t (*nt_sockconn_recvcb_t)(struct nt_sockconn_t *conn, const byte_t *data,
+                                       size_t length);
+
+/**
+  Called when nt_sockconn_connect has connected (@error is 0) or failed.
+**/
+typedef void (*nt_sockconn_connectcb_t)(struct nt_sockconn_t *conn, int error, void *arg);
+
+
+typedef struct nt_sockconn_t {
+  NT_OBJ_HEAD
+  int fd;                       /* socket */
+  nt_sockaddr_t addr;           /* address */
+  nt_sockserv_runloop_t *rs;  /* runloop-server tuple */
+  struct bufferevent bev;       /* buffer event */
+  nt_sockconn_readcb_t readcb;
+  nt_sockconn_writecb_t writecb;
+  nt_sockconn_errorcb_t errorcb;
+  nt_timerwheel_t *timers;      /* runloop timers, set by nt_sockconn_setidletimeout */
+  nt_timer_t idletimer;
+  uint64_t idleticks;           /* idle timeout in ticks */
+  uint64_t lastactive;          /* tick of last read or write */
+  bool counted;                 /* counted in the runloop's nconns */
+  nt_outq_t outq;               /* writes ordered after a sendfile or splice */
+  struct event outev;           /* waits for the socket to drain outq */
+  struct event srcev;           /* waits for a splice source */
+  bool outev_pending;
+  bool srcev_pending;
+  bool coalesce;                /* see nt_sockconn_setcoalesce */
+  struct event zcev;            /* reads while zerocopy completions are pending */
+  bool zcev_pending;
+  nt_timer_t zctimer;           /* reaps zerocopy completions every tick */
+  bool readpaused;              /* reading stopped by the output watermarks */
+  struct nt_connect_t *connecting;  /* see nt_sockconn_connect */
+  nt_sockserv_runloop_t connrs; /* runloop of an outbound connection */
+  nt_sockconn_connectcb_t connectcb;
+  void *connectarg;
+  size_t outhigh;               /* see nt_sockconn_setwatermarks */
+  size_t outlow;
+  nt_sockconn_flowcb_t flowcb;
+  void *flowarg;
+  bool outfull;                 /* above outhigh, until drained to outlow */
+  size_t outcounted;            /* output counted in the runloop's outbytes */
+  nt_sockconn_recvcb_t recvcb;  /* see nt_sockconn_setrecv */
+  struct event rxev;            /* socket readable */
+  bool rxev_pending;
+  byte_t *rxslab;               /* slab from the runloop's rxpool, while holding
+                                   a partial message */
+  size_t rxlen;                 /* bytes in rxslab */
+} nt_sockconn_t;
 
 
 /**
@@ -89,6 +150,9 @@ void nt_sockconn_setcb( nt_sockconn_t *self,
 
 /**
   Set read and write timeout in seconds.
+  
+  These are libevent timeouts, re-armed on every read and write. For idle
+  timeouts on many connections, nt_sockconn_setidletimeout is cheaper.
 **/
 NT_STATIC_INLINE
 void nt_sockconn_settimeout(nt_sockconn_t *self, int read, int write) {
@@ -96,6 +160,26 @@ void nt_sockconn_settimeout(nt_sockconn_t *self, int read, int write) {
   self->bev.timeout_write = write;
 }
 
+/**
+  Close the connection (by calling the error callback with EVBUFFER_TIMEOUT)
+  when nothing has been read or written for @seconds.
+  
+  Uses the runloop's timer wheel instead of libevent timeouts, so activity
+  only records the current tick and the timer is checked lazily when it
+  expires. Any timeouts set with nt_sockconn_settimeout are cleared. Must be
+  called after the connection has been added to a runloop (e.g. after
+  nt_sockconn_accept).
+  
+  @param seconds idle timeout, or 0 to disable
+**/
+void nt_sockconn_setidletimeout(nt_sockconn_t *self, unsigned int seconds);
+
+/**
+  Record activity on the connection. Called internally on reads and writes.
+**/
+#define nt_sockconn_touch(self) \
+  do { if ((self)->timers) (self)->lastactive = (self)->timers->now; } while (0)
+
 /**
   Accept a connection.
   
@@ -112,6 +196,135 @@ bool nt_sockconn_accept(nt_sockconn_t *self,
                         nt_sockconn_writecb_t writecb,
                         nt_sockconn_errorcb_t errorcb);
 
+/**
+  Set up a connection for a socket which has already been accepted, e.g.
+  one handed off by a nt_acceptor_t.
+  
+  @param fd      connected, non-blocking socket (see nt_sockutil_acceptnb)
+  @param addr    peer address, or NULL
+  @param readcb  called when there is something to read
+  @param writecb called when there is something to write
+  @param errorcb called when an error occured
+  @returns boolean success
+**/
+bool nt_sockconn_open(nt_sockconn_t *self,
+                      nt_sockserv_runloop_t *rs,
+                      int fd,
+                      const nt_sockaddr_t *addr,
+                      nt_sockconn_readcb_t readcb,
+                      nt_sockconn_writecb_t writecb,
+                      nt_sockconn_errorcb_t errorcb);
+
+/**
+  Connect to the first of @addrs to answer (see nt_connect_start).
+  
+  Callbacks set with nt_sockconn_setcb beforehand are enabled once the
+  connection is established, right before @cb is called. Closing the
+  connection while connecting aborts it without calling @cb.
+  
+  @param timeout_msec give up after this long, or 0 for no limit
+  @returns false with errno set if no attempt could be started
+**/
+bool nt_sockconn_connect(nt_sockconn_t *self, struct nt_runloop_t *runloop,
+                         const nt_sockaddr_t *addrs, size_t naddrs,
+                         unsigned int timeout_msec,
+                         nt_sockconn_connectcb_t cb, void *arg);
+
+/**
+  Receive through @cb instead of the read callback and the bufferevent's
+  input buffer.
+  
+  The socket is read into a slab borrowed from the runloop's rxpool, which
+  goes back to the pool as soon as @cb has consumed everything in it. Only
+  connections in the middle of a message hold a slab, so a large number of
+  idle connections holds no receive buffers at all. A message must fit in
+  a slab (NT_RUNLOOP_RXSLAB_SIZE bytes); if @cb consumes nothing of a full
+  slab, the error callback is called with EVBUFFER_READ|EVBUFFER_ERROR
+  and errno EMSGSIZE. End of file is reported like with a bufferevent.
+  
+  Must be called after the connection has been added to a runloop (e.g.
+  after nt_sockconn_accept), before anything has been read.
+**/
+void nt_sockconn_setrecv(nt_sockconn_t *self, nt_sockconn_recvcb_t cb);
+
+/**
+  Remove the connection from its runloop and take its socket, e.g. to
+  return it to a nt_connpool_t. Buffered input and unsent output are
+  discarded.
+  
+  @returns the socket, which the connection no longer refers to
+**/
+int nt_sockconn_detach(nt_sockconn_t *self);
+
+/**
+  Coalesce writes: with @enable, everything written during a runloop
+  iteration is queued (small writes copied into shared segments, chains and
+  nt_sockconn_writeref buffers referenced) and flushed with one writev()
+  at the end of the iteration, instead of going through the bufferevent.
+  Suits request/response protocols writing a response in several pieces.
+**/
+void nt_sockconn_setcoalesce(nt_sockconn_t *self, bool enable);
+
+/**
+  Send queued output of at least @threshold bytes with MSG_ZEROCOPY (see
+  nt_outq_setzerocopy). Pass large payloads with nt_sockconn_writeref or
+  nt_sockconn_writechain; their memory is released only once the kernel
+  reports it is done with it, which the connection picks up from the
+  socket's error queue before every flush and read, and on every runloop
+  tick while any sends are outstanding.
+  
+  @param threshold minimum size, or 0 to disable
+  @returns false if the socket does not support SO_ZEROCOPY (before Linux
+           4.14, or other platforms)
+**/
+NT_STATIC_INLINE
+bool nt_sockconn_setzerocopy(nt_sockconn_t *self, size_t threshold) {
+  return nt_outq_setzerocopy(&self->outq, self->fd, threshold);
+}
+
+/**
+  Bound the output buffered for a slow reader.
+  
+  When buffered output (the bufferevent's output buffer plus queued data,
+  not counting file and splice transfers) reaches @high bytes, @cb is
+  called with @full true; when it has drained to @low bytes, @cb is called
+  with @full false. Without a callback, the connection stops reading
+  instead, which for a protocol like echo stops the producer too, and
+  resumes at the low watermark.
+  
+  The connection is also considered full, however little it has reached of
+  @high, if it holds more than @low bytes when a write takes the runloop's
+  aggregate (runloop->outbytes) over runloop->outlimit -- so that the
+  connections holding the most are paused first, and no single client can
+  make the process buffer without bound.
+  
+  @param high high watermark, or 0 to only apply the runloop's limit
+  @param low  low watermark, less than @high
+  @param cb   flow callback, or NULL to pause reading
+**/
+void nt_sockconn_setwatermarks(nt_sockconn_t *self, size_t high, size_t low,
+                               nt_sockconn_flowcb_t cb, void *arg);
+
+/**
+  Bytes of output buffered, as compared with the watermarks.
+**/
+NT_STATIC_INLINE size_t nt_sockconn_outlength(nt_sockconn_t *self) {
+  return EVBUFFER_LENGTH(self->bev.output) + nt_outq_length(&self->outq);
+}
+
+/**
+  Update the connection's output accounting and flow state after output has
+  been added or drained. Called internally.
+**/
+void nt_sockconn_checkout(nt_sockconn_t *self);
+
+/**
+  Queue a copy of @data behind queued output and flush it at the end of the
+  runloop iteration. Used by nt_sockconn_write while coalescing or while a
+  transfer is queued.
+**/
+bool nt_sockconn_queuewrite(nt_sockconn_t *self, const void *data, size_t size);
+
 /**
   Send data to the client.
   
@@ -120,7 +333,12 @@ bool nt_sockconn_accept(nt_sockconn_t *self,
 **/
 NT_STATIC_INLINE
 void nt_sockconn_write(nt_sockconn_t *self, const void *data, size_t size) {
-  AZ(bufferevent_write(&self->bev, data, size));
+  nt_sockconn_touch(self);
+  if (nt_outq_empty(&self->outq) && !self->coalesce)
+    AZ(bufferevent_write(&self->bev, data, size));
+  else
+    AN(nt_sockconn_queuewrite(self, data, size));
+  nt_sockconn_checkout(self);
 }
 
 /**
@@ -130,9 +348,66 @@ void nt_sockconn_write(nt_sockconn_t *self, const void *data, size_t size) {
 **/
 NT_STATIC_INLINE
 void nt_sockconn_writebuf(nt_sockconn_t *self, struct evbuffer *buf) {
-  AZ(bufferevent_write_buffer(&self->bev, buf));
+  nt_sockconn_touch(self);
+  if (nt_outq_empty(&self->outq) && !self->coalesce) {
+    AZ(bufferevent_write_buffer(&self->bev, buf));
+  }
+  else {
+    AN(nt_sockconn_queuewrite(self, EVBUFFER_DATA(buf), EVBUFFER_LENGTH(buf)));
+    evbuffer_drain(buf, EVBUFFER_LENGTH(buf));
+  }
+  nt_sockconn_checkout(self);
 }
 
+/**
+  Send the content of a buffer chain to the client.
+  
+  The segments are referenced, not copied, and written with writev() at the
+  end of the runloop iteration. The chain is left as-is.
+  
+  @param chain the chain to send
+**/
+void nt_sockconn_writechain(nt_sockconn_t *self, const nt_bufchain_t *chain);
+
+/**
+  Send @size bytes at @data without copying them.
+  
+  @param freefn called with @data and @arg once the bytes have been written
+                (or the connection closed). May be NULL for memory which
+                outlives the connection.
+  @returns boolean success
+**/
+bool nt_sockconn_writeref(nt_sockconn_t *self, const void *data, size_t size,
+                          nt_bufseg_freefn_t freefn, void *arg);
+
+/**
+  Send @length bytes of file @fd, starting at @offset, without copying them
+  through userspace (sendfile).
+  
+  The transfer is ordered after everything written before it, and anything
+  written after it is queued behind it. The write callback is called once
+  all queued output has been written.
+  
+  @param fd  open file, which must stay open until @cb has been called
+  @param cb  called with @fd and 0 when the range has been sent, or with an
+             error (see nt_outq_donecb_t). May be NULL.
+  @returns boolean success
+**/
+bool nt_sockconn_sendfile(nt_sockconn_t *self, int fd, off_t offset, size_t length,
+                          nt_outq_donecb_t cb, void *arg);
+
+/**
+  Forward @length bytes (or NT_OUTQ_UNTIL_EOF) read from socket @fd to the
+  client through a pipe, without copying them through userspace (splice).
+  Ordered like nt_sockconn_sendfile. Linux only.
+  
+  @param fd  non-blocking socket, which must stay open until @cb has been
+             called and must not be read from by anyone else meanwhile
+  @returns boolean success (false with errno ENOSYS where splice is missing)
+**/
+bool nt_sockconn_splice(nt_sockconn_t *self, int fd, size_t length,
+                        nt_outq_donecb_t cb, void *arg);
+
 /**
   Close a client connection.
 **/
@@ -0,0 +1,134 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "sockopts.h"
+#include "sockaddr.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+const nt_sockopts_t nt_sockopts_default = {
+  NT_SOCKOPTS_REUSEADDR | NT_SOCKOPTS_REUSEPORT,
+  0, 0, 0, 0, 0, 0, -1
+};
+
+const nt_sockopts_t nt_sockopts_latency = {
+  NT_SOCKOPTS_REUSEADDR | NT_SOCKOPTS_REUSEPORT | NT_SOCKOPTS_NODELAY | NT_SOCKOPTS_QUICKACK,
+  0,                  /* backlog */
+  0, 0,               /* rcvbuf, sndbuf */
+  0,                  /* deferaccept */
+  256,                /* fastopen */
+  50,                 /* busypoll */
+  -1                  /* incomingcpu */
+};
+
+const nt_sockopts_t nt_sockopts_throughput = {
+  NT_SOCKOPTS_REUSEADDR | NT_SOCKOPTS_REUSEPORT,
+  0,                  /* backlog */
+  1024 * 1024,        /* rcvbuf */
+  1024 * 1024,        /* sndbuf */
+  1,                  /* deferaccept */
+  0,                  /* fastopen */
+  0,                  /* busypoll */
+  -1                  /* incomingcpu */
+};
+
+
+static bool _set(int fd, int level, int option, int value) {
+  return setsockopt(fd, level, option, (const void *)&value, (socklen_t)sizeof(int)) == 0;
+}
+
+
+static bool _istcp(int fd) {
+  int type = 0;
+  socklen_t len = sizeof(type);
+  return getsockopt(fd, SOL_SOCKET, SO_TYPE, (void *)&type, &len) == 0 && type == SOCK_STREAM;
+}
+
+
+static bool _isinet(int fd) {
+  nt_sockaddr_t sa;
+  socklen_t len = sizeof(sa);
+  memset((void *)&sa, 0, sizeof(sa));
+  return getsockname(fd, (struct sockaddr *)&sa, &len) == 0 &&
+         (sa.ss_family == AF_INET || sa.ss_family == AF_INET6);
+}
+
+
+/* The reuse flags are hints, as they always were -- not every family or
+   system takes them */
+static void _setreuse(const nt_sockopts_t *self, int fd) {
+  if ((self->flags & NT_SOCKOPTS_REUSEADDR) && !_set(fd, SOL_SOCKET, SO_REUSEADDR, 1))
+    nt_warn("setsockopt SO_REUSEADDR");
+  if (!(self->flags & NT_SOCKOPTS_REUSEPORT) || !_isinet(fd))
+    return;
+  #ifdef SO_REUSEPORT
+  if (!_set(fd, SOL_SOCKET, SO_REUSEPORT, 1))
+    nt_warn("setsockopt SO_REUSEPORT");
+  #endif
+  #ifdef SO_REUSESHAREUID
+  // APPLE: Allow reuse of port/socket by different userids
+  if (!_set(fd, SOL_SOCKET, SO_REUSESHAREUID, 1))
+    nt_warn("setsockopt SO_REUSESHAREUID");
+  #endif
+}
+
+
+bool nt_sockopts_setlistener(const nt_sockopts_t *self, int fd) {
+  _setreuse(self, fd);
+  
+  /* set before listen, so that the TCP window scale is chosen accordingly */
+  if (self->rcvbuf && !_set(fd, SOL_SOCKET, SO_RCVBUF, self->rcvbuf))
+    return false;
+  if (self->sndbuf && !_set(fd, SOL_SOCKET, SO_SNDBUF, self->sndbuf))
+    return false;
+  
+  /* the rest are hints */
+  #ifdef SO_BUSY_POLL
+  if (self->busypoll)
+    _set(fd, SOL_SOCKET, SO_BUSY_POLL, self->busypoll);
+  #endif
+  #ifdef SO_INCOMING_CPU
+  if (self->incomingcpu != -1)
+    _set(fd, SOL_SOCKET, SO_INCOMING_CPU, self->incomingcpu);
+  #endif
+  if ((self->deferaccept || self->fastopen) && _istcp(fd)) {
+    #ifdef TCP_DEFER_ACCEPT
+    if (self->deferaccept)
+      _set(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, self->deferaccept);
+    #endif
+    #ifdef TCP_FASTOPEN
+    if (self->fastopen)
+      _set(fd, IPPROTO_TCP, TCP_FASTOPEN, self->fastopen);
+    #endif
+  }
+  return true;
+}
+
+
+void nt_sockopts_setconn(const nt_sockopts_t *self, int fd) {
+  if (self->flags & NT_SOCKOPTS_NODELAY)
+    _set(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+  #ifdef TCP_QUICKACK
+  /* not sticky -- the kernel may go back to delayed ACKs later on */
+  if (self->flags & NT_SOCKOPTS_QUICKACK)
+    _set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+  #endif
+}
@@ -0,0 +1,111 @@
+/**
+  Socket option profiles.
+  
+  A nt_sockopts_t describes how listening sockets are set up and which
+  options accepted connections get. Attach one to a server before binding
+  it and every connection the library accepts from it inherits the
+  connection options:
+  
+    nt_sockopts_t opts = nt_sockopts_latency;
+    opts.backlog = 4096;
+    nt_sockserv_setopts(server, &opts);
+    nt_sockserv_bind(server, "", 8080, SOCK_STREAM, AF_UNSPEC);
+  
+  Start from one of the presets rather than a zeroed struct, since some
+  fields use -1 for "leave alone".
+  
+  Options which only tune performance (TCP_DEFER_ACCEPT, TCP_FASTOPEN,
+  TCP_QUICKACK, SO_BUSY_POLL and SO_INCOMING_CPU) are applied where the
+  system has them, and a refusal -- e.g. TCP_FASTOPEN disabled by sysctl, or
+  SO_BUSY_POLL above net.core.busy_read without CAP_NET_ADMIN -- is ignored.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_SOCKOPTS_H_
+#define _NT_SOCKOPTS_H_
+
+#include <sys/socket.h>
+
+/* Flags */
+#define NT_SOCKOPTS_REUSEADDR 0x01  /* SO_REUSEADDR on listeners */
+#define NT_SOCKOPTS_REUSEPORT 0x02  /* SO_REUSEPORT on listeners */
+#define NT_SOCKOPTS_NODELAY   0x04  /* TCP_NODELAY on connections */
+#define NT_SOCKOPTS_QUICKACK  0x08  /* TCP_QUICKACK on connections */
+
+typedef struct nt_sockopts_t {
+  int flags;          /* NT_SOCKOPTS_* */
+  int backlog;        /* listen backlog, or 0 for SOMAXCONN */
+  int rcvbuf;         /* SO_RCVBUF in bytes, or 0 to let the kernel tune it */
+  int sndbuf;         /* SO_SNDBUF in bytes, or 0 to let the kernel tune it */
+  int deferaccept;    /* TCP_DEFER_ACCEPT: seconds to wait for the client's
+                         first data before accept sees the connection, or 0 */
+  int fastopen;       /* TCP_FASTOPEN queue length on listeners, or 0 */
+  int busypoll;       /* SO_BUSY_POLL in microseconds, or 0 */
+  int incomingcpu;    /* SO_INCOMING_CPU for listeners, or -1 */
+} nt_sockopts_t;
+
+/**
+  What sockets got before profiles existed: SO_REUSEADDR, SO_REUSEPORT and
+  a backlog of SOMAXCONN. Servers use this unless told otherwise.
+**/
+extern const nt_sockopts_t nt_sockopts_default;
+
+/**
+  For request/response traffic: Nagle off, immediate ACKs, TCP Fast Open
+  and a short busy poll of the receive queue.
+**/
+extern const nt_sockopts_t nt_sockopts_latency;
+
+/**
+  For bulk transfers: 1 MB socket buffers (which turns off the kernel's
+  buffer autotuning -- that is the point) and TCP_DEFER_ACCEPT, so that
+  connections only wake a runloop once the client has sent something.
+  Not for protocols where the server speaks first.
+**/
+extern const nt_sockopts_t nt_sockopts_throughput;
+
+/**
+  Apply the listener options (reuse flags, buffer sizes, TCP_DEFER_ACCEPT,
+  TCP_FASTOPEN, SO_BUSY_POLL and SO_INCOMING_CPU) to @fd, which has not yet
+  been bound. Options for TCP only are skipped for other sockets, and
+  SO_REUSEPORT for sockets other than AF_INET and AF_INET6. Reuse flags
+  which cannot be set only give a warning. Buffer sizes and SO_BUSY_POLL
+  are inherited by accepted sockets.
+  
+  @returns false if a buffer size could not be set
+**/
+bool nt_sockopts_setlistener(const nt_sockopts_t *self, int fd);
+
+/**
+  Apply the connection options (TCP_NODELAY and TCP_QUICKACK) to an
+  accepted socket. Called by nt_sockserv_acceptv, nt_sockconn_accept and
+  nt_acceptor_t for connections from a server with a profile.
+**/
+void nt_sockopts_setconn(const nt_sockopts_t *self, int fd);
+
+/**
+  Listen backlog of @self.
+**/
+NT_STATIC_INLINE int nt_sockopts_backlog(const nt_sockopts_t *self) {
+  return self->backlog ? self->backlog : SOMAXCONN;
+}
+
+#endif
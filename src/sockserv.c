@@ -25,6 +25,13 @@
 #include <netinet/in.h>
 #include <netdb.h>
 
+#if defined(__linux__)
+  #include <linux/filter.h>
+  #if defined(SO_ATTACH_REUSEPORT_CBPF)
+    #define HAVE_REUSEPORT_CBPF 1
+  #endif
+#endif
+
 #ifndef IPPROTO_IPV4
 #define IPPROTO_IPV4 IPPROTO_IPIP
 #endif
@@ -44,10 +51,55 @@ nt_sockserv_t *nt_sockserv_new(nt_sockserv_on_accept_t on_accept) {
   self->fd4 = -1;
   self->fd6 = -1;
   self->on_accept = on_accept;
+  memcpy((void *)&self->opts, (const void *)&nt_sockopts_default, sizeof(nt_sockopts_t));
   return self;
 }
 
 
+void nt_sockserv_setopts(nt_sockserv_t *self, const nt_sockopts_t *opts) {
+  assert(self->fd4 == -1 && self->fd6 == -1);
+  memcpy((void *)&self->opts, (const void *)opts, sizeof(nt_sockopts_t));
+}
+
+
+void nt_sockserv_setacceptv(nt_sockserv_t *self, nt_sockserv_on_acceptv_t on_acceptv,
+                            size_t batch)
+{
+  assert(self->ev4 == NULL && self->ev6 == NULL);
+  self->on_acceptv = on_acceptv;
+  self->accept_batch = batch ? batch : NT_SOCKSERV_ACCEPTV_MAX;
+}
+
+
+void nt_sockserv_acceptv(int fd, short ev, nt_sockserv_runloop_t *rs) {
+  nt_sockserv_t *self = rs->server;
+  nt_sockaddr_t addrs[NT_SOCKSERV_ACCEPTV_MAX];
+  int fds[NT_SOCKSERV_ACCEPTV_MAX];
+  size_t n = 0, total = 0;
+  
+  /* drain the backlog, up to the batch limit */
+  while (total < self->accept_batch) {
+    if ((fds[n] = nt_sockutil_acceptnb(fd, &addrs[n])) == -1) {
+      /* interrupted, or the connection was reset while in the backlog --
+         the rest of the backlog is still there */
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        nt_warn("accept");
+      break;
+    }
+    nt_sockopts_setconn(&self->opts, fds[n]);
+    total++;
+    if (++n == NT_SOCKSERV_ACCEPTV_MAX) {
+      self->on_acceptv(rs, fds, addrs, n);
+      n = 0;
+    }
+  }
+  if (n)
+    self->on_acceptv(rs, fds, addrs, n);
+}
+
+
 bool nt_sockserv_bindtoaddr(nt_sockserv_t *self, const nt_sockaddr_t *sa, int type) {
   int *fd;
   
@@ -61,7 +113,7 @@ bool nt_sockserv_bindtoaddr(nt_sockserv_t *self, const nt_sockaddr_t *sa, int ty
     return false;
   
   // Bind to sa
-  if (nt_sockutil_bind(*fd, sa) != 0) {
+  if (nt_sockutil_bindopts(*fd, sa, &self->opts) != 0) {
     nt_fd_close(fd);
     return false;
   }
@@ -83,7 +135,7 @@ bool nt_sockserv_bind(nt_sockserv_t *self, const char *addr, int port, int type,
   
   assert(self != NULL);
   assert(addr != NULL);
-  assert(self->on_accept != NULL);
+  assert(self->on_accept != NULL || self->on_acceptv != NULL);
   
   // Setup getaddrinfo hints
   memset(&hints, 0, sizeof(hints));
@@ -118,9 +170,48 @@ bool nt_sockserv_bind(nt_sockserv_t *self, const char *addr, int port, int type,
 
 
 bool nt_sockserv_listen(nt_sockserv_t *self) {
-  if (self->fd4 != -1 && listen(self->fd4, SOMAXCONN) == -1)
+  int backlog = nt_sockopts_backlog(&self->opts);
+  if (self->fd4 != -1 && listen(self->fd4, backlog) == -1)
+    return false;
+  if (self->fd6 != -1 && listen(self->fd6, backlog) == -1)
+    return false;
+  return (self->fd4 != -1 || self->fd6 != -1);
+}
+
+
+bool nt_sockserv_steerbycpu(nt_sockserv_t *self, const int *cpus, size_t count) {
+  #if HAVE_REUSEPORT_CBPF
+  struct sock_filter code[NT_SOCKSERV_STEER_MAX * 2 + 3], *p = code;
+  struct sock_fprog prog;
+  size_t i;
+  
+  if (count == 0 || count > NT_SOCKSERV_STEER_MAX) {
+    errno = EINVAL;
+    return false;
+  }
+  
+  /* A = the CPU handling the packet */
+  *p++ = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+  /* if A == cpus[i] return i */
+  for (i = 0; i < count; i++) {
+    *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, (uint32_t)cpus[i], 0, 1);
+    *p++ = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, (uint32_t)i);
+  }
+  /* CPUs without a listener are spread over all of them */
+  *p++ = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, (uint32_t)count);
+  *p++ = (struct sock_filter)BPF_STMT(BPF_RET|BPF_A, 0);
+  
+  prog.len = (unsigned short)(p - code);
+  prog.filter = code;
+  if (self->fd4 != -1 &&
+      setsockopt(self->fd4, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1)
     return false;
-  if (self->fd6 != -1 && listen(self->fd6, SOMAXCONN) == -1)
+  if (self->fd6 != -1 &&
+      setsockopt(self->fd6, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1)
     return false;
   return (self->fd4 != -1 || self->fd6 != -1);
+  #else
+  errno = ENOTSUP;
+  return false;
+  #endif
 }
@@ -26,6 +26,7 @@
 
 #include "obj.h"
 #include "sockaddr.h"
+#include "sockopts.h"
 #include <event.h>
 #include <sys/socket.h>
 
@@ -40,6 +41,23 @@ typedef struct nt_sockserv_runloop_t {
 **/
 typedef void (*nt_sockserv_on_accept_t)(int fd, short ev, nt_sockserv_runloop_t *bs);
 
+/**
+  Called with a batch of accepted connections (see nt_sockserv_setacceptv).
+  
+  @param fds   accepted sockets, non-blocking and close-on-exec. The callback
+               owns them.
+  @param addrs peer address of each socket
+  @param count number of sockets
+**/
+typedef void (*nt_sockserv_on_acceptv_t)(nt_sockserv_runloop_t *rs, const int *fds,
+                                         const nt_sockaddr_t *addrs, size_t count);
+
+/* Maximum number of connections delivered in one nt_sockserv_on_acceptv_t call */
+#define NT_SOCKSERV_ACCEPTV_MAX 64
+
+/* Maximum number of listeners nt_sockserv_steerbycpu can steer to */
+#define NT_SOCKSERV_STEER_MAX 1024
+
 /**
   Server object.
 **/
@@ -60,8 +78,13 @@ typedef struct nt_sockserv_t {
   
   /* Callbacks */
   nt_sockserv_on_accept_t on_accept;
+  nt_sockserv_on_acceptv_t on_acceptv;
+  size_t accept_batch;  /* max connections accepted per readiness event */
   struct timeval accept_timeout;
   
+  /* Socket options, see nt_sockserv_setopts */
+  nt_sockopts_t opts;
+  
 } nt_sockserv_t;
 
 /**
@@ -71,6 +94,35 @@ typedef struct nt_sockserv_t {
 **/
 nt_sockserv_t *nt_sockserv_new(nt_sockserv_on_accept_t on_accept);
 
+/**
+  Let the library accept connections.
+  
+  Instead of calling on_accept for every readiness event, the runloop calls
+  nt_sockserv_acceptv, which accepts up to @batch pending connections with
+  accept4(SOCK_NONBLOCK|SOCK_CLOEXEC) (or accept and fcntl where accept4 is
+  not available) and passes them to @on_acceptv in groups of at most
+  NT_SOCKSERV_ACCEPTV_MAX. Must be called before the server is added to a
+  runloop.
+  
+  @param on_acceptv callback
+  @param batch      max connections per readiness event, or 0 for
+                    NT_SOCKSERV_ACCEPTV_MAX
+**/
+void nt_sockserv_setacceptv(nt_sockserv_t *self, nt_sockserv_on_acceptv_t on_acceptv,
+                            size_t batch);
+
+/**
+  Use the socket options in @opts (copied) instead of nt_sockopts_default.
+  Must be called before the server is bound. Connections accepted by the
+  library get the connection options of the profile.
+**/
+void nt_sockserv_setopts(nt_sockserv_t *self, const nt_sockopts_t *opts);
+
+/**
+  Accept handler used for servers with an on_acceptv callback.
+**/
+void nt_sockserv_acceptv(int fd, short ev, nt_sockserv_runloop_t *rs);
+
 /**
   Bind server to a specific address.
   
@@ -102,8 +154,29 @@ bool nt_sockserv_bind(nt_sockserv_t *self, const char *addr, int port, int type,
 
 
 /**
-  Listen for incoming connections.
+  Listen for incoming connections, with the backlog of the server's
+  socket options.
 **/
 bool nt_sockserv_listen(nt_sockserv_t *self);
 
+/**
+  Steer connections to the listener on the CPU which received them.
+  
+  @self is one of @count servers bound to the same address with
+  SO_REUSEPORT (e.g. by nt_runloop_group_listen), and the listener bound
+  i:th in that group is run by a thread pinned to @cpus[i]. Attaches a
+  classic BPF program (SO_ATTACH_REUSEPORT_CBPF) to the group, which picks
+  the listener for each new connection by the CPU handling its SYN -- the
+  one whose NIC queue received it -- so that the kernel's and the runloop's
+  processing of a connection stay on one core. Connections arriving on
+  other CPUs are spread by CPU number.
+  
+  The program maps to listeners by position, so it is no longer right once
+  a listener in the group has been closed.
+  
+  @returns false with ENOTSUP where the kernel has no
+           SO_ATTACH_REUSEPORT_CBPF (before Linux 4.5, and other systems)
+**/
+bool nt_sockserv_steerbycpu(nt_sockserv_t *self, const int *cpus, size_t count);
+
 #endif
@@ -28,6 +28,8 @@
 #include <netinet/tcp.h>
 #include <sys/ioctl.h>
 #include <sys/un.h>
+#include <fcntl.h>
+#include <netdb.h>
 
 
 int nt_sockutil_socket(int type, int family) {
@@ -49,35 +51,25 @@ int nt_sockutil_socket(int type, int family) {
 
 
 int nt_sockutil_bind(int fd, const nt_sockaddr_t *sa) {
+  return nt_sockutil_bindopts(fd, sa, &nt_sockopts_default);
+}
+
+
+int nt_sockutil_bindopts(int fd, const nt_sockaddr_t *sa, const nt_sockopts_t *opts) {
   int rc;
   socklen_t salen;
   
-  // Reuse address
-  nt_sockutil_setiopt(fd, SOL_SOCKET, SO_REUSEADDR, 1);
-  
-  // Reuse port
-  #ifdef SO_REUSEPORT
-  nt_sockutil_setiopt(fd, SOL_SOCKET, SO_REUSEPORT, 1);
-  #endif
-  
-  // APPLE: Allow reuse of port/socket by different userids
-  #ifdef SO_REUSESHAREUID
-  nt_sockutil_setiopt(fd, SOL_SOCKET, SO_REUSESHAREUID, 1);
-  #endif
+  if (!nt_sockopts_setlistener(opts, fd)) {
+    nt_warn("setsockopt");
+    return -1;
+  }
   
   // Set non-blocking
   nt_sockutil_setblocking(fd, false);
   
-  /* Don't delay send to coalesce packets (disable the Nagle algorithm) */
-  /*if ( !blocking && !nt_tcp_socket_setiopt(self, IPPROTO_TCP, TCP_NODELAY, 1)) {
-    perror("setsockopt IPPROTO_TCP TCP_NODELAY 1 in nt_tcp_socket_bind()");
-    nt_tcp_socket_close(self);
-    return false;
-  }*/
-  
   if (sa->ss_family == AF_UNIX)
     salen = sizeof(struct sockaddr_un);
-  if (sa->ss_family == AF_INET6)
+  else if (sa->ss_family == AF_INET6)
     salen = sizeof(struct sockaddr_in6);
   else
     salen = sizeof(struct sockaddr_in);
@@ -86,3 +78,74 @@ int nt_sockutil_bind(int fd, const nt_sockaddr_t *sa) {
     nt_warn("bind");
   return rc;
 }
+
+
+int nt_sockutil_acceptnb(int fd, nt_sockaddr_t *sa) {
+  socklen_t saz = sizeof(nt_sockaddr_t);
+  #ifdef SOCK_NONBLOCK
+  return accept4(fd, (struct sockaddr *)sa, &saz, SOCK_NONBLOCK|SOCK_CLOEXEC);
+  #else
+  int cfd;
+  if ((cfd = accept(fd, (struct sockaddr *)sa, &saz)) == -1)
+    return -1;
+  if (fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK) == -1 ||
+      fcntl(cfd, F_SETFD, FD_CLOEXEC) == -1) {
+    nt_fd_close(&cfd);
+    return -1;
+  }
+  return cfd;
+  #endif
+}
+
+
+int nt_sockutil_connectnb(const nt_sockaddr_t *sa) {
+  int fd, error;
+  #ifdef SOCK_NONBLOCK
+  if ((fd = socket(sa->ss_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, IPPROTO_TCP)) == -1)
+    return -1;
+  #else
+  if ((fd = socket(sa->ss_family, SOCK_STREAM, IPPROTO_TCP)) == -1)
+    return -1;
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1 ||
+      fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  #endif
+  if (connect(fd, (const struct sockaddr *)sa, nt_sockaddr_len(sa)) == -1 &&
+      errno != EINPROGRESS) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+
+size_t nt_sockutil_getaddrs(const char *host, int port, int family,
+                            nt_sockaddr_t *addrs, size_t maxaddrs)
+{
+  struct addrinfo hints, *res, *ai;
+  char strport[12];
+  size_t n = 0;
+  int rv;
+  
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  snprintf(strport, sizeof(strport), "%d", port);
+  if ((rv = getaddrinfo(host, strport, &hints, &res)) != 0) {
+    nt_warn("getaddrinfo: %s", gai_strerror(rv));
+    return 0;
+  }
+  for (ai = res; ai && n < maxaddrs; ai = ai->ai_next) {
+    if (ai->ai_family == AF_INET || ai->ai_family == AF_INET6)
+      memcpy((void *)&addrs[n++], (const void *)ai->ai_addr, ai->ai_addrlen);
+  }
+  freeaddrinfo(res);
+  return n;
+}
@@ -26,6 +26,7 @@
 
 #include "fd.h" /* nt_fd_close() etc */
 #include "sockaddr.h"
+#include "sockopts.h"
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/un.h>
@@ -84,7 +85,7 @@ NT_STATIC_INLINE void nt_sockutil_setblocking(int fd, bool blocking) {
 }
 
 /**
-  Bind socket @fd to address @sa.
+  Bind socket @fd to address @sa, with the options of nt_sockopts_default.
   
   @param fd socket.
   @param sa address.
@@ -92,6 +93,14 @@ NT_STATIC_INLINE void nt_sockutil_setblocking(int fd, bool blocking) {
 **/
 int nt_sockutil_bind(int fd, const nt_sockaddr_t *sa);
 
+/**
+  Make @fd non-blocking, apply the listener options of @opts and bind it to
+  address @sa.
+  
+  @returns see documentation of bind(). Fails if @opts could not be applied.
+**/
+int nt_sockutil_bindopts(int fd, const nt_sockaddr_t *sa, const nt_sockopts_t *opts);
+
 /**
   Check if socket is listening or not.
   
@@ -115,6 +124,37 @@ NT_STATIC_INLINE int nt_sockutil_accept(int fd, nt_sockaddr_t *sa) {
   return accept(fd, (struct sockaddr *)sa, &saz);
 }
 
+/**
+  Accept a connection as a non-blocking, close-on-exec socket.
+  
+  Uses a single accept4() call where available.
+  
+  @param fd server socket.
+  @param sa a value-return parameter which is the client address.
+  @returns open client socket on success or -1 on failure.
+**/
+int nt_sockutil_acceptnb(int fd, nt_sockaddr_t *sa);
+
+/**
+  Start connecting a non-blocking, close-on-exec TCP socket to @sa.
+  
+  The connection is established (or has failed) when the socket becomes
+  writable; SO_ERROR then tells which.
+  
+  @returns the socket, or -1 with errno set if connect failed right away.
+**/
+int nt_sockutil_connectnb(const nt_sockaddr_t *sa);
+
+/**
+  Resolve @host with getaddrinfo (blocking) into at most @maxaddrs TCP
+  addresses, in the order getaddrinfo returned them.
+  
+  @param family AF_INET, AF_INET6 or AF_UNSPEC for both
+  @returns number of addresses, or 0 if @host could not be resolved
+**/
+size_t nt_sockutil_getaddrs(const char *host, int port, int family,
+                            nt_sockaddr_t *addrs, size_t maxaddrs);
+
 /**
   Shutdown a socket.
   
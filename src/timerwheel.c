@@ -0,0 +1,130 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "timerwheel.h"
+
+#define BITS  NT_TIMERWHEEL_LEVELBITS
+#define MASK  (NT_TIMERWHEEL_SLOTS - 1)
+
+/* Slot of tick @t on @level */
+#define INDEX(t, level) (((t) >> ((level) * BITS)) & MASK)
+
+
+void nt_timerwheel_init(nt_timerwheel_t *self, uint64_t now) {
+  memset(self, 0, sizeof(nt_timerwheel_t));
+  self->now = now;
+}
+
+
+/* Put @timer in the slot matching its expiry, relative to self->now */
+static void _insert(nt_timerwheel_t *self, nt_timer_t *timer) {
+  uint64_t expires = timer->expires;
+  uint64_t delta = expires - self->now;
+  nt_timer_t **head;
+  int level;
+  
+  if ((int64_t)delta < 0) {
+    /* already due -- run at the next tick */
+    expires = self->now;
+    delta = 0;
+  }
+  else if (delta > NT_TIMERWHEEL_MAXTICKS) {
+    expires = timer->expires = self->now + NT_TIMERWHEEL_MAXTICKS;
+    delta = NT_TIMERWHEEL_MAXTICKS;
+  }
+  
+  for (level = 0; level < NT_TIMERWHEEL_LEVELS - 1; level++) {
+    if (delta < (1ULL << ((level + 1) * BITS)))
+      break;
+  }
+  
+  head = &self->slots[level][INDEX(expires, level)];
+  if ((timer->next = *head))
+    timer->next->pprev = &timer->next;
+  timer->pprev = head;
+  *head = timer;
+}
+
+
+void nt_timerwheel_add(nt_timerwheel_t *self, nt_timer_t *timer, uint64_t ticks) {
+  nt_timerwheel_cancel(self, timer);
+  timer->expires = self->now + ticks;
+  _insert(self, timer);
+  self->count++;
+}
+
+
+/* Re-insert all timers of a slot on an outer level, moving them inward */
+static void _cascade(nt_timerwheel_t *self, int level, int index) {
+  nt_timer_t *timer = self->slots[level][index], *next;
+  self->slots[level][index] = NULL;
+  for (; timer; timer = next) {
+    next = timer->next;
+    _insert(self, timer);
+  }
+}
+
+
+size_t nt_timerwheel_advance(nt_timerwheel_t *self, uint64_t now) {
+  size_t expired = 0;
+  
+  if (self->count == 0) {
+    /* nothing to do for the ticks in between */
+    if ((int64_t)(now - self->now) >= 0)
+      self->now = now + 1;
+    return 0;
+  }
+  
+  while ((int64_t)(now - self->now) >= 0) {
+    int index = INDEX(self->now, 0);
+    int level;
+    nt_timer_t **head, *timer;
+    
+    /* when a level wraps, pull the next slot of the level above inward */
+    for (level = 1; level < NT_TIMERWHEEL_LEVELS; level++) {
+      if (INDEX(self->now, level - 1) != 0)
+        break;
+      _cascade(self, level, INDEX(self->now, level));
+    }
+    
+    head = &self->slots[0][index];
+    self->now++;
+    
+    while ((timer = *head)) {
+      if ((*head = timer->next))
+        timer->next->pprev = head;
+      timer->next = NULL;
+      timer->pprev = NULL;
+      self->count--;
+      expired++;
+      timer->cb(timer, timer->arg);
+    }
+    
+    if (self->count == 0) {
+      if ((int64_t)(now - self->now) >= 0)
+        self->now = now + 1;
+      break;
+    }
+  }
+  
+  return expired;
+}
+
@@ -0,0 +1,114 @@
+/**
+  Hierarchical timing wheel.
+  
+  Timers are kept in buckets indexed by their expiry tick, over four levels
+  of 64 buckets each (the first level covers the next 64 ticks, the second
+  the next 64*64 ticks, and so on). Adding, cancelling and re-arming a timer
+  are O(1); timers on outer levels are moved inward ("cascaded") as time
+  reaches them. Timers further away than 2^24 ticks expire at 2^24 ticks.
+  
+  The wheel has no notion of wall time -- the owner decides how long a tick
+  is and calls nt_timerwheel_advance() as time passes. nt_runloop_t owns a
+  wheel ticking every NT_RUNLOOP_TICK_MSEC (see nt_runloop_addtimer).
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_TIMERWHEEL_H_
+#define _NT_TIMERWHEEL_H_
+
+#define NT_TIMERWHEEL_LEVELS     4
+#define NT_TIMERWHEEL_LEVELBITS  6
+#define NT_TIMERWHEEL_SLOTS      (1 << NT_TIMERWHEEL_LEVELBITS)
+#define NT_TIMERWHEEL_MAXTICKS \
+  ((1ULL << (NT_TIMERWHEEL_LEVELS * NT_TIMERWHEEL_LEVELBITS)) - 1)
+
+struct nt_timer_t;
+
+/**
+  Called when a timer expires. The timer is no longer pending and may be
+  added again from the callback.
+**/
+typedef void (*nt_timer_cb_t)(struct nt_timer_t *timer, void *arg);
+
+/**
+  A timer. Usually embedded in the struct it times out.
+**/
+typedef struct nt_timer_t {
+  struct nt_timer_t *next;
+  struct nt_timer_t **pprev;  /* NULL when not pending */
+  uint64_t expires;           /* tick */
+  nt_timer_cb_t cb;
+  void *arg;
+} nt_timer_t;
+
+typedef struct nt_timerwheel_t {
+  uint64_t now;               /* next tick to process */
+  size_t count;               /* number of pending timers */
+  nt_timer_t *slots[NT_TIMERWHEEL_LEVELS][NT_TIMERWHEEL_SLOTS];
+} nt_timerwheel_t;
+
+/**
+  Initialize a timer.
+**/
+NT_STATIC_INLINE void nt_timer_init(nt_timer_t *timer, nt_timer_cb_t cb, void *arg) {
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->expires = 0;
+  timer->cb = cb;
+  timer->arg = arg;
+}
+
+#define nt_timer_pending(timer) ((timer)->pprev != NULL)
+
+/**
+  Initialize a wheel.
+  
+  @param now current tick.
+**/
+void nt_timerwheel_init(nt_timerwheel_t *self, uint64_t now);
+
+/**
+  Add @timer to expire @ticks ticks from now. Re-arms the timer if it is
+  already pending. O(1).
+**/
+void nt_timerwheel_add(nt_timerwheel_t *self, nt_timer_t *timer, uint64_t ticks);
+
+/**
+  Cancel a pending timer. Does nothing if the timer is not pending. O(1).
+**/
+NT_STATIC_INLINE void nt_timerwheel_cancel(nt_timerwheel_t *self, nt_timer_t *timer) {
+  if (timer->pprev) {
+    if ((*timer->pprev = timer->next))
+      timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    self->count--;
+  }
+}
+
+/**
+  Run all timers which expire at or before tick @now.
+  
+  @returns number of timers which expired.
+**/
+size_t nt_timerwheel_advance(nt_timerwheel_t *self, uint64_t now);
+
+#endif
@@ -0,0 +1,399 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "uring.h"
+#include "atomic.h"
+#include "mpool.h"
+
+#if NT_HAVE_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static int _enter(int fd, unsigned int tosubmit, unsigned int mincomplete, unsigned int flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, tosubmit, mincomplete, flags, NULL, 0);
+}
+
+static int _register(int fd, unsigned int opcode, void *arg, unsigned int nargs) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+
+bool nt_uring_init(nt_uring_t *self, unsigned int entries) {
+  struct io_uring_params p;
+  byte_t *sq, *cq;
+  
+  memset((void *)self, 0, sizeof(nt_uring_t));
+  memset((void *)&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CLAMP;
+  if ((self->fd = (int)syscall(__NR_io_uring_setup, entries, &p)) == -1)
+    return false;
+  
+  self->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  self->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (self->cqmapsize > self->sqmapsize)
+      self->sqmapsize = self->cqmapsize;
+    self->cqmapsize = self->sqmapsize;
+  }
+  sq = (byte_t *)mmap(NULL, self->sqmapsize, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, self->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    goto fail;
+  self->sqmap = sq;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cq = sq;
+  }
+  else {
+    cq = (byte_t *)mmap(NULL, self->cqmapsize, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, self->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      goto fail;
+    self->cqmap = cq;
+  }
+  self->sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+  self->sqes = mmap(NULL, self->sqessize, PROT_READ|PROT_WRITE,
+                    MAP_SHARED|MAP_POPULATE, self->fd, IORING_OFF_SQES);
+  if (self->sqes == MAP_FAILED) {
+    self->sqes = NULL;
+    goto fail;
+  }
+  
+  self->sqhead = (unsigned int *)(sq + p.sq_off.head);
+  self->sqtail = (unsigned int *)(sq + p.sq_off.tail);
+  self->sqmask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  self->sqflags = (unsigned int *)(sq + p.sq_off.flags);
+  self->sqarray = (unsigned int *)(sq + p.sq_off.array);
+  self->cqhead = (unsigned int *)(cq + p.cq_off.head);
+  self->cqtail = (unsigned int *)(cq + p.cq_off.tail);
+  self->cqmask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  self->cqes = (void *)(cq + p.cq_off.cqes);
+  return true;
+
+fail:
+  nt_uring_destroy(self);
+  return false;
+}
+
+
+void nt_uring_destroy(nt_uring_t *self) {
+  if (self->sqes)
+    munmap(self->sqes, self->sqessize);
+  if (self->cqmap)
+    munmap(self->cqmap, self->cqmapsize);
+  if (self->sqmap)
+    munmap(self->sqmap, self->sqmapsize);
+  if (self->fd != -1)
+    close(self->fd);
+  self->sqes = self->cqmap = self->sqmap = NULL;
+  self->fd = -1;
+}
+
+
+int nt_uring_submit(nt_uring_t *self) {
+  int n;
+  if (self->queued == 0)
+    return 0;
+  if ((n = _enter(self->fd, self->queued, 0, 0)) > 0)
+    self->queued -= (unsigned int)n;
+  return n;
+}
+
+
+int nt_uring_reap(nt_uring_t *self) {
+  struct io_uring_cqe *cqes = (struct io_uring_cqe *)self->cqes;
+  unsigned int head, tail, mask = *self->cqmask;
+  int count = 0;
+  
+  for (;;) {
+    head = *self->cqhead;
+    tail = nt_atomic_load32(self->cqtail);
+    if (head == tail) {
+      /* completions the kernel could not fit in the ring are flushed on enter */
+      if (!(nt_atomic_load32(self->sqflags) & IORING_SQ_CQ_OVERFLOW))
+        break;
+      _enter(self->fd, 0, 0, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+    while (head != tail) {
+      struct io_uring_cqe *cqe = &cqes[head & mask];
+      nt_uring_op_t *op = (nt_uring_op_t *)(uintptr_t)cqe->user_data;
+      int res = cqe->res;
+      unsigned int flags = cqe->flags & ~0xffffU;
+      if (cqe->flags & IORING_CQE_F_BUFFER)
+        flags |= NT_URING_F_BUFFER;
+      if (cqe->flags & IORING_CQE_F_MORE)
+        flags |= NT_URING_F_MORE;
+      /* free the slot before the callback, which might queue more work */
+      nt_atomic_store32(self->cqhead, ++head);
+      count++;
+      if (op)
+        op->cb(op, res, flags);
+    }
+  }
+  
+  return count;
+}
+
+
+/* Next free submission queue entry, submitting queued ones if the ring is full */
+static struct io_uring_sqe *_getsqe(nt_uring_t *self) {
+  unsigned int tail = *self->sqtail, mask = *self->sqmask;
+  struct io_uring_sqe *sqe;
+  
+  if (tail - nt_atomic_load32(self->sqhead) > mask) {
+    if (nt_uring_submit(self) <= 0 || tail - nt_atomic_load32(self->sqhead) > mask)
+      return NULL;
+  }
+  sqe = &((struct io_uring_sqe *)self->sqes)[tail & mask];
+  memset((void *)sqe, 0, sizeof(struct io_uring_sqe));
+  self->sqarray[tail & mask] = tail & mask;
+  return sqe;
+}
+
+
+static bool _push(nt_uring_t *self, struct io_uring_sqe *sqe, nt_uring_op_t *op) {
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+  nt_atomic_store32(self->sqtail, *self->sqtail + 1);
+  if (self->queued++ == 0 && self->queuedcb)
+    self->queuedcb(self, self->queuedarg);
+  return true;
+}
+
+
+bool nt_uring_accept(nt_uring_t *self, nt_uring_op_t *op, int fd, bool multishot) {
+  struct io_uring_sqe *sqe;
+  if ((sqe = _getsqe(self)) == NULL)
+    return false;
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+  if (multishot)
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  return _push(self, sqe, op);
+}
+
+
+bool nt_uring_recv(nt_uring_t *self, nt_uring_op_t *op, int fd, nt_uring_bufring_t *br) {
+  struct io_uring_sqe *sqe;
+  if ((sqe = _getsqe(self)) == NULL)
+    return false;
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = br->bgid;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  return _push(self, sqe, op);
+}
+
+
+bool nt_uring_send(nt_uring_t *self, nt_uring_op_t *op, int fd,
+                   const void *buf, size_t length, int flags)
+{
+  struct io_uring_sqe *sqe;
+  if ((sqe = _getsqe(self)) == NULL)
+    return false;
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)length;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  if (flags & NT_URING_LINK)
+    sqe->flags = IOSQE_IO_LINK;
+  return _push(self, sqe, op);
+}
+
+
+bool nt_uring_close(nt_uring_t *self, nt_uring_op_t *op, int fd) {
+  struct io_uring_sqe *sqe;
+  if ((sqe = _getsqe(self)) == NULL)
+    return false;
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  return _push(self, sqe, op);
+}
+
+
+bool nt_uring_cancel(nt_uring_t *self, nt_uring_op_t *op) {
+  struct io_uring_sqe *sqe;
+  if ((sqe = _getsqe(self)) == NULL)
+    return false;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)(uintptr_t)op;
+  return _push(self, sqe, NULL);
+}
+
+
+nt_uring_bufring_t *nt_uring_bufring_new(nt_uring_t *self, uint16_t bgid,
+                                         unsigned int nbufs, unsigned int bufsize)
+{
+  nt_uring_bufring_t *br;
+  struct io_uring_buf_reg reg;
+  unsigned int bid;
+  size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  
+  assert(nbufs && nbufs <= 32768 && (nbufs & (nbufs - 1)) == 0);
+  if ((br = (nt_uring_bufring_t *)nt_malloc(sizeof(nt_uring_bufring_t))) == NULL)
+    return NULL;
+  br->nbufs = nbufs;
+  br->bufsize = bufsize;
+  br->bgid = bgid;
+  br->tail = 0;
+  /* the ring itself must be page aligned */
+  br->ringsize = (nbufs * sizeof(struct io_uring_buf) + pagesize - 1) & ~(pagesize - 1);
+  br->ring = mmap(NULL, br->ringsize, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+  if (br->ring == MAP_FAILED) {
+    nt_free(br, sizeof(nt_uring_bufring_t));
+    return NULL;
+  }
+  if ((br->bufs = (byte_t *)nt_malloc((size_t)nbufs * bufsize)) == NULL) {
+    munmap(br->ring, br->ringsize);
+    nt_free(br, sizeof(nt_uring_bufring_t));
+    return NULL;
+  }
+  
+  memset((void *)&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)br->ring;
+  reg.ring_entries = nbufs;
+  reg.bgid = bgid;
+  if (_register(self->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    int e = errno;
+    nt_free(br->bufs, (size_t)nbufs * bufsize);
+    munmap(br->ring, br->ringsize);
+    nt_free(br, sizeof(nt_uring_bufring_t));
+    errno = e;
+    return NULL;
+  }
+  
+  for (bid = 0; bid < nbufs; bid++)
+    nt_uring_bufring_recycle(br, bid);
+  return br;
+}
+
+
+void nt_uring_bufring_free(nt_uring_t *self, nt_uring_bufring_t *br) {
+  struct io_uring_buf_reg reg;
+  memset((void *)&reg, 0, sizeof(reg));
+  reg.bgid = br->bgid;
+  _register(self->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  nt_free(br->bufs, (size_t)br->nbufs * br->bufsize);
+  munmap(br->ring, br->ringsize);
+  nt_free(br, sizeof(nt_uring_bufring_t));
+}
+
+
+void nt_uring_bufring_recycle(nt_uring_bufring_t *br, unsigned int bid) {
+  struct io_uring_buf_ring *ring = (struct io_uring_buf_ring *)br->ring;
+  struct io_uring_buf *buf = &ring->bufs[br->tail & (br->nbufs - 1)];
+  buf->addr = (uint64_t)(uintptr_t)nt_uring_bufring_buf(br, bid);
+  buf->len = br->bufsize;
+  buf->bid = (uint16_t)bid;
+  br->tail++;
+  /* publish the entry before the new tail */
+  nt_atomic_barrier();
+  *(volatile uint16_t *)&ring->tail = br->tail;
+}
+
+
+static void _probecb(nt_uring_op_t *op, int res, unsigned int flags) {
+  *(int *)op->arg = res;
+}
+
+
+bool nt_uring_probe(nt_uring_t *self) {
+  nt_uring_bufring_t *br;
+  nt_uring_op_t op;
+  int sv[2], res = 1;
+  bool ok = false;
+  
+  /* provided buffer rings: 5.19 */
+  if ((br = nt_uring_bufring_new(self, 0xffff, 1, 64)) == NULL)
+    return false;
+  /* multishot receive: 6.0. Older kernels fail the receive right away, newer
+     ones wait for data, and end it at end of stream. */
+  if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sv) == 0) {
+    op.cb = &_probecb;
+    op.arg = (void *)&res;
+    if (nt_uring_recv(self, &op, sv[0], br) && nt_uring_submit(self) == 1) {
+      shutdown(sv[1], SHUT_WR);
+      while (res == 1) {
+        if (_enter(self->fd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR)
+          break;
+        nt_uring_reap(self);
+      }
+      ok = (res == 0);
+    }
+    close(sv[0]);
+    close(sv[1]);
+  }
+  nt_uring_bufring_free(self, br);
+  if (!ok)
+    errno = ENOSYS;
+  return ok;
+}
+
+#else /* !NT_HAVE_URING */
+
+bool nt_uring_init(nt_uring_t *self, unsigned int entries) {
+  memset((void *)self, 0, sizeof(nt_uring_t));
+  self->fd = -1;
+  errno = ENOSYS;
+  return false;
+}
+
+void nt_uring_destroy(nt_uring_t *self) {}
+int nt_uring_submit(nt_uring_t *self) { return 0; }
+int nt_uring_reap(nt_uring_t *self) { return 0; }
+
+bool nt_uring_accept(nt_uring_t *self, nt_uring_op_t *op, int fd, bool multishot) {
+  return false;
+}
+
+bool nt_uring_recv(nt_uring_t *self, nt_uring_op_t *op, int fd, nt_uring_bufring_t *br) {
+  return false;
+}
+
+bool nt_uring_send(nt_uring_t *self, nt_uring_op_t *op, int fd,
+                   const void *buf, size_t length, int flags) {
+  return false;
+}
+
+bool nt_uring_close(nt_uring_t *self, nt_uring_op_t *op, int fd) { return false; }
+bool nt_uring_cancel(nt_uring_t *self, nt_uring_op_t *op) { return false; }
+
+nt_uring_bufring_t *nt_uring_bufring_new(nt_uring_t *self, uint16_t bgid,
+                                         unsigned int nbufs, unsigned int bufsize) {
+  errno = ENOSYS;
+  return NULL;
+}
+
+void nt_uring_bufring_free(nt_uring_t *self, nt_uring_bufring_t *br) {}
+void nt_uring_bufring_recycle(nt_uring_bufring_t *br, unsigned int bid) {}
+
+bool nt_uring_probe(nt_uring_t *self) {
+  errno = ENOSYS;
+  return false;
+}
+
+#endif /* NT_HAVE_URING */
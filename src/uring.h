@@ -0,0 +1,201 @@
+/**
+  Minimal io_uring submission/completion rings.
+  
+  Operations are described by a nt_uring_op_t, usually embedded in the
+  struct owning the operation, and complete with a call to its callback.
+  Multishot operations (nt_uring_accept, nt_uring_recv) keep completing
+  until a completion without NT_URING_F_MORE is delivered.
+  
+  Queued operations are handed to the kernel in one io_uring_enter call by
+  nt_uring_submit. nt_runloop_enableuring ties a ring to a runloop, which
+  submits once per loop iteration and reaps completions when the ring's fd
+  becomes readable.
+  
+  Only available on Linux (multishot receive needs 6.0 or later);
+  nt_uring_init fails with ENOSYS elsewhere and callers should fall back to
+  nt_runloop_addio.
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_URING_H_
+#define _NT_URING_H_
+
+#if defined(__linux__) && !defined(NT_NO_URING)
+  #define NT_HAVE_URING 1
+#endif
+
+/* Completion flags passed to nt_uring_cb_t */
+#define NT_URING_F_BUFFER 1   /* a provided buffer was used, see nt_uring_bufid */
+#define NT_URING_F_MORE   2   /* the (multishot) operation is still active */
+
+/* Flags for nt_uring_send */
+#define NT_URING_LINK     1   /* the next queued operation starts after this one */
+
+/* The provided buffer id of a completion with NT_URING_F_BUFFER */
+#define nt_uring_bufid(cqeflags) ((cqeflags) >> 16)
+
+struct nt_uring_op_t;
+
+/**
+  Called when an operation completes.
+  
+  @param res   result of the operation (see accept(2), recv(2), ...) or -errno
+  @param flags NT_URING_F_ flags and, with NT_URING_F_BUFFER, a buffer id in
+               the upper 16 bits.
+**/
+typedef void (*nt_uring_cb_t)(struct nt_uring_op_t *op, int res, unsigned int flags);
+
+typedef struct nt_uring_op_t {
+  nt_uring_cb_t cb;
+  void *arg;
+} nt_uring_op_t;
+
+struct nt_uring_t;
+
+/**
+  Called when the first operation is queued after a submit.
+**/
+typedef void (*nt_uring_queuedcb_t)(struct nt_uring_t *uring, void *arg);
+
+typedef struct nt_uring_t {
+  int fd;
+  unsigned int *sqhead, *sqtail, *sqmask, *sqflags, *sqarray;
+  unsigned int *cqhead, *cqtail, *cqmask;
+  void *sqes;                 /* struct io_uring_sqe[] */
+  void *cqes;                 /* struct io_uring_cqe[] */
+  void *sqmap, *cqmap;        /* the same mapping with IORING_FEAT_SINGLE_MMAP */
+  size_t sqmapsize, cqmapsize, sqessize;
+  unsigned int queued;        /* operations not yet submitted */
+  nt_uring_queuedcb_t queuedcb;
+  void *queuedarg;
+} nt_uring_t;
+
+/**
+  A ring of receive buffers the kernel picks from (IORING_REGISTER_PBUF_RING).
+  
+  A completion with NT_URING_F_BUFFER owns buffer nt_uring_bufid(flags)
+  until it is handed back with nt_uring_bufring_recycle.
+**/
+typedef struct nt_uring_bufring_t {
+  void *ring;                 /* struct io_uring_buf_ring */
+  size_t ringsize;
+  byte_t *bufs;               /* nbufs * bufsize bytes */
+  unsigned int nbufs;         /* power of two */
+  unsigned int bufsize;
+  uint16_t bgid;
+  uint16_t tail;
+} nt_uring_bufring_t;
+
+/**
+  Set up a ring with room for @entries queued operations.
+  
+  @returns false with errno set if io_uring is not available
+**/
+bool nt_uring_init(nt_uring_t *self, unsigned int entries);
+
+/**
+  Tear down a ring. Operations in flight are cancelled by the kernel and
+  their callbacks are not called.
+**/
+void nt_uring_destroy(nt_uring_t *self);
+
+/**
+  Hand all queued operations to the kernel.
+  
+  @returns number of operations submitted, or -1 with errno set
+**/
+int nt_uring_submit(nt_uring_t *self);
+
+/**
+  Call the callbacks of all available completions.
+  
+  @returns number of completions
+**/
+int nt_uring_reap(nt_uring_t *self);
+
+/**
+  Queue an accept on listening socket @fd. The accepted socket is the
+  result. With @multishot, the operation keeps accepting connections.
+**/
+bool nt_uring_accept(nt_uring_t *self, nt_uring_op_t *op, int fd, bool multishot);
+
+/**
+  Queue a multishot receive on @fd into buffers picked from @br. Each
+  completion carries the number of bytes received and a buffer id; a
+  result of 0 means end of stream and -ENOBUFS that @br ran dry (in which
+  case the receive has to be queued again).
+**/
+bool nt_uring_recv(nt_uring_t *self, nt_uring_op_t *op, int fd, nt_uring_bufring_t *br);
+
+/**
+  Queue a send of @length bytes at @buf, which must stay valid until the
+  operation completes.
+  
+  @param flags 0 or NT_URING_LINK
+**/
+bool nt_uring_send(nt_uring_t *self, nt_uring_op_t *op, int fd,
+                   const void *buf, size_t length, int flags);
+
+/**
+  Queue a close of @fd. Queued after a send with NT_URING_LINK, the socket
+  is closed once the send completed. Operations still pending on @fd keep
+  the socket itself open -- cancel them first.
+**/
+bool nt_uring_close(nt_uring_t *self, nt_uring_op_t *op, int fd);
+
+/**
+  Cancel @op (e.g. a multishot operation). The operation completes with
+  -ECANCELED.
+**/
+bool nt_uring_cancel(nt_uring_t *self, nt_uring_op_t *op);
+
+/**
+  Create and register a ring of @nbufs buffers of @bufsize bytes each as
+  buffer group @bgid.
+  
+  @param nbufs power of two, at most 32768
+**/
+nt_uring_bufring_t *nt_uring_bufring_new(nt_uring_t *self, uint16_t bgid,
+                                         unsigned int nbufs, unsigned int bufsize);
+
+/**
+  Unregister and free a buffer ring.
+**/
+void nt_uring_bufring_free(nt_uring_t *self, nt_uring_bufring_t *br);
+
+/* Start of buffer @bid */
+#define nt_uring_bufring_buf(br, bid) ((br)->bufs + (size_t)(bid) * (br)->bufsize)
+
+/**
+  Give buffer @bid back to the kernel.
+**/
+void nt_uring_bufring_recycle(nt_uring_bufring_t *br, unsigned int bid);
+
+/**
+  Check that the kernel has what nt_uring_recv needs: provided buffer rings
+  (Linux 5.19) and multishot receive (6.0). Call before queueing anything;
+  it submits and waits for an operation of its own.
+  
+  @returns false with errno ENOSYS if either is missing
+**/
+bool nt_uring_probe(nt_uring_t *self);
+
+#endif
@@ -0,0 +1,59 @@
+/**
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#include "vec.h"
+
+/* Smallest number of elements allocated */
+#define MIN_SIZE 8
+
+
+bool _nt_vec_grow(void **start, size_t *size, size_t needed, size_t elemsize) {
+  size_t new_size = *size ? *size * 2 : MIN_SIZE;
+  void *p;
+  
+  if (new_size < needed)
+    new_size = needed;
+  if (new_size > SIZE_MAX / elemsize)
+    return false;
+  
+  if (*start == NULL)
+    p = nt_malloc(new_size * elemsize);
+  else
+    p = nt_realloc(*start, *size * elemsize, new_size * elemsize);
+  if (p == NULL)
+    return false;
+  
+  *start = p;
+  *size = new_size;
+  return true;
+}
+
+
+ssize_t _nt_vec_bsearch(const void *key, const void *start, size_t length,
+                        size_t elemsize, nt_vec_cmp_t cmp)
+{
+  const byte_t *p;
+  if (length == 0)
+    return -1;
+  if ((p = (const byte_t *)bsearch(key, start, length, elemsize, cmp)) == NULL)
+    return -1;
+  return (p - (const byte_t *)start) / elemsize;
+}
@@ -0,0 +1,159 @@
+/**
+  Typed dynamic arrays.
+  
+  Unlike nt_array_t, which stores void pointers, an NT_VEC(T) stores values
+  of type T contiguously. Everything is implemented as macros so element
+  access and push/pop compile down to a few instructions; only growing the
+  storage calls out of line.
+  
+  Example:
+  
+    typedef struct { uint32_t id; uint16_t port; } peer_t;
+    typedef NT_VEC(peer_t) peer_vec_t;
+    
+    peer_vec_t peers = NT_VEC_INIT;
+    peer_t p = {123, 80};
+    nt_vec_push(&peers, p);
+    nt_vec_sort(&peers, &peer_cmp);
+    i = nt_vec_bsearch(&peers, &key, &peer_cmp);
+    nt_vec_free(&peers);
+  
+  Copyright (c) 2009 Notion <http://notion.se/>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+**/
+#ifndef _NT_VEC_H_
+#define _NT_VEC_H_
+
+#include "mpool.h"
+
+/**
+  Declare a vector of T. Use with typedef or as a member.
+**/
+#define NT_VEC(T) struct { T *start; size_t length; size_t size; }
+
+/* Static initializer */
+#define NT_VEC_INIT {NULL, 0, 0}
+
+typedef int (*nt_vec_cmp_t)(const void *a, const void *b);
+
+/* Out-of-line helpers. Do not call directly. */
+bool _nt_vec_grow(void **start, size_t *size, size_t needed, size_t elemsize);
+ssize_t _nt_vec_bsearch(const void *key, const void *start, size_t length,
+                        size_t elemsize, nt_vec_cmp_t cmp);
+
+#define nt_vec_elemsize(v)  sizeof(*(v)->start)
+
+#define nt_vec_init(v) \
+  ((v)->start = NULL, (v)->length = 0, (v)->size = 0)
+
+/* Release storage. The vector is empty and usable afterwards. */
+#define nt_vec_free(v) do { \
+    if ((v)->start) \
+      nt_free((v)->start, (v)->size * nt_vec_elemsize(v)); \
+    nt_vec_init(v); \
+  } while (0)
+
+#define nt_vec_length(v)    ((v)->length)
+#define nt_vec_size(v)      ((v)->size)
+#define nt_vec_available(v) ((v)->size - (v)->length)
+
+/* Element @i as an lvalue */
+#define nt_vec_get(v, i)    ((v)->start[(i)])
+
+/* Address of element @i */
+#define nt_vec_at(v, i)     (&(v)->start[(i)])
+
+/* Last element as an lvalue */
+#define nt_vec_last(v)      ((v)->start[(v)->length - 1])
+
+#define nt_vec_clear(v)     ((v)->length = 0)
+
+/**
+  Make room for at least @n more elements.
+  
+  @returns false if memory is exhausted.
+**/
+#define nt_vec_reserve(v, n) \
+  (nt_vec_available(v) >= (size_t)(n) || \
+   _nt_vec_grow((void **)&(v)->start, &(v)->size, (v)->length + (n), \
+                nt_vec_elemsize(v)))
+
+/**
+  Append the value @x.
+  
+  @returns false if memory is exhausted.
+**/
+#define nt_vec_push(v, x) \
+  (nt_vec_reserve(v, 1) ? ((v)->start[(v)->length++] = (x), true) : false)
+
+/**
+  Append an uninitialized element.
+  
+  @returns address of the new element or NULL if memory is exhausted.
+**/
+#define nt_vec_pushp(v) \
+  (nt_vec_reserve(v, 1) ? &(v)->start[(v)->length++] : NULL)
+
+/* Remove and return the last element. The vector must not be empty. */
+#define nt_vec_pop(v) \
+  (assert((v)->length != 0), (v)->start[--(v)->length])
+
+/**
+  Append @n elements copied from @src.
+  
+  @returns false if memory is exhausted.
+**/
+#define nt_vec_append(v, src, n) \
+  (nt_vec_reserve(v, n) ? \
+    (memcpy(&(v)->start[(v)->length], (src), (n) * nt_vec_elemsize(v)), \
+     (v)->length += (n), true) : false)
+
+/**
+  Remove element @i in O(1) by moving the last element into its place.
+  Does not preserve order.
+**/
+#define nt_vec_swapdel(v, i) do { \
+    size_t _nt_i = (size_t)(i); /* @i may read (v)->length */ \
+    assert(_nt_i < (v)->length); \
+    (v)->length--; \
+    (v)->start[_nt_i] = (v)->start[(v)->length]; \
+  } while (0)
+
+/* Remove @count elements starting at @i, preserving order. O(n). */
+#define nt_vec_del(v, i, count) do { \
+    assert((size_t)(i) + (count) <= (v)->length); \
+    memmove(&(v)->start[(i)], &(v)->start[(i) + (count)], \
+            ((v)->length - (i) - (count)) * nt_vec_elemsize(v)); \
+    (v)->length -= (count); \
+  } while (0)
+
+/* Sort with a qsort() style comparator */
+#define nt_vec_sort(v, cmp) \
+  qsort((v)->start, (v)->length, nt_vec_elemsize(v), (cmp))
+
+/**
+  Find @key (a pointer to a T) in a vector sorted with the same comparator.
+  
+  @returns index of a matching element or -1 if not found.
+**/
+#define nt_vec_bsearch(v, key, cmp) \
+  _nt_vec_bsearch((key), (v)->start, (v)->length, nt_vec_elemsize(v), (cmp))
+
+#endif
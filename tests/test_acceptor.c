@@ -0,0 +1,185 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/acceptor.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+  #include <sys/syscall.h>
+#endif
+
+#define NWORKERS 4
+
+static nt_runloop_group_t *workers;
+static volatile int32_t handled = 0;
+static int32_t perworker[NWORKERS];
+
+static void _handoff(int fd, const nt_sockaddr_t *addr, nt_sockserv_runloop_t *rs) {
+  size_t i;
+  assert(nt_runloop_current() == rs->runloop);
+  assert(addr->ss_family == AF_INET);
+  for (i = 0; i < NWORKERS; i++) {
+    if (nt_runloop_group_runloop(workers, i) == rs->runloop)
+      perworker[i]++;
+  }
+  close(fd);
+  nt_atomic_add32(&handled, 1);
+}
+
+static volatile int32_t stalled = 0, unstall = 0;
+
+/* Keeps a worker busy, then stops it */
+static void _stall(nt_runloop_t *runloop, void *arg) {
+  nt_atomic_set32(&stalled, 1);
+  while (!nt_atomic_read32(&unstall))
+    usleep(1000);
+  nt_runloop_abort(runloop);
+}
+
+#ifdef __linux__
+static int naborts = 0;
+
+/* Fails @naborts times, as when clients reset while in the backlog */
+int accept4(int fd, struct sockaddr *sa, socklen_t *salen, int flags) {
+  if (naborts > 0) {
+    naborts--;
+    errno = ECONNABORTED;
+    return -1;
+  }
+  return (int)syscall(SYS_accept4, fd, sa, salen, flags);
+}
+#endif
+
+/* Connect @n clients and let the acceptor hand them off */
+static void _connect(nt_runloop_t *runloop, int port, int n) {
+  struct sockaddr_in sa;
+  int i, fds[64];
+  
+  assert(n <= 64);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  memset(perworker, 0, sizeof(perworker));
+  handled = 0;
+  for (i = 0; i < n; i++) {
+    // completes through the listen backlog
+    assert((fds[i] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(connect(fds[i], (struct sockaddr *)&sa, sizeof(sa)) == 0);
+  }
+  while (nt_atomic_read32(&handled) != n)
+    nt_runloop_run(runloop, EVLOOP_NONBLOCK);
+  for (i = 0; i < n; i++)
+    close(fds[i]);
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_sockserv_t *server;
+  nt_acceptor_t *acceptor;
+  nt_sockaddr_t sa;
+  socklen_t salen = sizeof(sa);
+  uint64_t nhandoffs;
+  int i, port, fds[4];
+
+  workers = nt_runloop_group_new(NWORKERS, 0);
+  assert(nt_runloop_group_start(workers, NULL, NULL));
+  runloop = nt_runloop_new();
+
+  server = nt_sockserv_new((nt_sockserv_on_accept_t)&_handoff); // unused
+  assert(nt_sockserv_bind(server, "127.0.0.1", 0, SOCK_STREAM, AF_INET));
+  assert(nt_sockserv_listen(server));
+  assert(getsockname(server->fd4, (struct sockaddr *)&sa, &salen) == 0);
+  port = ntohs(((struct sockaddr_in *)&sa)->sin_port);
+
+  // round-robin
+  acceptor = nt_acceptor_new(server, workers, NT_ACCEPTOR_ROUNDROBIN, &_handoff);
+  nt_acceptor_start(acceptor, runloop);
+  _connect(runloop, port, 8);
+  for (i = 0; i < NWORKERS; i++)
+    assert(perworker[i] == 2);
+  nt_acceptor_stop(acceptor);
+  nt_release(acceptor);
+
+  // least connections: workers 0-2 look busy
+  for (i = 0; i < NWORKERS - 1; i++)
+    nt_runloop_group_runloop(workers, i)->nconns = 100;
+  acceptor = nt_acceptor_new(server, workers, NT_ACCEPTOR_LEASTCONN, &_handoff);
+  nt_acceptor_start(acceptor, runloop);
+  _connect(runloop, port, 8);
+  assert(perworker[NWORKERS - 1] == 8);
+  nt_acceptor_stop(acceptor);
+  nt_release(acceptor);
+
+  // power of two choices: the idle worker wins whenever it is one of the two
+  acceptor = nt_acceptor_new(server, workers, NT_ACCEPTOR_P2C, &_handoff);
+  nt_acceptor_start(acceptor, runloop);
+  _connect(runloop, port, 40);
+  for (i = 0; i < NWORKERS - 1; i++)
+    assert(perworker[NWORKERS - 1] > perworker[i]);
+  nt_acceptor_stop(acceptor);
+  nt_release(acceptor);
+
+  for (i = 0; i < NWORKERS - 1; i++)
+    nt_runloop_group_runloop(workers, i)->nconns = 0;
+
+  #ifdef __linux__
+  // an aborted connection does not end the batch
+  acceptor = nt_acceptor_new(server, workers, NT_ACCEPTOR_ROUNDROBIN, &_handoff);
+  nt_acceptor_start(acceptor, runloop);
+  for (i = 0; i < 4; i++) {
+    assert((fds[i] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(connect(fds[i], (struct sockaddr *)&sa, sizeof(struct sockaddr_in)) == 0);
+  }
+  naborts = 2;
+  handled = 0;
+  while (naborts)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  for (i = 0, nhandoffs = 0; i < NWORKERS; i++)
+    nhandoffs += acceptor->workers[i].handoffs;
+  assert(nhandoffs == 4);
+  while (nt_atomic_read32(&handled) != 4)
+    usleep(1000);
+  for (i = 0; i < 4; i++)
+    close(fds[i]);
+  nt_acceptor_stop(acceptor);
+  nt_release(acceptor);
+  #endif
+  nt_release(workers);
+  
+  // a handoff to a worker which stops before running it is cancelled,
+  // closing the socket and releasing the acceptor
+  handled = 0;
+  workers = nt_runloop_group_new(1, 0);
+  assert(nt_runloop_group_start(workers, NULL, NULL));
+  acceptor = nt_acceptor_new(server, workers, NT_ACCEPTOR_ROUNDROBIN, &_handoff);
+  nt_acceptor_start(acceptor, runloop);
+  assert(nt_runloop_post(nt_runloop_group_runloop(workers, 0), &_stall, NULL));
+  while (!nt_atomic_read32(&stalled))
+    usleep(1000);
+  memset(&sa, 0, sizeof(sa));
+  ((struct sockaddr_in *)&sa)->sin_family = AF_INET;
+  ((struct sockaddr_in *)&sa)->sin_port = htons(port);
+  ((struct sockaddr_in *)&sa)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert((i = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  assert(connect(i, (struct sockaddr *)&sa, sizeof(struct sockaddr_in)) == 0);
+  while (acceptor->workers[0].handoffs == 0)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(nt_obj_get_refcount((nt_obj_t *)acceptor) == 2);
+  nt_atomic_set32(&unstall, 1);
+  nt_runloop_group_stop(workers);
+  assert(acceptor->workers[0].pending == 0);
+  assert(nt_obj_get_refcount((nt_obj_t *)acceptor) == 1);
+  assert(handled == 0);
+  nt_acceptor_stop(acceptor);
+  nt_release(acceptor);
+  nt_release(workers);
+  close(i);
+  nt_release(runloop);
+  nt_fd_close(&server->fd4);
+  nt_release(server);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
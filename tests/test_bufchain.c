@@ -0,0 +1,139 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/bufchain.h"
+#include <sys/socket.h>
+
+static int wrapped_freed = 0;
+
+static void _wrapped_free(void *data, void *arg) {
+  assert(arg == (void *)&wrapped_freed);
+  wrapped_freed++;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_bufchain_t *chain, *other, *slice;
+  nt_bufseg_t *seg;
+  byte_t out[256];
+  static byte_t body[] = "<html>hello</html>";
+  struct iovec iov[8];
+  ssize_t n;
+  int i, fds[2];
+
+  // copied appends fill the tail segment before allocating a new one
+  chain = nt_bufchain_new(16);
+  assert(nt_bufchain_length(chain) == 0);
+  assert(nt_bufchain_appends(chain, "0123456789"));
+  assert(nt_bufchain_appends(chain, "abcdef"));
+  assert(chain->nlinks == 1);
+  assert(nt_bufchain_appends(chain, "ghij"));
+  assert(chain->nlinks == 2);
+  assert(nt_bufchain_length(chain) == 20);
+  assert(nt_bufchain_copyout(chain, 0, out, sizeof(out)) == 20);
+  assert(memcmp(out, "0123456789abcdefghij", 20) == 0);
+  assert(nt_bufchain_copyout(chain, 14, out, 4) == 4);
+  assert(memcmp(out, "efgh", 4) == 0);
+
+  // zero-copy append of external memory
+  seg = nt_bufseg_wrap(body, sizeof(body)-1, &_wrapped_free, &wrapped_freed);
+  assert(nt_bufseg_length(seg) == sizeof(body)-1);
+  assert(nt_bufchain_appendseg(chain, seg, 6, 5));
+  assert(chain->tail->start == body + 6);
+  assert(nt_bufchain_length(chain) == 25);
+  // appending after a wrapped segment never writes into it
+  assert(nt_bufchain_appends(chain, "!"));
+  assert(chain->nlinks == 4);
+  assert(nt_bufchain_copyout(chain, 18, out, 7) == 7);
+  assert(memcmp(out, "ijhello!", 7) == 0);
+
+  // slices share segments
+  slice = nt_bufchain_slice(chain, 8, 13);
+  assert(slice != NULL);
+  assert(nt_bufchain_length(slice) == 13);
+  assert(slice->nlinks == 3);
+  assert(slice->head->seg == chain->head->seg);
+  assert(nt_bufchain_copyout(slice, 0, out, sizeof(out)) == 13);
+  assert(memcmp(out, "89abcdefghijh", 13) == 0);
+  assert(nt_bufchain_slice(chain, 20, 10) == NULL);
+
+  // appending to a slice must not overwrite bytes shared with the original
+  other = nt_bufchain_slice(chain, 8, 12);
+  assert(nt_bufchain_appends(other, "XYZ"));
+  assert(other->nlinks == 3);
+  assert(nt_bufchain_copyout(other, 0, out, sizeof(out)) == 15);
+  assert(memcmp(out, "89abcdefghijXYZ", 15) == 0);
+  assert(nt_bufchain_copyout(chain, 0, out, sizeof(out)) == 26);
+  assert(memcmp(out, "0123456789abcdefghijhello!", 26) == 0);
+  nt_release(other);
+
+  // consume frees links but not shared segments
+  nt_bufchain_consume(chain, 23);
+  assert(nt_bufchain_length(chain) == 3);
+  assert(nt_bufchain_copyout(chain, 0, out, sizeof(out)) == 3);
+  assert(memcmp(out, "lo!", 3) == 0);
+  nt_release(seg);
+  assert(wrapped_freed == 0);
+  nt_release(slice);
+  assert(wrapped_freed == 0);
+  nt_bufchain_consume(chain, 3);
+  assert(nt_bufchain_length(chain) == 0);
+  assert(chain->head == NULL && chain->tail == NULL && chain->nlinks == 0);
+  assert(wrapped_freed == 1);
+
+  // chain appended to chain
+  other = nt_bufchain_new(0);
+  assert(nt_bufchain_appends(chain, "HTTP/1.1 200 OK\r\n\r\n"));
+  seg = nt_bufseg_wrap(body, sizeof(body)-1, NULL, NULL);
+  assert(nt_bufchain_appendseg(other, seg, 0, nt_bufseg_length(seg)));
+  nt_release(seg);
+  assert(nt_bufchain_appendchain(chain, other));
+  assert(nt_bufchain_length(chain) == 19 + sizeof(body)-1);
+  assert(nt_bufchain_iov(chain, iov, 8) == 2);
+  assert(iov[0].iov_len == 19);
+  assert(iov[1].iov_base == (void *)body && iov[1].iov_len == sizeof(body)-1);
+  assert(nt_bufchain_iov(chain, iov, 1) == 1);
+  nt_release(other);
+
+  // a segment appended to two chains is never filled by either
+  seg = nt_bufseg_new(16);
+  memcpy(seg->ptr, "abc", 3);
+  seg->ptr += 3;
+  other = nt_bufchain_new(0);
+  slice = nt_bufchain_new(0);
+  assert(nt_bufchain_appendseg(other, seg, 0, 3));
+  assert(nt_bufchain_appendseg(slice, seg, 0, 3));
+  nt_release(seg);
+  assert(nt_bufchain_appends(other, "X"));
+  assert(nt_bufchain_appends(slice, "Y"));
+  assert(other->nlinks == 2 && slice->nlinks == 2);
+  assert(nt_bufseg_length(seg) == 3);
+  assert(nt_bufchain_copyout(other, 0, out, sizeof(out)) == 4);
+  assert(memcmp(out, "abcX", 4) == 0);
+  assert(nt_bufchain_copyout(slice, 0, out, sizeof(out)) == 4);
+  assert(memcmp(out, "abcY", 4) == 0);
+  nt_release(slice);
+  nt_release(other);
+
+  // large copied append gets a segment of its own
+  memset(out, 'x', sizeof(out));
+  assert(nt_bufchain_append(chain, out, sizeof(out)));
+  assert(nt_bufseg_size(chain->tail->seg) >= sizeof(out));
+
+  // write everything in as few syscalls as possible
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  i = (int)nt_bufchain_length(chain);
+  n = nt_bufchain_writev(chain, fds[0]);
+  assert(n == i);
+  assert(nt_bufchain_length(chain) == 0);
+  assert(read(fds[1], out, sizeof(out)) == sizeof(out));
+  assert(memcmp(out, "HTTP/1.1 200 OK\r\n\r\n<html>hello</html>", 37) == 0);
+  assert(nt_bufchain_writev(chain, fds[0]) == 0);
+  close(fds[0]);
+  close(fds[1]);
+
+  nt_release(chain);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
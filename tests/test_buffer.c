@@ -3,6 +3,7 @@
  100% free) by Notion.
 */
 #include "../src/buffer.h"
+#include "../src/mpool.h"
 
 int main (int argc, char const *argv[]) {
   nt_buffer_t *b;
@@ -17,6 +18,148 @@ int main (int argc, char const *argv[]) {
   assert(nt_buffer_occupied(b) == 22);
   assert(nt_buffer_indexof(b, (const byte_t *)"korv", 4) == 16);
   assert(nt_buffer_indexof(b, (const byte_t *)"not here", 8) == -1);
+  assert(nt_buffer_indexof(b, (const byte_t *)"hello", 5) == 0);
+  assert(nt_buffer_indexfrom(b, 1, (const byte_t *)"hello", 5) == 6);
+  assert(nt_buffer_indexfrom(b, 7, (const byte_t *)"hello", 5) == -1);
+  assert(nt_buffer_indexfrom(b, 22, (const byte_t *)"h", 1) == -1);
+  assert(nt_buffer_indexfrom(b, 23, (const byte_t *)"h", 1) == -1);
+  nt_release(b);
+  
+  // search for a delimiter in a larger buffer, crossing the vector widths
+  b = nt_buffer_new(0x10000, 0);
+  int i;
+  for (i = 0; i < 1000; i++)
+    nt_buffer_appends(b, "Header: value\r\n");
+  nt_buffer_appends(b, "\r\n");
+  ssize_t eoh = nt_buffer_length(b) - 4;
+  nt_buffer_appends(b, "body");
+  assert(nt_buffer_indexof(b, (const byte_t *)"\r\n\r\n", 4) == eoh);
+  assert(nt_buffer_indexfrom(b, eoh, (const byte_t *)"\r\n\r\n", 4) == eoh);
+  assert(nt_buffer_indexfrom(b, eoh+1, (const byte_t *)"\r\n\r\n", 4) == -1);
+  assert(nt_buffer_indexof(b, (const byte_t *)"body", 4) == eoh + 4);
+  assert(nt_buffer_indexof(b, (const byte_t *)"bodyx", 5) == -1);
+  for (i = 1; i <= 15; i++)
+    assert(nt_buffer_indexfrom(b, i, (const byte_t *)"Header", 6) == 15);
+  assert(nt_buffer_indexfrom(b, 16, (const byte_t *)"Header", 6) == 30);
+  nt_release(b);
+  
+  // geometric growth reallocates O(log n) times
+  b = nt_buffer_new(16, 0);
+  nt_buffer_setgrowth(b, NT_BUFFER_GROW_GEOMETRIC, 0);
+  int ngrow = 0;
+  byte_t *prevend = b->end;
+  for (i = 0; i < 100000; i++) {
+    nt_buffer_appendc(b, 'x');
+    if (b->end != prevend) {
+      ngrow++;
+      prevend = b->end;
+    }
+  }
+  assert(nt_buffer_length(b) == 100000);
+  assert(ngrow < 20);
+  
+  // shrink to fit
+  assert(nt_buffer_shrink(b));
+  assert(nt_buffer_size(b) == 100000);
+  assert(nt_buffer_length(b) == 100000);
+  assert(b->start[99999] == 'x');
+  nt_release(b);
+  
+  // per-buffer max size
+  b = nt_buffer_new(8, 0);
+  nt_buffer_setgrowmax(b, 64);
+  assert(nt_buffer_append(b, (const byte_t *)"0123456789012345678901234567890123456789", 40));
+  assert(!nt_buffer_append(b, (const byte_t *)"0123456789012345678901234567890123456789", 40));
+  assert(nt_buffer_append(b, (const byte_t *)"012345678901234567890123", 24));
+  assert(nt_buffer_size(b) == 64);
+  assert(!nt_buffer_appendc(b, 'x'));
+  nt_release(b);
+  
+  // running out of memory leaves the buffer as it was
+  assert((nt_mpool_shared = nt_mpool_open(0, 0, NULL, NULL)) != NULL);
+  b = nt_buffer_new(8, 0);
+  /* no more pages than the buffer already has */
+  assert(nt_mpool_set_max_pages(nt_mpool_shared, 1) == NT_MPOOL_ERROR_NONE);
+  assert(nt_buffer_append(b, (const byte_t *)"01234567", 8));
+  assert(!nt_buffer_grow(b, 1024 * 1024));
+  assert(nt_buffer_size(b) == 8 && nt_buffer_length(b) == 8);
+  assert(memcmp(b->start, "01234567", 8) == 0);
+  nt_release(b);
+  nt_mpool_close(nt_mpool_shared);
+  nt_mpool_shared = NULL;
+  
+  // mmap-backed growth past NT_BUFFER_GROW_MAX
+  b = nt_buffer_new(0x1000, 0);
+  nt_buffer_setgrowth(b, NT_BUFFER_GROW_MMAP, 0);
+  nt_buffer_setgrowmax(b, 0);
+  byte_t chunk[0x10000];
+  memset(chunk, 'z', sizeof(chunk));
+  while (nt_buffer_length(b) < NT_BUFFER_GROW_MAX + sizeof(chunk))
+    assert(nt_buffer_append(b, chunk, sizeof(chunk)));
+  assert(b->flags & NT_BUFFER_F_MMAPPED);
+  assert(b->start[0] == 'z' && b->ptr[-1] == 'z');
+  assert(nt_buffer_shrink(b));
+  assert(nt_buffer_length(b) == NT_BUFFER_GROW_MAX + sizeof(chunk));
+  nt_release(b);
+  
+  // formatted appends
+  b = nt_buffer_new(4, 0);
+  assert(nt_buffer_appendf(b, "%s=%d;", "a-rather-long-key", 12345));
+  assert(nt_buffer_length(b) == 24);
+  assert(memcmp(b->start, "a-rather-long-key=12345;", 24) == 0);
+  nt_buffer_del(b, 0, nt_buffer_length(b), 1);
+  
+  // numbers, checked against snprintf
+  {
+    static const uint64_t u[] = {0, 1, 9, 10, 99, 100, 101, 999, 1000, 65535,
+      4294967295ULL, 4294967296ULL, 999999999999999999ULL,
+      1000000000000000000ULL, 10000000000000000000ULL, UINT64_MAX};
+    static const double d[] = {0.0, -0.0, 0.5, 1.25, -3.999, 123456.789,
+      0.001, -0.0004, 1e17, 1e20, -2.5e300};
+    char expect[64];
+    byte_t got[64];
+    size_t i, n;
+    for (i = 0; i < sizeof(u)/sizeof(u[0]); i++) {
+      n = nt_fmt_u64(got, u[i]);
+      assert(n <= NT_FMT_U64_MAX);
+      assert(n == (size_t)snprintf(expect, sizeof(expect), "%llu", (unsigned long long)u[i]));
+      assert(memcmp(got, expect, n) == 0);
+      n = nt_fmt_x64(got, u[i]);
+      assert(n <= NT_FMT_X64_MAX);
+      assert(n == (size_t)snprintf(expect, sizeof(expect), "%llx", (unsigned long long)u[i]));
+      assert(memcmp(got, expect, n) == 0);
+      n = nt_fmt_i64(got, -(int64_t)(u[i] >> 1));
+      assert(n == (size_t)snprintf(expect, sizeof(expect), "%lld", -(long long)(u[i] >> 1)));
+      assert(memcmp(got, expect, n) == 0);
+    }
+    n = nt_fmt_i64(got, INT64_MIN);
+    assert(n == 20 && memcmp(got, "-9223372036854775808", 20) == 0);
+    for (i = 0; i < sizeof(d)/sizeof(d[0]); i++) {
+      n = nt_fmt_double(got, d[i], 3);
+      assert(n <= NT_FMT_DOUBLE_MAX);
+      if (d[i] < 1e15 && d[i] > -1e15)
+        snprintf(expect, sizeof(expect), "%.3f", d[i]);
+      else
+        snprintf(expect, sizeof(expect), "%.17g", d[i]);
+      assert(n == strlen(expect) && memcmp(got, expect, n) == 0);
+    }
+    assert(nt_fmt_double(got, 2.5, 0) == 1 && got[0] == '3');
+  }
+  
+  // batch of unchecked appends into reserved space
+  assert(nt_buffer_reserve(b, 3*NT_FMT_U64_MAX + NT_FMT_X64_MAX + 8) != NULL);
+  nt_buffer_puts(b, "GET ");
+  nt_buffer_putu(b, 200);
+  nt_buffer_putc(b, ' ');
+  nt_buffer_puti(b, -7);
+  nt_buffer_putc(b, ' ');
+  nt_buffer_putx(b, 0xbeef);
+  assert(nt_buffer_length(b) == 15);
+  assert(memcmp(b->start, "GET 200 -7 beef", 15) == 0);
+  assert(nt_buffer_appendu(b, 42) && nt_buffer_appendd(b, -1.5, 2));
+  assert(nt_buffer_length(b) == 22);
+  assert(memcmp(b->start + 15, "42-1.50", 7) == 0);
+  nt_release(b);
   
   return 0;
-}
\ No newline at end of file
+}
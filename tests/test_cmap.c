@@ -0,0 +1,139 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/cmap.h"
+#include "../src/mpool.h"
+
+#define NKEYS    512
+#define NREADERS 4
+#define ROUNDS   20
+
+typedef struct val_t {
+  NT_OBJ_HEAD
+  uintptr_t key;
+  uintptr_t magic;
+} val_t;
+
+static volatile int32_t live = 0;
+static volatile int32_t done = 0;
+static nt_cmap_t *m;
+
+static void _val_dealloc(val_t *v) {
+  v->magic = 0;
+  nt_atomic_sub32(&live, 1);
+  nt_free(v, sizeof(val_t));
+}
+
+static val_t *val_new(uintptr_t key) {
+  NT_OBJ_ALLOC_INIT_self(val_t, &_val_dealloc);
+  self->key = key;
+  self->magic = 0x5ca1ab1e;
+  nt_atomic_add32(&live, 1);
+  return self;
+}
+
+static void *reader(void *arg) {
+  nt_cmap_reader_t *r = nt_cmap_addreader(m);
+  size_t lookups = 0;
+  uintptr_t k;
+  val_t *v;
+  assert(r != NULL);
+  while (!nt_atomic_load32(&done)) {
+    nt_cmap_rlock(m, r);
+    for (k = 0; k < NKEYS; k++) {
+      if ((v = (val_t *)nt_cmap_get(m, NT_HASHMAP_INTKEY(k)))) {
+        assert(v->magic == 0x5ca1ab1e);
+        assert(v->key == k);
+      }
+      lookups++;
+    }
+    nt_cmap_runlock(m, r);
+  }
+  nt_cmap_removereader(m, r);
+  return (void *)lookups;
+}
+
+int main (int argc, char const *argv[]) {
+  pthread_t threads[NREADERS];
+  nt_cmap_reader_t *r, *readers[NT_CMAP_READERS_MAX];
+  val_t *v;
+  uintptr_t k;
+  int i;
+  
+  // single-threaded basics
+  m = nt_cmap_new(&nt_hashmap_intkeys, NT_CMAP_F_RETAIN);
+  r = nt_cmap_addreader(m);
+  v = val_new(1);
+  assert(nt_cmap_put(m, NT_HASHMAP_INTKEY(1), v));
+  nt_release(v); // map holds the only reference now
+  nt_cmap_rlock(m, r);
+  assert(nt_cmap_get(m, NT_HASHMAP_INTKEY(1)) == v);
+  assert(nt_cmap_get(m, NT_HASHMAP_INTKEY(2)) == NULL);
+  // removal while a reader is inside its section is deferred
+  assert(nt_cmap_remove(m, NT_HASHMAP_INTKEY(1)));
+  assert(nt_cmap_count(m) == 0);
+  assert(live == 1 && v->magic == 0x5ca1ab1e);
+  nt_cmap_runlock(m, r);
+  assert(!nt_cmap_remove(m, NT_HASHMAP_INTKEY(1)));
+  nt_cmap_reclaim(m);
+  assert(live == 0);
+  // grow past the initial table
+  for (k = 0; k < 1000; k++) {
+    v = val_new(k);
+    assert(nt_cmap_put(m, NT_HASHMAP_INTKEY(k), v));
+    nt_release(v);
+  }
+  assert(nt_cmap_count(m) == 1000);
+  assert(m->tab->size >= 1000);
+  nt_cmap_rlock(m, r);
+  for (k = 0; k < 1000; k++)
+    assert(((val_t *)nt_cmap_get(m, NT_HASHMAP_INTKEY(k)))->key == k);
+  nt_cmap_runlock(m, r);
+  nt_cmap_removereader(m, r);
+  nt_release(m);
+  assert(live == 0);
+  
+  // reader slots are reused once given back, and each has a cache line
+  m = nt_cmap_new(&nt_hashmap_intkeys, 0);
+  for (i = 0; i < NT_CMAP_READERS_MAX; i++) {
+    assert((readers[i] = nt_cmap_addreader(m)) != NULL);
+    assert(((uintptr_t)readers[i] & (NT_CACHELINE_SIZE - 1)) == 0);
+  }
+  assert(nt_cmap_addreader(m) == NULL);
+  nt_cmap_removereader(m, readers[3]);
+  assert(nt_cmap_addreader(m) == readers[3]);
+  for (i = 0; i < NT_CMAP_READERS_MAX; i++)
+    nt_cmap_removereader(m, readers[i]);
+  assert(m->nreaders == NT_CMAP_READERS_MAX);
+  for (i = 0; i < 4 * NT_CMAP_READERS_MAX; i++) {
+    assert((r = nt_cmap_addreader(m)) == m->readers);
+    nt_cmap_removereader(m, r);
+  }
+  nt_release(m);
+  
+  // readers racing a writer
+  m = nt_cmap_new(&nt_hashmap_intkeys, NT_CMAP_F_RETAIN);
+  for (i = 0; i < NREADERS; i++)
+    AZ(pthread_create(&threads[i], NULL, &reader, NULL));
+  for (i = 0; i < ROUNDS; i++) {
+    for (k = 0; k < NKEYS; k++) {
+      v = val_new(k);
+      assert(nt_cmap_put(m, NT_HASHMAP_INTKEY(k), v)); // insert or replace
+      nt_release(v);
+    }
+    for (k = i & 1; k < NKEYS; k += 2)
+      assert(nt_cmap_remove(m, NT_HASHMAP_INTKEY(k)));
+  }
+  nt_atomic_store32(&done, 1);
+  for (i = 0; i < NREADERS; i++) {
+    void *lookups;
+    AZ(pthread_join(threads[i], &lookups));
+    printf("reader %d: %zu lookups\n", i, (size_t)lookups);
+  }
+  assert(nt_cmap_count(m) == NKEYS / 2);
+  nt_release(m);
+  assert(live == 0);
+  
+  return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/connect.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int ndone = 0, lastfd = -1, lasterror = -1;
+static nt_sockaddr_t lastaddr;
+
+static void _done(int fd, const nt_sockaddr_t *addr, int error, void *arg) {
+  assert(arg == (void *)&ndone);
+  assert((fd == -1) == (addr == NULL));
+  ndone++;
+  lastfd = fd;
+  lasterror = error;
+  if (addr)
+    memcpy(&lastaddr, addr, sizeof(lastaddr));
+}
+
+static double _now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void _run(nt_runloop_t *runloop, int n) {
+  while (ndone < n)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+}
+
+/* A listening socket on 127.0.0.1. Returns its address in @sa. */
+static int _listen(nt_sockaddr_t *sa, int backlog) {
+  struct sockaddr_in *in = (struct sockaddr_in *)sa;
+  socklen_t salen = sizeof(*in);
+  int fd;
+  assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  memset(sa, 0, sizeof(*sa));
+  in->sin_family = AF_INET;
+  in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(fd, (struct sockaddr *)in, salen) == 0);
+  assert(listen(fd, backlog) == 0);
+  assert(getsockname(fd, (struct sockaddr *)in, &salen) == 0);
+  return fd;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_connect_t *c;
+  nt_sockaddr_t good, full, closed, addrs[4], v6[2];
+  int lfd, fullfd, fillfd, fd;
+  double t;
+
+  runloop = nt_runloop_new();
+  lfd = _listen(&good, 16);
+
+  // a single address
+  assert(nt_connect_start(runloop, &good, 1, 0, &_done, &ndone) != NULL);
+  assert(ndone == 0);
+  _run(runloop, 1);
+  assert(lasterror == 0 && lastfd != -1);
+  assert(memcmp(&lastaddr, &good, sizeof(struct sockaddr_in)) == 0);
+  assert((fd = accept(lfd, NULL, NULL)) != -1);
+  assert(write(lastfd, "hi", 2) == 2);
+  close(fd);
+  close(lastfd);
+
+  // refused
+  close(_listen(&closed, 1));
+  assert(nt_connect_start(runloop, &closed, 1, 0, &_done, &ndone) != NULL);
+  _run(runloop, 2);
+  assert(lastfd == -1 && lasterror == ECONNREFUSED);
+
+  // a refused address is skipped without waiting for the delay
+  memcpy(&addrs[0], &closed, sizeof(nt_sockaddr_t));
+  memcpy(&addrs[1], &good, sizeof(nt_sockaddr_t));
+  t = _now();
+  assert(nt_connect_start(runloop, addrs, 2, 0, &_done, &ndone) != NULL);
+  _run(runloop, 3);
+  assert(lasterror == 0 && memcmp(&lastaddr, &good, sizeof(struct sockaddr_in)) == 0);
+  assert(_now() - t < NT_CONNECT_DELAY_MSEC / 1000.0);
+  close(lastfd);
+  close(accept(lfd, NULL, NULL));
+
+  // an address which does not answer (SYNs to a full backlog are dropped)
+  // gives the next one a go after the delay
+  fullfd = _listen(&full, 0);
+  fillfd = socket(AF_INET, SOCK_STREAM, 0);
+  assert(connect(fillfd, (struct sockaddr *)&full, sizeof(struct sockaddr_in)) == 0);
+  memcpy(&addrs[0], &full, sizeof(nt_sockaddr_t));
+  memcpy(&addrs[1], &good, sizeof(nt_sockaddr_t));
+  t = _now();
+  assert(nt_connect_start(runloop, addrs, 2, 0, &_done, &ndone) != NULL);
+  _run(runloop, 4);
+  t = _now() - t;
+  assert(lasterror == 0 && memcmp(&lastaddr, &good, sizeof(struct sockaddr_in)) == 0);
+  assert(t >= NT_CONNECT_DELAY_MSEC / 1000.0 * 0.9 && t < 2.0);
+  close(lastfd);
+  close(accept(lfd, NULL, NULL));
+
+  // timeout
+  assert(nt_connect_start(runloop, &full, 1, 300, &_done, &ndone) != NULL);
+  _run(runloop, 5);
+  assert(lastfd == -1 && lasterror == ETIMEDOUT);
+
+  // cancel
+  assert((c = nt_connect_start(runloop, &full, 1, 0, &_done, &ndone)) != NULL);
+  nt_connect_cancel(c);
+
+  // address families alternate
+  memset(v6, 0, sizeof(v6));
+  v6[0].ss_family = v6[1].ss_family = AF_INET6;
+  ((struct sockaddr_in6 *)&v6[0])->sin6_addr = in6addr_loopback;
+  ((struct sockaddr_in6 *)&v6[0])->sin6_port = htons(nt_sockaddr_port(&closed));
+  memcpy(&v6[1], &v6[0], sizeof(nt_sockaddr_t));
+  memcpy(&addrs[0], &v6[0], sizeof(nt_sockaddr_t));
+  memcpy(&addrs[1], &v6[1], sizeof(nt_sockaddr_t));
+  memcpy(&addrs[2], &good, sizeof(nt_sockaddr_t));
+  assert((c = nt_connect_start(runloop, addrs, 3, 0, &_done, &ndone)) != NULL);
+  assert(c->naddrs == 3);
+  assert(c->addrs[0].ss_family == AF_INET6);
+  assert(c->addrs[1].ss_family == AF_INET);
+  assert(c->addrs[2].ss_family == AF_INET6);
+  _run(runloop, 6);
+  assert(lasterror == 0 && lastaddr.ss_family == AF_INET);
+  close(lastfd);
+  close(accept(lfd, NULL, NULL));
+
+  close(fillfd);
+  close(fullfd);
+  close(lfd);
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
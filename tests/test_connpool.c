@@ -0,0 +1,114 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/connpool.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int ncalls = 0, fds[4];
+
+static void _got(nt_connpool_t *pool, int fd, int error, void *arg) {
+  assert(error == 0 && fd != -1);
+  fds[(intptr_t)arg] = fd;
+  ncalls++;
+}
+
+static void _failed(nt_connpool_t *pool, int fd, int error, void *arg) {
+  assert(fd == -1 && error == ECONNREFUSED);
+  ncalls++;
+}
+
+static void _run(nt_runloop_t *runloop, int n) {
+  while (ncalls < n)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_connpool_t *pool;
+  nt_connpool_backend_t *b;
+  nt_sockaddr_t addr, closed;
+  struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+  socklen_t salen = sizeof(*in);
+  int lfd, peer, peer2;
+
+  runloop = nt_runloop_new();
+  assert((lfd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  memset(&addr, 0, sizeof(addr));
+  in->sin_family = AF_INET;
+  in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(lfd, (struct sockaddr *)in, salen) == 0);
+  assert(listen(lfd, 16) == 0);
+  assert(getsockname(lfd, (struct sockaddr *)in, &salen) == 0);
+  pool = nt_connpool_new(runloop, 2, 1);
+
+  // the first request connects
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)0));
+  assert(ncalls == 0);
+  _run(runloop, 1);
+  assert(pool->nconnects == 1 && pool->nreused == 0);
+  assert((peer = accept(lfd, NULL, NULL)) != -1);
+  b = (nt_connpool_backend_t *)nt_hashmap_get(pool->backends, &addr);
+  assert(b != NULL && b->nconns == 1);
+
+  // a returned socket is handed out again right away
+  nt_connpool_put(pool, &addr, fds[0]);
+  assert(b->nidle == 1 && b->nconns == 1);
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)1));
+  assert(ncalls == 2 && fds[1] == fds[0] && pool->nreused == 1);
+  assert(b->nidle == 0);
+
+  // at maxconns, requests wait for a socket to be returned
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)2));
+  _run(runloop, 3);
+  assert((peer2 = accept(lfd, NULL, NULL)) != -1);
+  assert(b->nconns == 2);
+  fds[3] = -1;
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)3));
+  nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  assert(ncalls == 3 && fds[3] == -1 && b->waithead != NULL);
+  nt_connpool_put(pool, &addr, fds[1]);
+  assert(ncalls == 4 && fds[3] == fds[1] && b->waithead == NULL);
+
+  // only maxidle sockets are kept
+  nt_connpool_put(pool, &addr, fds[2]);
+  nt_connpool_put(pool, &addr, fds[3]);
+  assert(b->nidle == 1 && b->nconns == 1);
+
+  // an idle socket closed by the backend is dropped
+  close(peer);
+  close(peer2);
+  while (b->nidle)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(b->nconns == 0);
+
+  // discarding a socket lets a waiting request connect
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)0));
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)1));
+  assert(nt_connpool_get(pool, &addr, &_got, (void *)2));
+  _run(runloop, 6);
+  nt_connpool_discard(pool, &addr, fds[0]);
+  _run(runloop, 7);
+  assert(pool->nconnects == 5 && b->nconns == 2);
+  close(accept(lfd, NULL, NULL));
+  close(accept(lfd, NULL, NULL));
+  close(accept(lfd, NULL, NULL));
+  nt_connpool_discard(pool, &addr, fds[1]);
+  nt_connpool_discard(pool, &addr, fds[2]);
+  assert(b->nconns == 0);
+
+  // a backend which refuses
+  memcpy(&closed, &addr, sizeof(addr));
+  close(lfd);
+  assert(nt_connpool_get(pool, &closed, &_failed, NULL));
+  _run(runloop, 8);
+  assert(b->nconns == 0);
+
+  nt_release(pool);
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/dgramserv.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NDGRAMS 20
+#define NCLIENTS 32
+
+static int ncalls = 0, nseen = 0, ntruncated = 0;
+static size_t grosize = 0, grolength = 0;
+
+static void _echo(nt_dgramserv_t *server, nt_dgram_t *dgrams, size_t count) {
+  size_t i;
+  assert(count > 0 && count <= server->nslots);
+  ncalls++;
+  for (i = 0; i < count; i++) {
+    assert(nt_dgramserv_send(server, dgrams[i].addr, dgrams[i].data, dgrams[i].length));
+    if (dgrams[i].truncated)
+      ntruncated++;
+  }
+}
+
+static void _count(nt_dgramserv_t *server, nt_dgram_t *dgrams, size_t count) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    nseen++;
+    grosize = dgrams[i].segsize;
+    grolength += dgrams[i].length;
+  }
+}
+
+static void _run(nt_runloop_t *runloop, uint64_t *counter, uint64_t value) {
+  while (*counter < value)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+}
+
+static int _client(void) {
+  int fd;
+  struct timeval tv = {5, 0};
+  assert((fd = socket(AF_INET, SOCK_DGRAM, 0)) != -1);
+  assert(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+  return fd;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_dgramserv_t *server, *server2;
+  const struct sockaddr *sa;
+  socklen_t salen = sizeof(struct sockaddr_in);
+  static byte_t big[1000];
+  char buf[256], expect[16];
+  int i, fd, fds[NCLIENTS];
+  ssize_t n;
+
+  runloop = nt_runloop_new();
+  for (i = 0; i < (int)sizeof(big); i++)
+    big[i] = (byte_t)i;
+
+  // echo: datagrams are received and sent in batches
+  assert((server = nt_dgramserv_new(&_echo, 8, 64)) != NULL);
+  assert(nt_dgramserv_bind(server, "127.0.0.1", 0, AF_INET, 0));
+  assert(nt_sockaddr_port(&server->addr) != 0);
+  sa = (const struct sockaddr *)&server->addr;
+  nt_dgramserv_start(server, runloop);
+  fd = _client();
+  for (i = 0; i < NDGRAMS; i++) {
+    snprintf(buf, sizeof(buf), "ping %d", i);
+    assert(sendto(fd, buf, strlen(buf), 0, sa, salen) == (ssize_t)strlen(buf));
+  }
+  _run(runloop, &server->nsent, NDGRAMS);
+  assert(server->nrecv == NDGRAMS && server->ndropped == 0);
+  assert(ncalls >= NDGRAMS / 8 && ncalls < NDGRAMS);
+  for (i = 0; i < NDGRAMS; i++) {
+    snprintf(expect, sizeof(expect), "ping %d", i);
+    assert((n = recv(fd, buf, sizeof(buf), 0)) == (ssize_t)strlen(expect));
+    assert(memcmp(buf, expect, n) == 0);
+  }
+
+  // datagrams larger than a slot
+  assert(sendto(fd, big, 100, 0, sa, salen) == 100);
+  _run(runloop, &server->nsent, NDGRAMS + 1);
+  assert(ntruncated == 1);
+  assert(recv(fd, buf, sizeof(buf), 0) == 64);
+  assert(memcmp(buf, big, 64) == 0);
+  assert(!nt_dgramserv_send(server, &server->addr, big, 65) && errno == EMSGSIZE);
+
+  // sharding with SO_REUSEPORT: a second socket on the same port
+  #if defined(__linux__)
+  assert((server2 = nt_dgramserv_new(&_echo, 8, 64)) != NULL);
+  assert(nt_dgramserv_bindtoaddr(server2, &server->addr, 0));
+  nt_dgramserv_start(server2, runloop);
+  server->nrecv = server->nsent = 0;
+  for (i = 0; i < NCLIENTS; i++) {
+    fds[i] = _client();
+    assert(sendto(fds[i], "x", 1, 0, sa, salen) == 1);
+  }
+  while (server->nsent + server2->nsent < NCLIENTS)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(server->nrecv > 0 && server2->nrecv > 0);
+  for (i = 0; i < NCLIENTS; i++) {
+    assert(recv(fds[i], buf, sizeof(buf), 0) == 1);
+    close(fds[i]);
+  }
+  nt_dgramserv_stop(server2);
+  nt_release(server2);
+  #endif
+
+  // segmentation offload: 1000 bytes as datagrams of 100
+  assert(!nt_dgramserv_sendsegments(server, &server->addr, big, 65, 10) && errno == EMSGSIZE);
+  nt_dgramserv_stop(server);
+  nt_release(server);
+  assert((server = nt_dgramserv_new(&_echo, 8, 0x10000)) != NULL);
+  assert(nt_dgramserv_bind(server, "127.0.0.1", 0, AF_INET, 0));
+  nt_dgramserv_start(server, runloop);
+  assert((server2 = nt_dgramserv_new(&_count, 8, 0x1000)) != NULL);
+  assert(!nt_dgramserv_bind(server2, "127.0.0.1", 0, AF_INET, NT_DGRAMSERV_GRO));
+  assert(errno == EINVAL);
+  nt_release(server2);
+  assert((server2 = nt_dgramserv_new(&_count, 8, 0x10000)) != NULL);
+  assert(nt_dgramserv_bind(server2, "127.0.0.1", 0, AF_INET, NT_DGRAMSERV_GRO));
+  nt_dgramserv_start(server2, runloop);
+  // to a plain socket, which gets ten datagrams
+  assert(getsockname(fd, (struct sockaddr *)buf, &salen) == 0);
+  assert(nt_dgramserv_sendsegments(server, (const nt_sockaddr_t *)buf, big, 1000, 100));
+  // to a UDP_GRO socket, which may get them coalesced
+  assert(nt_dgramserv_sendsegments(server, &server2->addr, big, 1000, 100));
+  nt_dgramserv_flush(server);
+  assert(server->ndropped == 0);
+  for (i = 0; i < 10; i++) {
+    assert(recv(fd, buf, sizeof(buf), 0) == 100);
+    assert(memcmp(buf, big + i * 100, 100) == 0);
+  }
+  while (grolength < 1000)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(grolength == 1000);
+  assert(nseen == 10 || (nseen == 1 && grosize == 100));
+  printf("UDP_GRO: %s\n", nseen == 1 ? "coalesced" : "not coalesced");
+
+  close(fd);
+  nt_release(server2);
+  nt_release(server);
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
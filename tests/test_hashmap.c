@@ -0,0 +1,128 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/hashmap.h"
+#include "../src/array.h"
+#include "../src/sockaddr.h"
+#include <sys/time.h>
+
+#define N 20000
+
+static double _now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_hashmap_t *m;
+  nt_hashmap_entry_t *e;
+  nt_array_t *a;
+  nt_buffer_t *k1, *k2;
+  nt_sockaddr_t sa1, sa2;
+  size_t i, iter, maxold;
+  void *v;
+  double t;
+  
+  // integer keys, across several incremental resizes
+  m = nt_hashmap_new(&nt_hashmap_intkeys, 0);
+  maxold = 0;
+  for (i = 0; i < N; i++) {
+    assert(nt_hashmap_put(m, NT_HASHMAP_INTKEY(i), (void *)(i + 1)));
+    if (m->old.count > maxold)
+      maxold = m->old.count;
+    // everything stays reachable while a resize is in progress
+    if (m->old.count)
+      assert(nt_hashmap_get(m, NT_HASHMAP_INTKEY(i / 2)) == (void *)(i / 2 + 1));
+  }
+  assert(maxold > 0);
+  assert(nt_hashmap_count(m) == N);
+  for (i = 0; i < N; i++)
+    assert(nt_hashmap_get(m, NT_HASHMAP_INTKEY(i)) == (void *)(i + 1));
+  assert(nt_hashmap_get(m, NT_HASHMAP_INTKEY(N)) == NULL);
+  
+  // replace
+  assert(nt_hashmap_put(m, NT_HASHMAP_INTKEY(7), (void *)7000));
+  assert(nt_hashmap_count(m) == N);
+  assert(nt_hashmap_get(m, NT_HASHMAP_INTKEY(7)) == (void *)7000);
+  
+  // iterate
+  iter = 0;
+  i = 0;
+  while ((e = nt_hashmap_next(m, &iter)))
+    i++;
+  assert(i == N);
+  
+  // remove every other key
+  for (i = 0; i < N; i += 2) {
+    assert(nt_hashmap_remove(m, NT_HASHMAP_INTKEY(i), &v));
+    assert(v == (void *)(i + 1));
+  }
+  assert(!nt_hashmap_remove(m, NT_HASHMAP_INTKEY(0), NULL));
+  assert(nt_hashmap_count(m) == N / 2);
+  for (i = 0; i < N; i++)
+    assert((nt_hashmap_find(m, NT_HASHMAP_INTKEY(i)) != NULL) == (i & 1));
+  nt_release(m);
+  
+  // string and buffer keys
+  m = nt_hashmap_new(&nt_hashmap_cstrkeys, 4);
+  assert(nt_hashmap_put(m, "Content-Length", (void *)1));
+  assert(nt_hashmap_put(m, "Host", (void *)2));
+  {
+    char key[] = "Host";
+    assert(nt_hashmap_get(m, key) == (void *)2);
+  }
+  assert(nt_hashmap_get(m, "Hos") == NULL);
+  nt_release(m);
+  
+  m = nt_hashmap_new(&nt_hashmap_bufferkeys, 0);
+  k1 = nt_buffer_new(0, 16);
+  k2 = nt_buffer_new(0, 16);
+  nt_buffer_appends(k1, "session-123456789");
+  nt_buffer_appends(k2, "session-123456789");
+  assert(nt_hashmap_put(m, k1, (void *)1));
+  assert(nt_hashmap_get(m, k2) == (void *)1);
+  nt_buffer_appendc(k2, 'x');
+  assert(nt_hashmap_get(m, k2) == NULL);
+  nt_release(m);
+  nt_release(k1);
+  nt_release(k2);
+  
+  // sockaddr keys
+  m = nt_hashmap_new(&nt_hashmap_sockaddrkeys, 0);
+  memset(&sa1, 0, sizeof(sa1));
+  memset(&sa2, 0xff, sizeof(sa2)); // garbage padding must not matter
+  ((struct sockaddr_in *)&sa1)->sin_family = AF_INET;
+  ((struct sockaddr_in *)&sa1)->sin_port = htons(8080);
+  ((struct sockaddr_in *)&sa1)->sin_addr.s_addr = htonl(0x7f000001);
+  ((struct sockaddr_in *)&sa2)->sin_family = AF_INET;
+  ((struct sockaddr_in *)&sa2)->sin_port = htons(8080);
+  ((struct sockaddr_in *)&sa2)->sin_addr.s_addr = htonl(0x7f000001);
+  assert(nt_hashmap_put(m, &sa1, (void *)1));
+  assert(nt_hashmap_get(m, &sa2) == (void *)1);
+  ((struct sockaddr_in *)&sa2)->sin_port = htons(8081);
+  assert(nt_hashmap_get(m, &sa2) == NULL);
+  nt_release(m);
+  
+  // benchmark: lookups vs a linear scan with nt_array_indexof
+  m = nt_hashmap_new(&nt_hashmap_intkeys, 0);
+  a = nt_array_new(0, 64);
+  for (i = 0; i < 2000; i++) {
+    void *p = (void *)(i * 64 + 1);
+    nt_array_push(a, p);
+    nt_hashmap_put(m, p, p);
+  }
+  t = _now();
+  for (i = 0; i < 2000 * 100; i++)
+    assert(nt_array_indexof(a, (void *)((i % 2000) * 64 + 1)) == (ssize_t)(i % 2000));
+  printf("linear scan:  %.1f ns/lookup\n", (_now() - t) * 1e9 / (2000 * 100));
+  t = _now();
+  for (i = 0; i < 2000 * 100; i++)
+    assert(nt_hashmap_get(m, (void *)((i % 2000) * 64 + 1)) != NULL);
+  printf("hashmap:      %.1f ns/lookup\n", (_now() - t) * 1e9 / (2000 * 100));
+  nt_release(a);
+  nt_release(m);
+  
+  return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/outq.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+
+#define BIGSIZE 0x100000
+
+static int ndone = 0, lasterror = -1;
+
+static void _done(int fd, int error, void *arg) {
+  assert(arg == (void *)&ndone);
+  ndone++;
+  lasterror = error;
+}
+
+static void _segfree(void *data, void *arg) {
+  (*(int *)arg)++;
+}
+
+/* Connected TCP sockets over loopback */
+static void _tcppair(int fds[2]) {
+  struct sockaddr_in sa;
+  socklen_t salen = sizeof(sa);
+  int lfd;
+  assert((lfd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+  assert(listen(lfd, 1) == 0);
+  assert(getsockname(lfd, (struct sockaddr *)&sa, &salen) == 0);
+  assert((fds[0] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  assert(connect(fds[0], (struct sockaddr *)&sa, sizeof(sa)) == 0);
+  assert((fds[1] = accept(lfd, NULL, NULL)) != -1);
+  close(lfd);
+}
+
+/* Read exactly @length bytes from blocking @fd */
+static void _readall(int fd, byte_t *buf, size_t length) {
+  ssize_t n;
+  while (length) {
+    assert((n = read(fd, buf, length)) > 0);
+    buf += n;
+    length -= (size_t)n;
+  }
+}
+
+int main (int argc, char const *argv[]) {
+  nt_outq_t q;
+  nt_bufchain_t *chain;
+  nt_bufseg_t *seg;
+  static byte_t body[] = "0123456789";
+  char path[] = "/tmp/test_outq.XXXXXX";
+  static byte_t big[BIGSIZE], out[BIGSIZE];
+  int i, r, file, fds[2], src[2], sndbuf = 4096, freed = 0;
+  size_t got;
+
+  for (i = 0; i < BIGSIZE; i++)
+    big[i] = (byte_t)(i * 7);
+  assert((file = mkstemp(path)) != -1);
+  unlink(path);
+  assert(write(file, big, BIGSIZE) == BIGSIZE);
+
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+  nt_outq_init(&q);
+  assert(nt_outq_empty(&q));
+  assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_EMPTY);
+
+  // data, a file range and more data go out in order
+  chain = nt_bufchain_new(0);
+  assert(nt_bufchain_appends(chain, "</tail>"));
+  assert(nt_outq_write(&q, "<head>", 6));
+  assert(nt_outq_sendfile(&q, file, 100, 10, &_done, &ndone));
+  assert(nt_outq_write(&q, "<mid>", 5));
+  assert(nt_outq_appendchain(&q, chain));
+  assert(q.tail->type == NT_OUTQ_DATA && q.head->next->type == NT_OUTQ_FILE);
+  assert(q.head->next->next == q.tail); // the two writes share a chunk
+  assert(nt_outq_length(&q) == 6 + 5 + 7); // the file range holds no memory
+  assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_EMPTY);
+  assert(nt_outq_empty(&q) && nt_outq_length(&q) == 0);
+  assert(ndone == 1 && lasterror == 0);
+  _readall(fds[1], out, 6 + 10 + 5 + 7);
+  assert(memcmp(out, "<head>", 6) == 0);
+  assert(memcmp(out + 6, big + 100, 10) == 0);
+  assert(memcmp(out + 16, "<mid></tail>", 12) == 0);
+  nt_release(chain);
+
+  // small writes and referenced buffers coalesce into one writev
+  assert((seg = nt_bufseg_wrap(body, 10, &_segfree, &freed)) != NULL);
+  assert(nt_outq_write(&q, "a", 1));
+  assert(nt_outq_appendseg(&q, seg, 2, 5));
+  assert(nt_outq_write(&q, "b", 1));
+  nt_release(seg);
+  assert(freed == 0);
+  assert(q.head == q.tail && q.head->data->nlinks == 3);
+  assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_EMPTY);
+  assert(freed == 1);
+  _readall(fds[1], out, 7);
+  assert(memcmp(out, "a23456b", 7) == 0);
+
+  // a large file is sent as the socket drains
+  assert(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+  assert(nt_outq_sendfile(&q, file, 0, BIGSIZE, &_done, &ndone));
+  got = 0;
+  while ((r = nt_outq_flush(&q, fds[0])) == NT_OUTQ_WAITWRITE) {
+    ssize_t n = read(fds[1], out + got, BIGSIZE - got);
+    assert(n > 0);
+    got += (size_t)n;
+  }
+  assert(r == NT_OUTQ_EMPTY && ndone == 2 && lasterror == 0);
+  _readall(fds[1], out + got, BIGSIZE - got);
+  assert(memcmp(out, big, BIGSIZE) == 0);
+
+  // a file shorter than promised fails the chunk and the flush
+  assert(nt_outq_sendfile(&q, file, BIGSIZE - 4, 8, &_done, &ndone));
+  assert(nt_outq_write(&q, "x", 1));
+  assert(nt_outq_flush(&q, fds[0]) == -1 && errno == EIO);
+  assert(ndone == 3 && lasterror == EIO);
+  _readall(fds[1], out, 4);
+  assert(memcmp(out, big + BIGSIZE - 4, 4) == 0);
+  nt_outq_clear(&q);
+  assert(nt_outq_empty(&q));
+
+  // clearing cancels pending transfers
+  assert(nt_outq_sendfile(&q, file, 0, 1, &_done, &ndone));
+  nt_outq_clear(&q);
+  assert(ndone == 4 && lasterror == ECANCELED);
+
+  // socket-to-socket through a pipe
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, src) == 0);
+  assert(fcntl(src[1], F_SETFL, O_NONBLOCK) == 0);
+  if (nt_outq_splice(&q, src[1], 5, &_done, &ndone)) {
+    assert(nt_outq_write(&q, "|", 1));
+    assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_WAITSOURCE);
+    assert(nt_outq_sourcefd(&q) == src[1]);
+    assert(write(src[0], "hello world", 11) == 11);
+    assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_EMPTY);
+    assert(ndone == 5 && lasterror == 0);
+    _readall(fds[1], out, 6);
+    assert(memcmp(out, "hello|", 6) == 0);
+    // the rest, until the source is shut down
+    assert(nt_outq_splice(&q, src[1], NT_OUTQ_UNTIL_EOF, &_done, &ndone));
+    assert(shutdown(src[0], SHUT_WR) == 0);
+    assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_EMPTY);
+    assert(ndone == 6 && lasterror == 0);
+    _readall(fds[1], out, 6);
+    assert(memcmp(out, " world", 6) == 0);
+    // a source which ends early
+    assert(nt_outq_splice(&q, src[1], 1, &_done, &ndone));
+    assert(nt_outq_flush(&q, fds[0]) == -1 && errno == EIO);
+    assert(ndone == 7 && lasterror == EIO);
+  }
+  else {
+    assert(errno == ENOSYS);
+  }
+  nt_outq_clear(&q);
+  close(fds[0]);
+  close(fds[1]);
+
+  // MSG_ZEROCOPY: segments are held until the kernel reports completion
+  _tcppair(fds);
+  assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+  if (nt_outq_setzerocopy(&q, fds[0], 0x4000)) {
+    struct pollfd pfd;
+    freed = 0;
+    assert((seg = nt_bufseg_wrap(big, 0x10000, &_segfree, &freed)) != NULL);
+    // below the threshold: copied as usual
+    assert(nt_outq_write(&q, "small", 5));
+    assert(nt_outq_flush(&q, fds[0]) == NT_OUTQ_EMPTY);
+    assert(!nt_outq_zcpending(&q));
+    _readall(fds[1], out, 5);
+    // above: retained until completion
+    assert(nt_outq_appendseg(&q, seg, 0, 0x10000));
+    nt_release(seg);
+    while ((r = nt_outq_flush(&q, fds[0])) == NT_OUTQ_WAITWRITE)
+      ;
+    assert(r == NT_OUTQ_EMPTY);
+    assert(nt_outq_zcpending(&q) && freed == 0);
+    _readall(fds[1], out, 0x10000);
+    assert(memcmp(out, big, 0x10000) == 0);
+    pfd.fd = fds[0];
+    pfd.events = 0;
+    while (nt_outq_zcpending(&q)) {
+      assert(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLERR));
+      nt_outq_reapzerocopy(&q, fds[0]);
+    }
+    assert(freed == 1);
+    assert(q.zcnext > 0 && q.zccopied > 0); // loopback always copies
+  }
+  else {
+    assert(errno == ENOSYS || errno == ENOPROTOOPT || errno == EOPNOTSUPP);
+  }
+  nt_outq_clear(&q);
+
+  close(src[0]);
+  close(src[1]);
+  close(fds[0]);
+  close(fds[1]);
+  close(file);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
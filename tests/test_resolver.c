@@ -0,0 +1,177 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/resolver.h"
+#include "../src/dgramserv.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int ndone = 0, lasterror = -1, nqueries = 0;
+static size_t lastnaddrs = 0;
+static nt_sockaddr_t lastaddrs[NT_RESOLVER_MAXADDRS];
+
+static void _done(const nt_sockaddr_t *addrs, size_t naddrs, int error, void *arg) {
+  assert(arg == (void *)&ndone);
+  ndone++;
+  lasterror = error;
+  lastnaddrs = naddrs;
+  if (naddrs)
+    memcpy(lastaddrs, addrs, naddrs * sizeof(nt_sockaddr_t));
+}
+
+static void _run(nt_runloop_t *runloop, int n) {
+  while (ndone < n)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+}
+
+static const char *_host(int i) {
+  static char buf[INET6_ADDRSTRLEN];
+  return nt_sockaddr_hostcpy(&lastaddrs[i], buf, sizeof(buf));
+}
+
+/*
+  A name server: "a.test" has the address 10.0.0.1 (TTL 1) and no IPv6
+  addresses, "nx.test" does not exist.
+*/
+static void _ns(nt_dgramserv_t *server, nt_dgram_t *dgrams, size_t count) {
+  static const byte_t answer[] = {
+    0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 1, 0, 4, 10, 0, 0, 1
+  };
+  byte_t buf[512];
+  size_t i, len, qlen;
+  for (i = 0; i < count; i++) {
+    len = dgrams[i].length;
+    assert(len > 12 + 4 && len < sizeof(buf) - sizeof(answer));
+    memcpy(buf, dgrams[i].data, len);
+    qlen = strlen((const char *)buf + 12);
+    buf[2] = 0x81;
+    buf[3] = 0x80;
+    nqueries++;
+    if (qlen == 7 && memcmp(buf + 12, "\1a\4test", 7) == 0) {
+      if (buf[12 + qlen + 2] == 1) {
+        buf[7] = 1;
+        memcpy(buf + len, answer, sizeof(answer));
+        len += sizeof(answer);
+      }
+    }
+    else {
+      buf[3] |= 3;
+    }
+    assert(nt_dgramserv_send(server, dgrams[i].addr, buf, len));
+  }
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_resolver_t *resolver;
+  nt_dgramserv_t *ns;
+  nt_sockaddr_t silent;
+  socklen_t salen = sizeof(silent);
+  char hostspath[] = "/tmp/test_resolver.XXXXXX";
+  const char *hosts = "# comment\n10.1.2.3\tfoo.test foo\n::5 foo.test\n";
+  int fd;
+
+  runloop = nt_runloop_new();
+  assert(nt_runloop_enablepost(runloop));
+  assert((resolver = nt_resolver_new(2)) != NULL);
+
+  // numeric addresses are answered right away
+  assert(nt_resolver_resolve(resolver, runloop, "127.0.0.1", 80, AF_UNSPEC, &_done, &ndone));
+  assert(ndone == 1 && lasterror == 0 && lastnaddrs == 1);
+  assert(strcmp(_host(0), "127.0.0.1") == 0 && nt_sockaddr_port(&lastaddrs[0]) == 80);
+  assert(nt_resolver_resolve(resolver, runloop, "::1", 80, AF_INET, &_done, &ndone));
+  assert(ndone == 2 && lasterror == ENOENT && lastnaddrs == 0);
+
+  // the hosts file, with the port applied
+  assert((fd = mkstemp(hostspath)) != -1);
+  assert(write(fd, hosts, strlen(hosts)) == (ssize_t)strlen(hosts));
+  close(fd);
+  nt_resolver_sethosts(resolver, hostspath);
+  assert(nt_resolver_resolve(resolver, runloop, "FOO.test.", 8080, AF_UNSPEC, &_done, &ndone));
+  assert(ndone == 2);
+  _run(runloop, 3);
+  assert(lasterror == 0 && lastnaddrs == 2);
+  assert(strcmp(_host(0), "10.1.2.3") == 0 && strcmp(_host(1), "::5") == 0);
+  assert(nt_sockaddr_port(&lastaddrs[0]) == 8080 && nt_sockaddr_port(&lastaddrs[1]) == 8080);
+
+  // then from the cache
+  assert(nt_resolver_resolve(resolver, runloop, "foo.test", 443, AF_INET6, &_done, &ndone));
+  assert(ndone == 4 && lasterror == 0 && lastnaddrs == 1 && resolver->nhits == 1);
+  assert(strcmp(_host(0), "::5") == 0 && nt_sockaddr_port(&lastaddrs[0]) == 443);
+  unlink(hostspath);
+  nt_resolver_sethosts(resolver, NULL);
+  nt_resolver_flush(resolver);
+
+  // a name server
+  assert((ns = nt_dgramserv_new(&_ns, 0, 0)) != NULL);
+  assert(nt_dgramserv_bind(ns, "127.0.0.1", 0, AF_INET, 0));
+  nt_dgramserv_start(ns, runloop);
+  nt_resolver_setnameservers(resolver, &ns->addr, 1);
+  assert(nt_resolver_resolve(resolver, runloop, "a.test", 80, AF_UNSPEC, &_done, &ndone));
+  _run(runloop, 5);
+  assert(lasterror == 0 && lastnaddrs == 1 && strcmp(_host(0), "10.0.0.1") == 0);
+  assert(nqueries == 2 && resolver->nqueries == 1);
+  assert(nt_resolver_resolve(resolver, runloop, "a.test", 80, AF_INET, &_done, &ndone));
+  assert(ndone == 6 && lasterror == 0 && resolver->nhits == 2);
+  assert(nt_resolver_resolve(resolver, runloop, "a.test", 80, AF_INET6, &_done, &ndone));
+  assert(ndone == 7 && lasterror == ENOENT);
+
+  // when the TTL has passed, concurrent lookups share one query
+  usleep(1100000);
+  assert(nt_resolver_resolve(resolver, runloop, "a.test", 80, AF_UNSPEC, &_done, &ndone));
+  assert(nt_resolver_resolve(resolver, runloop, "a.test", 81, AF_UNSPEC, &_done, &ndone));
+  assert(ndone == 7);
+  _run(runloop, 9);
+  assert(lasterror == 0 && nt_sockaddr_port(&lastaddrs[0]) == 81);
+  assert(nqueries == 4 && resolver->nqueries == 2);
+
+  // a name which does not exist
+  assert(nt_resolver_resolve(resolver, runloop, "nx.test", 80, AF_UNSPEC, &_done, &ndone));
+  _run(runloop, 10);
+  assert(lasterror == ENOENT && lastnaddrs == 0);
+  assert(nt_resolver_resolve(resolver, runloop, "nx.test", 80, AF_UNSPEC, &_done, &ndone));
+  assert(ndone == 11 && lasterror == ENOENT && resolver->nhits == 4);
+
+  // a full cache drops the least recently used name
+  resolver->maxentries = 2;
+  assert(nt_hashmap_count(resolver->cache) == 2);
+  assert(nt_resolver_resolve(resolver, runloop, "d.test", 80, AF_UNSPEC, &_done, &ndone));
+  _run(runloop, 12);
+  assert(lasterror == ENOENT && nt_hashmap_count(resolver->cache) == 2);
+  assert(nt_hashmap_get(resolver->cache, "a.test") == NULL);
+  assert(nt_hashmap_get(resolver->cache, "nx.test") != NULL);
+  assert(nt_resolver_resolve(resolver, runloop, "nx.test", 80, AF_UNSPEC, &_done, &ndone));
+  assert(ndone == 13 && resolver->nhits == 5);
+  assert(nt_resolver_resolve(resolver, runloop, "e.test", 80, AF_UNSPEC, &_done, &ndone));
+  _run(runloop, 14);
+  assert(nt_hashmap_count(resolver->cache) == 2);
+  assert(nt_hashmap_get(resolver->cache, "d.test") == NULL);
+  assert(nt_hashmap_get(resolver->cache, "nx.test") != NULL);
+  resolver->maxentries = NT_RESOLVER_MAXENTRIES;
+
+  // a name server which does not answer
+  assert((fd = socket(AF_INET, SOCK_DGRAM, 0)) != -1);
+  memset(&silent, 0, sizeof(silent));
+  silent.ss_family = AF_INET;
+  ((struct sockaddr_in *)&silent)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(fd, (struct sockaddr *)&silent, sizeof(struct sockaddr_in)) == 0);
+  assert(getsockname(fd, (struct sockaddr *)&silent, &salen) == 0);
+  nt_resolver_setnameservers(resolver, &silent, 1);
+  resolver->timeout = 200;
+  resolver->attempts = 1;
+  assert(nt_resolver_resolve(resolver, runloop, "b.test", 80, AF_UNSPEC, &_done, &ndone));
+  _run(runloop, 15);
+  assert(lasterror == ETIMEDOUT);
+
+  // lookups still queued are dropped
+  assert(nt_resolver_resolve(resolver, runloop, "c.test", 80, AF_UNSPEC, &_done, &ndone));
+  nt_release(resolver);
+  close(fd);
+  nt_release(ns);
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/ringbuf.h"
+#include <sys/socket.h>
+
+int main (int argc, char const *argv[]) {
+  nt_ringbuf_t *rb;
+  const byte_t *p;
+  byte_t *w, out[64];
+  size_t len;
+  struct iovec iov[2];
+  int i, fds[2];
+  
+  rb = nt_ringbuf_new(10);
+  assert(nt_ringbuf_size(rb) == 16);
+  assert(nt_ringbuf_length(rb) == 0);
+  assert(nt_ringbuf_peek(rb, &len) == NULL && len == 0);
+  
+  // fill and consume from the front
+  assert(nt_ringbuf_write(rb, (const byte_t *)"0123456789", 10));
+  assert(nt_ringbuf_length(rb) == 10);
+  nt_ringbuf_consume(rb, 8);
+  assert(nt_ringbuf_length(rb) == 2);
+  p = nt_ringbuf_peek(rb, &len);
+  assert(len == 2 && memcmp(p, "89", 2) == 0);
+  
+  // write across the end of storage
+  assert(nt_ringbuf_write(rb, (const byte_t *)"abcdefghij", 10));
+  assert(nt_ringbuf_size(rb) == 16);
+  assert(nt_ringbuf_length(rb) == 12);
+  p = nt_ringbuf_peek(rb, &len);
+  assert(len == 8 && memcmp(p, "89abcdef", 8) == 0);
+  assert(nt_ringbuf_readiov(rb, iov) == 2);
+  assert(iov[0].iov_len == 8 && iov[1].iov_len == 4);
+  assert(memcmp(iov[1].iov_base, "ghij", 4) == 0);
+  assert(nt_ringbuf_writeiov(rb, iov) == 1 && iov[0].iov_len == 4);
+  
+  // linearize
+  p = nt_ringbuf_linearize(rb);
+  assert(memcmp(p, "89abcdefghij", 12) == 0);
+  p = nt_ringbuf_peek(rb, &len);
+  assert(len == 12);
+  
+  // reserve + commit
+  w = nt_ringbuf_reserve(rb, &len);
+  assert(len == 4);
+  memcpy(w, "klmn", 4);
+  nt_ringbuf_commit(rb, 4);
+  assert(nt_ringbuf_available(rb) == 0);
+  assert(nt_ringbuf_reserve(rb, &len) == NULL);
+  
+  // grow while wrapped
+  nt_ringbuf_consume(rb, 10);
+  assert(nt_ringbuf_write(rb, (const byte_t *)"opqrstuv", 8));
+  assert(nt_ringbuf_write(rb, (const byte_t *)"wxyz0123456789", 14));
+  assert(nt_ringbuf_size(rb) == 32);
+  assert(nt_ringbuf_read(rb, out, sizeof(out)) == 28);
+  assert(memcmp(out, "ijklmnopqrstuvwxyz0123456789", 28) == 0);
+  assert(nt_ringbuf_length(rb) == 0);
+  
+  // stream through a socket pair, consuming from the front
+  AZ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  for (i = 0; i < 100; i++) {
+    assert(nt_ringbuf_write(rb, (const byte_t *)"ping\n", 5));
+    while (nt_ringbuf_length(rb))
+      assert(nt_ringbuf_writefd(rb, fds[0]) > 0);
+    assert(nt_ringbuf_readfd(rb, fds[1], 5) == 5);
+    assert(nt_ringbuf_read(rb, out, 5) == 5);
+    assert(memcmp(out, "ping\n", 5) == 0);
+  }
+  // a full ring is not mistaken for end of file
+  len = nt_ringbuf_available(rb);
+  assert(len <= sizeof(out) && nt_ringbuf_write(rb, out, len));
+  assert(nt_ringbuf_readfd(rb, fds[1], 0) == -1 && errno == ENOBUFS);
+  nt_ringbuf_consume(rb, len);
+  close(fds[0]);
+  close(fds[1]);
+  
+  nt_release(rb);
+  
+  // mirrored: every window is contiguous
+  rb = nt_ringbuf_newmirrored(1);
+  assert(rb != NULL);
+  len = nt_ringbuf_size(rb);
+  assert(len >= 4096 && (len & (len-1)) == 0);
+  byte_t *big = malloc(len);
+  memset(big, 'm', len);
+  assert(nt_ringbuf_write(rb, big, len - 10));
+  nt_ringbuf_consume(rb, len - 20);
+  assert(nt_ringbuf_write(rb, (const byte_t *)"0123456789abcdefghij", 20));
+  p = nt_ringbuf_peek(rb, &len);
+  assert(len == 30);
+  assert(memcmp(p + 10, "0123456789abcdefghij", 20) == 0);
+  assert(nt_ringbuf_readiov(rb, iov) == 1 && iov[0].iov_len == 30);
+  assert(nt_ringbuf_writeiov(rb, iov) == 1);
+  assert(iov[0].iov_len == nt_ringbuf_size(rb) - 30);
+  // wrapped content is linearized in place
+  assert(nt_ringbuf_linearize(rb) == p);
+  
+  // nt_buffer_t view over the ring memory
+  nt_buffer_t view;
+  nt_ringbuf_view(rb, &view);
+  assert(nt_buffer_length(&view) == 30);
+  assert(nt_buffer_indexof(&view, (const byte_t *)"9abc", 4) == 19);
+  assert(nt_buffer_appends(&view, "\r\n\r\n"));
+  nt_ringbuf_commitview(rb, &view);
+  assert(nt_ringbuf_length(rb) == 34);
+  nt_ringbuf_consume(rb, 30);
+  p = nt_ringbuf_peek(rb, &len);
+  assert(len == 4 && memcmp(p, "\r\n\r\n", 4) == 0);
+  nt_ringbuf_view(rb, &view);
+  assert(!nt_buffer_append(&view, big, nt_ringbuf_size(rb)));
+  
+  // growing keeps content
+  assert(nt_ringbuf_write(rb, big, nt_ringbuf_size(rb)));
+  assert(nt_ringbuf_length(rb) == 4 + 4096);
+  assert(rb->flags & NT_RINGBUF_F_MIRRORED);
+  p = nt_ringbuf_peek(rb, &len);
+  assert(len == 4 + 4096 && p[len-1] == 'm');
+  free(big);
+  
+  nt_release(rb);
+  return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/runloop_group.h"
+#include "../src/atomic.h"
+#include "../src/sockutil.h"
+
+#define NTHREADS 4
+#define NPOSTS   10000
+
+static volatile int32_t initialized = 0;
+static volatile int32_t received = 0;
+static int32_t lastseq[NTHREADS];
+static pthread_t threadof[NTHREADS];
+
+static bool _init(nt_runloop_group_t *group, nt_runloop_t *runloop, size_t index) {
+  assert(group->arg == (void *)&initialized);
+  assert(nt_runloop_current() == runloop);
+  assert(nt_runloop_group_runloop(group, index) == runloop);
+  // pinned with NT_RUNLOOP_GROUP_F_AFFINITY
+  assert((runloop->cpu != -1) == ((group->flags & NT_RUNLOOP_GROUP_F_AFFINITY) != 0));
+  threadof[index] = pthread_self();
+  lastseq[index] = -1;
+  nt_atomic_add32(&initialized, 1);
+  return true;
+}
+
+static bool _init_fail(nt_runloop_group_t *group, nt_runloop_t *runloop, size_t index) {
+  return index != 1;
+}
+
+static void _accept(int fd, short ev, nt_sockserv_runloop_t *rs) {
+}
+
+static void _received(nt_runloop_t *runloop, void *arg) {
+  size_t index = (size_t)arg / NPOSTS;
+  int32_t seq = (int32_t)((size_t)arg % NPOSTS);
+  assert(nt_runloop_current() == runloop);
+  assert(pthread_equal(pthread_self(), threadof[index]));
+  // calls from one thread arrive in order
+  assert(seq == lastseq[index] + 1);
+  lastseq[index] = seq;
+  nt_atomic_add32(&received, 1);
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_group_t *group;
+  size_t i, n;
+
+  group = nt_runloop_group_new(NTHREADS, NT_RUNLOOP_GROUP_F_AFFINITY);
+  assert(nt_runloop_group_count(group) == NTHREADS);
+  assert(nt_runloop_group_start(group, &_init, (void *)&initialized));
+  assert(nt_atomic_read32(&initialized) == NTHREADS);
+
+  // post to each thread's runloop from this thread
+  for (n = 0; n < NPOSTS; n++) {
+    for (i = 0; i < NTHREADS; i++)
+      assert(nt_runloop_post(nt_runloop_group_runloop(group, i), &_received,
+                             (void *)(i * NPOSTS + n)));
+  }
+  while (nt_atomic_read32(&received) != NTHREADS * NPOSTS)
+    usleep(1000);
+
+  nt_runloop_group_stop(group);
+  for (i = 0; i < NTHREADS; i++)
+    assert(nt_runloop_group_runloop(group, i) == NULL);
+
+  // the group can be started again
+  initialized = 0;
+  assert(nt_runloop_group_start(group, &_init, (void *)&initialized));
+  assert(nt_atomic_read32(&initialized) == NTHREADS);
+  nt_release(group); // stops
+
+  // a thread failing to initialize fails the start and stops the others
+  group = nt_runloop_group_new(NTHREADS, 0);
+  assert(!nt_runloop_group_start(group, &_init_fail, NULL));
+  assert(group->nstarted == 0);
+  nt_release(group);
+
+  // steering: listeners get their thread's CPU as SO_INCOMING_CPU
+  #if defined(SO_INCOMING_CPU) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  group = nt_runloop_group_new(1, NT_RUNLOOP_GROUP_F_STEER);
+  assert(nt_runloop_group_listen(group, "127.0.0.1", 0, AF_INET, &_accept));
+  assert(nt_sockutil_getiopt(group->threads[0].server->fd4, SOL_SOCKET, SO_INCOMING_CPU) == 0);
+  assert(nt_runloop_group_start(group, NULL, NULL));
+  assert(nt_runloop_group_runloop(group, 0)->cpu == 0);
+  nt_release(group);
+  #endif
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
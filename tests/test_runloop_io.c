@@ -0,0 +1,168 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/runloop.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <fcntl.h>
+
+#define ROUNDTRIPS 20000
+
+static double _now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int nread = 0, ncalls = 0;
+static nt_runloop_io_t *removeme = NULL;
+
+/* Edge-triggered reader: drains until EAGAIN */
+static void _drain(nt_runloop_io_t *io, short events) {
+  char buf[7];
+  ssize_t n;
+  assert(events == EV_READ);
+  ncalls++;
+  while ((n = read(io->fd, buf, sizeof(buf))) > 0)
+    nread += (int)n;
+  assert(n == -1 && errno == EAGAIN);
+  if (removeme) {
+    nt_runloop_rmio(io->runloop, removeme);
+    removeme = NULL;
+  }
+}
+
+static void _hup(nt_runloop_io_t *io, short events) {
+  char c;
+  assert(events == EV_READ);
+  assert(read(io->fd, &c, 1) == 0);
+  ncalls++;
+  nt_runloop_rmio(io->runloop, io);
+}
+
+/* Ping-pong: @arg points to the number of round trips left */
+static nt_runloop_io_t pingio[2];
+static struct event pingev[2];
+
+static bool _pong(int fd, int *left) {
+  char c;
+  assert(read(fd, &c, 1) == 1);
+  if (c == 'b' && --(*left) == 0)
+    return false;
+  c = (c == 'a') ? 'b' : 'a';
+  assert(write(fd, &c, 1) == 1);
+  return true;
+}
+
+static void _pingio(nt_runloop_io_t *io, short events) {
+  nt_runloop_t *runloop = io->runloop;
+  if (!_pong(io->fd, (int *)io->arg)) {
+    nt_runloop_rmio(runloop, &pingio[0]);
+    nt_runloop_rmio(runloop, &pingio[1]);
+  }
+}
+
+static void _pingev(int fd, short events, int *left) {
+  if (!_pong(fd, left)) {
+    event_del(&pingev[0]);
+    event_del(&pingev[1]);
+  }
+}
+
+static double _bench(nt_runloop_t *runloop, int fds[2], bool useio) {
+  int i, left = ROUNDTRIPS;
+  double t = _now();
+  for (i = 0; i < 2; i++) {
+    if (useio) {
+      nt_runloop_io_init(&pingio[i], fds[i], EV_READ, NT_RUNLOOP_IO_EDGE, &_pingio, &left);
+      assert(nt_runloop_addio(runloop, &pingio[i]));
+    }
+    else {
+      event_set(&pingev[i], fds[i], EV_READ|EV_PERSIST,
+        (void (*)(int, short, void *))&_pingev, &left);
+      nt_runloop_addev(runloop, &pingev[i], NULL);
+    }
+  }
+  assert(write(fds[0], "a", 1) == 1);
+  nt_runloop_run(runloop, 0);
+  assert(left == 0);
+  return (_now() - t) * 1e9 / ROUNDTRIPS;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_runloop_io_t io[2];
+  int i, fds[2], fds2[2];
+
+  runloop = nt_runloop_new();
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds2) == 0);
+  for (i = 0; i < 2; i++) {
+    assert(fcntl(fds[i], F_SETFL, O_NONBLOCK) == 0);
+    assert(fcntl(fds2[i], F_SETFL, O_NONBLOCK) == 0);
+  }
+
+  // nothing to dispatch
+  nt_runloop_io_init(&io[0], fds[1], EV_READ, NT_RUNLOOP_IO_EDGE, &_drain, NULL);
+  assert(nt_runloop_addio(runloop, &io[0]));
+  assert(io[0].runloop == runloop && runloop->nio == 1);
+  nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  assert(ncalls == 0);
+
+  // one callback for several writes, which reads everything
+  assert(write(fds[0], "hello ", 6) == 6);
+  assert(write(fds[0], "world", 5) == 5);
+  nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  assert(ncalls == 1 && nread == 11);
+  nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  assert(ncalls == 1);
+
+  // removing a watcher which is ready in the same batch skips it
+  nt_runloop_io_init(&io[1], fds2[1], EV_READ, NT_RUNLOOP_IO_EDGE, &_drain, NULL);
+  assert(nt_runloop_addio(runloop, &io[1]));
+  assert(write(fds[0], "x", 1) == 1);
+  assert(write(fds2[0], "y", 1) == 1);
+  removeme = &io[1];
+  ncalls = 0;
+  nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  if (ncalls == 1) {
+    // io[0] ran first and removed io[1]
+    assert(io[1].runloop == NULL);
+  }
+  else {
+    // io[1] ran first and removed itself, then io[0] ran
+    assert(ncalls == 2 && io[1].runloop == NULL);
+  }
+  assert(runloop->nio == 1);
+  nt_runloop_rmio(runloop, &io[1]); // not added -- no-op
+  assert(runloop->nio == 1);
+
+  // nt_runloop_run returns once no watchers are left
+  nt_runloop_rmio(runloop, &io[0]);
+  assert(io[0].runloop == NULL && runloop->nio == 0);
+  assert(nt_runloop_run(runloop, 0) == 1);
+  close(fds2[0]);
+  close(fds2[1]);
+
+  // hangup is reported as readable, so that read returns 0
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds2) == 0);
+  nt_runloop_io_init(&io[1], fds2[1], EV_READ, 0, &_hup, NULL);
+  assert(nt_runloop_addio(runloop, &io[1]));
+  close(fds2[0]);
+  ncalls = 0;
+  nt_runloop_run(runloop, 0);
+  assert(ncalls == 1 && io[1].runloop == NULL);
+  close(fds2[1]);
+
+  // benchmark: socketpair ping-pong, libevent events vs nt_runloop_io_t
+  printf("libevent:       %.0f ns/roundtrip\n", _bench(runloop, fds, false));
+  printf("nt_runloop_io:  %.0f ns/roundtrip\n", _bench(runloop, fds, true));
+
+  close(fds[0]);
+  close(fds[1]);
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/slabpool.h"
+
+int main (int argc, char const *argv[]) {
+  nt_slabpool_t pool;
+  byte_t *a, *b, *c;
+
+  nt_slabpool_init(&pool, 4096, 2);
+
+  // slabs are allocated while the free list is empty
+  assert((a = nt_slabpool_get(&pool)) != NULL);
+  assert((b = nt_slabpool_get(&pool)) != NULL);
+  assert((c = nt_slabpool_get(&pool)) != NULL);
+  assert(a != b && b != c && pool.nused == 3 && pool.nfree == 0);
+  memset(a, 'a', pool.slabsize);
+  memset(c, 'c', pool.slabsize);
+
+  // returned slabs are kept, up to maxfree
+  nt_slabpool_put(&pool, a);
+  nt_slabpool_put(&pool, b);
+  nt_slabpool_put(&pool, c);
+  assert(pool.nused == 0 && pool.nfree == 2);
+
+  // and handed out again, most recently returned first
+  assert(nt_slabpool_get(&pool) == b);
+  assert(nt_slabpool_get(&pool) == a);
+  assert(pool.nfree == 0 && pool.nused == 2);
+  assert((c = nt_slabpool_get(&pool)) != NULL && pool.nused == 3);
+
+  nt_slabpool_put(&pool, c);
+  nt_slabpool_put(&pool, a);
+  nt_slabpool_put(&pool, b);
+  nt_slabpool_destroy(&pool);
+  assert(pool.nfree == 0 && pool.free == NULL);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,278 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/sockconn.h"
+#include "../src/runloop.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BIG (256 * 1024)
+
+static nt_runloop_t *runloop;
+static nt_sockserv_runloop_t rs;
+static int lfd;
+static char input[64];
+static size_t ninput = 0;
+static int nfreed = 0;
+
+static void _read(struct bufferevent *bev, nt_sockconn_t *conn) {
+  ninput += bufferevent_read(bev, input + ninput, sizeof(input) - ninput);
+}
+
+static void _freed(void *data, void *arg) {
+  nfreed++;
+}
+
+static int nflow = 0;
+static bool lastfull = false;
+
+static void _flow(nt_sockconn_t *conn, bool full, void *arg) {
+  assert(arg == (void *)&nflow);
+  assert(full != lastfull);
+  lastfull = full;
+  nflow++;
+}
+
+static char lines[64];
+static size_t nlines = 0;
+static int nrecv = 0;
+static short lastwhat = 0;
+static int lasterrno = 0;
+
+/* Consumes complete lines. "quit" closes the connection. */
+static size_t _recvlines(nt_sockconn_t *conn, const byte_t *data, size_t length) {
+  const byte_t *nl;
+  size_t n, consumed = 0;
+  nrecv++;
+  while ((nl = memchr(data + consumed, '\n', length - consumed)) != NULL) {
+    n = (size_t)(nl - (data + consumed)) + 1;
+    if (n == 5 && memcmp(data + consumed, "quit\n", 5) == 0) {
+      nt_sockconn_close(conn);
+      nt_release(conn);
+      return consumed + n;
+    }
+    assert(nlines + n <= sizeof(lines));
+    memcpy(lines + nlines, data + consumed, n);
+    nlines += n;
+    consumed += n;
+  }
+  return consumed;
+}
+
+static void _error(struct bufferevent *bev, short what, nt_sockconn_t *conn) {
+  lastwhat = what;
+  lasterrno = errno;
+}
+
+/* A connection accepted over loopback TCP, and its (blocking) peer */
+static nt_sockconn_t *_pair(int *peer, nt_sockconn_readcb_t readcb) {
+  nt_sockaddr_t sa;
+  socklen_t salen = sizeof(sa);
+  nt_sockconn_t *conn = nt_sockconn_new();
+  int bufsize = 16384;
+  assert(getsockname(lfd, (struct sockaddr *)&sa, &salen) == 0);
+  assert((*peer = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  // small socket buffers, so that output backs up in the connection
+  assert(setsockopt(*peer, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)) == 0);
+  assert(connect(*peer, (struct sockaddr *)&sa, salen) == 0);
+  assert(nt_sockconn_accept(conn, &rs, lfd, readcb, NULL, NULL));
+  assert(setsockopt(conn->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize)) == 0);
+  return conn;
+}
+
+/* Run the runloop without reading from the peer until output stops draining */
+static void _backup(nt_sockconn_t *conn) {
+  size_t length;
+  do {
+    length = nt_sockconn_outlength(conn);
+    usleep(10000);
+    nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  } while (nt_sockconn_outlength(conn) != length);
+}
+
+/* Run the runloop, reading everything sent to @peer, until @done is true */
+#define _runreading(peer, got, done) do { \
+    char _buf[16384]; \
+    ssize_t _n; \
+    while (!(done)) { \
+      nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK); \
+      if ((_n = recv((peer), _buf, sizeof(_buf), MSG_DONTWAIT)) > 0) \
+        (got) += (size_t)_n; \
+      else \
+        usleep(1000); \
+    } \
+  } while (0)
+
+int main (int argc, char const *argv[]) {
+  nt_sockconn_t *conn, *conn2;
+  struct sockaddr_in sin;
+  static byte_t big[BIG];
+  size_t got;
+  int peer, peer2;
+
+  runloop = nt_runloop_new();
+  rs.server = NULL;
+  rs.runloop = runloop;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert((lfd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  assert(bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) == 0);
+  assert(listen(lfd, 16) == 0);
+  memset(big, 'z', sizeof(big));
+
+  // zerocopy: the connection keeps reading while completions are pending
+  conn = _pair(&peer, &_read);
+  if (nt_sockconn_setzerocopy(conn, 0x4000)) {
+    assert(nt_sockconn_writeref(conn, big, BIG, &_freed, NULL));
+    assert(send(peer, "ping", 4, 0) == 4);
+    got = 0;
+    _runreading(peer, got, got == BIG && ninput == 4 && nfreed == 1);
+    assert(memcmp(input, "ping", 4) == 0);
+    assert(!nt_outq_zcpending(&conn->outq) && !conn->zcev_pending);
+    // and has gone back to reading through the bufferevent
+    assert(send(peer, "pong", 4, 0) == 4);
+    _runreading(peer, got, ninput == 8);
+    assert(memcmp(input + 4, "pong", 4) == 0);
+    // without a read callback, completions are reaped on the timer tick
+    nt_release(conn);
+    close(peer);
+    conn = _pair(&peer, NULL);
+    assert(nt_sockconn_setzerocopy(conn, 0x4000));
+    assert(nt_sockconn_writeref(conn, big, BIG, &_freed, NULL));
+    got = 0;
+    _runreading(peer, got, got == BIG && nfreed == 2);
+    assert(!nt_timer_pending(&conn->zctimer));
+  }
+  else {
+    printf("SO_ZEROCOPY: not supported\n");
+  }
+  nt_release(conn);
+  close(peer);
+
+  // while outq is in use the bufferevent's write event is off
+  conn = _pair(&peer, &_read);
+  nt_sockconn_write(conn, "head", 4);
+  assert(nt_sockconn_writeref(conn, big, BIG, NULL, NULL));
+  assert(!(conn->bev.enabled & EV_WRITE));
+  assert(!event_pending(&conn->bev.ev_write, EV_WRITE, NULL));
+  got = 0;
+  _runreading(peer, got, got == 4 + BIG);
+  // and is back once outq has drained
+  assert(nt_outq_empty(&conn->outq) && (conn->bev.enabled & EV_WRITE));
+  nt_sockconn_write(conn, "tail", 4);
+  assert(event_pending(&conn->bev.ev_write, EV_WRITE, NULL));
+  _runreading(peer, got, got == 4 + BIG + 4);
+  nt_release(conn);
+  close(peer);
+
+  // watermarks: the flow callback is called at the high and the low mark
+  conn = _pair(&peer, &_read);
+  nt_sockconn_setwatermarks(conn, 64 * 1024, 16 * 1024, &_flow, &nflow);
+  nt_sockconn_write(conn, big, 32 * 1024);
+  assert(nflow == 0 && !conn->outfull);
+  nt_sockconn_write(conn, big, 64 * 1024);
+  assert(nflow == 1 && conn->outfull);
+  // the runloop's total follows the connection as output drains partially
+  _backup(conn);
+  assert(nt_sockconn_outlength(conn) > 16 * 1024);
+  assert(nt_sockconn_outlength(conn) < 96 * 1024);
+  assert(runloop->outbytes == nt_sockconn_outlength(conn));
+  assert(nflow == 1);
+  got = 0;
+  _runreading(peer, got, got == 96 * 1024);
+  assert(nflow == 2 && !conn->outfull && runloop->outbytes == 0);
+  nt_release(conn);
+  close(peer);
+
+  // without a flow callback, reading stops until output has drained
+  conn = _pair(&peer, &_read);
+  nt_sockconn_setwatermarks(conn, 64 * 1024, 16 * 1024, NULL, NULL);
+  nt_sockconn_write(conn, big, BIG);
+  assert(conn->outfull && conn->readpaused);
+  ninput = 0;
+  assert(send(peer, "ping", 4, 0) == 4);
+  _backup(conn);
+  assert(ninput == 0);
+  got = 0;
+  _runreading(peer, got, got == BIG && ninput == 4);
+  assert(!conn->outfull && !conn->readpaused);
+  nt_release(conn);
+  close(peer);
+
+  // the runloop's limit pauses connections holding more than their low mark
+  runloop->outlimit = 100 * 1024;
+  conn = _pair(&peer, &_read);
+  conn2 = _pair(&peer2, &_read);
+  nt_sockconn_setwatermarks(conn, 0, 8 * 1024, &_flow, &nflow);
+  nt_sockconn_setwatermarks(conn2, 0, 8 * 1024, NULL, NULL);
+  nflow = 0;
+  nt_sockconn_write(conn, big, 64 * 1024);
+  assert(!conn->outfull && runloop->outbytes == 64 * 1024);
+  nt_sockconn_write(conn2, big, 64 * 1024);
+  assert(conn2->outfull && conn2->readpaused && !conn->outfull);
+  nt_sockconn_write(conn, big, 1);
+  assert(conn->outfull && nflow == 1);
+  got = 0;
+  _runreading(peer, got, got == 64 * 1024 + 1);
+  assert(!conn->outfull && nflow == 2);
+  got = 0;
+  _runreading(peer2, got, got == 64 * 1024);
+  assert(!conn2->outfull && runloop->outbytes == 0);
+  nt_release(conn);
+  nt_release(conn2);
+  close(peer);
+  close(peer2);
+
+  // receiving into pooled slabs: a partial line stays in the slab
+  conn = _pair(&peer, NULL);
+  nt_sockconn_setcb(conn, NULL, NULL, &_error);
+  nt_sockconn_setrecv(conn, &_recvlines);
+  assert(conn->rxslab == NULL && runloop->rxpool.nused == 0);
+  assert(send(peer, "hel", 3, 0) == 3);
+  while (nrecv < 1)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(nlines == 0 && conn->rxslab != NULL && conn->rxlen == 3);
+  assert(runloop->rxpool.nused == 1);
+  // is completed by the next read, and what is left moves to the start
+  assert(send(peer, "lo\nwor", 6, 0) == 6);
+  while (nlines < 6)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(memcmp(lines, "hello\n", 6) == 0);
+  assert(conn->rxlen == 3 && memcmp(conn->rxslab, "wor", 3) == 0);
+  // the slab goes back to the pool once everything is consumed
+  assert(send(peer, "ld\n", 3, 0) == 3);
+  while (nlines < 12)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(memcmp(lines + 6, "world\n", 6) == 0);
+  assert(conn->rxslab == NULL && runloop->rxpool.nused == 0);
+  assert(runloop->rxpool.nfree == 1);
+  // a line which does not fit in a slab
+  memset(big, 'z', NT_RUNLOOP_RXSLAB_SIZE + 1);
+  assert(send(peer, big, NT_RUNLOOP_RXSLAB_SIZE + 1, 0) == NT_RUNLOOP_RXSLAB_SIZE + 1);
+  while (lastwhat == 0)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(lastwhat == (EVBUFFER_READ|EVBUFFER_ERROR) && lasterrno == EMSGSIZE);
+  assert(conn->rxslab == NULL && runloop->rxpool.nused == 0);
+  nt_release(conn);
+  close(peer);
+  memset(big, 'z', sizeof(big));
+
+  // closing the connection from the receive callback
+  conn = _pair(&peer, NULL);
+  nt_sockconn_setrecv(conn, &_recvlines);
+  nlines = 0;
+  assert(send(peer, "bye\nquit\n", 9, 0) == 9);
+  while (nlines < 4)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+  assert(runloop->rxpool.nused == 0 && runloop->nconns == 0);
+  close(peer);
+
+  close(lfd);
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/sockserv.h"
+#include "../src/sockutil.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static int accepted[4], naccepted = 0;
+
+static void _onacceptv(nt_sockserv_runloop_t *rs, const int *fds, const nt_sockaddr_t *addrs,
+                       size_t count) {
+  size_t i;
+  for (i = 0; i < count; i++)
+    accepted[naccepted++] = fds[i];
+}
+
+static int _connect(nt_sockserv_t *server) {
+  nt_sockaddr_t sa;
+  socklen_t salen = sizeof(sa);
+  int fd;
+  assert(getsockname(server->fd4, (struct sockaddr *)&sa, &salen) == 0);
+  assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  assert(connect(fd, (struct sockaddr *)&sa, salen) == 0);
+  return fd;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_sockserv_t *server;
+  nt_sockserv_runloop_t rs;
+  nt_sockopts_t opts;
+  int fd;
+
+  // the default is what sockets always got
+  assert((server = nt_sockserv_new(NULL)) != NULL);
+  nt_sockserv_setacceptv(server, &_onacceptv, 0);
+  assert(server->opts.flags == (NT_SOCKOPTS_REUSEADDR|NT_SOCKOPTS_REUSEPORT));
+  assert(nt_sockopts_backlog(&server->opts) == SOMAXCONN);
+  assert(nt_sockserv_bind(server, "127.0.0.1", 0, SOCK_STREAM, AF_INET));
+  assert(nt_sockutil_getiopt(server->fd4, SOL_SOCKET, SO_REUSEADDR) != 0);
+  assert(nt_sockserv_listen(server));
+  rs.server = server;
+  rs.runloop = NULL;
+  fd = _connect(server);
+  nt_sockserv_acceptv(server->fd4, EV_READ, &rs);
+  assert(naccepted == 1);
+  assert(nt_sockutil_getiopt(accepted[0], IPPROTO_TCP, TCP_NODELAY) == 0);
+  close(accepted[0]);
+  close(fd);
+  nt_fd_close(&server->fd4);
+  nt_release(server);
+
+  // latency: accepted connections get TCP_NODELAY
+  opts = nt_sockopts_latency;
+  opts.flags &= ~NT_SOCKOPTS_REUSEADDR;
+  opts.backlog = 7;
+  assert((server = nt_sockserv_new(NULL)) != NULL);
+  nt_sockserv_setacceptv(server, &_onacceptv, 0);
+  nt_sockserv_setopts(server, &opts);
+  assert(nt_sockserv_bind(server, "127.0.0.1", 0, SOCK_STREAM, AF_INET));
+  assert(nt_sockutil_getiopt(server->fd4, SOL_SOCKET, SO_REUSEADDR) == 0);
+  #if defined(TCP_FASTOPEN) && defined(__linux__)
+  {
+    int qlen = 0;
+    socklen_t len = sizeof(qlen);
+    /* refused when net.ipv4.tcp_fastopen does not enable it for servers */
+    if (getsockopt(server->fd4, IPPROTO_TCP, TCP_FASTOPEN, &qlen, &len) == 0 && qlen)
+      assert(qlen == 256);
+  }
+  #endif
+  assert(nt_sockserv_listen(server));
+  rs.server = server;
+  fd = _connect(server);
+  nt_sockserv_acceptv(server->fd4, EV_READ, &rs);
+  assert(naccepted == 2);
+  assert(nt_sockutil_getiopt(accepted[1], IPPROTO_TCP, TCP_NODELAY) != 0);
+  close(accepted[1]);
+  close(fd);
+  nt_fd_close(&server->fd4);
+  nt_release(server);
+
+  // throughput: fixed buffer sizes, inherited by accepted sockets
+  assert((server = nt_sockserv_new(NULL)) != NULL);
+  nt_sockserv_setacceptv(server, &_onacceptv, 0);
+  nt_sockserv_setopts(server, &nt_sockopts_throughput);
+  assert(nt_sockserv_bind(server, "127.0.0.1", 0, SOCK_STREAM, AF_INET));
+  /* Linux doubles the value, and caps it at net.core.rmem_max */
+  assert(nt_sockutil_getiopt(server->fd4, SOL_SOCKET, SO_RCVBUF) > 64 * 1024);
+  #ifdef TCP_DEFER_ACCEPT
+  assert(nt_sockutil_getiopt(server->fd4, IPPROTO_TCP, TCP_DEFER_ACCEPT) > 0);
+  #endif
+  assert(nt_sockserv_listen(server));
+  rs.server = server;
+  fd = _connect(server);
+  /* with TCP_DEFER_ACCEPT, the connection is only accepted once there is data */
+  assert(write(fd, "x", 1) == 1);
+  while (naccepted < 3) {
+    usleep(1000);
+    nt_sockserv_acceptv(server->fd4, EV_READ, &rs);
+  }
+  assert(nt_sockutil_getiopt(accepted[2], SOL_SOCKET, SO_RCVBUF) ==
+         nt_sockutil_getiopt(server->fd4, SOL_SOCKET, SO_RCVBUF));
+  close(accepted[2]);
+  close(fd);
+  nt_fd_close(&server->fd4);
+  nt_release(server);
+
+  // the reuse flags do not keep other families from binding
+  {
+    nt_sockaddr_t sa;
+    struct sockaddr_un *sun = (struct sockaddr_un *)&sa;
+    memset(&sa, 0, sizeof(sa));
+    sun->sun_family = AF_UNIX;
+    snprintf(sun->sun_path, sizeof(sun->sun_path), "/tmp/test_sockopts.%d", (int)getpid());
+    unlink(sun->sun_path);
+    assert((fd = socket(AF_UNIX, SOCK_STREAM, 0)) != -1);
+    assert(nt_sockutil_bind(fd, &sa) == 0);
+    assert(access(sun->sun_path, F_OK) == 0);
+    close(fd);
+    unlink(sun->sun_path);
+  }
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
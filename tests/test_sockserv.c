@@ -0,0 +1,121 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/runloop.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#define NCLIENTS 40
+
+static int accepted = 0;
+static int calls = 0;
+static size_t largest = 0;
+
+static void _acceptv(nt_sockserv_runloop_t *rs, const int *fds,
+                     const nt_sockaddr_t *addrs, size_t count) {
+  size_t i;
+  calls++;
+  if (count > largest)
+    largest = count;
+  for (i = 0; i < count; i++) {
+    assert(fcntl(fds[i], F_GETFL) & O_NONBLOCK);
+    assert(fcntl(fds[i], F_GETFD) & FD_CLOEXEC);
+    assert(addrs[i].ss_family == AF_INET);
+    close(fds[i]);
+  }
+  accepted += count;
+}
+
+int main (int argc, char const *argv[]) {
+  nt_runloop_t *runloop;
+  nt_sockserv_t *server;
+  nt_sockaddr_t sa;
+  socklen_t salen = sizeof(sa);
+  int i, fds[NCLIENTS];
+
+  server = nt_sockserv_new(NULL);
+  nt_sockserv_setacceptv(server, &_acceptv, 16);
+  assert(server->accept_batch == 16);
+  assert(nt_sockserv_bind(server, "127.0.0.1", 0, SOCK_STREAM, AF_INET));
+  assert(nt_sockserv_listen(server));
+  assert(getsockname(server->fd4, (struct sockaddr *)&sa, &salen) == 0);
+
+  // all clients are in the backlog before the runloop gets to run
+  for (i = 0; i < NCLIENTS; i++) {
+    assert((fds[i] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(connect(fds[i], (struct sockaddr *)&sa, salen) == 0);
+  }
+
+  runloop = nt_runloop_new();
+  assert(nt_runloop_addsockserv(runloop, server));
+  // each readiness event accepts at most one batch
+  assert(nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK) == 0);
+  assert(accepted == 16 && calls == 1);
+  while (accepted < NCLIENTS)
+    nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  assert(accepted == NCLIENTS);
+  assert(largest == 16);
+  assert(calls == 3);
+
+  for (i = 0; i < NCLIENTS; i++)
+    close(fds[i]);
+  nt_release(runloop);
+  nt_fd_close(&server->fd4);
+  nt_release(server);
+
+  // steering by CPU: with this thread on CPU 0, every connection goes to the
+  // listener the program maps CPU 0 to -- the second one
+  #if defined(__linux__)
+  {
+    nt_sockserv_t *servers[2];
+    int cpus[2] = {1000, 0}, lfd, n[2] = {0, 0};
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    assert(sched_setaffinity(0, sizeof(set), &set) == 0);
+    for (i = 0; i < 2; i++) {
+      servers[i] = nt_sockserv_new(NULL);
+      nt_sockserv_setacceptv(servers[i], &_acceptv, 0);
+      if (i == 0) {
+        assert(nt_sockserv_bind(servers[i], "127.0.0.1", 0, SOCK_STREAM, AF_INET));
+        assert(getsockname(servers[i]->fd4, (struct sockaddr *)&sa, &salen) == 0);
+      }
+      else {
+        assert(nt_sockserv_bindtoaddr(servers[i], &sa, SOCK_STREAM));
+      }
+      assert(nt_sockserv_listen(servers[i]));
+    }
+    if (!nt_sockserv_steerbycpu(servers[0], cpus, 2)) {
+      assert(errno == ENOTSUP || errno == EINVAL || errno == ENOPROTOOPT);
+      printf("SO_ATTACH_REUSEPORT_CBPF: not available\n");
+    }
+    else {
+      for (i = 0; i < NCLIENTS; i++) {
+        assert((fds[i] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+        assert(connect(fds[i], (struct sockaddr *)&sa, salen) == 0);
+      }
+      for (i = 0; i < 2; i++) {
+        while ((lfd = accept(servers[i]->fd4, NULL, NULL)) != -1) {
+          n[i]++;
+          close(lfd);
+        }
+      }
+      assert(n[0] == 0 && n[1] == NCLIENTS);
+      for (i = 0; i < NCLIENTS; i++)
+        close(fds[i]);
+    }
+    for (i = 0; i < 2; i++) {
+      nt_fd_close(&servers[i]->fd4);
+      nt_release(servers[i]);
+    }
+  }
+  #endif
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/timerwheel.h"
+
+#define NTIMERS 1000
+
+static uint64_t fired_at[NTIMERS];
+static nt_timerwheel_t wheel;
+
+static void _fire(nt_timer_t *timer, void *arg) {
+  fired_at[(size_t)arg] = wheel.now - 1;
+}
+
+static int rearm_count = 0;
+
+static void _rearm(nt_timer_t *timer, void *arg) {
+  if (++rearm_count < 3)
+    nt_timerwheel_add(&wheel, timer, 10);
+}
+
+int main (int argc, char const *argv[]) {
+  static nt_timer_t timers[NTIMERS];
+  nt_timer_t t;
+  size_t i;
+  uint64_t start = 12345;
+
+  nt_timerwheel_init(&wheel, start);
+
+  // timers on all levels expire exactly on their tick
+  for (i = 0; i < NTIMERS; i++) {
+    nt_timer_init(&timers[i], &_fire, (void *)i);
+    nt_timerwheel_add(&wheel, &timers[i], i * 97);
+    assert(nt_timer_pending(&timers[i]));
+  }
+  assert(wheel.count == NTIMERS);
+  assert(nt_timerwheel_advance(&wheel, start - 1) == 0);
+  assert(nt_timerwheel_advance(&wheel, start) == 1);
+  for (i = 1; i < 50; i++) {
+    assert(nt_timerwheel_advance(&wheel, start + i * 97 - 1) == 0);
+    assert(nt_timerwheel_advance(&wheel, start + i * 97) == 1);
+  }
+  // cancel every other remaining timer
+  for (i = 50; i < NTIMERS; i += 2)
+    nt_timerwheel_cancel(&wheel, &timers[i]);
+  assert(!nt_timer_pending(&timers[50]));
+  nt_timerwheel_cancel(&wheel, &timers[50]); // no-op
+  // advance in uneven steps
+  for (i = start; wheel.count; i += 31)
+    nt_timerwheel_advance(&wheel, i);
+  for (i = 0; i < NTIMERS; i++) {
+    if (i >= 50 && (i % 2) == 0)
+      assert(fired_at[i] == 0);
+    else
+      assert(fired_at[i] == start + i * 97);
+  }
+
+  // re-arming moves the expiry
+  memset(fired_at, 0, sizeof(fired_at));
+  nt_timerwheel_add(&wheel, &timers[0], 5);
+  nt_timerwheel_add(&wheel, &timers[0], 200);
+  assert(wheel.count == 1);
+  start = wheel.now;
+  nt_timerwheel_advance(&wheel, start + 100);
+  assert(fired_at[0] == 0);
+  nt_timerwheel_advance(&wheel, start + 300);
+  assert(fired_at[0] == start + 200);
+
+  // timers may be added from their callback
+  nt_timer_init(&t, &_rearm, NULL);
+  nt_timerwheel_add(&wheel, &t, 10);
+  nt_timerwheel_advance(&wheel, wheel.now + 100);
+  assert(rearm_count == 3);
+  assert(wheel.count == 0);
+
+  // an idle wheel skips ahead without walking every tick
+  nt_timerwheel_advance(&wheel, 1ULL << 40);
+  assert(wheel.now == (1ULL << 40) + 1);
+
+  // far-away timers are clamped to the range of the wheel
+  nt_timerwheel_add(&wheel, &timers[1], NT_TIMERWHEEL_MAXTICKS * 2);
+  start = wheel.now;
+  nt_timerwheel_advance(&wheel, start + NT_TIMERWHEEL_MAXTICKS - 1);
+  assert(fired_at[1] == 0);
+  nt_timerwheel_advance(&wheel, start + NT_TIMERWHEEL_MAXTICKS);
+  assert(fired_at[1] == start + NT_TIMERWHEEL_MAXTICKS);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
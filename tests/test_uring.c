@@ -0,0 +1,186 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/runloop.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+
+#define NCLIENTS 3
+
+/* A connection echoing everything it receives, until it receives "quit" */
+typedef struct conn_t {
+  int fd;
+  nt_uring_op_t recvop;
+  nt_uring_op_t sendop;
+  nt_uring_op_t closeop;
+  int closed;
+} conn_t;
+
+static nt_runloop_t *runloop;
+static nt_uring_bufring_t *br;
+static conn_t conns[NCLIENTS];
+static int naccepted = 0, nclosed = 0, nsent = 0, ncancelled = 0;
+
+static void _sentcb(nt_uring_op_t *op, int res, unsigned int flags) {
+  // the buffer is no longer needed once the send completed
+  assert(res > 0);
+  nt_uring_bufring_recycle(br, (unsigned int)(uintptr_t)op->arg);
+  nsent++;
+}
+
+static void _byecb(nt_uring_op_t *op, int res, unsigned int flags) {
+  assert(res == 3);
+}
+
+static void _closedcb(nt_uring_op_t *op, int res, unsigned int flags) {
+  conn_t *conn = (conn_t *)op->arg;
+  assert(res == 0);
+  conn->closed = 1;
+  nclosed++;
+}
+
+static void _recvcb(nt_uring_op_t *op, int res, unsigned int flags) {
+  conn_t *conn = (conn_t *)op->arg;
+  nt_uring_t *uring = nt_runloop_uring(runloop);
+  unsigned int bid;
+  byte_t *buf;
+
+  if (res <= 0) {
+    // end of stream or cancelled -- the multishot receive is over
+    assert((res == 0 || res == -ECANCELED) && !(flags & NT_URING_F_MORE));
+    return;
+  }
+  assert(flags & NT_URING_F_BUFFER);
+  bid = nt_uring_bufid(flags);
+  buf = nt_uring_bufring_buf(br, bid);
+  if (res == 4 && memcmp(buf, "quit", 4) == 0) {
+    // reply, and close once the reply is sent. The pending receive would
+    // keep the socket open.
+    nt_uring_bufring_recycle(br, bid);
+    assert(nt_uring_cancel(uring, &conn->recvop));
+    conn->sendop.cb = &_byecb;
+    conn->closeop.cb = &_closedcb;
+    conn->closeop.arg = conn;
+    assert(nt_uring_send(uring, &conn->sendop, conn->fd, "bye", 3, NT_URING_LINK));
+    assert(nt_uring_close(uring, &conn->closeop, conn->fd));
+  }
+  else {
+    conn->sendop.cb = &_sentcb;
+    conn->sendop.arg = (void *)(uintptr_t)bid;
+    assert(nt_uring_send(uring, &conn->sendop, conn->fd, buf, (size_t)res, 0));
+  }
+}
+
+static void _acceptcb(nt_uring_op_t *op, int res, unsigned int flags) {
+  conn_t *conn;
+  if (res == -ECANCELED) {
+    assert(!(flags & NT_URING_F_MORE));
+    ncancelled++;
+    return;
+  }
+  assert(res >= 0);
+  assert(flags & NT_URING_F_MORE);
+  assert(naccepted < NCLIENTS);
+  conn = &conns[naccepted++];
+  conn->fd = res;
+  conn->recvop.cb = &_recvcb;
+  conn->recvop.arg = conn;
+  assert(nt_uring_recv(nt_runloop_uring(runloop), &conn->recvop, conn->fd, br));
+}
+
+static void _run_until(int *counter, int value) {
+  while (*counter < value)
+    nt_runloop_run(runloop, EVLOOP_ONCE);
+}
+
+int main (int argc, char const *argv[]) {
+  struct sockaddr_in sa;
+  socklen_t salen = sizeof(sa);
+  nt_uring_op_t acceptop;
+  nt_uring_t *uring;
+  int i, lfd, fds[NCLIENTS], one = 1;
+  char buf[16];
+
+  runloop = nt_runloop_new();
+  if (!nt_runloop_enableuring(runloop, 64)) {
+    // fall back to nt_runloop_addio
+    printf("%s: io_uring not available (%s)\n", argv[0], strerror(errno));
+    nt_release(runloop);
+    printf("%s: ok\n", argv[0]);
+    return 0;
+  }
+  assert(nt_runloop_uring(runloop) != NULL);
+  if ((br = nt_uring_bufring_new(nt_runloop_uring(runloop), 1, 16, 64)) == NULL) {
+    printf("%s: provided buffer rings not available (%s)\n", argv[0], strerror(errno));
+    nt_release(runloop);
+    printf("%s: ok\n", argv[0]);
+    return 0;
+  }
+
+  assert((lfd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+  assert(setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+  assert(listen(lfd, 16) == 0);
+  assert(getsockname(lfd, (struct sockaddr *)&sa, &salen) == 0);
+
+  // one multishot accept for all clients
+  acceptop.cb = &_acceptcb;
+  acceptop.arg = NULL;
+  assert(nt_uring_accept(nt_runloop_uring(runloop), &acceptop, lfd, true));
+  assert(nt_runloop_uring(runloop)->queued == 1);
+  for (i = 0; i < NCLIENTS; i++) {
+    assert((fds[i] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(connect(fds[i], (struct sockaddr *)&sa, sizeof(sa)) == 0);
+  }
+  _run_until(&naccepted, NCLIENTS);
+  assert(nt_runloop_uring(runloop)->queued == 0);
+
+  // echo through provided buffers
+  for (i = 0; i < NCLIENTS; i++)
+    assert(write(fds[i], "hello", 5) == 5);
+  _run_until(&nsent, NCLIENTS);
+  for (i = 0; i < NCLIENTS; i++) {
+    assert(read(fds[i], buf, sizeof(buf)) == 5);
+    assert(memcmp(buf, "hello", 5) == 0);
+  }
+
+  // linked send and close
+  assert(write(fds[0], "quit", 4) == 4);
+  _run_until(&nclosed, 1);
+  assert(conns[0].closed);
+  assert(read(fds[0], buf, sizeof(buf)) == 3);
+  assert(memcmp(buf, "bye", 3) == 0);
+  assert(read(fds[0], buf, sizeof(buf)) == 0);
+
+  // cancelling the multishot accept
+  assert(nt_uring_cancel(nt_runloop_uring(runloop), &acceptop));
+  _run_until(&ncancelled, 1);
+
+  for (i = 0; i < NCLIENTS; i++)
+    close(fds[i]);
+  for (i = 1; i < NCLIENTS; i++)
+    close(conns[i].fd);
+  close(lfd);
+  nt_uring_bufring_free(nt_runloop_uring(runloop), br);
+
+  // a submit which fails for good is not retried, and the ring is given up
+  uring = nt_runloop_uring(runloop);
+  i = uring->fd;
+  assert((uring->fd = open("/dev/null", O_RDONLY)) != -1);
+  assert(nt_uring_cancel(uring, &acceptop));
+  nt_runloop_run(runloop, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+  assert(runloop->uringfailed && nt_runloop_uring(runloop) == NULL);
+  assert(!event_pending(&runloop->flushev, EV_TIMEOUT, NULL));
+  close(uring->fd);
+  uring->fd = i;
+  nt_release(runloop);
+
+  printf("%s: ok\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ This code is released in the Public Domain (no restrictions, no support
+ 100% free) by Notion.
+*/
+#include "../src/vec.h"
+
+typedef struct {
+  uint32_t id;
+  uint16_t port;
+} rec_t;
+
+typedef NT_VEC(rec_t) rec_vec_t;
+
+static int rec_cmp(const void *a, const void *b) {
+  uint32_t x = ((const rec_t *)a)->id, y = ((const rec_t *)b)->id;
+  return (x > y) - (x < y);
+}
+
+int main (int argc, char const *argv[]) {
+  NT_VEC(int) v = NT_VEC_INIT;
+  rec_vec_t recs;
+  rec_t r, *rp;
+  int i, *ip, more[] = {7, 8, 9};
+  
+  // push/pop
+  assert(nt_vec_length(&v) == 0);
+  for (i = 0; i < 100; i++)
+    assert(nt_vec_push(&v, i));
+  assert(nt_vec_length(&v) == 100);
+  assert(nt_vec_size(&v) >= 100);
+  assert(nt_vec_get(&v, 0) == 0 && nt_vec_get(&v, 99) == 99);
+  assert(nt_vec_pop(&v) == 99);
+  assert(nt_vec_last(&v) == 98);
+  nt_vec_get(&v, 0) = 42;
+  assert(*nt_vec_at(&v, 0) == 42);
+  
+  // bulk append
+  nt_vec_clear(&v);
+  assert(nt_vec_append(&v, more, 3));
+  assert(nt_vec_length(&v) == 3);
+  assert(nt_vec_get(&v, 2) == 9);
+  
+  // reserve does not move storage for pushes that fit
+  assert(nt_vec_reserve(&v, 1000));
+  ip = v.start;
+  for (i = 0; i < 1000; i++)
+    nt_vec_push(&v, i);
+  assert(v.start == ip);
+  
+  // ordered and unordered delete
+  nt_vec_clear(&v);
+  assert(nt_vec_append(&v, more, 3));
+  nt_vec_swapdel(&v, 0);
+  assert(nt_vec_length(&v) == 2);
+  assert(nt_vec_get(&v, 0) == 9 && nt_vec_get(&v, 1) == 8);
+  nt_vec_swapdel(&v, v.length - 1);
+  assert(nt_vec_length(&v) == 1 && nt_vec_get(&v, 0) == 9);
+  assert(nt_vec_push(&v, 8));
+  assert(nt_vec_push(&v, 10));
+  nt_vec_del(&v, 0, 1);
+  assert(nt_vec_length(&v) == 2);
+  assert(nt_vec_get(&v, 0) == 8 && nt_vec_get(&v, 1) == 10);
+  nt_vec_free(&v);
+  assert(v.start == NULL && nt_vec_length(&v) == 0);
+  
+  // structs stored by value, sort and bsearch
+  nt_vec_init(&recs);
+  for (i = 0; i < 1000; i++) {
+    r.id = (uint32_t)((i * 7919) % 1000);
+    r.port = (uint16_t)i;
+    assert(nt_vec_push(&recs, r));
+  }
+  assert((rp = nt_vec_pushp(&recs)) != NULL);
+  rp->id = 5000;
+  rp->port = 1;
+  nt_vec_sort(&recs, &rec_cmp);
+  for (i = 1; i < (int)nt_vec_length(&recs); i++)
+    assert(nt_vec_get(&recs, i-1).id < nt_vec_get(&recs, i).id);
+  r.id = 123;
+  i = (int)nt_vec_bsearch(&recs, &r, &rec_cmp);
+  assert(i == 123 && nt_vec_get(&recs, i).id == 123);
+  r.id = 1234;
+  assert(nt_vec_bsearch(&recs, &r, &rec_cmp) == -1);
+  r.id = 5000;
+  assert(nt_vec_bsearch(&recs, &r, &rec_cmp) == 1000);
+  nt_vec_free(&recs);
+  assert(nt_vec_bsearch(&recs, &r, &rec_cmp) == -1);
+  
+  return 0;
+}